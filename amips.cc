@@ -1,17 +1,325 @@
 #include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <functional>
+#include <vector>
 #include <sys/time.h>
+#include <unistd.h>
 
 #include "def.h"
 #include "util.h"
+#include "parallel.h"
 #include "pri_queue.h"
+#include "stats.h"
+#include "qalsh.h"
+#include "srp_lsh.h"
 #include "l2_alsh.h"
 #include "l2_alsh2.h"
 #include "xbox.h"
 #include "sign_alsh.h"
 #include "simple_lsh.h"
 #include "h2_alsh.h"
+#include "h2_shards.h"
+#include "pca.h"
+#include "server.h"
 #include "amips.h"
 
+int   g_query_batch = 0;
+FILE *g_stats_fp    = NULL;
+float g_index_time  = 0.0f;
+float g_index_mb    = -1.0f;
+std::vector<Eval_Row> *g_eval_rows = NULL;
+
+// -----------------------------------------------------------------------------
+static float percentile(			// p-th percentile of n values
+	int   n,							// number of values
+	const float *value,					// values
+	float p)							// percentile (0, 1]
+{
+	std::vector<float> sorted(value, value + n);
+	int pos = MAX(0, (int) ceil(p * n) - 1);
+	std::nth_element(sorted.begin(), sorted.begin() + pos, sorted.end());
+	return sorted[pos];
+}
+
+#ifdef H2_STATS
+// -----------------------------------------------------------------------------
+//  report_stats: the latency percentiles and the mean and percentiles of all 
+//  counters of Query_Stats, plus one line per query to g_stats_fp (if any)
+// -----------------------------------------------------------------------------
+static void report_stats(			// report per-query counters
+	int   qn,							// number of query objects
+	int   top_k,						// top-k value
+	const float *latency,				// latency of all queries (seconds)
+	const Query_Stats *stats,			// counters of all queries
+	FILE  *fp)							// output file
+{
+	std::vector<float> value(qn);
+	for (int i = 0; i < qn; ++i) value[i] = latency[i] * 1000.0f;
+	printf("  stats		latency p50 = %.4f, p95 = %.4f, p99 = %.4f (ms)\n", 
+		percentile(qn, value.data(), 0.50f), 
+		percentile(qn, value.data(), 0.95f),
+		percentile(qn, value.data(), 0.99f));
+	fprintf(fp, "# latency\t%f\t%f\t%f\n", percentile(qn, value.data(), 0.50f), 
+		percentile(qn, value.data(), 0.95f), 
+		percentile(qn, value.data(), 0.99f));
+
+	for (int c = 0; c < STATS_NUM; ++c) {
+		double sum = 0.0;
+		for (int i = 0; i < qn; ++i) {
+			value[i] = (float) stats_value(stats[i], c);
+			sum += value[i];
+		}
+		float p50 = percentile(qn, value.data(), 0.50f);
+		float p95 = percentile(qn, value.data(), 0.95f);
+		float p99 = percentile(qn, value.data(), 0.99f);
+		printf("\t\t%-8s mean = %.1f, p50 = %.0f, p95 = %.0f, p99 = %.0f\n", 
+			STATS_NAME[c], sum / qn, p50, p95, p99);
+		fprintf(fp, "# %s\t%f\t%f\t%f\t%f\n", STATS_NAME[c], sum / qn, 
+			p50, p95, p99);
+	}
+
+	if (g_stats_fp != NULL) {
+		for (int i = 0; i < qn; ++i) {
+			fprintf(g_stats_fp, "%d\t%d\t%f", top_k, i, latency[i] * 1000.0f);
+			for (int c = 0; c < STATS_NUM; ++c) {
+				fprintf(g_stats_fp, "\t%llu", 
+					(unsigned long long) stats_value(stats[i], c));
+			}
+			fprintf(g_stats_fp, "\n");
+		}
+	}
+}
+#endif
+
+// -----------------------------------------------------------------------------
+static void evaluate(				// evaluate and report a batch of queries
+	int   qn,							// number of query objects
+	int   top_k,						// top-k value
+	const Result **R,					// MIP ground truth results
+	const Result *result,				// top-k results of all queries
+	const float *latency,				// latency of all queries (seconds)
+	const Query_Stats *stats,			// counters of all queries
+	float batch_time,					// wall time of all queries (seconds)
+	FILE  *fp)							// output file
+{
+	g_ratio   = 0.0f;
+	g_recall  = 0.0f;
+	g_runtime = 0.0f;
+	for (int i = 0; i < qn; ++i) {
+		const Result *res = result + (size_t) i * top_k;
+		g_recall += calc_recall(top_k, R[i], res);
+
+		float ratio = 0.0f;
+		for (int j = 0; j < top_k; ++j) {
+			if (R[i][j].key_ > FLOATZERO) {
+				ratio += res[j].key_ / R[i][j].key_;
+			} else {
+				ratio += 1.0f;
+			}
+		}
+		g_ratio   += ratio / top_k;
+		g_runtime += latency[i];
+	}
+	g_ratio   = g_ratio / qn;
+	g_recall  = g_recall / qn;
+	g_runtime = (g_runtime * 1000.0f) / qn;
+	float qps = batch_time > 0.0f ? qn / batch_time : 0.0f;
+
+	// -------------------------------------------------------------------------
+	//  tail latency: the 99th percentile of the per-query latency (ms)
+	// -------------------------------------------------------------------------
+	float p99 = percentile(qn, latency, 0.99f) * 1000.0f;
+
+	printf("  %3d\t\t%.4f\t\t%.4f\t\t%.2f%%\t\t%.1f\t\t%.4f\n", top_k, 
+		g_ratio, g_runtime, g_recall, qps, p99);
+	fprintf(fp, "%d\t%f\t%f\t%f\t%f\t%f\n", top_k, g_ratio, g_runtime, 
+		g_recall, qps, p99);
+
+	if (g_eval_rows != NULL) {
+		Eval_Row row;
+		row.top_k_  = top_k;
+		row.ratio_  = g_ratio;
+		row.time_   = g_runtime;
+		row.recall_ = g_recall;
+		row.qps_    = qps;
+		row.p50_    = percentile(qn, latency, 0.50f) * 1000.0f;
+		row.p95_    = percentile(qn, latency, 0.95f) * 1000.0f;
+		row.p99_    = p99;
+		g_eval_rows->push_back(row);
+	}
+#ifdef H2_STATS
+	report_stats(qn, top_k, latency, stats, fp);
+#else
+	(void) stats;					// counters are compiled out
+#endif
+}
+
+// -----------------------------------------------------------------------------
+//  kmip_queries: run qn top-k queries on num_threads threads and report the 
+//  average ratio, the average per-query latency (ms), the recall, and the 
+//  aggregate throughput (queries per second).
+//
+//  every worker owns one MaxK_List and passes its thread id to kmip, so that
+//  the caller can hand it per-thread scratch space. The results of query i 
+//  are gathered into their own slot, so that ratio and recall do not depend 
+//  on the number of threads. With H2_STATS, the counters of query i are the 
+//  ones of g_stats of its worker around kmip.
+// -----------------------------------------------------------------------------
+typedef std::function<void(int, int, MaxK_List*)> KMIP_Func; // (tid, qid, list)
+
+static void kmip_queries(			// run and evaluate a batch of queries
+	int   qn,							// number of query objects
+	int   top_k,						// top-k value
+	int   num_threads,					// number of threads
+	const Result **R,					// MIP ground truth results
+	const KMIP_Func &kmip,				// k-MIP search of one query
+	FILE  *fp)							// output file
+{
+	MaxK_List **lists = new MaxK_List*[num_threads];
+	for (int t = 0; t < num_threads; ++t) {
+		lists[t] = new MaxK_List(top_k);
+	}
+	Result *result  = new Result[(size_t) qn * top_k];
+	float  *latency = new float[qn];
+	Query_Stats *stats = new Query_Stats[qn];
+
+	// -------------------------------------------------------------------------
+	//  k-MIP search
+	// -------------------------------------------------------------------------
+	timeval batch_start, batch_end;
+	gettimeofday(&batch_start, NULL);
+
+	parallel_for(qn, num_threads, [&](int tid, int i) {
+		timeval start_time, end_time;
+		gettimeofday(&start_time, NULL);
+
+		MaxK_List *list = lists[tid];
+		list->reset();
+#ifdef H2_STATS
+		g_stats.reset();
+		kmip(tid, i, list);
+		stats[i] = g_stats;
+#else
+		kmip(tid, i, list);
+#endif
+
+		Result *res = result + (size_t) i * top_k;
+		for (int j = 0; j < top_k; ++j) {
+			res[j].key_ = list->ith_key(j);
+			res[j].id_  = list->ith_id(j);
+		}
+		gettimeofday(&end_time, NULL);
+		latency[i] = end_time.tv_sec - start_time.tv_sec + 
+			(end_time.tv_usec - start_time.tv_usec) / 1000000.0f;
+	});
+
+	gettimeofday(&batch_end, NULL);
+	float batch_time = batch_end.tv_sec - batch_start.tv_sec + 
+		(batch_end.tv_usec - batch_start.tv_usec) / 1000000.0f;
+
+	// -------------------------------------------------------------------------
+	//  evaluation
+	// -------------------------------------------------------------------------
+	evaluate(qn, top_k, R, result, latency, stats, batch_time, fp);
+
+	// -------------------------------------------------------------------------
+	//  release space
+	// -------------------------------------------------------------------------
+	for (int t = 0; t < num_threads; ++t) {
+		delete lists[t]; lists[t] = NULL;
+	}
+	delete[] lists;   lists   = NULL;
+	delete[] result;  result  = NULL;
+	delete[] latency; latency = NULL;
+	delete[] stats;   stats   = NULL;
+}
+
+// -----------------------------------------------------------------------------
+//  kmip_batches: the same as kmip_queries, but the queries are handed to kmip 
+//  in batches of (at most) batch queries, e.g., for kmip_batch() of H2_ALSH. 
+//  The time (and the counters) of a query is the time of its batch divided by 
+//  the batch size.
+// -----------------------------------------------------------------------------
+typedef std::function<void(int, int, int, MaxK_List**)> KMIP_Batch_Func; 
+									// (tid, first qid, number of queries, lists)
+
+static void kmip_batches(			// run and evaluate queries in batches
+	int   qn,							// number of query objects
+	int   top_k,						// top-k value
+	int   batch,						// number of queries per batch
+	int   num_threads,					// number of threads
+	const Result **R,					// MIP ground truth results
+	const KMIP_Batch_Func &kmip,		// k-MIP search of one batch
+	FILE  *fp)							// output file
+{
+	int num_batches = (qn + batch - 1) / batch;
+	MaxK_List **lists = new MaxK_List*[(size_t) num_threads * batch];
+	for (int t = 0; t < num_threads * batch; ++t) {
+		lists[t] = new MaxK_List(top_k);
+	}
+	Result *result  = new Result[(size_t) qn * top_k];
+	float  *latency = new float[qn];
+	Query_Stats *stats = new Query_Stats[qn];
+
+	// -------------------------------------------------------------------------
+	//  k-MIP search
+	// -------------------------------------------------------------------------
+	timeval batch_start, batch_end;
+	gettimeofday(&batch_start, NULL);
+
+	parallel_for(num_batches, num_threads, [&](int tid, int b) {
+		timeval start_time, end_time;
+		gettimeofday(&start_time, NULL);
+
+		int first = b * batch;
+		int num   = MIN(batch, qn - first);
+		MaxK_List **list = lists + (size_t) tid * batch;
+		for (int i = 0; i < num; ++i) list[i]->reset();
+#ifdef H2_STATS
+		g_stats.reset();
+		kmip(tid, first, num, list);
+		g_stats.div(num);
+		for (int i = 0; i < num; ++i) stats[first + i] = g_stats;
+#else
+		kmip(tid, first, num, list);
+#endif
+
+		for (int i = 0; i < num; ++i) {
+			Result *res = result + (size_t) (first + i) * top_k;
+			for (int j = 0; j < top_k; ++j) {
+				res[j].key_ = list[i]->ith_key(j);
+				res[j].id_  = list[i]->ith_id(j);
+			}
+		}
+		gettimeofday(&end_time, NULL);
+		float time = end_time.tv_sec - start_time.tv_sec + 
+			(end_time.tv_usec - start_time.tv_usec) / 1000000.0f;
+		for (int i = 0; i < num; ++i) latency[first + i] = time / num;
+	});
+
+	gettimeofday(&batch_end, NULL);
+	float batch_time = batch_end.tv_sec - batch_start.tv_sec + 
+		(batch_end.tv_usec - batch_start.tv_usec) / 1000000.0f;
+
+	// -------------------------------------------------------------------------
+	//  evaluation
+	// -------------------------------------------------------------------------
+	evaluate(qn, top_k, R, result, latency, stats, batch_time, fp);
+
+	// -------------------------------------------------------------------------
+	//  release space
+	// -------------------------------------------------------------------------
+	for (int t = 0; t < num_threads * batch; ++t) {
+		delete lists[t]; lists[t] = NULL;
+	}
+	delete[] lists;   lists   = NULL;
+	delete[] result;  result  = NULL;
+	delete[] latency; latency = NULL;
+	delete[] stats;   stats   = NULL;
+}
 
 // -----------------------------------------------------------------------------
 int linear_scan(					// k-MIP search by linear scan
@@ -37,50 +345,31 @@ int linear_scan(					// k-MIP search by linear scan
 	// -------------------------------------------------------------------------
 	//  k-MIP search by linear scan
 	// -------------------------------------------------------------------------
+	Result *order_d = new Result[n];
+	sort_by_norm(n, norm_d, order_d);
+
+	const float **sorted = new const float*[n];
+	for (int j = 0; j < n; ++j) sorted[j] = data[order_d[j].id_];
+
+	int num_threads = g_num_threads;
 	printf("Top-k MIP of Linear Scan:\n");
-	printf("  Top-k\t\tRatio\t\tTime (ms)\tRecall\n");
+	printf("  Top-k\t\tRatio\t\tTime (ms)\tRecall\t\tQPS\t\tP99 (ms)\n");
 	for (int num = 0; num < MAX_ROUND; ++num) {
-		gettimeofday(&g_start_time, NULL);
-		
 		int top_k = TOPK[num];
-		Result **result = new Result*[qn];
-		for (int i = 0; i < qn; ++i) {
-			result[i] = new Result[top_k];
-		}
-		k_mip_search(n, qn, d, top_k, data, norm_d, query, norm_q, result);
-
-		g_ratio  = 0.0f;
-		g_recall = 0.0f;
-		for (int i = 0; i < qn; ++i) {
-			g_recall += calc_recall(top_k, R[i], (const Result *) result[i]);
-
-			float ratio = 0.0f;
-			for (int j = 0; j < top_k; ++j) {
-				if (R[i][j].key_ > FLOATZERO) {
-					ratio += result[i][j].key_ / R[i][j].key_;
-				} else {
-					ratio += 1.0f;
-				}
-			}
-			g_ratio += ratio / top_k;
+		if (g_query_batch > 0) {
+			kmip_batches(qn, top_k, g_query_batch, num_threads, R, 
+				[&](int /*tid*/, int first, int cnt, MaxK_List **list) {
+				linear_kmip_batch(n, d, order_d, sorted, cnt, query + first, 
+					norm_q + first, list);
+			}, fp);
+			continue;
 		}
-		for (int i = 0; i < qn; ++i) {
-			delete[] result[i]; result[i] = NULL;
-		}
-		delete[] result; result = NULL;
-
-		gettimeofday(&g_end_time, NULL);
-		g_runtime = g_end_time.tv_sec - g_start_time.tv_sec + 
-			(g_end_time.tv_usec - g_start_time.tv_usec) / 1000000.0f;
-
-		g_ratio   = g_ratio / qn;
-		g_recall  = g_recall / qn;
-		g_runtime = (g_runtime * 1000.0f) / qn;
-
-		printf("  %3d\t\t%.4f\t\t%.4f\t\t%.2f%%\n", top_k, g_ratio, 
-			g_runtime, g_recall);
-		fprintf(fp, "%d\t%f\t%f\t%f\n", top_k, g_ratio, g_runtime, g_recall);
+		kmip_queries(qn, top_k, num_threads, R, [&](int /*tid*/, int i, MaxK_List *list) {
+			linear_kmip(n, d, order_d, data, norm_d, query[i], norm_q[i], list);
+		}, fp);
 	}
+	delete[] sorted;  sorted  = NULL;
+	delete[] order_d; order_d = NULL;
 	printf("\n");
 	fprintf(fp, "\n");
 	fclose(fp);
@@ -122,48 +411,28 @@ int l2_alsh(						// k-MIP search by l2_alsh
 	gettimeofday(&g_end_time, NULL);
 	float indexing_time = g_end_time.tv_sec - g_start_time.tv_sec + 
 		(g_end_time.tv_usec - g_start_time.tv_usec) / 1000000.0f;
-	printf("Indexing Time = %f Seconds\n\n", indexing_time);
-	fprintf(fp, "Indexing Time = %f Seconds\n\n", indexing_time);
+	float indexing_rate = indexing_time > 0.0f ? n / indexing_time : 0.0f;
+	float index_mb = lsh->index_size() / 1048576.0f;
+	g_index_time = indexing_time; g_index_mb = index_mb;
+	printf("Indexing Time = %f Seconds (%.1f Points/s)\n", indexing_time,
+		indexing_rate);
+	printf("Index Size    = %.2f MB\n\n", index_mb);
+	fprintf(fp, "Indexing Time = %f Seconds (%.1f Points/s)\n", 
+		indexing_time, indexing_rate);
+	fprintf(fp, "Index Size    = %.2f MB\n\n", index_mb);
 
 	// -------------------------------------------------------------------------
 	//  k-MIP search by L2_ALSH
 	// -------------------------------------------------------------------------	
+	int num_threads = g_num_threads;
+	QALSH_Scratch *scratch = new QALSH_Scratch[num_threads];
 	printf("Top-k c-AMIP of L2_ALSH: \n");
-	printf("  Top-k\t\tRatio\t\tTime (ms)\tRecall\n");
+	printf("  Top-k\t\tRatio\t\tTime (ms)\tRecall\t\tQPS\t\tP99 (ms)\n");
 	for (int num = 0; num < MAX_ROUND; ++num) {
-		gettimeofday(&g_start_time, NULL);
 		int top_k = TOPK[num];
-		MaxK_List* list = new MaxK_List(top_k);
-
-		g_ratio  = 0.0f;
-		g_recall = 0.0f;
-		for (int i = 0; i < qn; ++i) {
-			list->reset();
-			lsh->kmip(top_k, query[i], norm_q[i], list);
-			g_recall += calc_recall(top_k, R[i], list);
-			
-			float ratio = 0.0f;
-			for (int j = 0; j < top_k; ++j) {
-				if (R[i][j].key_ > FLOATZERO) { 
-					ratio += list->ith_key(j) / R[i][j].key_;
-				} else {
-					ratio += 1.0f;
-				}
-			}
-			g_ratio += ratio / top_k;
-		}
-		delete list; list = NULL;
-		gettimeofday(&g_end_time, NULL);
-		g_runtime = g_end_time.tv_sec - g_start_time.tv_sec + 
-			(g_end_time.tv_usec - g_start_time.tv_usec) / 1000000.0f;
-
-		g_ratio   = g_ratio / qn;
-		g_recall  = g_recall / qn;
-		g_runtime = (g_runtime * 1000.0f) / qn;
-
-		printf("  %3d\t\t%.4f\t\t%.4f\t\t%.2f%%\n", top_k, g_ratio, 
-			g_runtime, g_recall);
-		fprintf(fp, "%d\t%f\t%f\t%f\n", top_k, g_ratio, g_runtime, g_recall);
+		kmip_queries(qn, top_k, num_threads, R, [&](int tid, int i, MaxK_List *list) {
+			lsh->kmip(top_k, query[i], norm_q[i], &scratch[tid], list);
+		}, fp);
 	}
 	printf("\n");
 	fprintf(fp, "\n");
@@ -173,6 +442,7 @@ int l2_alsh(						// k-MIP search by l2_alsh
 	//  release space
 	// -------------------------------------------------------------------------
 	delete lsh; lsh = NULL;
+	delete[] scratch; scratch = NULL;
 
 	return 0;
 }
@@ -211,48 +481,28 @@ int l2_alsh2(						// k-MIP search by l2_alsh2
 	gettimeofday(&g_end_time, NULL);
 	float indexing_time = g_end_time.tv_sec - g_start_time.tv_sec + 
 		(g_end_time.tv_usec - g_start_time.tv_usec) / 1000000.0f;
-	printf("Indexing Time = %f Seconds\n\n", indexing_time);
-	fprintf(fp, "Indexing Time = %f Seconds\n\n", indexing_time);
+	float indexing_rate = indexing_time > 0.0f ? n / indexing_time : 0.0f;
+	float index_mb = lsh->index_size() / 1048576.0f;
+	g_index_time = indexing_time; g_index_mb = index_mb;
+	printf("Indexing Time = %f Seconds (%.1f Points/s)\n", indexing_time,
+		indexing_rate);
+	printf("Index Size    = %.2f MB\n\n", index_mb);
+	fprintf(fp, "Indexing Time = %f Seconds (%.1f Points/s)\n", 
+		indexing_time, indexing_rate);
+	fprintf(fp, "Index Size    = %.2f MB\n\n", index_mb);
 
 	// -------------------------------------------------------------------------
 	//  k-MIP search by L2_ALSH2
 	// -------------------------------------------------------------------------	
+	int num_threads = g_num_threads;
+	QALSH_Scratch *scratch = new QALSH_Scratch[num_threads];
 	printf("Top-k c-AMIP of L2_ALSH2: \n");
-	printf("  Top-k\t\tRatio\t\tTime (ms)\tRecall\n");
+	printf("  Top-k\t\tRatio\t\tTime (ms)\tRecall\t\tQPS\t\tP99 (ms)\n");
 	for (int num = 0; num < MAX_ROUND; ++num) {
-		gettimeofday(&g_start_time, NULL);
 		int top_k = TOPK[num];
-		MaxK_List* list = new MaxK_List(top_k);
-
-		g_ratio  = 0.0f;
-		g_recall = 0.0f;
-		for (int i = 0; i < qn; ++i) {
-			list->reset();
-			lsh->kmip(top_k, query[i], norm_q[i], list);
-			g_recall += calc_recall(top_k, R[i], list);
-			
-			float ratio = 0.0f;
-			for (int j = 0; j < top_k; ++j) {
-				if (R[i][j].key_ > FLOATZERO) { 
-					ratio += list->ith_key(j) / R[i][j].key_;
-				} else {
-					ratio += 1.0f;
-				}
-			}
-			g_ratio += ratio / top_k;
-		}
-		delete list; list = NULL;
-		gettimeofday(&g_end_time, NULL);
-		g_runtime = g_end_time.tv_sec - g_start_time.tv_sec + 
-			(g_end_time.tv_usec - g_start_time.tv_usec) / 1000000.0f;
-
-		g_ratio   = g_ratio / qn;
-		g_recall  = g_recall / qn;
-		g_runtime = (g_runtime * 1000.0f) / qn;
-
-		printf("  %3d\t\t%.4f\t\t%.4f\t\t%.2f%%\n", top_k, g_ratio, 
-			g_runtime, g_recall);
-		fprintf(fp, "%d\t%f\t%f\t%f\n", top_k, g_ratio, g_runtime, g_recall);
+		kmip_queries(qn, top_k, num_threads, R, [&](int tid, int i, MaxK_List *list) {
+			lsh->kmip(top_k, query[i], norm_q[i], &scratch[tid], list);
+		}, fp);
 	}
 	printf("\n");
 	fprintf(fp, "\n");
@@ -262,6 +512,7 @@ int l2_alsh2(						// k-MIP search by l2_alsh2
 	//  release space
 	// -------------------------------------------------------------------------
 	delete lsh; lsh = NULL;
+	delete[] scratch; scratch = NULL;
 
 	return 0;
 }
@@ -292,7 +543,12 @@ int xbox(							// k-MIP search by xbox
 	gettimeofday(&g_end_time, NULL);
 	float indexing_time = g_end_time.tv_sec - g_start_time.tv_sec + 
 		(g_end_time.tv_usec - g_start_time.tv_usec) / 1000000.0f;
-	printf("Indexing Time = %f Seconds\n\n", indexing_time);
+	float indexing_rate = indexing_time > 0.0f ? n / indexing_time : 0.0f;
+	float index_mb = xbox->index_size() / 1048576.0f;
+	g_index_time = indexing_time; g_index_mb = index_mb;
+	printf("Indexing Time = %f Seconds (%.1f Points/s)\n", indexing_time,
+		indexing_rate);
+	printf("Index Size    = %.2f MB\n\n", index_mb);
 
 	// -------------------------------------------------------------------------
 	//  k-MIP search by XBox
@@ -303,44 +559,28 @@ int xbox(							// k-MIP search by xbox
 		printf("Could not create %s\n", output_set);
 		return 1;
 	}
-	fprintf(fp, "Indexing Time = %f Seconds\n\n", indexing_time);
+	fprintf(fp, "Indexing Time = %f Seconds (%.1f Points/s)\n", 
+		indexing_time, indexing_rate);
+	fprintf(fp, "Index Size    = %.2f MB\n\n", index_mb);
 
+	int num_threads = g_num_threads;
+	QALSH_Scratch *scratch = new QALSH_Scratch[num_threads];
 	printf("Top-k c-AMIP of XBox: \n");
-	printf("  Top-k\t\tRatio\t\tTime (ms)\tRecall\n");
+	printf("  Top-k\t\tRatio\t\tTime (ms)\tRecall\t\tQPS\t\tP99 (ms)\n");
 	for (int num = 0; num < MAX_ROUND; ++num) {
-		gettimeofday(&g_start_time, NULL);
 		int top_k = TOPK[num];
-		MaxK_List* list = new MaxK_List(top_k);
-
-		g_ratio  = 0.0f;
-		g_recall = 0.0f;
-		for (int i = 0; i < qn; ++i) {
-			list->reset();
-			xbox->kmip(top_k, false, query[i], norm_q[i], list);
-			g_recall += calc_recall(top_k, R[i], list);
-			
-			float ratio = 0.0f;
-			for (int j = 0; j < top_k; ++j) {
-				if (R[i][j].key_ > FLOATZERO) { 
-					ratio += list->ith_key(j) / R[i][j].key_;
-				} else {
-					ratio += 1.0f;
-				}
-			}
-			g_ratio += ratio / top_k;
+		if (g_query_batch > 0) {
+			kmip_batches(qn, top_k, g_query_batch, num_threads, R, 
+				[&](int tid, int first, int cnt, MaxK_List **list) {
+				xbox->kmip_batch(top_k, false, cnt, query + first, 
+					norm_q + first, &scratch[tid], list);
+			}, fp);
+			continue;
 		}
-		delete list; list = NULL;
-		gettimeofday(&g_end_time, NULL);
-		g_runtime = g_end_time.tv_sec - g_start_time.tv_sec + 
-			(g_end_time.tv_usec - g_start_time.tv_usec) / 1000000.0f;
-
-		g_ratio   = g_ratio / qn;
-		g_recall  = g_recall / qn;
-		g_runtime = (g_runtime * 1000.0f) / qn;
-
-		printf("  %3d\t\t%.4f\t\t%.4f\t\t%.2f%%\n", top_k, g_ratio, 
-			g_runtime, g_recall);
-		fprintf(fp, "%d\t%f\t%f\t%f\n", top_k, g_ratio, g_runtime, g_recall);
+		kmip_queries(qn, top_k, num_threads, R, [&](int tid, int i, MaxK_List *list) {
+			xbox->kmip(top_k, false, query[i], norm_q[i], 
+				&scratch[tid], list);
+		}, fp);
 	}
 	printf("\n");
 	fprintf(fp, "\n");
@@ -355,44 +595,26 @@ int xbox(							// k-MIP search by xbox
 		printf("Could not create %s\n", output_set);
 		return 1;
 	}
-	fprintf(fp, "Indexing Time = %f Seconds\n\n", indexing_time);
+	fprintf(fp, "Indexing Time = %f Seconds (%.1f Points/s)\n", 
+		indexing_time, indexing_rate);
+	fprintf(fp, "Index Size    = %.2f MB\n\n", index_mb);
 
 	printf("Top-k c-AMIP of H2-ALSH-: \n");
-	printf("  Top-k\t\tRatio\t\tTime (ms)\tRecall\n");
+	printf("  Top-k\t\tRatio\t\tTime (ms)\tRecall\t\tQPS\t\tP99 (ms)\n");
 	for (int num = 0; num < MAX_ROUND; ++num) {
-		gettimeofday(&g_start_time, NULL);
 		int top_k = TOPK[num];
-		MaxK_List* list = new MaxK_List(top_k);
-
-		g_ratio  = 0.0f;
-		g_recall = 0.0f;
-		for (int i = 0; i < qn; ++i) {
-			list->reset();
-			xbox->kmip(top_k, true, query[i], norm_q[i], list);
-			g_recall += calc_recall(top_k, R[i], list);
-			
-			float ratio = 0.0f;
-			for (int j = 0; j < top_k; ++j) {
-				if (R[i][j].key_ > FLOATZERO) { 
-					ratio += list->ith_key(j) / R[i][j].key_;
-				} else {
-					ratio += 1.0f;
-				}
-			}
-			g_ratio += ratio / top_k;
+		if (g_query_batch > 0) {
+			kmip_batches(qn, top_k, g_query_batch, num_threads, R, 
+				[&](int tid, int first, int cnt, MaxK_List **list) {
+				xbox->kmip_batch(top_k, true, cnt, query + first, 
+					norm_q + first, &scratch[tid], list);
+			}, fp);
+			continue;
 		}
-		delete list; list = NULL;
-		gettimeofday(&g_end_time, NULL);
-		g_runtime = g_end_time.tv_sec - g_start_time.tv_sec + 
-			(g_end_time.tv_usec - g_start_time.tv_usec) / 1000000.0f;
-
-		g_ratio   = g_ratio / qn;
-		g_recall  = g_recall / qn;
-		g_runtime = (g_runtime * 1000.0f) / qn;
-
-		printf("  %3d\t\t%.4f\t\t%.4f\t\t%.2f%%\n", top_k, g_ratio, 
-			g_runtime, g_recall);
-		fprintf(fp, "%d\t%f\t%f\t%f\n", top_k, g_ratio, g_runtime, g_recall);
+		kmip_queries(qn, top_k, num_threads, R, [&](int tid, int i, MaxK_List *list) {
+			xbox->kmip(top_k, true, query[i], norm_q[i], 
+				&scratch[tid], list);
+		}, fp);
 	}
 	printf("\n");
 	fprintf(fp, "\n");
@@ -402,6 +624,7 @@ int xbox(							// k-MIP search by xbox
 	//  release space
 	// -------------------------------------------------------------------------
 	delete xbox; xbox = NULL;
+	delete[] scratch; scratch = NULL;
 
 	return 0;
 }
@@ -419,6 +642,7 @@ int sign_alsh(						// k-MIP search by sign_alsh
 	const float **query,				// query objects
 	const float **norm_q,				// l2-norm of query objects
 	const Result **R,					// MIP ground truth results
+	const char *index_set,				// address of index set (or NULL)
 	const char *out_path)				// output path
 {
 	char output_set[200];
@@ -434,54 +658,49 @@ int sign_alsh(						// k-MIP search by sign_alsh
 	//  indexing
 	// -------------------------------------------------------------------------
 	gettimeofday(&g_start_time, NULL);
-	Sign_ALSH *lsh = new Sign_ALSH(n, d, K, m, U, data, norm_d);
+	bool loaded = index_set != NULL && access(index_set, F_OK) == 0;
+	Sign_ALSH *lsh = NULL;
+	if (loaded) {
+		lsh = Sign_ALSH::load(n, d, index_set, data, norm_d);
+		if (lsh == NULL) { fclose(fp); return 1; }
+	}
+	else {
+		lsh = new Sign_ALSH(n, d, K, m, U, data, norm_d);
+	}
 	lsh->display();
 
 	gettimeofday(&g_end_time, NULL);
 	float indexing_time = g_end_time.tv_sec - g_start_time.tv_sec + 
 		(g_end_time.tv_usec - g_start_time.tv_usec) / 1000000.0f;
-	printf("Indexing Time = %f Seconds\n\n", indexing_time);
-	fprintf(fp, "Indexing Time = %f Seconds\n\n", indexing_time);
+	float indexing_rate = indexing_time > 0.0f ? n / indexing_time : 0.0f;
+	float index_mb = lsh->index_size() / 1048576.0f;
+	g_index_time = indexing_time; g_index_mb = index_mb;
+	printf("Indexing Time = %f Seconds (%.1f Points/s)\n", indexing_time,
+		indexing_rate);
+	printf("Index Size    = %.2f MB\n\n", index_mb);
+	fprintf(fp, "Indexing Time = %f Seconds (%.1f Points/s)\n", 
+		indexing_time, indexing_rate);
+	fprintf(fp, "Index Size    = %.2f MB\n\n", index_mb);
+
+	if (loaded) {
+		printf("Loaded index from %s\n\n", index_set);
+	}
+	else if (index_set != NULL && lsh->save(index_set) == 0) {
+		printf("Saved index to %s\n\n", index_set);
+	}
 
 	// -------------------------------------------------------------------------
 	//  k-MIP search by Sign_ALSH
 	// -------------------------------------------------------------------------
+	int num_threads = g_num_threads;
+	SRP_Scratch *scratch = new SRP_Scratch[num_threads];
 	printf("Top-k c-AMIP of Sign_ALSH: \n");
-	printf("  Top-k\t\tRatio\t\tTime (ms)\tRecall\n");
+	printf("  Top-k\t\tRatio\t\tTime (ms)\tRecall\t\tQPS\t\tP99 (ms)\n");
 	for (int num = 0; num < MAX_ROUND; ++num) {
-		gettimeofday(&g_start_time, NULL);
 		int top_k = TOPK[num];
-		MaxK_List* list = new MaxK_List(top_k);
-
-		g_ratio  = 0.0f;
-		g_recall = 0.0f;
-		for (int i = 0; i < qn; ++i) {
-			list->reset();
-			lsh->kmip(top_k, query[i], norm_q[i], list);
-			g_recall += calc_recall(top_k, R[i], list);
-			
-			float ratio = 0.0f;
-			for (int j = 0; j < top_k; ++j) {
-				if (R[i][j].key_ > FLOATZERO) { 
-					ratio += list->ith_key(j) / R[i][j].key_;
-				} else {
-					ratio += 1.0f;
-				}
-			}
-			g_ratio += ratio / top_k;
-		}
-		delete list; list = NULL;
-		gettimeofday(&g_end_time, NULL);
-		g_runtime = g_end_time.tv_sec - g_start_time.tv_sec + 
-			(g_end_time.tv_usec - g_start_time.tv_usec) / 1000000.0f;
-
-		g_ratio   = g_ratio / qn;
-		g_recall  = g_recall / qn;
-		g_runtime = (g_runtime * 1000.0f) / qn;
-
-		printf("  %3d\t\t%.4f\t\t%.4f\t\t%.2f%%\n", top_k, g_ratio, 
-			g_runtime, g_recall);
-		fprintf(fp, "%d\t%f\t%f\t%f\n", top_k, g_ratio, g_runtime, g_recall);
+		kmip_queries(qn, top_k, num_threads, R, [&](int tid, int i, MaxK_List *list) {
+			lsh->kmip(top_k, query[i], norm_q[i], &scratch[tid], list);
+		}, fp);
 	}
 	printf("\n");
 	fprintf(fp, "\n");
@@ -491,6 +710,7 @@ int sign_alsh(						// k-MIP search by sign_alsh
 	//  release space
 	// -------------------------------------------------------------------------
 	delete lsh; lsh = NULL;
+	delete[] scratch; scratch = NULL;
 
 	return 0;
 }
@@ -506,6 +726,7 @@ int simple_lsh(						// k-MIP search by simple_lsh
 	const float **query,				// query objects
 	const float **norm_q,				// l2-norm of query objects
 	const Result **R,					// MIP ground truth results
+	const char *index_set,				// address of index set (or NULL)
 	const char *out_path)				// output path
 {
 	char output_set[200];
@@ -521,54 +742,122 @@ int simple_lsh(						// k-MIP search by simple_lsh
 	//  indexing
 	// -------------------------------------------------------------------------
 	gettimeofday(&g_start_time, NULL);
-	Simple_LSH *lsh = new Simple_LSH(n, d, K, data, norm_d);
+	bool loaded = index_set != NULL && access(index_set, F_OK) == 0;
+	Simple_LSH *lsh = NULL;
+	if (loaded) {
+		lsh = Simple_LSH::load(n, d, index_set, data, norm_d);
+		if (lsh == NULL) { fclose(fp); return 1; }
+	}
+	else {
+		lsh = new Simple_LSH(n, d, K, data, norm_d);
+	}
 	lsh->display();
 
 	gettimeofday(&g_end_time, NULL);
 	float indexing_time = g_end_time.tv_sec - g_start_time.tv_sec + 
 		(g_end_time.tv_usec - g_start_time.tv_usec) / 1000000.0f;
-	printf("Indexing Time = %f Seconds\n\n", indexing_time);
-	fprintf(fp, "Indexing Time = %f Seconds\n\n", indexing_time);
+	float indexing_rate = indexing_time > 0.0f ? n / indexing_time : 0.0f;
+	float index_mb = lsh->index_size() / 1048576.0f;
+	g_index_time = indexing_time; g_index_mb = index_mb;
+	printf("Indexing Time = %f Seconds (%.1f Points/s)\n", indexing_time,
+		indexing_rate);
+	printf("Index Size    = %.2f MB\n\n", index_mb);
+	fprintf(fp, "Indexing Time = %f Seconds (%.1f Points/s)\n", 
+		indexing_time, indexing_rate);
+	fprintf(fp, "Index Size    = %.2f MB\n\n", index_mb);
+
+	if (loaded) {
+		printf("Loaded index from %s\n\n", index_set);
+	}
+	else if (index_set != NULL && lsh->save(index_set) == 0) {
+		printf("Saved index to %s\n\n", index_set);
+	}
 
 	// -------------------------------------------------------------------------
 	//  k-MIP search by Simple_LSH
 	// -------------------------------------------------------------------------	
+	int num_threads = g_num_threads;
+	SRP_Scratch *scratch = new SRP_Scratch[num_threads];
 	printf("Top-k c-AMIP of Simple_LSH: \n");
-	printf("  Top-k\t\tRatio\t\tTime (ms)\tRecall\n");
+	printf("  Top-k\t\tRatio\t\tTime (ms)\tRecall\t\tQPS\t\tP99 (ms)\n");
 	for (int num = 0; num < MAX_ROUND; ++num) {
-		gettimeofday(&g_start_time, NULL);
 		int top_k = TOPK[num];
-		MaxK_List *list = new MaxK_List(top_k);
+		kmip_queries(qn, top_k, num_threads, R, [&](int tid, int i, MaxK_List *list) {
+			lsh->kmip(top_k, query[i], norm_q[i], &scratch[tid], list);
+		}, fp);
+	}
+	printf("\n");
+	fprintf(fp, "\n");
+	fclose(fp);
 
-		g_ratio  = 0.0f;
-		g_recall = 0.0f;
-		for (int i = 0; i < qn; ++i) {
-			list->reset();
-			lsh->kmip(top_k, query[i], norm_q[i], list);
-			g_recall += calc_recall(top_k, R[i], list);
-			
-			float ratio = 0.0f;
-			for (int j = 0; j < top_k; ++j) {
-				if (R[i][j].key_ > FLOATZERO) { 
-					ratio += list->ith_key(j) / R[i][j].key_;
-				} else {
-					ratio += 1.0f;
-				}
-			}
-			g_ratio += ratio / top_k;
-		}
-		delete list; list = NULL;
-		gettimeofday(&g_end_time, NULL);
-		g_runtime = g_end_time.tv_sec - g_start_time.tv_sec + 
-			(g_end_time.tv_usec - g_start_time.tv_usec) / 1000000.0f;
+	// -------------------------------------------------------------------------
+	//  release space
+	// -------------------------------------------------------------------------
+	delete lsh; lsh = NULL;
+	delete[] scratch; scratch = NULL;
 
-		g_ratio   = g_ratio / qn;
-		g_recall  = g_recall / qn;
-		g_runtime = (g_runtime * 1000.0f) / qn;
+	return 0;
+}
 
-		printf("  %3d\t\t%.4f\t\t%.4f\t\t%.2f%%\n", top_k, g_ratio, 
-			g_runtime, g_recall);
-		fprintf(fp, "%d\t%f\t%f\t%f\n", top_k, g_ratio, g_runtime, g_recall);
+// -----------------------------------------------------------------------------
+//  h2_shards: k-MIP search by H2_Shards, i.e., by g_num_shards H2_ALSH on the 
+//  NUMA nodes. The queries run one by one, and each of them is searched by 
+//  all shards in parallel. The shards are always built (they have no index 
+//  file) on all objects.
+// -----------------------------------------------------------------------------
+static int h2_shards(				// k-MIP search by h2_shards
+	int   n,							// number of data objects
+	int   qn,							// number of query objects
+	int   d,							// dimensionality
+	float nn_ratio,						// approximation ratio for ANN search
+	float mip_ratio,					// approximation ratio for AMIP search
+	const float **data,					// data objects
+	const float **norm_d,				// l2-norm of data objects
+	const float **query,				// query objects
+	const float **norm_q,				// l2-norm of query objects
+	const Result **R,					// MIP ground truth results
+	const char *out_path)				// output path
+{
+	char output_set[200];
+	sprintf(output_set, "%sh2_shards.mip", out_path);
+
+	FILE *fp = fopen(output_set, "a+");
+	if (!fp) {
+		printf("Could not create %s\n", output_set);
+		return 1;
+	}
+
+	// -------------------------------------------------------------------------
+	//  indexing
+	// -------------------------------------------------------------------------
+	gettimeofday(&g_start_time, NULL);
+	H2_Shards *lsh = new H2_Shards(n, d, nn_ratio, mip_ratio, data, norm_d, 
+		g_num_shards, MIN(qn, CAL_QUERIES), query, norm_q);
+	lsh->display();
+
+	gettimeofday(&g_end_time, NULL);
+	float indexing_time = g_end_time.tv_sec - g_start_time.tv_sec + 
+		(g_end_time.tv_usec - g_start_time.tv_usec) / 1000000.0f;
+	float indexing_rate = indexing_time > 0.0f ? n / indexing_time : 0.0f;
+	float index_mb = lsh->index_size() / 1048576.0f;
+	g_index_time = indexing_time; g_index_mb = index_mb;
+	printf("Indexing Time = %f Seconds (%.1f Points/s)\n", indexing_time,
+		indexing_rate);
+	printf("Index Size    = %.2f MB\n\n", index_mb);
+	fprintf(fp, "Indexing Time = %f Seconds (%.1f Points/s)\n", 
+		indexing_time, indexing_rate);
+	fprintf(fp, "Index Size    = %.2f MB\n\n", index_mb);
+
+	// -------------------------------------------------------------------------
+	//  k-MIP search by H2_Shards
+	// -------------------------------------------------------------------------
+	printf("Top-k c-AMIP of H2_ALSH (%d shards): \n", lsh->num_shards());
+	printf("  Top-k\t\tRatio\t\tTime (ms)\tRecall\t\tQPS\t\tP99 (ms)\n");
+	for (int num = 0; num < MAX_ROUND; ++num) {
+		int top_k = TOPK[num];
+		kmip_queries(qn, top_k, 1, R, [&](int /*tid*/, int i, MaxK_List *list) {
+			lsh->kmip(top_k, query[i], norm_q[i], list);
+		}, fp);
 	}
 	printf("\n");
 	fprintf(fp, "\n");
@@ -594,8 +883,14 @@ int h2_alsh(						// k-MIP search by h2_alsh
 	const float **query,				// query objects
 	const float **norm_q,				// l2-norm of query objects
 	const Result **R,					// MIP ground truth results
+	const char *index_set,				// address of index set (or NULL)
 	const char *out_path)				// output path
 {
+	if (g_num_shards > 1) {
+		return h2_shards(n, qn, d, nn_ratio, mip_ratio, data, norm_d, query, 
+			norm_q, R, out_path);
+	}
+
 	char output_set[200];
 	sprintf(output_set, "%sh2_alsh.mip", out_path);
 
@@ -606,57 +901,119 @@ int h2_alsh(						// k-MIP search by h2_alsh
 	}
 
 	// -------------------------------------------------------------------------
-	//  indexing
+	//  indexing; with online updates, the index is built on the first 
+	//  n - num_updates objects only (and is not loaded or saved). With a 
+	//  build budget, a new index is built into index_set and then loaded.
 	// -------------------------------------------------------------------------
+	int num_updates = MIN(g_num_updates, n - 1);
+	if (num_updates > 0) index_set = NULL;
+
 	gettimeofday(&g_start_time, NULL);
-	H2_ALSH *lsh = new H2_ALSH(n, d, nn_ratio, mip_ratio, data, norm_d);
+	bool loaded = index_set != NULL && access(index_set, F_OK) == 0;
+	bool streamed = !loaded && index_set != NULL && g_build_mb > 0;
+	H2_ALSH *lsh = NULL;
+	if (streamed && H2_ALSH::build(n, d, nn_ratio, mip_ratio, data, norm_d, 
+		MIN(qn, CAL_QUERIES), query, norm_q, index_set, 
+		(size_t) g_build_mb * 1048576) == 1) {
+		fclose(fp); return 1;
+	}
+	if (loaded || streamed) {
+		lsh = H2_ALSH::load(n, d, index_set, data, norm_d);
+		if (lsh == NULL) { fclose(fp); return 1; }
+	}
+	else {
+		lsh = new H2_ALSH(n - num_updates, d, nn_ratio, mip_ratio, data, 
+			norm_d, MIN(qn, CAL_QUERIES), query, norm_q);
+	}
 	lsh->display();
 
 	gettimeofday(&g_end_time, NULL);
 	float indexing_time = g_end_time.tv_sec - g_start_time.tv_sec + 
 		(g_end_time.tv_usec - g_start_time.tv_usec) / 1000000.0f;
-	printf("Indexing Time = %f Seconds\n\n", indexing_time);
-	fprintf(fp, "Indexing Time = %f Seconds\n\n", indexing_time);
+	float indexing_rate = indexing_time > 0.0f ? 
+		(n - num_updates) / indexing_time : 0.0f;
+	float index_mb = lsh->index_size() / 1048576.0f;
+	g_index_time = indexing_time; g_index_mb = index_mb;
+	printf("Indexing Time = %f Seconds (%.1f Points/s)\n", indexing_time,
+		indexing_rate);
+	printf("Index Size    = %.2f MB\n\n", index_mb);
+	fprintf(fp, "Indexing Time = %f Seconds (%.1f Points/s)\n", 
+		indexing_time, indexing_rate);
+	fprintf(fp, "Index Size    = %.2f MB\n\n", index_mb);
+
+	if (loaded) {
+		printf("Loaded index from %s\n\n", index_set);
+	}
+	else if (streamed) {
+		printf("Built index into %s (%d MB per step)\n\n", index_set, 
+			g_build_mb);
+	}
+	else if (index_set != NULL && lsh->save(index_set) == 0) {
+		printf("Saved index to %s\n\n", index_set);
+	}
 
 	// -------------------------------------------------------------------------
-	//  k-MIP search by H2_ALSH
-	// -------------------------------------------------------------------------	
-	printf("Top-k c-AMIP of H2_ALSH: \n");
-	printf("  Top-k\t\tRatio\t\tTime (ms)\tRecall\n");
-	for (int num = 0; num < MAX_ROUND; ++num) {
+	//  online updates: insert the last num_updates objects, and remove and 
+	//  insert again every 4th of the first num_updates objects, so that the 
+	//  index holds the same objects as the ground truth. Blocks are merged in 
+	//  the background, also while the first queries run.
+	// -------------------------------------------------------------------------
+	if (num_updates > 0) {
 		gettimeofday(&g_start_time, NULL);
-		int top_k = TOPK[num];
-		MaxK_List* list = new MaxK_List(top_k);
-
-		g_ratio  = 0.0f;
-		g_recall = 0.0f;
-		for (int i = 0; i < qn; ++i) {
-			list->reset();
-			lsh->kmip(top_k, query[i], norm_q[i], list);
-			g_recall += calc_recall(top_k, R[i], list);
-			
-			float ratio = 0.0f;
-			for (int j = 0; j < top_k; ++j) {
-				if (R[i][j].key_ > FLOATZERO) { 
-					ratio += list->ith_key(j) / R[i][j].key_;
-				} else {
-					ratio += 1.0f;
-				}
+		int removes = 0;
+		for (int j = 0; j < num_updates; ++j) {
+			int id = n - num_updates + j;
+			lsh->insert(id, data[id]);
+			if (j % 4 == 0) {
+				lsh->remove(j);
+				lsh->insert(j, data[j]);
+				++removes;
 			}
-			g_ratio += ratio / top_k;
 		}
-		delete list; list = NULL;
 		gettimeofday(&g_end_time, NULL);
-		g_runtime = g_end_time.tv_sec - g_start_time.tv_sec + 
+		float update_time = g_end_time.tv_sec - g_start_time.tv_sec + 
 			(g_end_time.tv_usec - g_start_time.tv_usec) / 1000000.0f;
+		printf("Online Updates = %d Inserts, %d Removes in %f Seconds\n\n", 
+			num_updates + removes, removes, update_time);
+		fprintf(fp, "Online Updates = %d Inserts, %d Removes in %f Seconds\n\n",
+			num_updates + removes, removes, update_time);
+	}
 
-		g_ratio   = g_ratio / qn;
-		g_recall  = g_recall / qn;
-		g_runtime = (g_runtime * 1000.0f) / qn;
-
-		printf("  %3d\t\t%.4f\t\t%.4f\t\t%.2f%%\n", top_k, g_ratio, 
-			g_runtime, g_recall);
-		fprintf(fp, "%d\t%f\t%f\t%f\n", top_k, g_ratio, g_runtime, g_recall);
+	// -------------------------------------------------------------------------
+	//  k-MIP search by H2_ALSH; with g_query_threads > 1, the queries are run 
+	//  one by one, and the blocks of each query are searched by a thread pool
+	// -------------------------------------------------------------------------	
+	int num_threads = g_num_threads;
+	Thread_Pool *pool = NULL;
+	if (g_query_threads > 1 && g_query_batch <= 0) {
+		pool = new Thread_Pool(g_query_threads);
+		num_threads = g_query_threads;
+		printf("Block-parallel search with %d threads per query\n\n", 
+			g_query_threads);
+	}
+	QALSH_Scratch *scratch = new QALSH_Scratch[num_threads];
+	printf("Top-k c-AMIP of H2_ALSH: \n");
+	printf("  Top-k\t\tRatio\t\tTime (ms)\tRecall\t\tQPS\t\tP99 (ms)\n");
+	for (int num = 0; num < MAX_ROUND; ++num) {
+		int top_k = TOPK[num];
+		if (g_query_batch > 0) {
+			kmip_batches(qn, top_k, g_query_batch, num_threads, R, 
+				[&](int tid, int first, int cnt, MaxK_List **list) {
+				lsh->kmip_batch(top_k, cnt, query + first, norm_q + first, 
+					&scratch[tid], list);
+			}, fp);
+			continue;
+		}
+		if (pool != NULL) {
+			kmip_queries(qn, top_k, 1, R, [&](int /*tid*/, int i, MaxK_List *list) {
+				lsh->kmip_parallel(top_k, query[i], norm_q[i], pool, scratch, 
+					list);
+			}, fp);
+			continue;
+		}
+		kmip_queries(qn, top_k, num_threads, R, [&](int tid, int i, MaxK_List *list) {
+			lsh->kmip(top_k, query[i], norm_q[i], &scratch[tid], list);
+		}, fp);
 	}
 	printf("\n");
 	fprintf(fp, "\n");
@@ -666,6 +1023,86 @@ int h2_alsh(						// k-MIP search by h2_alsh
 	//  release space
 	// -------------------------------------------------------------------------
 	delete lsh; lsh = NULL;
+	delete pool; pool = NULL;
+	delete[] scratch; scratch = NULL;
 
 	return 0;
 }
+
+// -----------------------------------------------------------------------------
+int h2_server(						// k-MIP server by h2_alsh
+	int   n,							// number of data objects
+	int   d,							// dimensionality
+	float nn_ratio,						// approximation ratio for ANN search
+	float mip_ratio,					// approximation ratio for AMIP search
+	const float **data,					// data objects
+	const float **norm_d,				// l2-norm of data objects
+	const char *index_set,				// address of index set (or NULL)
+	const PCA *pca)						// rotation of data (or NULL)
+{
+	// -------------------------------------------------------------------------
+	//  with requests on stdin, stdout carries the responses, and all messages 
+	//  go to stderr instead (also the ones still buffered by stdout)
+	// -------------------------------------------------------------------------
+	int out_fd = STDOUT_FILENO;
+	if (g_server_port == 0) {
+		out_fd = dup(STDOUT_FILENO);
+		dup2(STDERR_FILENO, STDOUT_FILENO);
+		fflush(stdout);
+	}
+
+	// -------------------------------------------------------------------------
+	//  indexing (with a build budget, a new index is built into index_set 
+	//  and then loaded)
+	// -------------------------------------------------------------------------
+	gettimeofday(&g_start_time, NULL);
+	bool loaded = index_set != NULL && access(index_set, F_OK) == 0;
+	bool streamed = !loaded && index_set != NULL && g_build_mb > 0;
+	H2_ALSH *lsh = NULL;
+	if (streamed && H2_ALSH::build(n, d, nn_ratio, mip_ratio, data, norm_d, 
+		0, NULL, NULL, index_set, (size_t) g_build_mb * 1048576) == 1) {
+		return 1;
+	}
+	if (loaded || streamed) {
+		lsh = H2_ALSH::load(n, d, index_set, data, norm_d);
+		if (lsh == NULL) return 1;
+	}
+	else {
+		lsh = new H2_ALSH(n, d, nn_ratio, mip_ratio, data, norm_d, 0, NULL, 
+			NULL);
+	}
+	lsh->display();
+
+	gettimeofday(&g_end_time, NULL);
+	float indexing_time = g_end_time.tv_sec - g_start_time.tv_sec + 
+		(g_end_time.tv_usec - g_start_time.tv_usec) / 1000000.0f;
+	printf("Indexing Time = %f Seconds\n", indexing_time);
+	printf("Index Size    = %.2f MB\n\n", lsh->index_size() / 1048576.0f);
+
+	if (loaded) {
+		printf("Loaded index from %s\n\n", index_set);
+	}
+	else if (streamed) {
+		printf("Built index into %s (%d MB per step)\n\n", index_set, 
+			g_build_mb);
+	}
+	else if (index_set != NULL && lsh->save(index_set) == 0) {
+		printf("Saved index to %s\n\n", index_set);
+	}
+
+	// -------------------------------------------------------------------------
+	//  serve requests
+	// -------------------------------------------------------------------------
+	int batch = g_query_batch > 0 ? g_query_batch : SERVER_BATCH;
+	H2_Server *server = new H2_Server(lsh, d, batch, g_batch_wait, pca);
+	int ret = server->run(g_server_port, out_fd);
+
+	// -------------------------------------------------------------------------
+	//  release space
+	// -------------------------------------------------------------------------
+	delete server; server = NULL;
+	delete lsh; lsh = NULL;
+	if (out_fd != STDOUT_FILENO) close(out_fd);
+
+	return ret;
+}
@@ -1,6 +1,27 @@
 #ifndef __AMIPS_H
 #define __AMIPS_H
 
+extern int g_query_batch;			// global parameter: queries per batch
+extern FILE *g_stats_fp;			// per-query counters (with H2_STATS)
+extern float g_index_time;			// indexing time of the last index (s)
+extern float g_index_mb;			// index size of the last index (MB, or -1)
+
+// -----------------------------------------------------------------------------
+//  Eval_Row: the evaluation of one top-k value, as printed by the drivers
+// -----------------------------------------------------------------------------
+struct Eval_Row {
+	int   top_k_;						// top-k value
+	float ratio_;						// overall ratio
+	float time_;						// average latency (ms)
+	float recall_;						// recall (percentage)
+	float qps_;							// queries per second
+	float p50_;							// 50th percentile of latency (ms)
+	float p95_;							// 95th percentile of latency (ms)
+	float p99_;							// 99th percentile of latency (ms)
+};
+
+extern std::vector<Eval_Row> *g_eval_rows; // collected rows (or NULL)
+
 
 // -----------------------------------------------------------------------------
 int linear_scan(					// k-MIP search by linear scan
@@ -70,6 +91,7 @@ int sign_alsh(						// k-MIP search by sign_alsh
 	const float **query,				// query objects
 	const float **norm_q,				// l2-norm of query objects
 	const Result **R,					// MIP ground truth results
+	const char *index_set,				// address of index set (or NULL)
 	const char *out_path);				// output path
 
 // -----------------------------------------------------------------------------
@@ -83,6 +105,7 @@ int simple_lsh(						// k-MIP search by simple_lsh
 	const float **query,				// query objects
 	const float **norm_q,				// l2-norm of query objects
 	const Result **R,					// MIP ground truth results
+	const char *index_set,				// address of index set (or NULL)
 	const char *out_path);				// output path
 
 // -----------------------------------------------------------------------------
@@ -97,6 +120,22 @@ int h2_alsh(						// k-MIP search by h2_alsh
 	const float **query,				// query objects
 	const float **norm_q,				// l2-norm of query objects
 	const Result **R,					// MIP ground truth results
+	const char *index_set,				// address of index set (or NULL)
 	const char *out_path);				// output path
 
+// -----------------------------------------------------------------------------
+//  h2_server: load (or build and save) the H2_ALSH index of index_set once, 
+//  and answer k-MIP requests on stdin or a TCP port by H2_Server (server.h); 
+//  with pca, data are rotated by it, and so are the queries of requests
+// -----------------------------------------------------------------------------
+int h2_server(						// k-MIP server by h2_alsh
+	int   n,							// number of data objects
+	int   d,							// dimensionality
+	float nn_ratio,						// approximation ratio for ANN search
+	float mip_ratio,					// approximation ratio for AMIP search
+	const float **data,					// data objects
+	const float **norm_d,				// l2-norm of data objects
+	const char *index_set,				// address of index set (or NULL)
+	const PCA *pca);					// rotation of data (or NULL)
+
 #endif // __AMIPS_H
@@ -20,11 +20,51 @@ const int   MAXK          = TOPK[MAX_ROUND - 1];
 const int   tMIPs[]       = { 1, 2, 5, 10, 20, 30, 40, 50, 60, 70, 80, 90, 100, 200, 500, 1000 };
 const int   MAX_T         = 16;
 
-const int   NORM_K        = 3;
+// -----------------------------------------------------------------------------
+//  partial-norm checkpoints of inner products with early termination: after 
+//  the first NORM_DIMS[t-1] coordinates (ascending multiples of 8), the rest 
+//  is bounded by norm_d[t] (see calc_norm), so NORM_K - 1 checkpoints need 
+//  NORM_K l2-norms per object
+// -----------------------------------------------------------------------------
+constexpr int NORM_DIMS[] = { 8, 16, 32, 64 };
+const int   NORM_K        = 1 + (int) (sizeof(NORM_DIMS) / sizeof(int));
+
+// -----------------------------------------------------------------------------
+//  the SIMD kernels of ip_thres step by 8 floats up to every checkpoint, so a 
+//  checkpoint that is not a multiple of 8 would be passed and give a wrong 
+//  bound of the rest
+// -----------------------------------------------------------------------------
+constexpr bool valid_norm_dims(		// NORM_DIMS are ascending multiples of 8
+	int   t = 0)						// checkpoint id
+{
+	return t >= NORM_K - 1 || (NORM_DIMS[t] > 0 && NORM_DIMS[t] % 8 == 0 && 
+		(t == 0 || NORM_DIMS[t] > NORM_DIMS[t - 1]) && valid_norm_dims(t + 1));
+}
+static_assert(valid_norm_dims(), 
+	"NORM_DIMS must be positive, ascending multiples of 8");
+
 const int   SCAN_SIZE     = 512;
 const int   CANDIDATES    = 100;
 const int   MAX_BLOCK_NUM = 5000;
 const int   N_THRESHOLD   = CANDIDATES * 4;
+const int   RADIX_SIZE    = 256;	// smaller inputs of sort_results use std::sort
+const int   IP_BLOCK      = 32768;	// bytes of points per calc_ip_block tile
+const int   BATCH_TILE    = 64;		// points per tile of batched linear scans
+const int   SCAN_TILE     = 256;	// points per tile of exact k-MIP scans
+const int   QUERY_TILE    = 64;		// queries per tile of exact k-MIP scans
+const int   HEAP_K        = 128;		// top-k lists with k > HEAP_K are heaps
+const int   PREFETCH_DIST = 4;		// candidates prefetched ahead of verification
+const int   PREFETCH_LINES = 4;		// cache lines prefetched per row
+
+const int   CAL_QUERIES   = 100;	// sample queries of adaptive H2_ALSH blocks
+const int   BP_GRID       = 256;	// rank grid of adaptive block boundaries
+const float SCAN_FRAC     = 0.4f;	// fraction of a table scanned by QALSH
+const float COUNT_COST    = 0.5f;	// cost of one collision count (multiply-adds)
+const int   DELTA_SIZE    = 256;	// inserts buffered per block before a merge
+const int   SERVER_BATCH  = 64;		// default requests per micro-batch of -alg 14
+const int   SERVER_REPORT = 10;		// seconds between reports of -alg 14
+const int   PCA_SAMPLE    = 10000;	// sample objects of the PCA rotation (-pc)
+const float PCA_TOL       = 1e-6f;	// relative tolerance of keys in recall (-pc)
 
 const float MAXREAL       = 3.402823466e+38F;
 const float MINREAL       = -MAXREAL;
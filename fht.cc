@@ -0,0 +1,105 @@
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#include "def.h"
+#include "random.h"
+#include "fht.h"
+
+int g_struct_proj = 0;
+
+// -----------------------------------------------------------------------------
+void fwht(							// fast Walsh-Hadamard transform
+	int   n,							// number of values (a power of 2)
+	float *x)							// values (transformed in place)
+{
+	for (int h = 1; h < n; h <<= 1) {
+		for (int i = 0; i < n; i += h << 1) {
+			float *lo = x + i;
+			float *hi = x + i + h;
+			for (int j = 0; j < h; ++j) {
+				float a = lo[j];
+				float b = hi[j];
+				lo[j] = a + b;
+				hi[j] = a - b;
+			}
+		}
+	}
+}
+
+// -----------------------------------------------------------------------------
+SRHT::SRHT(							// constructor
+	int   d,							// dimensionality
+	int   m)							// number of projections
+{
+	d_ = d;
+	m_ = m;
+	D_ = 1;
+	while (D_ < d_) D_ <<= 1;
+	num_   = (m_ + D_ - 1) / D_;
+	scale_ = 1.0f / D_;
+
+	Random rng;
+	sign_ = new float[(size_t) num_ * 3 * D_];
+	for (size_t i = 0; i < (size_t) num_ * 3 * D_; ++i) {
+		sign_[i] = rng.sign();
+	}
+}
+
+// -----------------------------------------------------------------------------
+SRHT::~SRHT()						// destructor
+{
+	delete[] sign_; sign_ = NULL;
+}
+
+// -----------------------------------------------------------------------------
+void SRHT::project(					// project one vector
+	int   dim,							// number of leading coordinates (<= d)
+	const float *x,						// input vector
+	float *proj,						// projections (m values) (return)
+	float *buf)							// buffer (buf_size() floats)
+{
+	for (int s = 0; s < num_; ++s) {
+		const float *sign = sign_ + (size_t) s * 3 * D_;
+		for (int j = 0; j < dim; ++j) buf[j] = x[j] * sign[j];
+		for (int j = dim; j < D_; ++j) buf[j] = 0.0f;
+
+		fwht(D_, buf);
+		for (int r = 1; r < 3; ++r) {
+			const float *sr = sign + r * D_;
+			for (int j = 0; j < D_; ++j) buf[j] *= sr[j];
+			fwht(D_, buf);
+		}
+
+		int base = s * D_;
+		int num  = MIN(D_, m_ - base);
+		for (int j = 0; j < num; ++j) proj[base + j] = buf[j] * scale_;
+	}
+}
+
+// -----------------------------------------------------------------------------
+void SRHT::row(						// get one row as a dense vector
+	int   i,							// row id (0 <= i < m)
+	float *a,							// row (d values) (return)
+	float *buf)							// buffer (buf_size() floats)
+{
+	// -------------------------------------------------------------------------
+	//  row i of stack s is the transposed stack (S1 H S2 H S3 H / D) applied 
+	//  to the unit vector e_r (H is symmetric)
+	// -------------------------------------------------------------------------
+	int s = i / D_;
+	int r = i % D_;
+	const float *sign = sign_ + (size_t) s * 3 * D_;
+
+	memset(buf, 0, D_ * SIZEFLOAT);
+	buf[r] = 1.0f;
+	for (int t = 2; t >= 0; --t) {
+		const float *st = sign + t * D_;
+		fwht(D_, buf);
+		for (int j = 0; j < D_; ++j) buf[j] *= st[j];
+	}
+	for (int j = 0; j < d_; ++j) a[j] = buf[j] * scale_;
+}
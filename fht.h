@@ -0,0 +1,63 @@
+#ifndef __FHT_H
+#define __FHT_H
+
+extern int g_struct_proj;			// global parameter: structured projections
+
+// -----------------------------------------------------------------------------
+//  fwht: in-place (unnormalized) fast Walsh-Hadamard transform of n = 2^k 
+//  values, i.e., x = H x in O(n log n)
+// -----------------------------------------------------------------------------
+void fwht(							// fast Walsh-Hadamard transform
+	int   n,							// number of values (a power of 2)
+	float *x);							// values (transformed in place)
+
+// -----------------------------------------------------------------------------
+//  SRHT: structured random projections of d-dim vectors (randomized Hadamard 
+//  transforms with sign flips, as in FJLT and SORF). With D the smallest power 
+//  of 2 >= d, m projections come from ceil(m / D) stacks of D rows each, and a 
+//  stack is the D x D matrix H S3 H S2 H S1 / D, with H the Walsh-Hadamard 
+//  matrix and S1, S2, S3 random diagonal sign matrices. Three rounds make the 
+//  rows close to independent Gaussian ones: like the rows of N(0, 1), every 
+//  row has squared norm D (i.e., about d on the d coordinates in use), so 
+//  w and the collision probabilities of QALSH do not change.
+//
+//  project() costs 3 * D * log2(D) additions per stack instead of m * d 
+//  multiply-adds. row() spells out one row as a dense hash function, so that 
+//  the GEMM of batched queries, shared hash functions and save() still work 
+//  on plain rows (a loaded index uses those rows only).
+// -----------------------------------------------------------------------------
+class SRHT {
+public:
+	SRHT(							// constructor
+		int   d,						// dimensionality
+		int   m);						// number of projections
+
+	// -------------------------------------------------------------------------
+	~SRHT();						// destructor
+
+	// -------------------------------------------------------------------------
+	inline int buf_size() { return D_; }
+
+	// -------------------------------------------------------------------------
+	void project(					// project one vector
+		int   dim,						// number of leading coordinates (<= d)
+		const float *x,					// input vector
+		float *proj,					// projections (m values) (return)
+		float *buf);					// buffer (buf_size() floats)
+
+	// -------------------------------------------------------------------------
+	void row(						// get one row as a dense vector
+		int   i,						// row id (0 <= i < m)
+		float *a,						// row (d values) (return)
+		float *buf);					// buffer (buf_size() floats)
+
+protected:
+	int   d_;						// dimensionality
+	int   m_;						// number of projections
+	int   D_;						// padded dimensionality (a power of 2)
+	int   num_;						// number of stacks
+	float scale_;					// scale of a stack (1 / D)
+	float *sign_;					// sign flips (num_ x 3 x D)
+};
+
+#endif // __FHT_H
@@ -1,11 +1,39 @@
 #include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <utility>
+#include <vector>
 
 #include "def.h"
+#include "random.h"
 #include "util.h"
+#include "simd.h"
+#include "matrix.h"
 #include "pri_queue.h"
+#include "parallel.h"
+#include "stats.h"
+#include "fht.h"
+#include "sq8.h"
 #include "qalsh.h"
 #include "h2_alsh.h"
 
+int g_block_mode  = 0;
+int g_early_stop  = 0;
+int g_shared_proj = 0;
+int g_num_updates = 0;
+int g_build_mb    = 0;
+
+// -----------------------------------------------------------------------------
+Block::~Block()						// destructor
+{
+	if (index_ != NULL) { delete[] index_; index_ = NULL; }
+	if (lsh_ != NULL) { delete lsh_; lsh_ = NULL; }
+	if (dead_ != NULL) { delete[] dead_; dead_ = NULL; }
+}
+
 // -----------------------------------------------------------------------------
 H2_ALSH::H2_ALSH(					// constructor
 	int   n,							// number of data objects
@@ -13,40 +41,261 @@ H2_ALSH::H2_ALSH(					// constructor
 	float nn_ratio,						// approximation ratio for ANN search
 	float mip_ratio,					// approximation ratio for AMIP search
 	const float **data, 				// input data
-	const float **norm_d)				// l2-norm of data objects
+	const float **norm_d,				// l2-norm of data objects
+	int   cn,							// number of calibration queries
+	const float **cal_query,			// calibration queries (or NULL)
+	const float **cal_norm)				// l2-norm of calibration queries
 {
+	init(n, d, nn_ratio, mip_ratio, data, norm_d);
+	sq8_ = g_sq_frac > 0.0f ? new SQ8(n, d, data) : NULL;
+
 	// -------------------------------------------------------------------------
-	//  init parameters
+	//  build index
 	// -------------------------------------------------------------------------
+	bulkload(cn, cal_query, cal_norm);
+}
+
+// -----------------------------------------------------------------------------
+void H2_ALSH::init(					// init parameters
+	int   n,							// number of data objects
+	int   d,							// dimension of data objects
+	float nn_ratio,						// approximation ratio for NN
+	float mip_ratio,					// approximation ratio for MIP
+	const float **data, 				// input data
+	const float **norm_d)				// l2-norm of data objects
+{
 	n_pts_     = n;	
 	dim_       = d;
+	kern_      = dim_kernels(d);
 	nn_ratio_  = nn_ratio;
 	mip_ratio_ = mip_ratio;
 	data_      = data;
 	norm_d_	   = norm_d;
 
-	// -------------------------------------------------------------------------
-	//  build index
-	// -------------------------------------------------------------------------
-	bulkload();
+	num_blocks_ = 0;
+	adaptive_   = false;
+	index_file_ = NULL;
+	merging_    = false;
+	proj_       = NULL;
+	srht_       = NULL;
+	sq8_        = NULL;
+}
+
+// -----------------------------------------------------------------------------
+int H2_ALSH::build(					// build index into an index file
+	int   n,							// number of data objects
+	int   d,							// dimension of data objects
+	float nn_ratio,						// approximation ratio for NN
+	float mip_ratio,					// approximation ratio for MIP
+	const float **data, 				// input data
+	const float **norm_d,				// l2-norm of data objects
+	int   cn,							// number of calibration queries
+	const float **cal_query,			// calibration queries (or NULL)
+	const float **cal_norm,				// l2-norm of calibration queries
+	const char *fname,					// address of index file
+	size_t budget)						// memory of one build step (bytes)
+{
+	FILE *fp = fopen(fname, "wb");
+	if (!fp) {
+		printf("Could not create %s\n", fname);
+		return 1;
+	}
+
+	H2_ALSH *lsh = new H2_ALSH();
+	lsh->init(n, d, nn_ratio, mip_ratio, data, norm_d);
+	int ret = lsh->bulkload(cn, cal_query, cal_norm, fp, budget);
+	fclose(fp);
+	delete lsh; lsh = NULL;
+
+	if (ret != 0) {
+		printf("Could not write %s\n", fname);
+		::remove(fname);
+		return 1;
+	}
+	return 0;
 }
 
 // -----------------------------------------------------------------------------
 H2_ALSH::~H2_ALSH()					// destructor
 {
-	for (int i = 0; i < n_pts_; ++i) {
-		delete[] h2_alsh_data_[i]; h2_alsh_data_[i] = NULL;
+	if (merger_.joinable()) merger_.join();
+	for (size_t id = 0; id < owned_.size(); ++id) {
+		if (owned_[id]) delete[] rows_[id];
 	}
-	delete[] h2_alsh_data_; h2_alsh_data_ = NULL;
+	delete proj_; proj_ = NULL;
+	delete srht_; srht_ = NULL;
+	delete sq8_;  sq8_  = NULL;
 
 	for (int i = 0; i < num_blocks_; ++i) {
 		delete blocks_[i]; blocks_[i] = NULL;
 	}
 	blocks_.clear(); blocks_.shrink_to_fit();
+
+	if (index_file_ != NULL) {
+		munmap_file(index_file_);
+		delete index_file_; index_file_ = NULL;
+	}
+}
+
+// -----------------------------------------------------------------------------
+//  cost model of adaptive blocks: pos holds, for every calibration query, the 
+//  number of objects (in norm order) with norm * normq > kip, where kip is its 
+//  exact k-th MIP value (k = MAXK). The search visits a block starting at rank 
+//  s iff s < pos, and a linear scan of it stops at rank pos.
+// -----------------------------------------------------------------------------
+static float visit_rate(			// fraction of queries visiting a block
+	int   s,							// first rank of block
+	const std::vector<int> &pos)		// calibration stops (ascending)
+{
+	int cnt = (int) (pos.end() - std::upper_bound(pos.begin(), pos.end(), s));
+	return (float) cnt / pos.size();
+}
+
+// -----------------------------------------------------------------------------
+static float scan_cost(				// expected cost of a linear scan block
+	int   s,							// first rank of block
+	int   e,							// last rank of block (exclusive)
+	int   d,							// dimensionality
+	const std::vector<int> &pos)		// calibration stops (ascending)
+{
+	double sum = 0.0;
+	for (size_t q = 0; q < pos.size(); ++q) {
+		if (pos[q] > s) sum += MIN(pos[q], e) - s;
+	}
+	return (float) (sum * d / pos.size());
+}
+
+// -----------------------------------------------------------------------------
+float H2_ALSH::block_cost(			// expected cost of a block per query
+	int   s,							// first rank of block
+	int   e,							// last rank of block (exclusive)
+	bool  use_lsh,						// true if searched by QALSH
+	const std::vector<int> &pos)		// calibration stops (ascending)
+{
+	if (!use_lsh) return scan_cost(s, e, dim_, pos);
+	return visit_rate(s, pos) * QALSH::query_cost(e - s, dim_ + 1, nn_ratio_);
+}
+
+// -----------------------------------------------------------------------------
+void H2_ALSH::calibrate(			// calibration stops of sample queries
+	int   cn,							// number of calibration queries
+	const float **cal_query,			// calibration queries
+	const float **cal_norm,				// l2-norm of calibration queries
+	const Result *order,				// data objects sorted by norm (desc)
+	std::vector<int> &pos)				// calibration stops (return)
+{
+	pos.resize(cn);
+	parallel_for(cn, g_num_threads, [&](int tid, int i) {
+		MaxK_List list(MAXK);
+		linear_kmip(n_pts_, dim_, order, data_, norm_d_, cal_query[i], 
+			cal_norm[i], &list);
+
+		float kip = list.min_key();
+		float normq = cal_norm[i][0];
+		int   j = 0;
+		while (j < n_pts_ && order[j].key_ * normq > kip) ++j;
+		pos[i] = j;
+	});
+	std::sort(pos.begin(), pos.end());
+}
+
+// -----------------------------------------------------------------------------
+void H2_ALSH::fixed_partition(		// blocks by b_ and max_size
+	const Result *order,				// data objects sorted by norm (desc)
+	int   max_size,						// max block size
+	std::vector<int> &cuts,				// block boundaries (return)
+	std::vector<bool> &use_lsh)			// QALSH for blocks (return)
+{
+	cuts.assign(1, 0);
+	use_lsh.clear();
+
+	int i = 0;
+	while (i < n_pts_) {
+		int   s = i;
+		float m = order[s].key_ * b_;
+		while (i < n_pts_ && i - s < max_size && order[i].key_ >= m) ++i;
+		if (i == s) ++i;
+
+		cuts.push_back(i);
+		use_lsh.push_back(i - s > N_THRESHOLD);
+	}
 }
 
 // -----------------------------------------------------------------------------
-void H2_ALSH::bulkload()			// bulkloading
+void H2_ALSH::adaptive_partition(	// blocks by the cost model
+	const Result *order,				// data objects sorted by norm (desc)
+	const std::vector<int> &pos,		// calibration stops (ascending)
+	std::vector<int> &cuts,				// block boundaries (return)
+	std::vector<bool> &use_lsh)			// QALSH for blocks (return)
+{
+	// -------------------------------------------------------------------------
+	//  candidate boundaries: a rank grid plus the boundaries of b_ (without 
+	//  MAX_BLOCK_NUM), so that a valid partition always exists
+	// -------------------------------------------------------------------------
+	std::vector<int>  grid;
+	std::vector<bool> tmp;
+	fixed_partition(order, n_pts_, grid, tmp);
+
+	int step = MAX(1, n_pts_ / BP_GRID);
+	for (int i = step; i < n_pts_; i += step) grid.push_back(i);
+	std::sort(grid.begin(), grid.end());
+	grid.erase(std::unique(grid.begin(), grid.end()), grid.end());
+
+	// -------------------------------------------------------------------------
+	//  dynamic programming over the boundaries: a block [s, e) is valid iff 
+	//  all its norms are at least b_ * M (as for the fixed blocks), and it is 
+	//  searched by a linear scan or QALSH, whichever is expected to be cheaper
+	// -------------------------------------------------------------------------
+	int g = (int) grid.size();
+	std::vector<float>  lsh_cost(n_pts_ + 1, -1.0f); // QALSH cost by size
+	std::vector<double> best(g, MAXREAL);
+	std::vector<int>    prev(g, -1);
+	std::vector<bool>   lsh(g, false);
+	best[0] = 0.0;
+
+	for (int c = 1; c < g; ++c) {
+		int e = grid[c];
+		for (int p = c - 1; p >= 0; --p) {
+			int s = grid[p];
+			if (order[e - 1].key_ < order[s].key_ * b_) break;
+			if (best[p] >= MAXREAL) continue;
+
+			float cost = scan_cost(s, e, dim_, pos);
+			bool  flag = false;
+			if (e - s > N_THRESHOLD) {
+				float &lc = lsh_cost[e - s];
+				if (lc < 0.0f) lc = QALSH::query_cost(e - s, dim_ + 1, nn_ratio_);
+				if (visit_rate(s, pos) * lc < cost) {
+					cost = visit_rate(s, pos) * lc; flag = true;
+				}
+			}
+			if (best[p] + cost < best[c]) {
+				best[c] = best[p] + cost; prev[c] = p; lsh[c] = flag;
+			}
+		}
+	}
+
+	// -------------------------------------------------------------------------
+	//  trace back the cheapest partition
+	// -------------------------------------------------------------------------
+	std::vector<int> chain;
+	for (int c = g - 1; c > 0; c = prev[c]) chain.push_back(c);
+
+	cuts.assign(1, 0);
+	use_lsh.clear();
+	for (int j = (int) chain.size() - 1; j >= 0; --j) {
+		cuts.push_back(grid[chain[j]]);
+		use_lsh.push_back(lsh[chain[j]]);
+	}
+}
+
+// -----------------------------------------------------------------------------
+int H2_ALSH::bulkload(				// bulkloading
+	int   cn,							// number of calibration queries
+	const float **cal_query,			// calibration queries (or NULL)
+	const float **cal_norm,				// l2-norm of calibration queries
+	FILE  *fp,							// index file of build() (or NULL)
+	size_t budget)						// memory of one build step (bytes)
 {
 	// -------------------------------------------------------------------------
 	//  sort data objects by their Euclidean norms under the ascending order
@@ -56,60 +305,329 @@ void H2_ALSH::bulkload()			// bulkloading
 		order[i].key_ = norm_d_[i][0];
 		order[i].id_  = i;			// data object id		
 	}
-	qsort(order, n_pts_, sizeof(Result), ResultCompDesc);
+	sort_results(n_pts_, true, order);
 
 	M_ = order[0].key_;
 	b_ = sqrt((pow(nn_ratio_,4.0f) - 1) / (pow(nn_ratio_,4.0f) - mip_ratio_));
 
 	// -------------------------------------------------------------------------
-	//  construct new data
+	//  partition the data objects into blocks
 	// -------------------------------------------------------------------------
-	h2_alsh_data_ = new float*[n_pts_];
-	num_blocks_ = 0;
+	std::vector<int>  pos;			// calibration stops
+	std::vector<int>  cuts;			// block boundaries
+	std::vector<bool> use_lsh;		// QALSH for blocks
+	if (cn > 0 && cal_query != NULL) {
+		calibrate(cn, cal_query, cal_norm, order, pos);
+	}
+	adaptive_ = g_block_mode == 1 && !pos.empty();
+	if (adaptive_) adaptive_partition(order, pos, cuts, use_lsh);
+	else fixed_partition(order, MAX_BLOCK_NUM, cuts, use_lsh);
 
-	int i = 0;
-	while (i < n_pts_) {
-		int   n     = 0;
-		float M     = order[i].key_;
-		float m     = M * b_;
-		float M_sqr = M * M;
+	num_blocks_ = (int) use_lsh.size();
+
+	// -------------------------------------------------------------------------
+	//  shared hash functions: as many as the QALSH of the largest block needs
+	// -------------------------------------------------------------------------
+	if (g_shared_proj == 1) {
+		int m = 0;
+		for (int b = 0; b < num_blocks_; ++b) {
+			if (!use_lsh[b]) continue;
+			m = MAX(m, QALSH::calc_m(cuts[b + 1] - cuts[b], nn_ratio_));
+		}
+		if (m > 0 && g_struct_proj == 1) {
+			proj_ = new Matrix(m, dim_ + 1);
+			srht_ = new SRHT(dim_ + 1, m);
+			float *buf = new float[srht_->buf_size()];
+			for (int i = 0; i < m; ++i) srht_->row(i, proj_->row(i), buf);
+			delete[] buf; buf = NULL;
+		}
+		else if (m > 0) {
+			proj_ = new Matrix(m, dim_ + 1);
+			Random rng;
+			for (int i = 0; i < m; ++i) { // chosen from N(0.0, 1.0)
+				rng.gaussian(dim_ + 1, proj_->row(i));
+			}
+		}
+	}
 
-		while (i < n_pts_) {
-			if (n >= MAX_BLOCK_NUM) break;
+	for (int b = 0; b < num_blocks_; ++b) {
+		int start = cuts[b];
+		int n     = cuts[b + 1] - start;
 
-			float norm_d = order[i].key_;
-			if (norm_d < m) break;
+		Block *block = new Block();
+		block->n_pts_  = n;
+		block->M_      = order[start].key_;
+		block->index_  = new int[n];
+		block->shared_ = use_lsh[b] && proj_ != NULL;
+		if (!pos.empty()) {
+			block->visit_ = visit_rate(start, pos);
+			block->cost_  = block_cost(start, start + n, use_lsh[b], pos);
+		}
+		for (int j = 0; j < n; ++j) block->index_[j] = order[start + j].id_;
+		blocks_.push_back(block);
+	}
+	int ret = fp != NULL ? save_head(fp, use_lsh) : 0;
 
-			int id = order[i].id_;
-			float *data = new float[dim_ + 1];
-			for (int j = 0; j < dim_; ++j) {
-				data[j] = data_[id][j];
+	// -------------------------------------------------------------------------
+	//  build the QALSH of consecutive blocks in groups: all blocks at once in 
+	//  memory, or, with fp, as many as fit into budget (at least one), which 
+	//  are written to fp and released before the next group
+	// -------------------------------------------------------------------------
+	for (int s = 0, e = 0; s < num_blocks_ && ret == 0; s = e) {
+		size_t mem = 0;
+		for (e = s; e < num_blocks_; ++e) {
+			int    n    = cuts[e + 1] - cuts[e];
+			size_t size = (size_t) n * (sizeof(float*) + SIZEFLOAT);
+			if (use_lsh[e]) {
+				size += QALSH::build_size(n, dim_ + 1, nn_ratio_, 
+					proj_ != NULL, g_num_threads);
 			}
-			data[dim_]= sqrt(M_sqr - norm_d * norm_d);
-			h2_alsh_data_[i] = data; 
-			++i; ++n;
+			if (fp != NULL && e > s && mem + size > budget) break;
+			mem += size;
 		}
 
-		Block *block = new Block();
-		block->n_pts_ = n;
-		block->M_     = M;
+		// ---------------------------------------------------------------------
+		//  the h2_alsh data of the group: rows of data_ and last coordinates
+		// ---------------------------------------------------------------------
+		int lo = cuts[s];
+		std::vector<const float*> rows(cuts[e] - lo);
+		std::vector<float> last(cuts[e] - lo);
+		for (int b = s; b < e; ++b) {
+			float M_sqr = blocks_[b]->M_ * blocks_[b]->M_;
+			for (int j = cuts[b]; j < cuts[b + 1]; ++j) {
+				float norm = order[j].key_;
+				rows[j - lo] = data_[order[j].id_];
+				last[j - lo] = sqrt(MAX(0.0f, M_sqr - norm * norm));
+			}
+			if (use_lsh[b]) {
+				blocks_[b]->lsh_ = new QALSH(cuts[b + 1] - cuts[b], dim_ + 1, 
+					nn_ratio_, rows.data() + cuts[b] - lo, false, 
+					proj_ != NULL ? (const float **) proj_->rows() : NULL, 
+					last.data() + cuts[b] - lo);
+			}
+		}
 
-		int *index = new int[n];
-		Result *tmp = &order[i - n];
-		for (int j = 0; j < n; ++j) {
-			index[j] = tmp[j].id_;
+		// ---------------------------------------------------------------------
+		//  build the hash tables of the group concurrently (the hash functions 
+		//  have been drawn above in block order, so the index is deterministic 
+		//  and the same for any budget); blocks with structured hash functions 
+		//  project their data first
+		// ---------------------------------------------------------------------
+		parallel_for(e - s, g_num_threads, [&](int tid, int j) {
+			QALSH *lsh = blocks_[s + j]->lsh_;
+			if (lsh != NULL) lsh->project_data(1);
+		});
+
+		std::vector<std::pair<QALSH*, int> > tables;
+		for (int j = s; j < e; ++j) {
+			QALSH *lsh = blocks_[j]->lsh_;
+			if (lsh == NULL) continue;
+
+			for (int t = 0; t < lsh->num_tables(); ++t) {
+				tables.push_back(std::make_pair(lsh, t));
+			}
+		}
+		parallel_for((int) tables.size(), g_num_threads, [&](int tid, int j) {
+			tables[j].first->build_table(tables[j].second);
+		});
+		for (int j = s; j < e; ++j) {
+			if (blocks_[j]->lsh_ != NULL) blocks_[j]->lsh_->free_data_proj();
 		}
-		block->index_ = index;
 
-		if (n > N_THRESHOLD) {
-			int start = i - n;
-			block->lsh_ = new QALSH(n, dim_ + 1, nn_ratio_, 
-				(const float **) h2_alsh_data_ + start);
+		if (fp == NULL) continue;
+		for (int j = s; j < e && ret == 0; ++j) {
+			if (blocks_[j]->lsh_ == NULL) continue;
+			ret |= blocks_[j]->lsh_->save(fp);
+			delete blocks_[j]->lsh_; blocks_[j]->lsh_ = NULL;
 		}
-		blocks_.push_back(block);
-		++num_blocks_;
 	}
 	delete[] order; order = NULL;
+	return ret;
+}
+
+// -----------------------------------------------------------------------------
+int H2_ALSH::save(					// write index to disk
+	const char *fname)					// address of index file
+{
+	if (!rows_.empty()) {
+		printf("Could not save %s after online updates\n", fname);
+		return 1;
+	}
+	FILE *fp = fopen(fname, "wb");
+	if (!fp) {
+		printf("Could not create %s\n", fname);
+		return 1;
+	}
+
+	std::vector<bool> use_lsh(num_blocks_);
+	for (int i = 0; i < num_blocks_; ++i) {
+		use_lsh[i] = blocks_[i]->lsh_ != NULL;
+	}
+	int ret = save_head(fp, use_lsh);
+	for (int i = 0; i < num_blocks_ && ret == 0; ++i) {
+		if (use_lsh[i]) ret |= blocks_[i]->lsh_->save(fp);
+	}
+	fclose(fp);
+
+	if (ret != 0) {
+		printf("Could not write %s\n", fname);
+		return 1;
+	}
+	return 0;
+}
+
+// -----------------------------------------------------------------------------
+int H2_ALSH::save_head(				// write all but the QALSH of the blocks
+	FILE  *fp,							// output file
+	const std::vector<bool> &use_lsh)	// QALSH for blocks
+{
+	// -------------------------------------------------------------------------
+	//  header, parameters, block boundaries (size, M, has QALSH: 0 no, 1 yes, 
+	//  2 with shared hash functions), and the ids of all blocks; then the 
+	//  shared hash functions (if any). The QALSH of each block follow in order.
+	// -------------------------------------------------------------------------
+	float para[4] = { nn_ratio_, mip_ratio_, b_, M_ };
+	std::vector<int>   size(num_blocks_), has_lsh(num_blocks_);
+	std::vector<float> M(num_blocks_);
+	for (int i = 0; i < num_blocks_; ++i) {
+		size[i]    = blocks_[i]->n_pts_;
+		M[i]       = blocks_[i]->M_;
+		has_lsh[i] = !use_lsh[i] ? 0 : (blocks_[i]->shared_ ? 2 : 1);
+	}
+
+	int ret = write_index_header(fp, IDX_H2_ALSH, n_pts_, dim_);
+	ret |= write_aligned(fp, para, sizeof(para));
+	ret |= write_aligned(fp, &num_blocks_, sizeof(int));
+	ret |= write_aligned(fp, size.data(), num_blocks_ * sizeof(int));
+	ret |= write_aligned(fp, M.data(), num_blocks_ * SIZEFLOAT);
+	ret |= write_aligned(fp, has_lsh.data(), num_blocks_ * sizeof(int));
+	for (int i = 0; i < num_blocks_; ++i) {
+		fwrite(blocks_[i]->index_, sizeof(int), size[i], fp);
+	}
+	ret |= write_aligned(fp, NULL, 0);
+
+	if (proj_ != NULL) {
+		int m = proj_->n();
+		ret |= write_aligned(fp, &m, sizeof(int));
+		for (int i = 0; i < m; ++i) {
+			fwrite(proj_->row(i), SIZEFLOAT, dim_ + 1, fp);
+		}
+		ret |= write_aligned(fp, NULL, 0);
+	}
+	return ret;
+}
+
+// -----------------------------------------------------------------------------
+H2_ALSH* H2_ALSH::load(				// load index from disk (mmap-ed)
+	int   n,							// number of data objects
+	int   d,							// dimension of data objects
+	const char *fname,					// address of index file
+	const float **data, 				// input data
+	const float **norm_d)				// l2-norm of data objects
+{
+	Mmap_File  *mf = new Mmap_File();
+	Mmap_Cursor in;
+	if (open_index(fname, IDX_H2_ALSH, n, d, mf, &in) == 1) {
+		delete mf;
+		return NULL;
+	}
+
+	H2_ALSH *lsh = new H2_ALSH();
+	lsh->n_pts_        = n;
+	lsh->dim_          = d;
+	lsh->kern_         = dim_kernels(d);
+	lsh->data_         = data;
+	lsh->norm_d_       = norm_d;
+	lsh->num_blocks_   = 0;
+	lsh->index_file_   = mf;
+	lsh->adaptive_     = false;
+	lsh->merging_      = false;
+	lsh->proj_         = NULL;
+	lsh->srht_         = NULL;
+	lsh->sq8_          = NULL;
+
+	// -------------------------------------------------------------------------
+	//  read parameters and block boundaries
+	// -------------------------------------------------------------------------
+	const float *para = (const float *) read_aligned(&in, 4 * SIZEFLOAT);
+	const int *num    = (const int *) read_aligned(&in, sizeof(int));
+	int num_blocks    = (num != NULL && *num > 0 && *num <= n) ? *num : 0;
+
+	const int   *size    = (const int *) read_aligned(&in, 
+		num_blocks * sizeof(int));
+	const float *M       = (const float *) read_aligned(&in, 
+		num_blocks * SIZEFLOAT);
+	const int   *has_lsh = (const int *) read_aligned(&in, 
+		num_blocks * sizeof(int));
+	const int   *index   = (const int *) read_aligned(&in, n * sizeof(int));
+
+	if (para == NULL || num_blocks == 0 || size == NULL || M == NULL || 
+		has_lsh == NULL || index == NULL) {
+		printf("Corrupted H2_ALSH index %s\n", fname);
+		delete lsh;
+		return NULL;
+	}
+	lsh->nn_ratio_  = para[0];
+	lsh->mip_ratio_ = para[1];
+	lsh->b_         = para[2];
+	lsh->M_         = para[3];
+
+	// -------------------------------------------------------------------------
+	//  shared hash functions (in place)
+	// -------------------------------------------------------------------------
+	bool shared = false;
+	for (int i = 0; i < num_blocks; ++i) {
+		if (has_lsh[i] == 2) shared = true;
+	}
+	if (shared) {
+		const int   *m = (const int *) read_aligned(&in, sizeof(int));
+		const float *a = NULL;
+		if (m != NULL && *m > 0) {
+			a = (const float *) read_aligned(&in, 
+				(size_t) *m * (d + 1) * SIZEFLOAT);
+		}
+		if (a == NULL) {
+			printf("Corrupted H2_ALSH index %s\n", fname);
+			delete lsh;
+			return NULL;
+		}
+		lsh->proj_ = new Matrix(*m, d + 1, d + 1, a);
+	}
+
+	// -------------------------------------------------------------------------
+	//  map the QALSH of each block (its data are only read by a build)
+	// -------------------------------------------------------------------------
+	int start = 0;
+	for (int i = 0; i < num_blocks; ++i) {
+		if (size[i] <= 0 || start + size[i] > n) {
+			printf("Corrupted H2_ALSH index %s\n", fname);
+			delete lsh;
+			return NULL;
+		}
+		Block *block = new Block();
+		block->n_pts_ = size[i];
+		block->M_     = M[i];
+		block->index_ = new int[size[i]];
+		lsh->blocks_.push_back(block);
+		++lsh->num_blocks_;
+
+		memcpy(block->index_, index + start, size[i] * sizeof(int));
+
+		if (has_lsh[i]) {
+			block->shared_ = has_lsh[i] == 2;
+			block->lsh_ = QALSH::load(&in, size[i], d + 1, NULL, 
+				block->shared_ ? (const float **) lsh->proj_->rows() : NULL);
+			if (block->lsh_ == NULL || (block->shared_ && 
+				block->lsh_->num_tables() > lsh->proj_->n())) {
+				printf("Corrupted H2_ALSH index %s\n", fname);
+				delete lsh;
+				return NULL;
+			}
+		}
+		start += size[i];
+	}
+	if (g_sq_frac > 0.0f) lsh->sq8_ = new SQ8(n, d, data);
+	return lsh;
 }
 
 // -------------------------------------------------------------------------
@@ -121,7 +639,237 @@ void H2_ALSH::display()				// display parameters
 	printf("    c0         = %.1f\n", nn_ratio_);
 	printf("    c          = %.1f\n", mip_ratio_);
 	printf("    M          = %f\n",   M_);
+	if (index_file_ == NULL) {
+		printf("    blocks     = %s\n", adaptive_ ? "adaptive" : "fixed");
+	}
+	if (proj_ != NULL) {
+		printf("    shared m   = %d\n", proj_->n());
+	}
 	printf("    num_blocks = %d\n\n", num_blocks_);
+
+	// -------------------------------------------------------------------------
+	//  expected cost per query of every block (known after calibration), in 
+	//  units of one multiply-add of an inner product
+	// -------------------------------------------------------------------------
+	if (num_blocks_ == 0 || blocks_[0]->cost_ < 0.0f) return;
+
+	float total = 0.0f;
+	printf("    Block\tn\tM\t\tSearch\tVisit\tCost\n");
+	for (int i = 0; i < num_blocks_; ++i) {
+		Block *block = blocks_[i];
+		printf("    %d\t%d\t%f\t%s\t%.2f\t%.0f\n", i, block->n_pts_, 
+			block->M_, block->lsh_ != NULL ? "QALSH" : "scan", block->visit_,
+			block->cost_);
+		total += block->cost_;
+	}
+	printf("    Expected cost per query = %.0f (linear scan: %.0f)\n\n", 
+		total, (float) n_pts_ * dim_);
+}
+
+// -----------------------------------------------------------------------------
+size_t H2_ALSH::index_size()		// memory of index (without data)
+{
+	size_t size = (size_t) n_pts_ * SIZEINT;	// ids of blocks
+	for (int i = 0; i < num_blocks_; ++i) {
+		if (blocks_[i]->lsh_ != NULL) size += blocks_[i]->lsh_->index_size();
+	}
+	if (proj_ != NULL) size += (size_t) proj_->n() * (dim_ + 1) * SIZEFLOAT;
+	if (sq8_  != NULL) size += sq8_->index_size();
+	return size;
+}
+
+// -----------------------------------------------------------------------------
+int H2_ALSH::query_size()			// floats of h2_alsh query buffers
+{
+	// -------------------------------------------------------------------------
+	//  a buffer holds the h2_alsh query (dim + 1) or its rescaled projections 
+	//  on the hash functions of a block (at most proj_->n())
+	// -------------------------------------------------------------------------
+	if (proj_ == NULL) return dim_ + 1;
+	return MAX(dim_ + 1, proj_->n());
+}
+
+// -----------------------------------------------------------------------------
+int H2_ALSH::proj_size()			// floats of query projections on proj_
+{
+	// -------------------------------------------------------------------------
+	//  the projections, then the buffer of srht_ (if any)
+	// -------------------------------------------------------------------------
+	if (proj_ == NULL) return 0;
+	return proj_->n() + (srht_ != NULL ? srht_->buf_size() : 0);
+}
+
+// -----------------------------------------------------------------------------
+const float* H2_ALSH::project(		// projections of a query on proj_
+	const float *query,					// input query
+	float *q_proj)						// buffer of proj_size() floats
+{
+	if (proj_ == NULL) return NULL;
+
+	if (srht_ != NULL) {
+		srht_->project(dim_, query, q_proj, q_proj + proj_->n());
+	}
+	else {
+		calc_ip_block(dim_, 1, &query, proj_->n(), (const float **) 
+			proj_->rows(), q_proj);
+	}
+	return (const float *) q_proj;
+}
+
+// -----------------------------------------------------------------------------
+float H2_ALSH::search_delta(		// k-MIP search in a delta buffer
+	Block *block,						// block
+	const float *query,					// input query
+	const float *norm_q,				// l2-norm of query
+	float kip,							// current k-th MIP value
+	MaxK_List *list,					// top-k MIP results (return)
+	std::atomic<float> *bound)			// shared k-th MIP value (or NULL)
+{
+	float normq = norm_q[0];
+	const std::vector<int> &delta = block->delta_;
+	for (size_t j = 0; j < delta.size(); ++j) {
+		int id = delta[j];
+		if (norm_d_[id][0] * normq <= kip) continue;
+
+		float ip = calc_inner_product(kern_, dim_, kip, data_[id], 
+			norm_d_[id], query, norm_q);
+		if (ip <= kip) continue;
+
+		kip = list->insert(ip, id + 1);
+		if (bound != NULL) kip = share_kip(kip, bound);
+	}
+	return kip;
+}
+
+// -----------------------------------------------------------------------------
+float H2_ALSH::search_block(		// k-MIP search in one block
+	int   b,							// block id
+	int   top_k,						// top-k value
+	const float *query,					// input query
+	const float *norm_q,				// l2-norm of query
+	const float *q_proj,				// projections on proj_ (or NULL)
+	float kip,							// current k-th MIP value
+	float *h2_alsh_query,				// buffer of query_size() floats
+	QALSH_Scratch *scratch,				// search context of this thread
+	std::vector<int> &cand,				// buffer of candidates
+	MaxK_List *list,					// top-k MIP results (return)
+	std::atomic<float> *bound)			// shared k-th MIP value (or NULL)
+{
+	Block *block = blocks_[b];
+	int   *index = block->index_;
+	int   n      = block->n_pts_;
+	float M      = block->M_;
+	float normq  = norm_q[0];
+	STATS_ADD(blocks_, 1);
+
+	if (block->lsh_ == NULL) {
+		// ---------------------------------------------------------------------
+		//  MIP search by linear scan
+		// ---------------------------------------------------------------------
+		const uint8_t *dead = block->dead_;
+		for (int j = 0; j < n; ++j) {
+			if (j + PREFETCH_DIST < n) {
+				int next = index[j + PREFETCH_DIST];
+				prefetch_point(dim_, data_[next], norm_d_[next]);
+			}
+			if (dead != NULL && dead[j]) continue;
+
+			int id = index[j];
+			if (norm_d_[id][0] * normq <= kip) break;
+			
+			float ip = calc_inner_product(kern_, dim_, kip, data_[id], 
+				norm_d_[id], query, norm_q);
+			if (ip <= kip) continue;
+
+			kip = list->insert(ip, id + 1);
+			if (bound != NULL) kip = share_kip(kip, bound);
+		}
+	}
+	else {
+		// ---------------------------------------------------------------------
+		//  conduct c-k-ANN search by qalsh
+		// ---------------------------------------------------------------------
+		QALSH *lsh    = block->lsh_;
+		bool  shared  = block->shared_ && q_proj != NULL;
+		float lambda  = M / normq;
+		float R = sqrt(2.0f * (M * M - lambda * kip));
+		if (shared) {
+			int m = lsh->num_tables();
+			for (int j = 0; j < m; ++j) {
+				h2_alsh_query[j] = lambda * q_proj[j];
+			}
+		}
+		else {
+			for (int j = 0; j < dim_; ++j) {
+				h2_alsh_query[j] = lambda * query[j];
+			}
+			h2_alsh_query[dim_] = 0.0f;
+		}
+		const float *q = (const float *) h2_alsh_query;
+
+		if (g_early_stop == 1) {
+			// -----------------------------------------------------------------
+			//  verify each candidate as soon as qalsh finds it: a larger kip 
+			//  shrinks the search range of qalsh on the fly, so that it can 
+			//  stop early (its T1 condition) instead of after all candidates
+			// -----------------------------------------------------------------
+			Cand_Check &check = scratch->check();
+			check.kern_   = kern_;
+			check.dim_    = dim_;
+			check.index_  = index;
+			check.data_   = data_;
+			check.norm_d_ = norm_d_;
+			check.query_  = query;
+			check.norm_q_ = norm_q;
+			check.M_      = M;
+			check.lambda_ = lambda;
+			check.kip_    = kip;
+			check.list_   = list;
+			check.bound_  = bound;
+
+			if (shared) lsh->knn_proj(top_k, R, q, scratch, &check);
+			else lsh->knn(top_k, R, q, scratch, &check);
+			kip = check.kip_;
+			cand.clear();
+		}
+		else {
+			cand.clear();
+			if (shared) lsh->knn_proj(top_k, R, q, scratch, cand);
+			else lsh->knn(top_k, R, q, scratch, cand);
+		}
+
+		// ---------------------------------------------------------------------
+		//  compute inner product for the candidates returned by qalsh (or for 
+		//  the best of them by their int8 codes). index_ is sorted by norm, so 
+		//  the candidates (positions in the block) are verified in ascending 
+		//  order, i.e., in descending order of norm.
+		// ---------------------------------------------------------------------
+		if (sq8_ != NULL) {
+			sq8_->filter(top_k, query, index, cand, 
+				scratch->score_buf(sq8_->buf_size((int) cand.size())));
+		}
+		int size = (int) cand.size();
+		std::sort(cand.begin(), cand.end());
+		for (int j = 0; j < size; ++j) {
+			if (j + PREFETCH_DIST < size) {
+				int next = index[cand[j + PREFETCH_DIST]];
+				prefetch_point(dim_, data_[next], norm_d_[next]);
+			}
+			int id = index[cand[j]];
+			if (norm_d_[id][0] * normq <= kip) break;
+
+			float ip = calc_inner_product(kern_, dim_, kip, data_[id], 
+				norm_d_[id], query, norm_q);
+			if (ip <= kip) continue;
+
+			kip = list->insert(ip, id + 1);
+			if (bound != NULL) kip = share_kip(kip, bound);
+		}
+	}
+	if (!block->delta_.empty()) {
+		kip = search_delta(block, query, norm_q, kip, list, bound);
+	}
+	return kip;
 }
 
 // -----------------------------------------------------------------------------
@@ -129,69 +877,551 @@ int H2_ALSH::kmip(					// c-k-AMIP search
 	int   top_k,						// top-k value
 	const float *query,					// input query
 	const float *norm_q,				// l2-norm of query
-	MaxK_List *list)					// top-k MIP results (return)  
+	QALSH_Scratch *scratch,				// search context of this thread
+	MaxK_List *list,					// top-k MIP results (return)  
+	std::atomic<float> *bound)			// shared k-th MIP value (or NULL)
 {
 	// -------------------------------------------------------------------------
 	//  initialize parameters
 	// -------------------------------------------------------------------------
 	float kip   = MINREAL;
 	float normq = norm_q[0];
-	float *h2_alsh_query = new float[dim_ + 1];
-	std::vector<int> cand;
+	int   qs    = query_size();
+	float *h2_alsh_query = scratch->query_buf(qs + proj_size());
+	const float *q_proj  = project(query, h2_alsh_query + qs);
+	std::vector<int> &cand = scratch->cand();
 
 	// -------------------------------------------------------------------------
 	//  c-k-AMIP search
 	// -------------------------------------------------------------------------
+	lock_.lock_shared();
 	for (int i = 0; i < num_blocks_; ++i) {
-		Block *block = blocks_[i];
+		if (bound != NULL) {
+			kip = MAX(kip, bound->load(std::memory_order_relaxed));
+		}
+		if (blocks_[i]->M_ * normq <= kip) {
+			STATS_ADD(pruned_, num_blocks_ - i); break;
+		}
+		kip = search_block(i, top_k, query, norm_q, q_proj, kip, 
+			h2_alsh_query, scratch, cand, list, bound);
+	}
+	lock_.unlock_shared();
+
+	return 0;
+}
+
+// -----------------------------------------------------------------------------
+int H2_ALSH::kmip_parallel(			// k-MIP search with parallel blocks
+	int   top_k,						// top-k value
+	const float *query,					// input query
+	const float *norm_q,				// l2-norm of query
+	Thread_Pool *pool,					// thread pool
+	QALSH_Scratch *scratch,				// search contexts (one per thread)
+	MaxK_List *list)					// top-k MIP results (return) 
+{
+	// -------------------------------------------------------------------------
+	//  initialize parameters
+	// -------------------------------------------------------------------------
+	int   num_threads = pool->num_threads();
+	float normq = norm_q[0];
+	int   qs    = query_size();
+	int   size  = qs + proj_size();	// h2_alsh query, then projections
+	std::atomic<float> bound(MINREAL);
+#ifdef H2_STATS
+	std::vector<Query_Stats> stats(num_threads); // counts of the workers
+#endif
+
+	for (int t = 0; t < num_threads; ++t) {
+		scratch[t].list(top_k)->reset();
+	}
+	const float *q_proj = project(query, scratch[0].query_buf(size) + qs);
+
+	// -------------------------------------------------------------------------
+	//  c-k-AMIP search: a block is skipped once M * normq <= kip (all later 
+	//  blocks then follow, as the blocks are sorted by M)
+	// -------------------------------------------------------------------------
+	lock_.lock_shared();
+	pool->run(num_blocks_, [&](int tid, int i) {
+		STATS_SCOPE(&stats[tid]);
+		QALSH_Scratch *s = &scratch[tid];
+		MaxK_List *local = s->list(top_k);
+		float kip = MAX(local->min_key(), 
+			bound.load(std::memory_order_relaxed));
+		if (blocks_[i]->M_ * normq <= kip) { STATS_ADD(pruned_, 1); return; }
+
+		search_block(i, top_k, query, norm_q, q_proj, kip, 
+			s->query_buf(size), s, s->cand(), local, &bound);
+	});
+	lock_.unlock_shared();
+
+	// -------------------------------------------------------------------------
+	//  merge the lists (and counts) of all threads
+	// -------------------------------------------------------------------------
+	for (int t = 0; t < num_threads; ++t) {
+#ifdef H2_STATS
+		g_stats.add(stats[t]);
+#endif
+		MaxK_List *local = scratch[t].list(top_k);
+		int num = local->size();
+		for (int j = 0; j < num; ++j) {
+			list->insert(local->ith_key(j), local->ith_id(j));
+		}
+	}
+
+	return 0;
+}
+
+// -----------------------------------------------------------------------------
+int H2_ALSH::kmip_batch(			// k-MIP search of a batch of queries
+	int   top_k,						// top-k value
+	int   qn,							// number of queries
+	const float **query,				// input queries
+	const float **norm_q,				// l2-norm of queries
+	QALSH_Scratch *scratch,				// search context of this thread
+	MaxK_List **list)					// top-k MIP results (return)
+{
+	// -------------------------------------------------------------------------
+	//  initialize parameters
+	// -------------------------------------------------------------------------
+	Batch_Buf &b = scratch->batch();
+	b.kip_.resize(qn); b.active_.resize(qn); b.scan_.resize(qn);
+	b.act_q_.resize(qn);
+
+	float *kip    = b.kip_.data();	// k-th MIP value of queries
+	int   *active = b.active_.data(); // queries that are not pruned yet
+	int   *scan   = b.scan_.data();	// queries that still scan a block
+	const float **act_q = b.act_q_.data();
+	for (int i = 0; i < qn; ++i) {
+		kip[i] = MINREAL; active[i] = i;
+	}
+	int num_active = qn;
+
+	std::vector<float> &buf  = b.buf_;	// inner products or projections
+	std::vector<float> &ips  = b.ips_;	// inner products of candidates
+	std::vector<const float*> &rows = b.rows_; // points to verify
+	std::vector<float> &zero = b.zero_;	// row of removed points
+	std::vector<float> &q_proj = b.proj_; // projections on proj_ (qn x pm)
+	std::vector<int> &cand = scratch->cand();
+	zero.assign(dim_, 0.0f);
+
+	int pm = proj_ != NULL ? proj_->n() : 0;
+	if (pm > 0) {
+		q_proj.resize((size_t) qn * pm);
+		calc_ip_block(dim_, qn, query, pm, (const float **) proj_->rows(), 
+			q_proj.data());
+	}
+
+	// -------------------------------------------------------------------------
+	//  c-k-AMIP search
+	// -------------------------------------------------------------------------
+	lock_.lock_shared();
+	for (int b = 0; b < num_blocks_ && num_active > 0; ++b) {
+		Block *block = blocks_[b];
 		int   *index = block->index_;
 		int   n      = block->n_pts_;
 		float M      = block->M_;
-		if (M * normq <= kip) break;
 
-		if (n <= N_THRESHOLD) {
+		int na = 0;
+		for (int k = 0; k < num_active; ++k) {
+			int i = active[k];
+			if (M * norm_q[i][0] > kip[i]) active[na++] = i;
+		}
+		STATS_ADD(blocks_, na);
+		STATS_ADD(pruned_, (uint64_t) (num_active - na) * (num_blocks_ - b));
+		if ((num_active = na) == 0) break;
+
+		if (block->lsh_ == NULL) {
 			// -----------------------------------------------------------------
-			//  MIP search by linear scan
+			//  MIP search by linear scan, BATCH_TILE points at a time; a query 
+			//  stops scanning at the first point with norm * normq <= kip
 			// -----------------------------------------------------------------
+			const uint8_t *dead = block->dead_;
+			rows.resize(n);
 			for (int j = 0; j < n; ++j) {
-				int id = index[j];
-				if (norm_d_[id][0] * normq <= kip) break;
-				
-				float ip = calc_inner_product(dim_, kip, data_[id], 
-					norm_d_[id], query, norm_q);
-				kip = list->insert(ip, id + 1);
+				bool live = dead == NULL || !dead[j];
+				rows[j] = live ? data_[index[j]] : zero.data();
+			}
+
+			int ns = na;
+			for (int k = 0; k < na; ++k) scan[k] = active[k];
+			for (int j0 = 0; j0 < n && ns > 0; j0 += BATCH_TILE) {
+				int nt = MIN(BATCH_TILE, n - j0);
+				for (int k = 0; k < ns; ++k) act_q[k] = query[scan[k]];
+				buf.resize((size_t) ns * nt);
+				calc_ip_block(dim_, ns, act_q, nt, &rows[j0], buf.data());
+
+				int left = 0;
+				for (int k = 0; k < ns; ++k) {
+					int   i     = scan[k];
+					float normq = norm_q[i][0];
+					const float *ip = &buf[(size_t) k * nt];
+
+					int j = 0;
+					for (; j < nt; ++j) {
+						if (dead != NULL && dead[j0 + j]) continue;
+
+						int id = index[j0 + j];
+						if (norm_d_[id][0] * normq <= kip[i]) break;
+						kip[i] = list[i]->insert(ip[j], id + 1);
+					}
+					if (j == nt) scan[left++] = i;
+				}
+				ns = left;
 			}
 		}
 		else {
 			// -----------------------------------------------------------------
-			//  conduct c-k-ANN search by qalsh
+			//  project all remaining queries at once (or take the shared 
+			//  projections), then conduct c-k-ANN search by qalsh with 
+			//  lambda * <a, q> as the h2_alsh projection
 			// -----------------------------------------------------------------
-			float lambda = M / normq;
-			float R = sqrt(2.0f * (M * M - lambda * kip));
-			for (int j = 0; j < dim_; ++j) {
-				h2_alsh_query[j] = lambda * query[j];
+			QALSH *lsh = block->lsh_;
+			int   m    = lsh->num_tables();
+			buf.resize((size_t) na * m);
+			if (block->shared_ && pm > 0) {
+				for (int k = 0; k < na; ++k) {
+					memcpy(&buf[(size_t) k * m], &q_proj[(size_t) active[k] * pm],
+						m * SIZEFLOAT);
+				}
+			}
+			else {
+				for (int k = 0; k < na; ++k) act_q[k] = query[active[k]];
+				lsh->project(na, act_q, dim_, buf.data());
 			}
-			h2_alsh_query[dim_] = 0.0f;
 
-			cand.clear();
-			block->lsh_->knn(top_k, R, (const float *) h2_alsh_query, cand);
+			for (int k = 0; k < na; ++k) {
+				int   i      = active[k];
+				float normq  = norm_q[i][0];
+				float lambda = M / normq;
+				float R      = sqrt(2.0f * (M * M - lambda * kip[i]));
 
-			// -----------------------------------------------------------------
-			//  compute inner product for the candidates returned by qalsh
-			// -----------------------------------------------------------------
-			int size = (int) cand.size();
-			for (int j = 0; j < size; ++j) {
-				int id = index[cand[j]];
-
-				if (norm_d_[id][0] * normq > kip) {
-					float ip = calc_inner_product(dim_, kip, data_[id], 
-						norm_d_[id], query, norm_q);
-					kip = list->insert(ip, id + 1);
+				float *proj = &buf[(size_t) k * m];
+				for (int j = 0; j < m; ++j) proj[j] *= lambda;
+
+				cand.clear();
+				lsh->knn_proj(top_k, R, (const float *) proj, scratch, cand);
+
+				// -------------------------------------------------------------
+				//  verify the candidates that can beat kip by blocked inner 
+				//  products (an id is checked again after the inserts before)
+				// -------------------------------------------------------------
+				int size = 0;
+				for (int j = 0; j < (int) cand.size(); ++j) {
+					int id = index[cand[j]];
+					if (norm_d_[id][0] * normq > kip[i]) cand[size++] = id;
+				}
+				cand.resize(size);
+				if (sq8_ != NULL) {
+					size = sq8_->filter(top_k, query[i], NULL, cand, 
+						scratch->score_buf(sq8_->buf_size(size)));
+				}
+				rows.resize(size);
+				for (int j = 0; j < size; ++j) rows[j] = data_[cand[j]];
+
+				ips.resize(size);
+				calc_ip_block(dim_, 1, &query[i], size, rows.data(), ips.data());
+				for (int j = 0; j < size; ++j) {
+					int id = cand[j];
+					if (norm_d_[id][0] * normq > kip[i]) {
+						kip[i] = list[i]->insert(ips[j], id + 1);
+					}
 				}
 			}
 		}
+
+		// ---------------------------------------------------------------------
+		//  objects inserted online and not merged yet
+		// ---------------------------------------------------------------------
+		if (!block->delta_.empty()) {
+			for (int k = 0; k < na; ++k) {
+				int i = active[k];
+				kip[i] = search_delta(block, query[i], norm_q[i], kip[i], 
+					list[i], NULL);
+			}
+		}
 	}
-	delete[] h2_alsh_query; h2_alsh_query = NULL;
+	lock_.unlock_shared();
 
 	return 0;
 }
+
+// -----------------------------------------------------------------------------
+void H2_ALSH::init_updates()		// set up rows_, loc_ for the first update
+{
+	if (!rows_.empty() || n_pts_ == 0) return;
+
+	// -------------------------------------------------------------------------
+	//  ids of the constructor are the rows of data; later ids may be larger, 
+	//  so data_ and norm_d_ are redirected to rows_ and norms_, which grow
+	// -------------------------------------------------------------------------
+	rows_.assign(data_, data_ + n_pts_);
+	norms_.assign(norm_d_, norm_d_ + n_pts_);
+	owned_.assign(n_pts_, 0);
+	loc_.assign(n_pts_, NULL);
+	pos_.assign(n_pts_, -1);
+	ver_.assign(n_pts_, 0);
+
+	for (int i = 0; i < num_blocks_; ++i) {
+		Block *block = blocks_[i];
+		for (int j = 0; j < block->n_pts_; ++j) {
+			loc_[block->index_[j]] = block;
+			pos_[block->index_[j]] = j;
+		}
+	}
+	data_   = rows_.data();
+	norm_d_ = norms_.data();
+}
+
+// -----------------------------------------------------------------------------
+bool H2_ALSH::needs_merge(			// whether a block is due for a merge
+	Block *block)						// block
+{
+	if ((int) block->delta_.size() >= DELTA_SIZE) return true;
+	return block->num_dead_ > 0 && block->num_dead_ * 4 >= block->n_pts_;
+}
+
+// -----------------------------------------------------------------------------
+int H2_ALSH::insert(				// insert a data object online
+	int   id,							// object id (not in the index)
+	const float *vec)					// data object (copied)
+{
+	if (id < 0) {
+		printf("Invalid object id %d\n", id);
+		return 1;
+	}
+	float *obj = new float[dim_ + NORM_K];
+	memcpy(obj, vec, dim_ * SIZEFLOAT);
+	calc_norm(dim_, obj, obj + dim_);
+	float norm = obj[dim_];
+
+	lock_.lock();
+	init_updates();
+	if (id < (int) loc_.size() && loc_[id] != NULL) {
+		lock_.unlock();
+		printf("Object %d is already in the index\n", id);
+		delete[] obj;
+		return 1;
+	}
+	if (id >= (int) rows_.size()) {
+		rows_.resize(id + 1, NULL);
+		norms_.resize(id + 1, NULL);
+		owned_.resize(id + 1, 0);
+		loc_.resize(id + 1, NULL);
+		pos_.resize(id + 1, -1);
+		ver_.resize(id + 1, 0);
+		data_   = rows_.data();
+		norm_d_ = norms_.data();
+	}
+	rows_[id]  = obj;
+	norms_[id] = obj + dim_;
+	owned_[id] = 1;
+	++ver_[id];
+	if (sq8_ != NULL && id < sq8_->n()) sq8_->encode(id, obj);
+
+	// -------------------------------------------------------------------------
+	//  the last block with M >= norm keeps the h2_alsh transformation valid; 
+	//  a larger norm goes to a linear scan block in front, whose M is raised
+	// -------------------------------------------------------------------------
+	Block *block = NULL;
+	if (num_blocks_ == 0 || norm > blocks_[0]->M_) {
+		if (num_blocks_ > 0 && blocks_[0]->lsh_ == NULL) {
+			block = blocks_[0];
+		}
+		else {
+			block = new Block();
+			blocks_.insert(blocks_.begin(), block);
+			++num_blocks_;
+		}
+		block->M_ = norm;
+		M_ = MAX(M_, norm);
+	}
+	else {
+		int b = 0;
+		while (b + 1 < num_blocks_ && blocks_[b + 1]->M_ >= norm) ++b;
+		block = blocks_[b];
+	}
+	block->delta_.push_back(id);
+	loc_[id] = block;
+	pos_[id] = -1;
+	++n_pts_;
+
+	// -------------------------------------------------------------------------
+	//  start the merger (it goes on with other blocks that are due)
+	// -------------------------------------------------------------------------
+	if (!merging_ && needs_merge(block)) {
+		if (merger_.joinable()) merger_.join();
+		merging_ = true;
+		merger_  = std::thread(&H2_ALSH::merge_loop, this, block);
+	}
+	lock_.unlock();
+
+	return 0;
+}
+
+// -----------------------------------------------------------------------------
+int H2_ALSH::remove(				// remove a data object online
+	int   id)							// object id
+{
+	lock_.lock();
+	init_updates();
+	if (id < 0 || id >= (int) loc_.size() || loc_[id] == NULL) {
+		lock_.unlock();
+		printf("Object %d is not in the index\n", id);
+		return 1;
+	}
+
+	Block *block = loc_[id];
+	if (pos_[id] >= 0) {
+		if (block->dead_ == NULL) {
+			block->dead_ = new uint8_t[block->n_pts_];
+			memset(block->dead_, 0, block->n_pts_);
+			if (block->lsh_ != NULL) block->lsh_->set_tombstones(block->dead_);
+		}
+		block->dead_[pos_[id]] = 1;
+		++block->num_dead_;
+	}
+	else {
+		std::vector<int> &delta = block->delta_;
+		delta.erase(std::find(delta.begin(), delta.end(), id));
+	}
+	if (owned_[id]) { delete[] rows_[id]; owned_[id] = 0; }
+	rows_[id]  = NULL;
+	norms_[id] = NULL;
+	loc_[id]   = NULL;
+	pos_[id]   = -1;
+	--n_pts_;
+
+	if (!merging_ && needs_merge(block)) {
+		if (merger_.joinable()) merger_.join();
+		merging_ = true;
+		merger_  = std::thread(&H2_ALSH::merge_loop, this, block);
+	}
+	lock_.unlock();
+
+	return 0;
+}
+
+// -----------------------------------------------------------------------------
+void H2_ALSH::merge_loop(			// main loop of merger_
+	Block *block)						// first block to merge
+{
+	while (block != NULL) {
+		merge_block(block);
+
+		lock_.lock();
+		block = NULL;
+		for (int i = 0; i < num_blocks_ && block == NULL; ++i) {
+			if (needs_merge(blocks_[i])) block = blocks_[i];
+		}
+		if (block == NULL) merging_ = false;
+		lock_.unlock();
+	}
+}
+
+// -----------------------------------------------------------------------------
+void H2_ALSH::merge_block(			// rebuild a block with its delta buffer
+	Block *block)						// block
+{
+	// -------------------------------------------------------------------------
+	//  step 1: copy the live objects (sorted by norm) and their last h2_alsh 
+	//  coordinates, as rows_ may change while the tables are built
+	// -------------------------------------------------------------------------
+	lock_.lock_shared();
+	std::vector<Result> obj;
+	for (int j = 0; j < block->n_pts_; ++j) {
+		if (block->dead_ != NULL && block->dead_[j]) continue;
+
+		Result r; r.id_ = block->index_[j]; r.key_ = norm_d_[r.id_][0];
+		obj.push_back(r);
+	}
+	for (size_t j = 0; j < block->delta_.size(); ++j) {
+		Result r; r.id_ = block->delta_[j]; r.key_ = norm_d_[r.id_][0];
+		obj.push_back(r);
+	}
+	int   n     = (int) obj.size();
+	float M_sqr = block->M_ * block->M_;
+	bool  use_lsh = n > N_THRESHOLD && (block->lsh_ != NULL || !adaptive_);
+	bool  shared  = use_lsh && proj_ != NULL && 
+		QALSH::calc_m(n, nn_ratio_) <= proj_->n();
+	sort_results(n, true, obj.data());
+
+	Matrix *h2_data = new Matrix(MAX(n, 1), dim_);
+	std::vector<float> last(MAX(n, 1));
+	std::vector<int> ver(n);
+	for (int j = 0; j < n; ++j) {
+		int id = obj[j].id_;
+		memcpy(h2_data->row(j), data_[id], dim_ * SIZEFLOAT);
+		last[j] = sqrt(MAX(0.0f, M_sqr - obj[j].key_ * obj[j].key_));
+		ver[j]  = ver_[id];
+	}
+	lock_.unlock_shared();
+
+	// -------------------------------------------------------------------------
+	//  step 2: build the hash tables while queries go on
+	// -------------------------------------------------------------------------
+	QALSH *lsh = NULL;
+	if (use_lsh) {
+		lsh = new QALSH(n, dim_ + 1, nn_ratio_, (const float **) 
+			h2_data->rows(), true, shared ? (const float **) proj_->rows() : 
+			NULL, last.data());
+	}
+	delete h2_data; h2_data = NULL;
+
+	// -------------------------------------------------------------------------
+	//  step 3: swap the block in; objects removed (or inserted again) since 
+	//  step 1 get tombstones, and objects inserted since step 1 stay in delta_
+	// -------------------------------------------------------------------------
+	int     *index    = new int[MAX(n, 1)];
+	uint8_t *dead     = NULL;
+	int     num_dead  = 0;
+
+	lock_.lock();
+	for (int j = 0; j < n; ++j) {
+		int id = obj[j].id_;
+		index[j] = id;
+		if (loc_[id] == block && ver_[id] == ver[j]) {
+			pos_[id] = j;
+			continue;
+		}
+		if (dead == NULL) {
+			dead = new uint8_t[n];
+			memset(dead, 0, n);
+		}
+		dead[j] = 1;
+		++num_dead;
+	}
+	std::vector<int> &delta = block->delta_;
+	size_t left = 0;
+	for (size_t j = 0; j < delta.size(); ++j) {
+		if (pos_[delta[j]] < 0) delta[left++] = delta[j];
+	}
+	delta.resize(left);
+
+	std::swap(block->index_, index);
+	std::swap(block->lsh_, lsh);
+	std::swap(block->dead_, dead);
+	block->n_pts_    = n;
+	block->num_dead_ = num_dead;
+	block->shared_   = shared;
+	if (block->lsh_ != NULL) block->lsh_->set_tombstones(block->dead_);
+	lock_.unlock();
+
+	// -------------------------------------------------------------------------
+	//  release the old block (no query can use it any more)
+	// -------------------------------------------------------------------------
+	delete[] index;
+	delete   lsh;
+	delete[] dead;
+}
+
+// -----------------------------------------------------------------------------
+void H2_ALSH::flush()				// wait for merges, then merge all blocks
+{
+	if (merger_.joinable()) merger_.join();
+
+	for (int i = 0; i < num_blocks_; ++i) {
+		Block *block = blocks_[i];
+		if (!block->delta_.empty() || block->num_dead_ > 0) merge_block(block);
+	}
+}
+
@@ -2,7 +2,21 @@
 #define __H2_ALSH_H
 
 class QALSH;
+class QALSH_Scratch;
+struct Result;
+class Thread_Pool;
+class Matrix;
+class SRHT;
+class SQ8;
 class MaxK_List;
+struct Mmap_File;
+struct Dim_Kernels;
+
+extern int g_block_mode;			// global parameter: 0 fixed, 1 adaptive
+extern int g_num_updates;			// global parameter: online updates
+extern int g_early_stop;			// global parameter: streaming verification
+extern int g_shared_proj;			// global parameter: shared hash functions
+extern int g_build_mb;				// global parameter: build budget (MB)
 
 // -----------------------------------------------------------------------------
 //  Assistant Data Structure for H2-ALSH
@@ -12,18 +26,57 @@ struct Block {
 	float M_;
 	int   *index_;
 	QALSH *lsh_;
+	float visit_;					// expected fraction of queries visiting
+	float cost_;					// expected cost per query (-1: unknown)
+
+	uint8_t *dead_;					// tombstones of index_ (or NULL)
+	int   num_dead_;				// number of tombstones
+	std::vector<int> delta_;		// inserted objects not merged yet
+	bool  shared_;					// true if lsh_ uses H2_ALSH::proj_
 
-	Block() { n_pts_ = 0; M_ = 0; index_ = NULL; lsh_ = NULL; }
-	~Block() {
-		if (index_ != NULL) { delete[] index_; index_ = NULL; }
-		if (lsh_ != NULL) { delete lsh_; lsh_ = NULL; }
-	}
+	Block() { n_pts_ = 0; M_ = 0; index_ = NULL; lsh_ = NULL; visit_ = 0; 
+		cost_ = -1.0f; dead_ = NULL; num_dead_ = 0; shared_ = false; }
+	~Block();
 };
 
 // -----------------------------------------------------------------------------
 //  Asymmetric Locality-Sensitive Hashing based on Homocentric Hypersphere 
 //  partition (H2_ALSH) is used to solve the problem of c-Approximate Maximum 
 //  Inner Product (c-AMIP) search
+//
+//  the blocks are either cut greedily by the compression ratio b_ (and at most 
+//  MAX_BLOCK_NUM objects), or, with g_block_mode = 1, chosen by a cost model: 
+//  the exact k-th MIP values of cn calibration queries give the fraction of 
+//  queries that visit a block and the objects a linear scan reads, and the 
+//  partition (and scan or QALSH per block) with the least expected cost is 
+//  found by dynamic programming over candidate boundaries. Every block still 
+//  satisfies norm >= b_ * M, so the guarantee of H2_ALSH is kept.
+//
+//  with g_shared_proj = 1, the QALSH of all blocks share one set of hash 
+//  functions proj_ (as many as the largest block needs). The h2_alsh query of 
+//  a block is (lambda * q, 0), so its projections are lambda * <a[0, d), q>: 
+//  a query is projected once, and every block rescales the projections by 
+//  its own lambda = M / normq instead of computing m inner products again.
+//  With g_struct_proj = 1 as well, proj_ holds the rows of an SRHT (see 
+//  fht.h), and project() computes them by fast Hadamard transforms.
+//
+//  the h2_alsh data (o, sqrt(M^2 - |o|^2)) of a block are never copied: its 
+//  QALSH reads the rows of data_ and gets the last coordinates, computed from 
+//  norm_d_ and the M of the block, while it builds its tables. build() runs 
+//  the same bulkloading out of core: the norms are sorted and the blocks cut 
+//  in one pass, then groups of consecutive blocks (as many as fit into a 
+//  memory budget) are built, written to an index file, and released, so that 
+//  load() maps the index afterwards. The data are only read block by block, 
+//  e.g., from a memory-mapped binary set whose pages the kernel can evict.
+//
+//  online updates: insert() appends an object to the delta buffer of the last 
+//  block with M >= its norm (a linear scan block in front takes objects with 
+//  larger norms), which queries scan after the block. remove() sets a 
+//  tombstone, which linear scans and QALSH skip. Once a delta buffer has 
+//  DELTA_SIZE objects (or a quarter of a block is dead), a background thread 
+//  rebuilds the block with its delta and without tombstones, and swaps it 
+//  in. Queries hold lock_ for reading, and updates and swaps for writing, so 
+//  queries stay correct while merges run. Updates come from one thread.
 // -----------------------------------------------------------------------------
 class H2_ALSH {
 public:
@@ -33,7 +86,10 @@ public:
 		float nn_ratio,					// approximation ratio for NN
 		float mip_ratio,				// approximation ratio for MIP
 		const float **data, 			// input data
-		const float **norm_d);			// l2-norm of data objects
+		const float **norm_d,			// l2-norm of data objects
+		int   cn,						// number of calibration queries
+		const float **cal_query,		// calibration queries (or NULL)
+		const float **cal_norm);		// l2-norm of calibration queries
 
 	// -------------------------------------------------------------------------
 	~H2_ALSH();						// destructor
@@ -41,16 +97,98 @@ public:
 	// -------------------------------------------------------------------------
 	void display();					// display parameters
 
+	// -------------------------------------------------------------------------
+	size_t index_size();			// memory of index (without data)
+
+	// -------------------------------------------------------------------------
+	//  kmip: with bound, the k-th MIP value is shared with other searches of 
+	//  the same query (e.g., the shards of H2_Shards), so that the blocks and 
+	//  points of this index are also pruned by the k-th MIP values they found
 	// -------------------------------------------------------------------------
 	int kmip(						// k-MIP search
 		int   top_k,					// top-k value
 		const float *query,				// input query
 		const float *norm_q,			// l2-norm of query
+		QALSH_Scratch *scratch,			// search context of this thread
+		MaxK_List *list,				// top-k MIP results (return) 
+		std::atomic<float> *bound = NULL); // shared k-th MIP value (or NULL)
+
+	// -------------------------------------------------------------------------
+	//  kmip_parallel: the same search for one query, where the blocks are 
+	//  handed out in order to the threads of pool. Every thread keeps its own 
+	//  top-k list; the largest k-th MIP value of the threads is shared by an 
+	//  atomic, so that the blocks and points of all threads are pruned by it, 
+	//  and the lists are merged into list at the end.
+	// -------------------------------------------------------------------------
+	int kmip_parallel(				// k-MIP search with parallel blocks
+		int   top_k,					// top-k value
+		const float *query,				// input query
+		const float *norm_q,			// l2-norm of query
+		Thread_Pool *pool,				// thread pool
+		QALSH_Scratch *scratch,			// search contexts (one per thread)
 		MaxK_List *list);				// top-k MIP results (return) 
 
+	// -------------------------------------------------------------------------
+	//  kmip_batch: the same search for a batch of queries, block by block. A 
+	//  query leaves the batch at the first block with M * normq <= kip (the 
+	//  blocks are sorted by M). Per block, the remaining queries are projected 
+	//  on the hash functions of QALSH by one GEMM, and the points of small 
+	//  blocks and the candidates of QALSH are verified by blocked inner 
+	//  products (calc_ip_block).
+	// -------------------------------------------------------------------------
+	int kmip_batch(					// k-MIP search of a batch of queries
+		int   top_k,					// top-k value
+		int   qn,						// number of queries
+		const float **query,			// input queries
+		const float **norm_q,			// l2-norm of queries
+		QALSH_Scratch *scratch,			// search context of this thread
+		MaxK_List **list);				// top-k MIP results (return)
+
+	// -------------------------------------------------------------------------
+	int insert(						// insert a data object online
+		int   id,						// object id (not in the index)
+		const float *vec);				// data object (copied)
+
+	// -------------------------------------------------------------------------
+	int remove(						// remove a data object online
+		int   id);						// object id
+
+	// -------------------------------------------------------------------------
+	void flush();					// wait for merges, then merge all blocks
+
+	// -------------------------------------------------------------------------
+	int save(						// write index to disk
+		const char *fname);				// address of index file
+
+	// -------------------------------------------------------------------------
+	static int build(				// build index into an index file
+		int   n,						// number of data objects
+		int   d,						// dimension of data objects
+		float nn_ratio,					// approximation ratio for NN
+		float mip_ratio,				// approximation ratio for MIP
+		const float **data, 			// input data
+		const float **norm_d,			// l2-norm of data objects
+		int   cn,						// number of calibration queries
+		const float **cal_query,		// calibration queries (or NULL)
+		const float **cal_norm,			// l2-norm of calibration queries
+		const char *fname,				// address of index file
+		size_t budget);					// memory of one build step (bytes)
+
+	// -------------------------------------------------------------------------
+	static H2_ALSH* load(			// load index from disk (mmap-ed)
+		int   n,						// number of data objects
+		int   d,						// dimension of data objects
+		const char *fname,				// address of index file
+		const float **data, 			// input data
+		const float **norm_d);			// l2-norm of data objects
+
 protected:
+	H2_ALSH() {}					// constructor (used by load)
+
+	// -------------------------------------------------------------------------
 	int   n_pts_;					// number of data objects
 	int   dim_;						// dimension of data objects
+	const Dim_Kernels *kern_;		// kernels for dim_ (simd.h)
 	float nn_ratio_;				// approximation ratio for NN
 	float mip_ratio_;				// approximation ratio for MIP
 	const float **data_;			// original data objects
@@ -58,12 +196,127 @@ protected:
 	
 	float b_;						// compression ratio
 	float M_;						// max norm of the data objects
-	float **h2_alsh_data_;			// h2_alsh data
 	int   num_blocks_;				// number of blocks
 	std::vector<Block*> blocks_;	// blocks
+	bool  adaptive_;				// true if blocks are from the cost model
+	Matrix *proj_;					// shared hash functions (or NULL)
+	SRHT  *srht_;					// structured proj_ (or NULL)
+	SQ8   *sq8_;					// int8 codes of data (or NULL)
+	Mmap_File *index_file_;			// mapping of loaded index (or NULL)
+
+	RW_Lock lock_;					// queries (read) vs. updates (write)
+	std::vector<const float*> rows_;  // data_ of all ids (after an update)
+	std::vector<const float*> norms_; // norm_d_ of all ids (after an update)
+	std::vector<uint8_t> owned_;	// true if a row is a copy from insert()
+	std::vector<Block*> loc_;		// block of every id (NULL: none)
+	std::vector<int> pos_;			// position in block (-1: delta buffer)
+	std::vector<int> ver_;			// insert count of every id
+	std::thread merger_;			// background merge thread
+	bool  merging_;					// true while merger_ runs (under lock_)
 	
 	// -------------------------------------------------------------------------
-	void bulkload();				// bulkloading
+	void init(						// init parameters
+		int   n,						// number of data objects
+		int   d,						// dimension of data objects
+		float nn_ratio,					// approximation ratio for NN
+		float mip_ratio,				// approximation ratio for MIP
+		const float **data, 			// input data
+		const float **norm_d);			// l2-norm of data objects
+
+	// -------------------------------------------------------------------------
+	//  bulkload: with fp, the blocks are built in groups of at most budget 
+	//  bytes, written to fp (as by save) and released; returns 1 on a failed 
+	//  write, 0 otherwise
+	// -------------------------------------------------------------------------
+	int   bulkload(					// bulkloading
+		int   cn,						// number of calibration queries
+		const float **cal_query,		// calibration queries (or NULL)
+		const float **cal_norm,			// l2-norm of calibration queries
+		FILE  *fp = NULL,				// index file of build() (or NULL)
+		size_t budget = 0);				// memory of one build step (bytes)
+
+	// -------------------------------------------------------------------------
+	int   save_head(				// write all but the QALSH of the blocks
+		FILE  *fp,						// output file
+		const std::vector<bool> &use_lsh); // QALSH for blocks
+
+	// -------------------------------------------------------------------------
+	void calibrate(					// calibration stops of sample queries
+		int   cn,						// number of calibration queries
+		const float **cal_query,		// calibration queries
+		const float **cal_norm,			// l2-norm of calibration queries
+		const Result *order,			// data objects sorted by norm (desc)
+		std::vector<int> &pos);			// calibration stops (return)
+
+	// -------------------------------------------------------------------------
+	float block_cost(				// expected cost of a block per query
+		int   s,						// first rank of block
+		int   e,						// last rank of block (exclusive)
+		bool  use_lsh,					// true if searched by QALSH
+		const std::vector<int> &pos);	// calibration stops (ascending)
+
+	// -------------------------------------------------------------------------
+	void fixed_partition(			// blocks by b_ and max_size
+		const Result *order,			// data objects sorted by norm (desc)
+		int   max_size,					// max block size
+		std::vector<int> &cuts,			// block boundaries (return)
+		std::vector<bool> &use_lsh);	// QALSH for blocks (return)
+
+	// -------------------------------------------------------------------------
+	void adaptive_partition(		// blocks by the cost model
+		const Result *order,			// data objects sorted by norm (desc)
+		const std::vector<int> &pos,	// calibration stops (ascending)
+		std::vector<int> &cuts,			// block boundaries (return)
+		std::vector<bool> &use_lsh);	// QALSH for blocks (return)
+
+	// -------------------------------------------------------------------------
+	void init_updates();			// set up rows_, loc_ for the first update
+
+	// -------------------------------------------------------------------------
+	bool needs_merge(				// whether a block is due for a merge
+		Block *block);					// block
+
+	// -------------------------------------------------------------------------
+	void merge_block(				// rebuild a block with its delta buffer
+		Block *block);					// block
+
+	// -------------------------------------------------------------------------
+	void merge_loop(				// main loop of merger_
+		Block *block);					// first block to merge
+
+	// -------------------------------------------------------------------------
+	float search_delta(				// k-MIP search in a delta buffer
+		Block *block,					// block
+		const float *query,				// input query
+		const float *norm_q,			// l2-norm of query
+		float kip,						// current k-th MIP value
+		MaxK_List *list,				// top-k MIP results (return)
+		std::atomic<float> *bound);		// shared k-th MIP value (or NULL)
+
+	// -------------------------------------------------------------------------
+	int   query_size();				// floats of h2_alsh query buffers
+
+	// -------------------------------------------------------------------------
+	int   proj_size();				// floats of query projections on proj_
+
+	// -------------------------------------------------------------------------
+	const float *project(			// projections of a query on proj_
+		const float *query,				// input query
+		float *q_proj);					// buffer of proj_size() floats
+
+	// -------------------------------------------------------------------------
+	float search_block(				// k-MIP search in one block
+		int   b,						// block id
+		int   top_k,					// top-k value
+		const float *query,				// input query
+		const float *norm_q,			// l2-norm of query
+		const float *q_proj,			// projections on proj_ (or NULL)
+		float kip,						// current k-th MIP value
+		float *h2_alsh_query,			// buffer of query_size() floats
+		QALSH_Scratch *scratch,			// search context of this thread
+		std::vector<int> &cand,			// buffer of candidates
+		MaxK_List *list,				// top-k MIP results (return)
+		std::atomic<float> *bound);		// shared k-th MIP value (or NULL)
 };
 
 #endif // __H2_ALSH_H
@@ -0,0 +1,156 @@
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+
+#include "def.h"
+#include "util.h"
+#include "matrix.h"
+#include "pri_queue.h"
+#include "parallel.h"
+#include "stats.h"
+#include "qalsh.h"
+#include "h2_alsh.h"
+#include "h2_shards.h"
+
+int g_num_shards = 1;
+
+// -----------------------------------------------------------------------------
+H2_Shards::H2_Shards(				// constructor
+	int   n,							// number of data objects
+	int   d,							// dimension of data objects
+	float nn_ratio,						// approximation ratio for NN
+	float mip_ratio,					// approximation ratio for MIP
+	const float **data,					// input data
+	const float **norm_d,				// l2-norm of data objects
+	int   num_shards,					// number of shards
+	int   cn,							// number of calibration queries
+	const float **cal_query,			// calibration queries (or NULL)
+	const float **cal_norm)				// l2-norm of calibration queries
+{
+	n_pts_      = n;
+	dim_        = d;
+	num_shards_ = MAX(1, MIN(num_shards, n));
+	pool_       = new Thread_Pool(num_shards_, true);
+	scratch_    = new QALSH_Scratch[num_shards_];
+
+	lsh_.resize(num_shards_, NULL);
+	data_.resize(num_shards_, NULL);
+	norm_d_.resize(num_shards_, NULL);
+	ids_.resize(num_shards_);
+
+	// -------------------------------------------------------------------------
+	//  deal the objects in norm order to the shards (ids_ stay ascending)
+	// -------------------------------------------------------------------------
+	Result *order = new Result[n];
+	int    *shard = new int[n];
+	sort_by_norm(n, norm_d, order);
+	for (int i = 0; i < n; ++i) shard[order[i].id_] = i % num_shards_;
+	for (int i = 0; i < n; ++i) ids_[shard[i]].push_back(i);
+	delete[] order; order = NULL;
+	delete[] shard; shard = NULL;
+
+	// -------------------------------------------------------------------------
+	//  copy the objects and build the index of shard s on worker s; the shards 
+	//  are built one by one, so every build can use all g_num_threads threads 
+	//  (which inherit the node of worker s)
+	// -------------------------------------------------------------------------
+	for (int s = 0; s < num_shards_; ++s) {
+		pool_->run_each(num_shards_, [&](int tid, int i) {
+			if (i != s) return;
+
+			const std::vector<int> &ids = ids_[s];
+			int ns = (int) ids.size();
+			Matrix *sd = new Matrix(ns, d);
+			Matrix *sn = new Matrix(ns, NORM_K, false);
+			for (int j = 0; j < ns; ++j) {
+				memcpy(sd->row(j), data[ids[j]], d * SIZEFLOAT);
+				memcpy(sn->row(j), norm_d[ids[j]], NORM_K * SIZEFLOAT);
+			}
+			data_[s] = sd; norm_d_[s] = sn;
+			lsh_[s]  = new H2_ALSH(ns, d, nn_ratio, mip_ratio, 
+				(const float **) sd->rows(), (const float **) sn->rows(), 
+				cn, cal_query, cal_norm);
+		});
+	}
+}
+
+// -----------------------------------------------------------------------------
+H2_Shards::~H2_Shards()				// destructor
+{
+	for (int s = 0; s < num_shards_; ++s) {
+		delete lsh_[s];    lsh_[s]    = NULL;
+		delete data_[s];   data_[s]   = NULL;
+		delete norm_d_[s]; norm_d_[s] = NULL;
+	}
+	delete pool_; pool_ = NULL;
+	delete[] scratch_; scratch_ = NULL;
+}
+
+// -----------------------------------------------------------------------------
+void H2_Shards::display()			// display parameters
+{
+	printf("Parameters of H2_Shards:\n");
+	printf("    n          = %d\n", n_pts_);
+	printf("    d          = %d\n", dim_);
+	printf("    num_shards = %d\n", num_shards_);
+	printf("    numa_nodes = %d\n\n", numa_nodes());
+
+	printf("    Shard\tNode\tn\tIndex (MB)\n");
+	for (int s = 0; s < num_shards_; ++s) {
+		printf("    %d\t%d\t%d\t%.2f\n", s, pool_->node(s), 
+			(int) ids_[s].size(), lsh_[s]->index_size() / 1048576.0f);
+	}
+	printf("\n");
+	lsh_[0]->display();
+}
+
+// -----------------------------------------------------------------------------
+size_t H2_Shards::index_size()		// memory of index (without data)
+{
+	size_t size = (size_t) n_pts_ * SIZEINT;	// global ids of shards
+	for (int s = 0; s < num_shards_; ++s) size += lsh_[s]->index_size();
+	return size;
+}
+
+// -----------------------------------------------------------------------------
+int H2_Shards::kmip(				// k-MIP search
+	int   top_k,						// top-k value
+	const float *query,					// input query
+	const float *norm_q,				// l2-norm of query
+	MaxK_List *list)					// top-k MIP results (return) 
+{
+	std::atomic<float> bound(MINREAL);
+#ifdef H2_STATS
+	std::vector<Query_Stats> stats(num_shards_); // counts of the shards
+#endif
+
+	// -------------------------------------------------------------------------
+	//  search every shard on its own worker with the shared k-th MIP value
+	// -------------------------------------------------------------------------
+	pool_->run_each(num_shards_, [&](int tid, int s) {
+		STATS_SCOPE(&stats[s]);
+		MaxK_List *local = scratch_[s].list(top_k);
+		local->reset();
+		lsh_[s]->kmip(top_k, query, norm_q, &scratch_[s], local, &bound);
+	});
+
+	// -------------------------------------------------------------------------
+	//  merge the lists (and counts) of all shards
+	// -------------------------------------------------------------------------
+	for (int s = 0; s < num_shards_; ++s) {
+#ifdef H2_STATS
+		g_stats.add(stats[s]);
+#endif
+		MaxK_List *local = scratch_[s].list(top_k);
+		const std::vector<int> &ids = ids_[s];
+		int num = local->size();
+		for (int j = 0; j < num; ++j) {
+			list->insert(local->ith_key(j), ids[local->ith_id(j) - 1] + 1);
+		}
+	}
+	return 0;
+}
@@ -0,0 +1,76 @@
+#ifndef __H2_SHARDS_H
+#define __H2_SHARDS_H
+
+#include <vector>
+
+class H2_ALSH;
+class QALSH_Scratch;
+class Thread_Pool;
+class Matrix;
+class MaxK_List;
+
+extern int g_num_shards;			// global parameter: shards of H2_ALSH
+
+// -----------------------------------------------------------------------------
+//  H2_Shards: the data objects are partitioned into num_shards shards, each 
+//  with its own copy of its objects and its own H2_ALSH, so that the data set 
+//  and indexes can be larger than the memory (and bandwidth) of one socket.
+//
+//  the objects are sorted by norm and dealt round-robin to the shards, so every 
+//  shard has the same norm distribution and blocks with about the same M. A 
+//  pinned Thread_Pool has one worker per shard, bound to NUMA node s % nodes; 
+//  shard s copies its objects and builds its index on worker s, so that first 
+//  touch places them on that node, and every query of shard s runs there too.
+//
+//  kmip() fans a query out to all shards, which share one atomic k-th MIP 
+//  value: a shard prunes its blocks by M * normq <= kip and its points by the 
+//  largest k-th MIP value found by any shard so far. The top-k lists of the 
+//  shards are merged at the end (with global object ids).
+// -----------------------------------------------------------------------------
+class H2_Shards {
+public:
+	H2_Shards(						// constructor
+		int   n,						// number of data objects
+		int   d,						// dimension of data objects
+		float nn_ratio,					// approximation ratio for NN
+		float mip_ratio,				// approximation ratio for MIP
+		const float **data, 			// input data
+		const float **norm_d,			// l2-norm of data objects
+		int   num_shards,				// number of shards
+		int   cn,						// number of calibration queries
+		const float **cal_query,		// calibration queries (or NULL)
+		const float **cal_norm);		// l2-norm of calibration queries
+
+	// -------------------------------------------------------------------------
+	~H2_Shards();					// destructor
+
+	// -------------------------------------------------------------------------
+	void display();					// display parameters
+
+	// -------------------------------------------------------------------------
+	size_t index_size();			// memory of index (without data)
+
+	// -------------------------------------------------------------------------
+	int kmip(						// k-MIP search
+		int   top_k,					// top-k value
+		const float *query,				// input query
+		const float *norm_q,			// l2-norm of query
+		MaxK_List *list);				// top-k MIP results (return) 
+
+	// -------------------------------------------------------------------------
+	inline int num_shards() { return num_shards_; }
+
+protected:
+	int   n_pts_;					// number of data objects
+	int   dim_;						// dimensionality
+	int   num_shards_;				// number of shards
+	Thread_Pool *pool_;				// one pinned worker per shard
+	QALSH_Scratch *scratch_;		// search contexts (one per shard)
+
+	std::vector<H2_ALSH*> lsh_;		// H2_ALSH of shards
+	std::vector<Matrix*> data_;		// data objects of shards
+	std::vector<Matrix*> norm_d_;	// l2-norm of data objects of shards
+	std::vector<std::vector<int> > ids_; // global ids of objects of shards
+};
+
+#endif // __H2_SHARDS_H
@@ -1,9 +1,17 @@
 #include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
 
 #include "def.h"
 #include "util.h"
+#include "simd.h"
+#include "matrix.h"
 #include "pri_queue.h"
 #include "qalsh.h"
+#include "sq8.h"
 #include "l2_alsh2.h"
 
 // -----------------------------------------------------------------------------
@@ -23,6 +31,7 @@ L2_ALSH2::L2_ALSH2(					// constructor
 	// -------------------------------------------------------------------------
 	n_pts_        = n;
 	dim_          = d;
+	kern_         = dim_kernels(d);
 	m_            = m;
 	U_            = U;
 	nn_ratio_     = nn_ratio;
@@ -41,10 +50,8 @@ L2_ALSH2::L2_ALSH2(					// constructor
 L2_ALSH2::~L2_ALSH2()				// destructor
 {
 	delete lsh_; lsh_ = NULL;
-	for (int i = 0; i < n_pts_; ++i) {
-		delete[] l2_alsh2_data_[i]; l2_alsh2_data_[i] = NULL;
-	}
-	delete[] l2_alsh2_data_; l2_alsh2_data_ = NULL;
+	delete sq8_; sq8_ = NULL;
+	delete l2_alsh2_data_; l2_alsh2_data_ = NULL;
 }
 
 // -----------------------------------------------------------------------------
@@ -73,21 +80,21 @@ void L2_ALSH2::bulkload(			// pre-processing of data
 	float scale = U_ / M_;
 	int   exponent = -1;
 
-	l2_alsh2_data_ = new float*[n_pts_];
+	l2_alsh2_data_ = new Matrix(n_pts_, l2_alsh2_dim_);
 	for (int i = 0; i < n_pts_; ++i) {
-		l2_alsh2_data_[i] = new float[l2_alsh2_dim_];
+		float *l2_alsh2_data = l2_alsh2_data_->row(i);
 
 		norm[i] *= scale;
 		for (int j = 0; j < l2_alsh2_dim_; ++j) {
 			if (j < dim_) {
-				l2_alsh2_data_[i][j] = data_[i][j] * scale;
+				l2_alsh2_data[j] = data_[i][j] * scale;
 			}
 			else if (j < dim_ + m_) {
 				exponent = (int) pow(2.0f, j - dim_ + 1);
-				l2_alsh2_data_[i][j] = pow(norm[i], exponent);
+				l2_alsh2_data[j] = pow(norm[i], exponent);
 			}
 			else {
-				l2_alsh2_data_[i][j] = 0.5f;
+				l2_alsh2_data[j] = 0.5f;
 			}
 		}
 	}
@@ -95,7 +102,9 @@ void L2_ALSH2::bulkload(			// pre-processing of data
 	// -------------------------------------------------------------------------
 	//  indexing the new format of data using qalsh
 	// -------------------------------------------------------------------------
-	lsh_ = new QALSH(n_pts_, l2_alsh2_dim_, nn_ratio_, (const float **) l2_alsh2_data_);
+	lsh_ = new QALSH(n_pts_, l2_alsh2_dim_, nn_ratio_, 
+		(const float **) l2_alsh2_data_->rows());
+	sq8_ = g_sq_frac > 0.0f ? new SQ8(n_pts_, dim_, data_) : NULL;
 }
 
 // -----------------------------------------------------------------------------
@@ -110,11 +119,20 @@ void L2_ALSH2::display()			// display parameters
 	printf("    M  = %f\n\n", M_);
 }
 
+// -----------------------------------------------------------------------------
+size_t L2_ALSH2::index_size()		// memory of index (without data)
+{
+	size_t size = lsh_->index_size();
+	if (sq8_ != NULL) size += sq8_->index_size();
+	return size;
+}
+
 // -----------------------------------------------------------------------------
 int L2_ALSH2::kmip(					// c-k-AMIP search
 	int   top_k,						// top-k value
 	const float *query,					// input query
 	const float *norm_q,				// l2-norm of query
+	QALSH_Scratch *scratch,				// search context of this thread
 	MaxK_List *list)					// top-k MIP results (return) 
 {
 	float kip   = MINREAL;
@@ -125,7 +143,7 @@ int L2_ALSH2::kmip(					// c-k-AMIP search
 	// -------------------------------------------------------------------------
 	int   exponent = -1;
 	float scale = U_ / M_;
-	float *l2_alsh2_query = new float[l2_alsh2_dim_];
+	float *l2_alsh2_query = scratch->query_buf(l2_alsh2_dim_);
 
 	normq *= scale;
 	for (int i = 0; i < l2_alsh2_dim_; ++i) {
@@ -144,22 +162,33 @@ int L2_ALSH2::kmip(					// c-k-AMIP search
 	// -------------------------------------------------------------------------
 	//  conduct c-k-ANN search by qalsh
 	// -------------------------------------------------------------------------
-	std::vector<int> cand;
-	lsh_->knn(top_k, MAXREAL, (const float *) l2_alsh2_query, cand);
+	std::vector<int> &cand = scratch->cand();
+	cand.clear();
+	lsh_->knn(top_k, MAXREAL, (const float *) l2_alsh2_query, scratch, 
+		cand);
 
 	// -------------------------------------------------------------------------
-	//  calc inner product for candidates returned by qalsh
+	//  calc inner product for candidates returned by qalsh (or for the best 
+	//  of them by their int8 codes)
 	// -------------------------------------------------------------------------
+	if (sq8_ != NULL) {
+		sq8_->filter(top_k, query, NULL, cand, 
+			scratch->score_buf(sq8_->buf_size((int) cand.size())));
+	}
 	int size = (int) cand.size();
+	sort_cand(size, norm_d_, cand.data());
 	for (int i = 0; i < size; ++i) {
+		if (i + PREFETCH_DIST < size) {
+			int next = cand[i + PREFETCH_DIST];
+			prefetch_point(dim_, data_[next], norm_d_[next]);
+		}
 		int id = cand[i];
 		if (norm_d_[id][0] * normq <= kip) break;
-			
-		float ip = calc_inner_product(dim_, kip, data_[id], norm_d_[id], 
-			query, norm_q);
+
+		float ip = calc_inner_product(kern_, dim_, kip, data_[id], 
+			norm_d_[id], query, norm_q);
 		kip = list->insert(ip, id + 1);
 	}
-	delete[] l2_alsh2_query; l2_alsh2_query = NULL;
 
 	return 0;
 }
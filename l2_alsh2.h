@@ -2,7 +2,11 @@
 #define __L2_ALSH2_H
 
 class QALSH;
+class QALSH_Scratch;
+class SQ8;
+class Matrix;
 class MaxK_List;
+struct Dim_Kernels;
 
 // -----------------------------------------------------------------------------
 //  L2_ALSH2 is used to solve the problem of c-Approximate Maximum Inner 
@@ -43,16 +47,21 @@ public:
 	// -------------------------------------------------------------------------
 	void display();					// display parameters
 
+	// -------------------------------------------------------------------------
+	size_t index_size();			// memory of index (without data)
+
 	// -------------------------------------------------------------------------
 	int kmip(						// c-k-AMIP search
 		int   top_k,					// top-k value
 		const float *query,				// input query
 		const float *norm_q,			// l2-norm of query
+		QALSH_Scratch *scratch,			// search context of this thread
 		MaxK_List *list);				// top-k MIP results (return) 
 
 protected:
 	int   n_pts_;					// number of data objects
 	int   dim_;						// dimensionality
+	const Dim_Kernels *kern_;		// kernels for dim_ (simd.h)
 	int   m_;						// additional dimension of data
 	float U_;						// scale factor
 	float nn_ratio_;				// approximation ratio for ANN search
@@ -62,8 +71,9 @@ protected:
 
 	float M_;						// max norm of data and query
 	int   l2_alsh2_dim_;			// dim of l2_alsh2 data (dim_ + 2 * m_)
-	float **l2_alsh2_data_;			// l2_alsh2 data
+	Matrix *l2_alsh2_data_;			// l2_alsh2 data
 	QALSH *lsh_;					// qalsh
+	SQ8   *sq8_;					// int8 codes of data (or NULL)
 
 	// -------------------------------------------------------------------------
 	void bulkload(					// bulkloading
@@ -1,10 +1,29 @@
 #include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
 #include <cstring>
+#include <vector>
+#include <unistd.h>
 
 #include "def.h"
 #include "util.h"
+#include "matrix.h"
+#include "simd.h"
+#include "parallel.h"
+#include "stats.h"
+#include "random.h"
+#include "fht.h"
+#include "sq8.h"
+#include "pca.h"
+#include "qalsh.h"
+#include "h2_alsh.h"
+#include "h2_shards.h"
+#include "server.h"
 #include "amips.h"
 #include "pre_recall.h"
+#include "sweep.h"
 
 
 // -----------------------------------------------------------------------------
@@ -14,7 +33,7 @@ void usage() 						// display the usage of this package
 		"-------------------------------------------------------------------\n"
 		" Usage of the package for c-Approximate MIP (c-AMIP) search\n"
 		"-------------------------------------------------------------------\n"
-		"    -alg  {integer}  options of algorithms (0 - 11)\n"
+		"    -alg  {integer}  options of algorithms (0 - 14)\n"
 		"    -n    {integer}  cardinality of the dataset\n"
 		"    -d    {integer}  dimensionality of the dataset\n"
 		"    -qn   {integer}  number of queries\n"
@@ -26,7 +45,31 @@ void usage() 						// display the usage of this package
 		"    -ds   {string}   address of the data  set\n"
 		"    -qs   {string}   address of the query set\n"
 		"    -ts   {string}   address of the truth set\n"
+		"    -bs   {string}   address of the binary set (output of -alg 12)\n"
+		"    -is   {string}   address of the index set (for -alg 1, 5, 6)\n"
 		"    -op   {string}   output path\n"
+		"    -nt   {integer}  number of threads (default 1)\n"
+		"    -kb   {integer}  bits per hash key of QALSH (32 or 16, default 32)\n"
+		"    -bq   {integer}  queries per batch for -alg 1, 4, 7 (default 0: none)\n"
+		"    -iq   {integer}  threads per query for -alg 1 (default 1)\n"
+		"    -bp   {integer}  blocks of -alg 1, 8: 0 fixed, 1 adaptive (default 0)\n"
+		"    -up   {integer}  objects inserted online for -alg 1 (default 0)\n"
+		"    -et   {integer}  early termination of QALSH for -alg 1, 8 (0 or 1)\n"
+		"    -sp   {integer}  shared hash functions of QALSH for -alg 1, 8 (0 or 1)\n"
+		"    -sw   {string}   address of the sweep set (parameter sets of -alg 13)\n"
+		"    -pi   {integer}  one search at the largest t for -alg 8 - 10 (0 or 1)\n"
+		"    -rp   {integer}  hash functions of -alg 1 - 6, 8 - 10: 0 Gaussian,\n"
+		"                     1 structured (randomized Hadamard) (default 0)\n"
+		"    -sd   {integer}  random seed of hash functions (default 0: rand())\n"
+		"    -sq   {real}     fraction of candidates re-ranked after int8 scoring\n"
+		"                     for -alg 1 - 6, 8 - 10 (default 0: no int8 codes)\n"
+		"    -sh   {integer}  shards of -alg 1 on the NUMA nodes (default 1)\n"
+		"    -pt   {integer}  TCP port of -alg 14 (default 0: stdin and stdout)\n"
+		"    -bw   {integer}  micro-batch window of -alg 14 in us (default 200)\n"
+		"    -pc   {integer}  PCA rotation of data and queries for -alg 1 - 10,\n"
+		"                     13, 14 (0 or 1, default 0)\n"
+		"    -mb   {integer}  memory per step of an out-of-core build of -alg 1,\n"
+		"                     14 into -is in MB (default 0: in memory)\n"
 		"\n"
 		"-------------------------------------------------------------------\n"
 		" The options of algorithms are:\n"
@@ -67,6 +110,78 @@ void usage() 						// display the usage of this package
 		"    11 - Norm Distributiuon\n"
 		"         Parameters: -alg 11 -n -d -ds -op\n"
 		"\n"
+		"    12 - Convert Text Data (or Query) Set to Binary Format\n"
+		"         Parameters: -alg 12 -n -d -ds -bs\n"
+		"\n"
+		"    13 - Parameter Sweep of -alg 1 - 7 (one line of -sw per set)\n"
+		"         Parameters: -alg 13 -n -qn -d -ds -qs -ts -sw -op\n"
+		"\n"
+		"    14 - k-MIP Server of H2_ALSH (requests on stdin or -pt)\n"
+		"         Parameters: -alg 14 -n -d -c0 -c -ds -is\n"
+		"\n"
+		" Indexing and queries of -alg 0 - 7 run on -nt threads.\n"
+		"\n"
+		" With -is, an existing index set is loaded (memory-mapped) instead of\n"
+		" building the index; otherwise the index is built and saved there.\n"
+		"\n"
+		" With -kb 16, hash keys of QALSH (-alg 1 - 4, 8) are quantized to\n"
+		" int16 (and ids to uint16 if n <= 65536) to save memory.\n"
+		"\n"
+		" With -bp 1, the blocks of H2_ALSH are chosen by a cost model from\n"
+		" the norms of the data and a sample of the queries.\n"
+		"\n"
+		" With -up u, -alg 1 builds H2_ALSH on the first n - u objects, then\n"
+		" inserts the others (and removes and re-inserts some) online.\n"
+		"\n"
+		" With -sp 1, the QALSH of all blocks of H2_ALSH share one set of\n"
+		" hash functions, so a query is projected only once.\n"
+		"\n"
+		" With -et 1, H2_ALSH verifies the candidates of QALSH one by one,\n"
+		" and QALSH stops once the k-th MIP found so far is good enough.\n"
+		" It trades recall for speed, e.g., top-10 recall 99.12%% -> 94.07%%\n"
+		" for 26%% less time on Mnist (-c0 2.0 -c 0.5).\n"
+		"\n"
+		" With -iq > 1, the queries of -alg 1 run one after another, and the\n"
+		" blocks of each query are searched by -iq threads (for latency).\n"
+		"\n"
+		" With -pi 1, -alg 8 - 10 search each query once at the largest t\n"
+		" and take the smaller top-t results as prefixes of its result.\n"
+		"\n"
+		" With -rp 1, the hash functions of QALSH and SRP_LSH are rows of\n"
+		" randomized Hadamard transforms, which project in O(d log d).\n"
+		"\n"
+		" With -sd s > 0, hash functions come from per-index random streams\n"
+		" seeded by s instead of rand() (the same on any number of threads).\n"
+		"\n"
+		" With -sq f (0 < f < 1), candidates are first scored by int8 codes of\n"
+		" the data, and only the best fraction f (at least k) is verified.\n"
+		"\n"
+		" With -sh s > 1, -alg 1 deals the data by norm to s shards, each with\n"
+		" its own H2_ALSH on a NUMA node, and every query searches all shards\n"
+		" in parallel with a shared k-th MIP bound (-is, -up, -bq, -iq unused).\n"
+		"\n"
+		" With -pc 1, data and queries are rotated onto the principal axes of\n"
+		" the data, so that most inner products stop at the first partial-norm\n"
+		" checkpoints; with -is, the axes are kept in the index set plus .pca.\n"
+		"\n"
+		" With -mb b > 0, a new index of -alg 1, 14 is built into -is block\n"
+		" group by block group (b MB of tables each) and then memory-mapped;\n"
+		" with a binary set as -ds, the data are paged in as blocks need them.\n"
+		"\n"
+		" With -alg 14, the index of -is is loaded (or built and saved) once,\n"
+		" and requests (int32 k, then d floats) are answered by int32 num and\n"
+		" num pairs (int32 id, float ip). Requests within -bw us of each other\n"
+		" (at most -bq, default 64) are searched as one batch; k = 0 asks for\n"
+		" the counters, k < 0 shuts the server down. See server.h.\n"
+		"\n"
+		" With -alg 13, every line of -sw holds the options of one set (e.g.,\n"
+		" -alg 1 -c0 2.0 -c 0.5 -nt 4); data and truth are loaded once, the\n"
+		" indexes of -alg 1, 5, 6 are reused while their build options stay\n"
+		" the same, and all results go to sweep.csv under -op.\n"
+		"\n"
+		" Binary sets are detected automatically when passed to -ds or -qs\n"
+		" and are memory-mapped instead of parsed.\n"
+		"\n"
 		"-------------------------------------------------------------------\n"
 		" Authors: Qiang Huang (huangq2011@gmail.com)                       \n"
 		"          Guihong Ma  (maguihong@vip.qq.com)                       \n"
@@ -83,6 +198,9 @@ int main(int nargs, char **args)
 	char   data_set[200];			// address of data set
 	char   query_set[200];			// address of query set
 	char   truth_set[200];			// address of ground truth file
+	char   bin_set[200];			// address of binary data set
+	char   index_set[200] = "";		// address of index set
+	char   sweep_set[200] = "";		// address of sweep set
 	char   out_path[200];			// output path
 
 	int    alg       = -1;			// which algorithm?
@@ -95,11 +213,18 @@ int main(int nargs, char **args)
 	float  nn_ratio  = -1.0f;		// approximation ratio of ANN search
 	float  mip_ratio = -1.0f;		// approximation ratio of AMIP search
 
+	Matrix *data_mat   = NULL;		// matrix of data  objects
+	Matrix *query_mat  = NULL;		// matrix of query objects
+	Matrix *norm_d_mat = NULL;		// matrix of l2-norm of data  objects
+	Matrix *norm_q_mat = NULL;		// matrix of l2-norm of query objects
 	float  **data    = NULL;		// data objects
 	float  **query   = NULL;		// query objects
 	float  **norm_d  = NULL;		// l2-norm of data  objects
 	float  **norm_q  = NULL;		// l2-norm of query objects
+	Mmap_File data_file;			// mapping of binary data set
+	Mmap_File query_file;			// mapping of binary query set
 	Result **R       = NULL;		// truth set
+	PCA    *pca      = NULL;		// rotation of data and queries
 	float  **pre     = NULL;		// precision array
 	float  **recall  = NULL;		// recall array
 	bool   failed    = false;
@@ -109,7 +234,7 @@ int main(int nargs, char **args)
 		if (strcmp(args[cnt], "-alg") == 0) {
 			alg = atoi(args[++cnt]);
 			printf("alg       = %d\n", alg);
-			if (alg < 0 || alg > 11) {
+			if (alg < 0 || alg > 14) {
 				failed = true;
 				break;
 			}
@@ -190,6 +315,154 @@ int main(int nargs, char **args)
 			strncpy(truth_set, args[++cnt], sizeof(truth_set));
 			printf("truth_set = %s\n", truth_set);
 		}
+		else if (strcmp(args[cnt], "-bs") == 0) {
+			strncpy(bin_set, args[++cnt], sizeof(bin_set));
+			printf("bin_set   = %s\n", bin_set);
+		}
+		else if (strcmp(args[cnt], "-is") == 0) {
+			strncpy(index_set, args[++cnt], sizeof(index_set));
+			printf("index_set = %s\n", index_set);
+		}
+		else if (strcmp(args[cnt], "-sw") == 0) {
+			strncpy(sweep_set, args[++cnt], sizeof(sweep_set));
+			printf("sweep_set = %s\n", sweep_set);
+		}
+		else if (strcmp(args[cnt], "-nt") == 0) {
+			g_num_threads = atoi(args[++cnt]);
+			printf("nt        = %d\n", g_num_threads);
+			if (g_num_threads <= 0) {
+				failed = true;
+				break;
+			}
+		}
+		else if (strcmp(args[cnt], "-kb") == 0) {
+			g_key_bits = atoi(args[++cnt]);
+			printf("kb        = %d\n", g_key_bits);
+			if (g_key_bits != 32 && g_key_bits != 16) {
+				failed = true;
+				break;
+			}
+		}
+		else if (strcmp(args[cnt], "-bq") == 0) {
+			g_query_batch = atoi(args[++cnt]);
+			printf("bq        = %d\n", g_query_batch);
+			if (g_query_batch < 0) {
+				failed = true;
+				break;
+			}
+		}
+		else if (strcmp(args[cnt], "-iq") == 0) {
+			g_query_threads = atoi(args[++cnt]);
+			printf("iq        = %d\n", g_query_threads);
+			if (g_query_threads <= 0) {
+				failed = true;
+				break;
+			}
+		}
+		else if (strcmp(args[cnt], "-bp") == 0) {
+			g_block_mode = atoi(args[++cnt]);
+			printf("bp        = %d\n", g_block_mode);
+			if (g_block_mode != 0 && g_block_mode != 1) {
+				failed = true;
+				break;
+			}
+		}
+		else if (strcmp(args[cnt], "-et") == 0) {
+			g_early_stop = atoi(args[++cnt]);
+			printf("et        = %d\n", g_early_stop);
+			if (g_early_stop != 0 && g_early_stop != 1) {
+				failed = true;
+				break;
+			}
+		}
+		else if (strcmp(args[cnt], "-sp") == 0) {
+			g_shared_proj = atoi(args[++cnt]);
+			printf("sp        = %d\n", g_shared_proj);
+			if (g_shared_proj != 0 && g_shared_proj != 1) {
+				failed = true;
+				break;
+			}
+		}
+		else if (strcmp(args[cnt], "-rp") == 0) {
+			g_struct_proj = atoi(args[++cnt]);
+			printf("rp        = %d\n", g_struct_proj);
+			if (g_struct_proj != 0 && g_struct_proj != 1) {
+				failed = true;
+				break;
+			}
+		}
+		else if (strcmp(args[cnt], "-sd") == 0) {
+			g_seed = atoi(args[++cnt]);
+			printf("sd        = %d\n", g_seed);
+			if (g_seed < 0) {
+				failed = true;
+				break;
+			}
+		}
+		else if (strcmp(args[cnt], "-sq") == 0) {
+			g_sq_frac = (float) atof(args[++cnt]);
+			printf("sq        = %.2f\n", g_sq_frac);
+			if (g_sq_frac < 0.0f || g_sq_frac > 1.0f) {
+				failed = true;
+				break;
+			}
+		}
+		else if (strcmp(args[cnt], "-pt") == 0) {
+			g_server_port = atoi(args[++cnt]);
+			printf("pt        = %d\n", g_server_port);
+			if (g_server_port < 0 || g_server_port > 65535) {
+				failed = true;
+				break;
+			}
+		}
+		else if (strcmp(args[cnt], "-bw") == 0) {
+			g_batch_wait = atoi(args[++cnt]);
+			printf("bw        = %d\n", g_batch_wait);
+			if (g_batch_wait < 0) {
+				failed = true;
+				break;
+			}
+		}
+		else if (strcmp(args[cnt], "-sh") == 0) {
+			g_num_shards = atoi(args[++cnt]);
+			printf("sh        = %d\n", g_num_shards);
+			if (g_num_shards <= 0) {
+				failed = true;
+				break;
+			}
+		}
+		else if (strcmp(args[cnt], "-pc") == 0) {
+			g_pca = atoi(args[++cnt]);
+			printf("pc        = %d\n", g_pca);
+			if (g_pca != 0 && g_pca != 1) {
+				failed = true;
+				break;
+			}
+		}
+		else if (strcmp(args[cnt], "-mb") == 0) {
+			g_build_mb = atoi(args[++cnt]);
+			printf("mb        = %d\n", g_build_mb);
+			if (g_build_mb < 0) {
+				failed = true;
+				break;
+			}
+		}
+		else if (strcmp(args[cnt], "-pi") == 0) {
+			g_pr_prefix = atoi(args[++cnt]);
+			printf("pi        = %d\n", g_pr_prefix);
+			if (g_pr_prefix != 0 && g_pr_prefix != 1) {
+				failed = true;
+				break;
+			}
+		}
+		else if (strcmp(args[cnt], "-up") == 0) {
+			g_num_updates = atoi(args[++cnt]);
+			printf("up        = %d\n", g_num_updates);
+			if (g_num_updates < 0) {
+				failed = true;
+				break;
+			}
+		}
 		else if (strcmp(args[cnt], "-op") == 0) {
 			strncpy(out_path, args[++cnt], sizeof(out_path));
 			printf("out_path  = %s\n", out_path);
@@ -208,30 +481,70 @@ int main(int nargs, char **args)
 		}
 		cnt++;
 	}
+	printf("simd      = %s\n", g_simd.name_);
+#ifdef H2_STATS
+	printf("stats     = %squery_stats.txt\n", out_path);
+#endif
 	printf("\n");
 
 	// -------------------------------------------------------------------------
 	//  read data set, query set, and ground truth file
 	// -------------------------------------------------------------------------
-	data   = new float*[n];
-	norm_d = new float*[n];
-	for (int i = 0; i < n; ++i) {
-		data[i]   = new float[d];
-		norm_d[i] = new float[NORM_K];
+	if (load_data(n, d, data_set, &data_mat, &norm_d_mat, &data_file) == 1) {
+		return 1;
 	}
-	if (read_data(n, d, data_set, data, norm_d) == 1) return 1;
+	data   = data_mat->rows();
+	norm_d = norm_d_mat->rows();
+
+	if (g_pca == 1 && ((alg >= 1 && alg <= 10) || alg == 13 || alg == 14)) {
+		// ---------------------------------------------------------------------
+		//  rotate data onto the axes of PCA (those of the index set, if any)
+		// ---------------------------------------------------------------------
+		char pca_set[220] = "";
+		if (index_set[0] != '\0') sprintf(pca_set, "%s.pca", index_set);
+		if (pca_set[0] != '\0' && (access(index_set, F_OK) == 0) != 
+			(access(pca_set, F_OK) == 0)) {
+			if (access(pca_set, F_OK) == 0) {
+				printf("%s exists without its index set %s\n", pca_set, 
+					index_set);
+			}
+			else {
+				printf("Index set %s exists without its rotation %s (built "
+					"without -pc 1?)\n", index_set, pca_set);
+			}
+			return 1;
+		}
 
-	if (alg >= 0 && alg <= 10) {
-        query  = new float*[qn];
-		norm_q = new float*[qn];
-        for (int i = 0; i < qn; ++i) {
-			query[i]  = new float[d];
-			norm_q[i] = new float[NORM_K];
-		}
-        if (read_data(qn, d, query_set, query, norm_q) == 1) return 1;
-    }
+		pca = new PCA(d);
+		if (pca_set[0] != '\0' && access(pca_set, F_OK) == 0) {
+			if (pca->load(n, pca_set) == 1) return 1;
+			printf("Loaded PCA from %s\n\n", pca_set);
+		}
+		else {
+			pca->build(n, (const float **) data);
+			if (pca_set[0] != '\0' && pca->save(pca_set) == 0) {
+				printf("Saved PCA to %s\n\n", pca_set);
+			}
+		}
+		pca->display();
+		rotate_data(pca, n, d, &data_mat, &norm_d_mat, &data_file);
+		g_rotation = pca->digest();	// recorded in (and checked by) indexes
+		data   = data_mat->rows();
+		norm_d = norm_d_mat->rows();
+		g_recall_tol = PCA_TOL;		// rotated ips are not exact
+	}
+
+	if ((alg >= 0 && alg <= 10) || alg == 13) {
+		if (load_data(qn, d, query_set, &query_mat, &norm_q_mat, 
+			&query_file) == 1) return 1;
+		if (pca != NULL) {
+			rotate_data(pca, qn, d, &query_mat, &norm_q_mat, &query_file);
+		}
+		query  = query_mat->rows();
+		norm_q = norm_q_mat->rows();
+	}
 
-	if (alg >= 1 && alg <= 10) {
+	if ((alg >= 1 && alg <= 10) || alg == 13) {
 		R = new Result*[qn];
 		for (int i = 0; i < qn; ++i) {
 			R[i] = new Result[MAXK];
@@ -254,9 +567,30 @@ int main(int nargs, char **args)
 		}
 	}
 
+#ifdef H2_STATS
+	// -------------------------------------------------------------------------
+	//  per-query counters of -alg 1 - 7 and 13 (one section per run)
+	// -------------------------------------------------------------------------
+	if ((alg >= 1 && alg <= 7) || alg == 13) {
+		char stats_set[220];
+		sprintf(stats_set, "%squery_stats.txt", out_path);
+		g_stats_fp = fopen(stats_set, "a+");
+		if (!g_stats_fp) {
+			printf("Could not create %s\n", stats_set);
+			return 1;
+		}
+		fprintf(g_stats_fp, "# alg = %d\n# top_k\tqid\tlatency", alg);
+		for (int c = 0; c < STATS_NUM; ++c) {
+			fprintf(g_stats_fp, "\t%s", STATS_NAME[c]);
+		}
+		fprintf(g_stats_fp, "\n");
+	}
+#endif
+
 	// -------------------------------------------------------------------------
 	//  methods
 	// -------------------------------------------------------------------------
+	const char *index_ptr = index_set[0] != '\0' ? index_set : NULL;
 	switch (alg) {
 	case 0:
 		ground_truth(n, qn, d, (const float **) data, (const float **) norm_d,
@@ -265,7 +599,8 @@ int main(int nargs, char **args)
 	case 1:
 		h2_alsh(n, qn, d, nn_ratio, mip_ratio, (const float **) data, 
 			(const float **) norm_d, (const float **) query, 
-			(const float **) norm_q, (const Result **) R, out_path);
+			(const float **) norm_q, (const Result **) R, 
+			index_ptr, out_path);
 		break;
 	case 2:
 		l2_alsh(n, qn, d, m, U, nn_ratio, (const float **) data, 
@@ -285,12 +620,14 @@ int main(int nargs, char **args)
 	case 5:
 		sign_alsh(n, qn, d, K, m, U, (const float **) data, 
 			(const float **) norm_d, (const float **) query, 
-			(const float **) norm_q, (const Result **) R, out_path);
+			(const float **) norm_q, (const Result **) R, 
+			index_ptr, out_path);
 		break;
 	case 6:
 		simple_lsh(n, qn, d, K, (const float **) data, 
 			(const float **) norm_d, (const float **) query, 
-			(const float **) norm_q, (const Result **) R, out_path);
+			(const float **) norm_q, (const Result **) R, 
+			index_ptr, out_path);
 		break;
 	case 7:
 		linear_scan(n, qn, d, (const float **) data, (const float **) norm_d,
@@ -319,6 +656,19 @@ int main(int nargs, char **args)
 		norm_distribution(n, d, (const float **) data, (const float **) norm_d, 
 			out_path);
 		break;
+	case 12:
+		write_bin_data(n, d, bin_set, (const float **) data, 
+			(const float **) norm_d);
+		break;
+	case 13:
+		sweep(n, qn, d, K, m, U, nn_ratio, mip_ratio, (const float **) data, 
+			(const float **) norm_d, (const float **) query, 
+			(const float **) norm_q, (const Result **) R, sweep_set, out_path);
+		break;
+	case 14:
+		h2_server(n, d, nn_ratio, mip_ratio, (const float **) data, 
+			(const float **) norm_d, index_ptr, pca);
+		break;
 	default:
 		printf("Parameters error!\n");
 		usage();
@@ -328,23 +678,19 @@ int main(int nargs, char **args)
 	// -------------------------------------------------------------------------
 	//  release space
 	// -------------------------------------------------------------------------
-	for (int i = 0; i < n; ++i) {
-		delete[] data[i];   data[i]   = NULL;
-		delete[] norm_d[i]; norm_d[i] = NULL;
+	if (g_stats_fp != NULL) {
+		fclose(g_stats_fp); g_stats_fp = NULL;
 	}
-	delete[] data;   data   = NULL;
-	delete[] norm_d; norm_d = NULL;
+	free_data(data_mat, norm_d_mat, &data_file);
+	data_mat = NULL; norm_d_mat = NULL; data = NULL; norm_d = NULL;
+	delete pca; pca = NULL;
 
-    if (alg >= 0 && alg <= 10) {
-        for (int i = 0; i < qn; ++i) {
-            delete[] query[i];  query[i]  = NULL;
-            delete[] norm_q[i]; norm_q[i] = NULL;
-        }
-        delete[] query;  query  = NULL;
-        delete[] norm_q; norm_q = NULL;
-    }
+	if ((alg >= 0 && alg <= 10) || alg == 13) {
+		free_data(query_mat, norm_q_mat, &query_file);
+		query_mat = NULL; norm_q_mat = NULL; query = NULL; norm_q = NULL;
+	}
 
-	if (alg >= 1 && alg <= 10) {
+	if ((alg >= 1 && alg <= 10) || alg == 13) {
 		for (int i = 0; i < qn; ++i) {
 			delete[] R[i]; R[i] = NULL;
 		}
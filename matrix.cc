@@ -0,0 +1,69 @@
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#include "def.h"
+#include "matrix.h"
+
+// -----------------------------------------------------------------------------
+Matrix::Matrix(						// constructor (allocate zeroed arena)
+	int  n,								// number of rows
+	int  d,								// number of columns
+	bool padded)						// pad stride to 64-byte boundary
+{
+	n_      = n;
+	d_      = d;
+	stride_ = padded ? padded_stride(d) : d;
+	owned_  = true;
+
+	size_t size = (size_t) n_ * stride_ * SIZEFLOAT;
+	void *addr = NULL;
+	if (posix_memalign(&addr, ALIGN_BYTES, size > 0 ? size : ALIGN_BYTES)) {
+		printf("Could not allocate %d x %d matrix\n", n_, d_);
+		exit(1);
+	}
+	data_ = (float*) addr;
+	memset(data_, 0, size);
+
+	init_rows();
+}
+
+// -----------------------------------------------------------------------------
+Matrix::Matrix(						// constructor (view of external memory)
+	int   n,							// number of rows
+	int   d,							// number of columns
+	int   stride,						// distance between rows (in floats)
+	const float *data)					// start address of the first row
+{
+	n_      = n;
+	d_      = d;
+	stride_ = stride;
+	owned_  = false;
+	data_   = (float*) data;
+
+	init_rows();
+}
+
+// -----------------------------------------------------------------------------
+Matrix::~Matrix()					// destructor
+{
+	if (owned_) free(data_);
+	data_ = NULL;
+	delete[] rows_; rows_ = NULL;
+}
+
+// -----------------------------------------------------------------------------
+void Matrix::init_rows()			// init row pointers
+{
+	rows_ = new float*[n_];
+	for (int i = 0; i < n_; ++i) {
+		rows_[i] = row(i);
+	}
+}
+
+// -----------------------------------------------------------------------------
+int Matrix::padded_stride(			// stride of a padded row
+	int d)								// number of columns
+{
+	return (d + ALIGN_FLOATS - 1) / ALIGN_FLOATS * ALIGN_FLOATS;
+}
@@ -0,0 +1,64 @@
+#ifndef __MATRIX_H
+#define __MATRIX_H
+
+// -----------------------------------------------------------------------------
+//  Matrix: a dense row-major matrix of floats stored in one arena. By default,
+//  every row starts on a 64-byte boundary, i.e., the row stride is padded to
+//  a multiple of ALIGN_FLOATS. It also keeps an array of row pointers, so it
+//  can be handed to all indexes which accept "const float **data".
+//
+//  A matrix can also be a view of external memory (e.g., an mmap-ed binary
+//  data set); in this case, the memory is not released by the destructor.
+// -----------------------------------------------------------------------------
+const int ALIGN_BYTES  = 64;
+const int ALIGN_FLOATS = ALIGN_BYTES / (int) sizeof(float);
+
+class Matrix {
+public:
+	Matrix(							// constructor (allocate zeroed arena)
+		int  n,							// number of rows
+		int  d,							// number of columns
+		bool padded = true);			// pad stride to 64-byte boundary
+
+	// -------------------------------------------------------------------------
+	Matrix(							// constructor (view of external memory)
+		int   n,						// number of rows
+		int   d,						// number of columns
+		int   stride,					// distance between rows (in floats)
+		const float *data);				// start address of the first row
+
+	// -------------------------------------------------------------------------
+	~Matrix();						// destructor
+
+	// -------------------------------------------------------------------------
+	inline int n() { return n_; }
+
+	// -------------------------------------------------------------------------
+	inline int d() { return d_; }
+
+	// -------------------------------------------------------------------------
+	inline int stride() { return stride_; }
+
+	// -------------------------------------------------------------------------
+	inline float* row(int i) { return data_ + (size_t) i * stride_; }
+
+	// -------------------------------------------------------------------------
+	inline float** rows() { return rows_; }
+
+	// -------------------------------------------------------------------------
+	static int padded_stride(		// stride of a padded row
+		int d);							// number of columns
+
+protected:
+	int   n_;						// number of rows
+	int   d_;						// number of columns
+	int   stride_;					// distance between rows (in floats)
+	bool  owned_;					// whether data_ is owned by the matrix
+	float *data_;					// arena of all rows
+	float **rows_;					// row pointers into data_
+
+	// -------------------------------------------------------------------------
+	void init_rows();				// init row pointers
+};
+
+#endif // __MATRIX_H
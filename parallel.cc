@@ -0,0 +1,230 @@
+#include <atomic>
+#include <cstdio>
+#include <cstdlib>
+#include <functional>
+#include <thread>
+#include <vector>
+#include <unistd.h>
+#ifdef __linux__
+#include <sched.h>
+#endif
+
+#include "parallel.h"
+
+int g_num_threads   = 1;
+int g_query_threads = 1;
+
+// -----------------------------------------------------------------------------
+void parallel_for(					// parallel loop with dynamic scheduling
+	int   n,							// number of items
+	int   num_threads,					// number of threads
+	const std::function<void(int, int)> &func) // func(tid, item)
+{
+	if (num_threads > n) num_threads = n;
+	if (num_threads <= 1) {
+		for (int i = 0; i < n; ++i) func(0, i);
+		return;
+	}
+
+	std::atomic<int> next(0);
+	std::vector<std::thread> workers;
+	for (int tid = 0; tid < num_threads; ++tid) {
+		workers.push_back(std::thread([&, tid]() {
+			int i;
+			while ((i = next.fetch_add(1)) < n) func(tid, i);
+		}));
+	}
+	for (int tid = 0; tid < num_threads; ++tid) {
+		workers[tid].join();
+	}
+}
+
+// -----------------------------------------------------------------------------
+int numa_nodes()					// number of NUMA nodes
+{
+	int num = 0;
+	char path[100];
+	while (true) {
+		sprintf(path, "/sys/devices/system/node/node%d", num);
+		if (access(path, F_OK) != 0) break;
+		++num;
+	}
+	return num > 0 ? num : 1;
+}
+
+// -----------------------------------------------------------------------------
+int pin_to_node(					// bind calling thread to a NUMA node
+	int   node)							// node id
+{
+#ifdef __linux__
+	char path[100];
+	sprintf(path, "/sys/devices/system/node/node%d/cpulist", node);
+	FILE *fp = fopen(path, "r");
+	if (!fp) return 1;
+
+	// -------------------------------------------------------------------------
+	//  cpulist is a list of ranges, e.g., "0-7,16-23"
+	// -------------------------------------------------------------------------
+	cpu_set_t set;
+	CPU_ZERO(&set);
+	int num = 0, lo = 0, hi = 0;
+	char sep = 0;
+	while (fscanf(fp, "%d", &lo) == 1) {
+		hi = lo;
+		if (fscanf(fp, "%c", &sep) == 1 && sep == '-') {
+			if (fscanf(fp, "%d", &hi) != 1) break;
+			if (fscanf(fp, "%c", &sep) != 1) sep = 0;
+		}
+		for (int cpu = lo; cpu <= hi && cpu < CPU_SETSIZE; ++cpu) {
+			CPU_SET(cpu, &set); ++num;
+		}
+		if (sep != ',') break;
+	}
+	fclose(fp);
+
+	if (num == 0 || sched_setaffinity(0, sizeof(set), &set) != 0) return 1;
+	return 0;
+#else
+	return 1;
+#endif
+}
+
+// -----------------------------------------------------------------------------
+Thread_Pool::Thread_Pool(			// constructor
+	int   num_threads,					// number of threads (with caller)
+	bool  pin)							// bind workers to NUMA nodes
+	: next_(0)
+{
+	num_threads_ = num_threads > 1 ? num_threads : 1;
+	pin_         = pin;
+	num_nodes_   = pin ? numa_nodes() : 1;
+	func_        = NULL;
+	n_           = 0;
+	each_        = false;
+	generation_  = 0;
+	busy_        = 0;
+	stop_        = false;
+
+	for (int tid = pin ? 0 : 1; tid < num_threads_; ++tid) {
+		workers_.push_back(std::thread(&Thread_Pool::work, this, tid));
+	}
+}
+
+// -----------------------------------------------------------------------------
+Thread_Pool::~Thread_Pool()			// destructor
+{
+	{
+		std::lock_guard<std::mutex> lock(mutex_);
+		stop_ = true;
+	}
+	start_.notify_all();
+	for (size_t i = 0; i < workers_.size(); ++i) {
+		workers_[i].join();
+	}
+}
+
+// -----------------------------------------------------------------------------
+void Thread_Pool::work(				// main loop of a worker thread
+	int   tid)							// thread id
+{
+	if (pin_) pin_to_node(node(tid));
+
+	int seen = 0;					// last loop run by this worker
+	while (true) {
+		const std::function<void(int, int)> *func = NULL;
+		int  n = 0;
+		bool each = false;
+		{
+			std::unique_lock<std::mutex> lock(mutex_);
+			start_.wait(lock, [&]() { return stop_ || generation_ != seen; });
+			if (stop_) return;
+			seen = generation_;
+			func = func_;
+			n    = n_;
+			each = each_;
+		}
+		items(tid, n, each, *func);
+
+		std::lock_guard<std::mutex> lock(mutex_);
+		if (--busy_ == 0) done_.notify_one();
+	}
+}
+
+// -----------------------------------------------------------------------------
+void Thread_Pool::run(				// parallel loop with dynamic scheduling
+	int   n,							// number of items
+	const std::function<void(int, int)> &func) // func(tid, item)
+{
+	loop(n, false, func);
+}
+
+// -----------------------------------------------------------------------------
+void Thread_Pool::run_each(			// parallel loop with static scheduling
+	int   n,							// number of items
+	const std::function<void(int, int)> &func) // func(tid, item)
+{
+	loop(n, true, func);
+}
+
+// -----------------------------------------------------------------------------
+void Thread_Pool::loop(				// run func over n items on all threads
+	int   n,							// number of items
+	bool  each,							// static scheduling
+	const std::function<void(int, int)> &func) // func(tid, item)
+{
+	if (!pin_ && (num_threads_ <= 1 || n <= 1)) {
+		for (int i = 0; i < n; ++i) func(0, i);
+		return;
+	}
+
+	{
+		std::lock_guard<std::mutex> lock(mutex_);
+		func_ = &func;
+		n_    = n;
+		each_ = each;
+		busy_ = (int) workers_.size();
+		next_.store(0);
+		++generation_;
+	}
+	start_.notify_all();
+	if (!pin_) items(0, n, each, func);
+
+	// -------------------------------------------------------------------------
+	//  wait until every worker has left the loop, so that func can go away
+	// -------------------------------------------------------------------------
+	std::unique_lock<std::mutex> lock(mutex_);
+	done_.wait(lock, [&]() { return busy_ == 0; });
+}
+
+// -----------------------------------------------------------------------------
+void RW_Lock::lock_shared()			// acquire for reading
+{
+	std::unique_lock<std::mutex> lock(mutex_);
+	cv_.wait(lock, [&]() { return !writing_ && writers_ == 0; });
+	++readers_;
+}
+
+// -----------------------------------------------------------------------------
+void RW_Lock::unlock_shared()		// release after reading
+{
+	std::lock_guard<std::mutex> lock(mutex_);
+	if (--readers_ == 0) cv_.notify_all();
+}
+
+// -----------------------------------------------------------------------------
+void RW_Lock::lock()				// acquire for writing
+{
+	std::unique_lock<std::mutex> lock(mutex_);
+	++writers_;
+	cv_.wait(lock, [&]() { return !writing_ && readers_ == 0; });
+	--writers_;
+	writing_ = true;
+}
+
+// -----------------------------------------------------------------------------
+void RW_Lock::unlock()				// release after writing
+{
+	std::lock_guard<std::mutex> lock(mutex_);
+	writing_ = false;
+	cv_.notify_all();
+}
@@ -0,0 +1,148 @@
+#ifndef __PARALLEL_H
+#define __PARALLEL_H
+
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+extern int g_num_threads;			// global parameter: number of threads
+extern int g_query_threads;			// global parameter: threads per query
+
+// -----------------------------------------------------------------------------
+//  parallel_for: run func(tid, i) for i = 0, ..., n-1 on num_threads threads.
+//  Items are handed out one by one from a shared atomic counter, so slow
+//  items (e.g., hard queries) do not stall the other workers. tid in [0,
+//  num_threads) identifies the worker, so that callers can keep per-thread
+//  scratch space. It runs inline on the calling thread if num_threads <= 1.
+// -----------------------------------------------------------------------------
+void parallel_for(					// parallel loop with dynamic scheduling
+	int   n,							// number of items
+	int   num_threads,					// number of threads
+	const std::function<void(int, int)> &func); // func(tid, item)
+
+// -----------------------------------------------------------------------------
+//  numa_nodes / pin_to_node: the NUMA nodes of this machine as listed in 
+//  /sys/devices/system/node (1 if unknown), and binding the calling thread to 
+//  the CPUs of one node. Threads started by a bound thread inherit its CPUs, 
+//  and memory is placed on the node of the thread that first touches it.
+// -----------------------------------------------------------------------------
+int numa_nodes();					// number of NUMA nodes
+
+// -----------------------------------------------------------------------------
+int pin_to_node(					// bind calling thread to a NUMA node
+	int   node);						// node id
+
+// -----------------------------------------------------------------------------
+//  Thread_Pool: num_threads - 1 persistent worker threads plus the caller, for 
+//  short parallel loops on the critical path of one query (e.g., the blocks 
+//  of H2_ALSH), where parallel_for would pay for creating threads each time. 
+//  run() has the same semantics as parallel_for; the caller works as tid 0 
+//  and returns when all items are done. One thread calls run() at a time.
+//
+//  With pin, there are num_threads workers, and worker tid is bound to NUMA 
+//  node tid % numa_nodes(); the caller only waits, so that its own CPUs stay 
+//  as they are. run_each() hands item i to tid i % num_threads, e.g., to 
+//  search every shard of H2_Shards on the node which holds its memory.
+// -----------------------------------------------------------------------------
+class Thread_Pool {
+public:
+	Thread_Pool(					// constructor
+		int   num_threads,				// number of threads (with caller)
+		bool  pin = false);				// bind workers to NUMA nodes
+
+	// -------------------------------------------------------------------------
+	~Thread_Pool();					// destructor
+
+	// -------------------------------------------------------------------------
+	void run(						// parallel loop with dynamic scheduling
+		int   n,						// number of items
+		const std::function<void(int, int)> &func); // func(tid, item)
+
+	// -------------------------------------------------------------------------
+	void run_each(					// parallel loop with static scheduling
+		int   n,						// number of items
+		const std::function<void(int, int)> &func); // func(tid, item)
+
+	// -------------------------------------------------------------------------
+	inline int num_threads() { return num_threads_; }
+
+	// -------------------------------------------------------------------------
+	inline int node(int tid) { return pin_ ? tid % num_nodes_ : -1; }
+
+protected:
+	int   num_threads_;				// number of threads (with caller)
+	bool  pin_;						// workers are bound to NUMA nodes
+	int   num_nodes_;				// number of NUMA nodes
+	std::vector<std::thread> workers_; // worker threads (tid 1, 2, ...)
+
+	std::mutex mutex_;				// protects the fields below
+	std::condition_variable start_; // signals a new loop (or stop)
+	std::condition_variable done_;	// signals that all workers are idle
+	const std::function<void(int, int)> *func_; // loop body
+	int   n_;						// number of items of current loop
+	bool  each_;					// item i runs on tid i % num_threads_
+	int   generation_;				// id of current loop
+	int   busy_;					// workers still in current loop
+	bool  stop_;					// true if workers shall exit
+	std::atomic<int> next_;			// next item of current loop
+
+	// -------------------------------------------------------------------------
+	void work(						// main loop of a worker thread
+		int   tid);						// thread id
+
+	// -------------------------------------------------------------------------
+	void loop(						// run func over n items on all threads
+		int   n,						// number of items
+		bool  each,						// static scheduling
+		const std::function<void(int, int)> &func); // func(tid, item)
+
+	// -------------------------------------------------------------------------
+	inline void items(				// run the items of tid in current loop
+		int   tid,						// thread id
+		int   n,						// number of items
+		bool  each,						// static scheduling
+		const std::function<void(int, int)> &func) // func(tid, item)
+	{
+		int i;
+		if (each) {
+			for (i = tid; i < n; i += num_threads_) func(tid, i);
+		}
+		else {
+			while ((i = next_.fetch_add(1)) < n) func(tid, i);
+		}
+	}
+};
+
+// -----------------------------------------------------------------------------
+//  RW_Lock: a readers-writer lock (C++11 has no std::shared_mutex), e.g., for 
+//  queries (readers) that run concurrently with updates of an index (writer). 
+//  Waiting writers block new readers, so that updates are not starved.
+// -----------------------------------------------------------------------------
+class RW_Lock {
+public:
+	RW_Lock() { readers_ = 0; writers_ = 0; writing_ = false; }
+
+	// -------------------------------------------------------------------------
+	void lock_shared();				// acquire for reading
+
+	// -------------------------------------------------------------------------
+	void unlock_shared();			// release after reading
+
+	// -------------------------------------------------------------------------
+	void lock();					// acquire for writing
+
+	// -------------------------------------------------------------------------
+	void unlock();					// release after writing
+
+protected:
+	std::mutex mutex_;				// protects the fields below
+	std::condition_variable cv_;	// signals a release
+	int   readers_;					// number of active readers
+	int   writers_;					// number of waiting writers
+	bool  writing_;					// true if a writer is active
+};
+
+#endif // __PARALLEL_H
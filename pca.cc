@@ -0,0 +1,408 @@
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+#include <sys/time.h>
+
+#include "def.h"
+#include "util.h"
+#include "matrix.h"
+#include "parallel.h"
+#include "pca.h"
+
+int g_pca = 0;
+
+// -----------------------------------------------------------------------------
+//  tridiagonalize: Householder reduction of the symmetric matrix V (n x n, 
+//  row-major) to tridiagonal form, with diagonal d and subdiagonal e, and V 
+//  replaced by the orthogonal transformation (as tred2 of EISPACK)
+// -----------------------------------------------------------------------------
+static void tridiagonalize(			// Householder tridiagonalization
+	int   n,							// order of matrix
+	double *V,							// matrix (transformation) (return)
+	double *d,							// diagonal (return)
+	double *e)							// subdiagonal (return)
+{
+	for (int j = 0; j < n; ++j) d[j] = V[(size_t) (n-1)*n + j];
+
+	for (int i = n - 1; i > 0; --i) {
+		double *Vi = V + (size_t) i * n;
+		double scale = 0.0, h = 0.0;
+		for (int k = 0; k < i; ++k) scale += fabs(d[k]);
+
+		if (scale == 0.0) {
+			e[i] = d[i-1];
+			for (int j = 0; j < i; ++j) {
+				d[j] = V[(size_t) (i-1)*n + j];
+				Vi[j] = 0.0; V[(size_t) j*n + i] = 0.0;
+			}
+		}
+		else {
+			// -----------------------------------------------------------------
+			//  generate the Householder vector
+			// -----------------------------------------------------------------
+			for (int k = 0; k < i; ++k) { d[k] /= scale; h += d[k] * d[k]; }
+			double f = d[i-1];
+			double g = f > 0 ? -sqrt(h) : sqrt(h);
+			e[i] = scale * g;
+			h -= f * g;
+			d[i-1] = f - g;
+			for (int j = 0; j < i; ++j) e[j] = 0.0;
+
+			// -----------------------------------------------------------------
+			//  apply the similarity transformation to the remaining columns
+			// -----------------------------------------------------------------
+			for (int j = 0; j < i; ++j) {
+				f = d[j];
+				V[(size_t) j*n + i] = f;
+				g = e[j] + V[(size_t) j*n + j] * f;
+				for (int k = j + 1; k <= i - 1; ++k) {
+					g    += V[(size_t) k*n + j] * d[k];
+					e[k] += V[(size_t) k*n + j] * f;
+				}
+				e[j] = g;
+			}
+			f = 0.0;
+			for (int j = 0; j < i; ++j) { e[j] /= h; f += e[j] * d[j]; }
+			double hh = f / (h + h);
+			for (int j = 0; j < i; ++j) e[j] -= hh * d[j];
+			for (int j = 0; j < i; ++j) {
+				f = d[j]; g = e[j];
+				for (int k = j; k <= i - 1; ++k) {
+					V[(size_t) k*n + j] -= (f * e[k] + g * d[k]);
+				}
+				d[j] = V[(size_t) (i-1)*n + j];
+				Vi[j] = 0.0;
+			}
+		}
+		d[i] = h;
+	}
+
+	// -------------------------------------------------------------------------
+	//  accumulate the transformations
+	// -------------------------------------------------------------------------
+	for (int i = 0; i < n - 1; ++i) {
+		V[(size_t) (n-1)*n + i] = V[(size_t) i*n + i];
+		V[(size_t) i*n + i] = 1.0;
+		double h = d[i+1];
+		if (h != 0.0) {
+			for (int k = 0; k <= i; ++k) d[k] = V[(size_t) k*n + i+1] / h;
+			for (int j = 0; j <= i; ++j) {
+				double g = 0.0;
+				for (int k = 0; k <= i; ++k) {
+					g += V[(size_t) k*n + i+1] * V[(size_t) k*n + j];
+				}
+				for (int k = 0; k <= i; ++k) V[(size_t) k*n + j] -= g * d[k];
+			}
+		}
+		for (int k = 0; k <= i; ++k) V[(size_t) k*n + i+1] = 0.0;
+	}
+	for (int j = 0; j < n; ++j) {
+		d[j] = V[(size_t) (n-1)*n + j];
+		V[(size_t) (n-1)*n + j] = 0.0;
+	}
+	V[(size_t) (n-1)*n + n-1] = 1.0;
+	e[0] = 0.0;
+}
+
+// -----------------------------------------------------------------------------
+//  diagonalize: eigenvalues d and eigenvectors of a symmetric tridiagonal 
+//  matrix by the implicit QL method (as tql2 of EISPACK). W holds the rows of 
+//  the Householder transformation, i.e., its transpose, so that the Givens 
+//  rotations update two contiguous rows, and row i of W ends up as the 
+//  eigenvector of d[i].
+// -----------------------------------------------------------------------------
+static void diagonalize(			// implicit QL method
+	int   n,							// order of matrix
+	double *W,							// transposed transformation (return)
+	double *d,							// diagonal (eigenvalues) (return)
+	double *e)							// subdiagonal (destroyed)
+{
+	for (int i = 1; i < n; ++i) e[i-1] = e[i];
+	e[n-1] = 0.0;
+
+	double f = 0.0, tst1 = 0.0;
+	const double eps = pow(2.0, -52.0);
+	for (int l = 0; l < n; ++l) {
+		// ---------------------------------------------------------------------
+		//  find a small subdiagonal element
+		// ---------------------------------------------------------------------
+		tst1 = std::max(tst1, fabs(d[l]) + fabs(e[l]));
+		int m = l;
+		while (m < n - 1 && fabs(e[m]) > eps * tst1) ++m;
+
+		// ---------------------------------------------------------------------
+		//  if m == l, d[l] is an eigenvalue; otherwise, iterate
+		// ---------------------------------------------------------------------
+		if (m > l) {
+			do {
+				double g = d[l];
+				double p = (d[l+1] - g) / (2.0 * e[l]);
+				double r = p < 0 ? -hypot(p, 1.0) : hypot(p, 1.0);
+				d[l]   = e[l] / (p + r);
+				d[l+1] = e[l] * (p + r);
+				double dl1 = d[l+1];
+				double h = g - d[l];
+				for (int i = l + 2; i < n; ++i) d[i] -= h;
+				f += h;
+
+				p = d[m];
+				double c = 1.0, c2 = c, c3 = c, s = 0.0, s2 = 0.0;
+				double el1 = e[l+1];
+				for (int i = m - 1; i >= l; --i) {
+					c3 = c2; c2 = c; s2 = s;
+					g = c * e[i];
+					h = c * p;
+					r = hypot(p, e[i]);
+					e[i+1] = s * r;
+					s = e[i] / r;
+					c = p / r;
+					p = c * d[i] - s * g;
+					d[i+1] = h + s * (c * g + s * d[i]);
+
+					double *w0 = W + (size_t) i * n, *w1 = w0 + n;
+					for (int k = 0; k < n; ++k) {
+						h = w1[k];
+						w1[k] = s * w0[k] + c * h;
+						w0[k] = c * w0[k] - s * h;
+					}
+				}
+				p = -s * s2 * c3 * el1 * e[l] / dl1;
+				e[l] = s * p;
+				d[l] = c * p;
+			} while (fabs(e[l]) > eps * tst1);
+		}
+		d[l] += f;
+		e[l] = 0.0;
+	}
+}
+
+// -----------------------------------------------------------------------------
+PCA::PCA(							// constructor
+	int   d)							// dimensionality
+{
+	n_      = 0;
+	d_      = d;
+	axes_   = new Matrix(d, d);
+	eigen_  = new float[d];
+	moment_ = new float[d];
+}
+
+// -----------------------------------------------------------------------------
+PCA::~PCA()							// destructor
+{
+	delete axes_;     axes_   = NULL;
+	delete[] eigen_;  eigen_  = NULL;
+	delete[] moment_; moment_ = NULL;
+}
+
+// -----------------------------------------------------------------------------
+void PCA::build(					// principal axes of data
+	int   n,							// number of data objects
+	const float **data)					// data objects
+{
+	gettimeofday(&g_start_time, NULL);
+	n_ = n;
+
+	// -------------------------------------------------------------------------
+	//  second moments of an even sample, as inner products of its columns
+	// -------------------------------------------------------------------------
+	int s = MIN(n, PCA_SAMPLE);
+	Matrix *cols = new Matrix(d_, s);
+	for (int i = 0; i < s; ++i) {
+		const float *obj = data[(size_t) i * n / s];
+		for (int j = 0; j < d_; ++j) cols->row(j)[i] = obj[j];
+	}
+
+	std::vector<float> ip((size_t) d_ * d_);
+	const float **col = (const float **) cols->rows();
+	int num_tiles = (d_ + QUERY_TILE - 1) / QUERY_TILE;
+	parallel_for(num_tiles, g_num_threads, [&](int tid, int tile) {
+		int first = tile * QUERY_TILE;
+		int cnt   = MIN(QUERY_TILE, d_ - first);
+		calc_ip_block(s, cnt, col + first, d_, col, &ip[(size_t) first * d_]);
+	});
+	delete cols; cols = NULL;
+
+	// -------------------------------------------------------------------------
+	//  eigenvectors of the (symmetrized) second-moment matrix
+	// -------------------------------------------------------------------------
+	std::vector<double> V((size_t) d_ * d_), W((size_t) d_ * d_);
+	std::vector<double> ev(d_), e(d_);
+	for (int i = 0; i < d_; ++i) {
+		for (int j = 0; j < d_; ++j) {
+			V[(size_t) i*d_ + j] = ((double) ip[(size_t) i*d_ + j] + 
+				ip[(size_t) j*d_ + i]) / (2.0 * s);
+		}
+		moment_[i] = (float) V[(size_t) i*d_ + i];
+	}
+	tridiagonalize(d_, V.data(), ev.data(), e.data());
+	for (int i = 0; i < d_; ++i) {
+		for (int j = 0; j < d_; ++j) W[(size_t) j*d_ + i] = V[(size_t) i*d_ + j];
+	}
+	diagonalize(d_, W.data(), ev.data(), e.data());
+
+	// -------------------------------------------------------------------------
+	//  the axes in descending order of their eigenvalues
+	// -------------------------------------------------------------------------
+	std::vector<int> order(d_);
+	for (int i = 0; i < d_; ++i) order[i] = i;
+	std::stable_sort(order.begin(), order.end(), [&](int a, int b) {
+		return ev[a] > ev[b]; });
+
+	for (int i = 0; i < d_; ++i) {
+		const double *w = &W[(size_t) order[i] * d_];
+		float *axis = axes_->row(i);
+		for (int j = 0; j < d_; ++j) axis[j] = (float) w[j];
+		eigen_[i] = (float) MAX(ev[order[i]], 0.0);
+	}
+
+	gettimeofday(&g_end_time, NULL);
+	float running_time = g_end_time.tv_sec - g_start_time.tv_sec + 
+		(g_end_time.tv_usec - g_start_time.tv_usec) / 1000000.0f;
+	printf("Build PCA Rotation: %f Seconds\n\n", running_time);
+}
+
+// -----------------------------------------------------------------------------
+int PCA::save(						// save axes to disk
+	const char *fname)					// address of PCA file
+{
+	FILE *fp = fopen(fname, "wb");
+	if (!fp) {
+		printf("Could not create %s\n", fname);
+		return 1;
+	}
+
+	int ret = write_index_header(fp, IDX_PCA, n_, d_);
+	for (int i = 0; i < d_ && ret == 0; ++i) {
+		ret = (int) (fwrite(axes_->row(i), SIZEFLOAT, d_, fp) != (size_t) d_);
+	}
+	if (ret == 0) ret = write_aligned(fp, NULL, 0);
+	if (ret == 0) ret = write_aligned(fp, eigen_,  (size_t) d_ * SIZEFLOAT);
+	if (ret == 0) ret = write_aligned(fp, moment_, (size_t) d_ * SIZEFLOAT);
+	fclose(fp);
+
+	if (ret != 0) {
+		printf("Could not write %s\n", fname);
+		return 1;
+	}
+	return 0;
+}
+
+// -----------------------------------------------------------------------------
+uint64_t PCA::digest() const		// digest of the axes (never 0)
+{
+	// -------------------------------------------------------------------------
+	//  64-bit FNV-1a over the bytes of the axes
+	// -------------------------------------------------------------------------
+	uint64_t h = 14695981039346656037ULL;
+	for (int i = 0; i < d_; ++i) {
+		const unsigned char *p = (const unsigned char *) axes_->row(i);
+		for (size_t j = 0; j < (size_t) d_ * SIZEFLOAT; ++j) {
+			h = (h ^ p[j]) * 1099511628211ULL;
+		}
+	}
+	return h != 0 ? h : 1;
+}
+
+// -----------------------------------------------------------------------------
+int PCA::load(						// load axes from disk
+	int   n,							// number of data objects
+	const char *fname)					// address of PCA file
+{
+	Mmap_File   mf;
+	Mmap_Cursor in;
+	if (open_index(fname, IDX_PCA, n, d_, &mf, &in) == 1) return 1;
+
+	size_t size = (size_t) d_ * SIZEFLOAT;
+	const float *axes = (const float *) read_aligned(&in, d_ * size);
+	const float *eigen  = axes   != NULL ? (const float *) read_aligned(&in, 
+		size) : NULL;
+	const float *moment = eigen  != NULL ? (const float *) read_aligned(&in, 
+		size) : NULL;
+	if (moment == NULL) {
+		printf("Corrupted PCA file %s\n", fname);
+		munmap_file(&mf);
+		return 1;
+	}
+
+	n_ = n;
+	for (int i = 0; i < d_; ++i) {
+		memcpy(axes_->row(i), axes + (size_t) i * d_, size);
+	}
+	memcpy(eigen_,  eigen,  size);
+	memcpy(moment_, moment, size);
+	munmap_file(&mf);
+
+	return 0;
+}
+
+// -----------------------------------------------------------------------------
+void PCA::rotate(					// rotate objects onto the axes
+	int   n,							// number of objects
+	const float **vec,					// objects
+	float **out) const					// rotated objects (return)
+{
+	std::vector<float> ip((size_t) n * d_);
+	calc_ip_block(d_, n, vec, d_, (const float **) axes_->rows(), ip.data());
+	for (int i = 0; i < n; ++i) {
+		memcpy(out[i], &ip[(size_t) i * d_], d_ * SIZEFLOAT);
+	}
+}
+
+// -----------------------------------------------------------------------------
+void PCA::display()					// display energy at the checkpoints
+{
+	double total = 0.0, before = 0.0, after = 0.0;
+	for (int j = 0; j < d_; ++j) total += eigen_[j];
+
+	printf("Parameters of PCA:\n");
+	printf("    n = %d\n", n_);
+	printf("    d = %d\n", d_);
+	int j = 0;
+	for (int t = 0; t < NORM_K - 1 && NORM_DIMS[t] < d_; ++t) {
+		for (; j < NORM_DIMS[t]; ++j) {
+			before += moment_[j]; after += eigen_[j];
+		}
+		printf("    energy of first %d dims = %.2f%% (%.2f%% unrotated)\n",
+			NORM_DIMS[t], 100.0 * after / total, 100.0 * before / total);
+	}
+	printf("\n");
+}
+
+// -----------------------------------------------------------------------------
+void rotate_data(					// rotate data loaded by load_data
+	const PCA *pca,						// rotation
+	int   n,							// number of data objects
+	int   d,							// dimensionality
+	Matrix **data,						// data objects (replaced)
+	Matrix **norm_d,					// l2-norm of data objects (replaced)
+	Mmap_File *mf)						// mapped file (released)
+{
+	gettimeofday(&g_start_time, NULL);
+	Matrix *rot_data = new Matrix(n, d);
+	Matrix *rot_norm = new Matrix(n, NORM_K, false);
+	const float **src = (const float **) (*data)->rows();
+	float **dst = rot_data->rows();
+
+	int num_tiles = (n + BATCH_TILE - 1) / BATCH_TILE;
+	parallel_for(num_tiles, g_num_threads, [&](int tid, int tile) {
+		int first = tile * BATCH_TILE;
+		int cnt   = MIN(BATCH_TILE, n - first);
+		pca->rotate(cnt, src + first, dst + first);
+		for (int i = first; i < first + cnt; ++i) {
+			calc_norm(d, dst[i], rot_norm->row(i));
+		}
+	});
+	free_data(*data, *norm_d, mf);
+	*data   = rot_data;
+	*norm_d = rot_norm;
+
+	gettimeofday(&g_end_time, NULL);
+	float running_time = g_end_time.tv_sec - g_start_time.tv_sec + 
+		(g_end_time.tv_usec - g_start_time.tv_usec) / 1000000.0f;
+	printf("Rotate Data: %f Seconds\n\n", running_time);
+}
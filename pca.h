@@ -0,0 +1,81 @@
+#ifndef __PCA_H
+#define __PCA_H
+
+class  Matrix;
+struct Mmap_File;
+
+extern int g_pca;					// global parameter: PCA rotation (0 or 1)
+
+// -----------------------------------------------------------------------------
+//  PCA: an orthogonal rotation of the data space onto the principal axes of 
+//  the data, i.e., the eigenvectors of the (uncentered) second-moment matrix 
+//  of PCA_SAMPLE objects, in descending order of their eigenvalues. Inner 
+//  products and l2-norms do not change under a rotation, so the MIP results 
+//  stay the same, but the energy of the data (and of typical queries) moves 
+//  to the leading coordinates. Then the tails norm_d[t] (see calc_norm) are 
+//  small, and calc_inner_product with a threshold stops most verifications 
+//  at one of the first checkpoints of NORM_DIMS.
+//
+//  build() costs O(s d^2) for the second moments of s sample objects and 
+//  O(d^3) for the eigenvectors (Householder tridiagonalization, then the 
+//  implicit QL method, in double precision); rotate() costs d^2 multiply-adds 
+//  per object by calc_ip_block. Data and queries must be rotated by the same 
+//  axes, so that an index persisted on rotated data keeps them in a file of 
+//  its own (save() and load()).
+// -----------------------------------------------------------------------------
+class PCA {
+public:
+	PCA(							// constructor
+		int   d);						// dimensionality
+
+	// -------------------------------------------------------------------------
+	~PCA();							// destructor
+
+	// -------------------------------------------------------------------------
+	void build(						// principal axes of data
+		int   n,						// number of data objects
+		const float **data);			// data objects
+
+	// -------------------------------------------------------------------------
+	int save(						// save axes to disk
+		const char *fname);				// address of PCA file
+
+	// -------------------------------------------------------------------------
+	int load(						// load axes from disk
+		int   n,						// number of data objects
+		const char *fname);				// address of PCA file
+
+	// -------------------------------------------------------------------------
+	void rotate(					// rotate objects onto the axes
+		int   n,						// number of objects
+		const float **vec,				// objects
+		float **out) const;				// rotated objects (return)
+
+	// -------------------------------------------------------------------------
+	uint64_t digest() const;		// digest of the axes (never 0)
+
+	// -------------------------------------------------------------------------
+	void display();					// display energy at the checkpoints
+
+protected:
+	int   n_;						// number of data objects
+	int   d_;						// dimensionality
+	Matrix *axes_;					// principal axes (d x d, by row)
+	float *eigen_;					// eigenvalues (second moments of axes)
+	float *moment_;					// second moments of the coordinates
+};
+
+// -----------------------------------------------------------------------------
+//  rotate_data: replace the data (or queries) of load_data by owned copies 
+//  rotated by pca, with their l2-norms recomputed; the input is released by 
+//  free_data, so the result is released by free_data as usual
+// -----------------------------------------------------------------------------
+void rotate_data(					// rotate data loaded by load_data
+	const PCA *pca,						// rotation
+	int   n,							// number of data objects
+	int   d,							// dimensionality
+	Matrix **data,						// data objects (replaced)
+	Matrix **norm_d,					// l2-norm of data objects (replaced)
+	Mmap_File *mf);						// mapped file (released)
+
+#endif // __PCA_H
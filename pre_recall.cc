@@ -1,14 +1,71 @@
 #include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <functional>
+#include <vector>
 #include <sys/time.h>
 
 #include "def.h"
 #include "util.h"
 #include "pri_queue.h"
+#include "parallel.h"
+#include "qalsh.h"
+#include "srp_lsh.h"
 #include "sign_alsh.h"
 #include "simple_lsh.h"
 #include "h2_alsh.h"
 #include "pre_recall.h"
 
+int g_pr_prefix = 0;
+
+// -----------------------------------------------------------------------------
+//  pr_search: add the precision and recall of all queries at every top-t of 
+//  tMIPs to pre and recall. By default, each query is searched once per top-t.
+//  With g_pr_prefix = 1, it is searched once at the largest top-t, and every 
+//  smaller top-t takes the prefix of this ordered result (get_hits only reads 
+//  the first top-t results), which costs one search instead of MAX_T.
+// -----------------------------------------------------------------------------
+typedef std::function<void(int, int, MaxK_List*)> PR_Func; // (top_t, qid, list)
+
+static void pr_search(				// precision and recall of all queries
+	int   qn,							// number of query objects
+	const Result **R,					// MIP ground truth results
+	float **pre,						// precision (return)
+	float **recall,						// recall (return)
+	const PR_Func &kmip)				// k-MIP search of one query
+{
+	int max_t = 0;
+	for (int t = 0; t < MAX_T; ++t) max_t = MAX(max_t, tMIPs[t]);
+
+	bool prefix = g_pr_prefix == 1;
+	int  num_searches = prefix ? 1 : MAX_T;
+	for (int s = 0; s < num_searches; ++s) {
+		int size  = prefix ? max_t : tMIPs[s];
+		int first = prefix ? 0 : s;		// top-t values of this search
+		int last  = prefix ? MAX_T : s + 1;
+		MaxK_List *list = new MaxK_List(size);
+
+		for (int i = 0; i < qn; ++i) {
+			list->reset();
+			kmip(size, i, list);
+
+			for (int t = first; t < last; ++t) {
+				int top_t = tMIPs[t];
+				for (int r = 0; r < MAX_ROUND; ++r) {
+					int top_k = TOPK[r];
+					int hits  = get_hits(top_t, top_k, R[i], list);
+
+					pre[r][t]    += hits / (float) top_t;
+					recall[r][t] += hits / (float) top_k;
+				}
+			}
+		}
+		delete list; list = NULL;
+	}
+}
+
 // -----------------------------------------------------------------------------
 int h2_alsh_precision_recall(		// precision-recall curve of h2_alsh
 	int   n,							// number of data objects
@@ -37,30 +94,18 @@ int h2_alsh_precision_recall(		// precision-recall curve of h2_alsh
 		printf("Could not create %s\n", output_set);
 		return 1;
 	}
-	H2_ALSH *lsh = new H2_ALSH(n, d, nn_ratio, mip_ratio, data, norm_d);
+	H2_ALSH *lsh = new H2_ALSH(n, d, nn_ratio, mip_ratio, data, norm_d, 
+		MIN(qn, CAL_QUERIES), query, norm_q);
+	QALSH_Scratch *scratch = new QALSH_Scratch();
 
 	// -------------------------------------------------------------------------
 	//  Precision Recall Curve of H2_ALSH
 	// -------------------------------------------------------------------------
-	for (int t = 0; t < MAX_T; ++t) {
-		int top_t = tMIPs[t];
-		MaxK_List* list = new MaxK_List(top_t);
-
-		for (int i = 0; i < qn; ++i) {
-			list->reset();
-			lsh->kmip(top_t, query[i], norm_q[i], list);
-
-			for (int r = 0; r < MAX_ROUND; ++r) {
-				int top_k = TOPK[r];
-				int hits  = get_hits(top_t, top_k, R[i], list);
-
-				pre[r][t]    += hits / (float) top_t;
-				recall[r][t] += hits / (float) top_k;
-			}
-		}
-		delete list; list = NULL;
-	}
+	pr_search(qn, R, pre, recall, [&](int top_t, int i, MaxK_List *list) {
+		lsh->kmip(top_t, query[i], norm_q[i], scratch, list);
+	});
 	delete lsh; lsh = NULL;
+	delete scratch; scratch = NULL;
 
 	for (int r = 0; r < MAX_ROUND; ++r) {
 		int top_k = TOPK[r];
@@ -119,29 +164,16 @@ int sign_alsh_precision_recall(		// precision-recall curve of sign_alsh
 		return 1;
 	}
 	Sign_ALSH *lsh = new Sign_ALSH(n, d, K, m, U, data, norm_d);
+	SRP_Scratch *scratch = new SRP_Scratch();
 
 	// -------------------------------------------------------------------------
 	//  Precision Recall Curve of Sign-ALSH
 	// -------------------------------------------------------------------------	
-	for (int t = 0; t < MAX_T; ++t) {
-		int top_t = tMIPs[t];
-		MaxK_List* list = new MaxK_List(top_t);
-
-		for (int i = 0; i < qn; ++i) {
-			list->reset();
-			lsh->kmip(top_t, query[i], norm_q[i], list);
-
-			for (int r = 0; r < MAX_ROUND; ++r) {
-				int top_k = TOPK[r];
-				int hits  = get_hits(top_t, top_k, R[i], list);
-
-				pre[r][t]    += hits / (float) top_t;
-				recall[r][t] += hits / (float) top_k;
-			}
-		}
-		delete list; list = NULL;
-	}
+	pr_search(qn, R, pre, recall, [&](int top_t, int i, MaxK_List *list) {
+		lsh->kmip(top_t, query[i], norm_q[i], scratch, list);
+	});
 	delete lsh; lsh = NULL;
+	delete scratch; scratch = NULL;
 
 	for (int r = 0; r < MAX_ROUND; ++r) {
 		int top_k = TOPK[r];
@@ -198,29 +230,16 @@ int simple_lsh_precision_recall(	// precision-recall curve of simple_lsh
 		return 1;
 	}
 	Simple_LSH *lsh = new Simple_LSH(n, d, K, data, norm_d);
+	SRP_Scratch *scratch = new SRP_Scratch();
 
 	// -------------------------------------------------------------------------
 	//  Precision Recall Curve of Simple_LSH
 	// -------------------------------------------------------------------------
-	for (int t = 0; t < MAX_T; ++t) {
-		int top_t = tMIPs[t];
-		MaxK_List* list = new MaxK_List(top_t);
-
-		for (int i = 0; i < qn; ++i) {
-			list->reset();
-			lsh->kmip(top_t, query[i], norm_q[i], list);
-
-			for (int r = 0; r < MAX_ROUND; ++r) {
-				int top_k = TOPK[r];
-				int hits  = get_hits(top_t, top_k, R[i], list);
-
-				pre[r][t]    += hits / (float) top_t;
-				recall[r][t] += hits / (float) top_k;
-			}
-		}
-		delete list; list = NULL;
-	}
+	pr_search(qn, R, pre, recall, [&](int top_t, int i, MaxK_List *list) {
+		lsh->kmip(top_t, query[i], norm_q[i], scratch, list);
+	});
 	delete lsh; lsh = NULL;
+	delete scratch; scratch = NULL;
 
 	for (int r = 0; r < MAX_ROUND; ++r) {
 		int top_k = TOPK[r];
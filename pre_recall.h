@@ -1,6 +1,7 @@
 #ifndef __PRE_RECALL_H
 #define __PRE_RECALL_H
 
+extern int g_pr_prefix;				// global parameter: prefixes of max top-t
 
 // -----------------------------------------------------------------------------
 int h2_alsh_precision_recall(		// precision-recall curve of h2_alsh
@@ -1,3 +1,6 @@
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
 #include <cstring>
 #include <sys/time.h>
 
@@ -5,13 +8,63 @@
 #include "util.h"
 #include "pri_queue.h"
 
+// -----------------------------------------------------------------------------
+//  heap of the best k items with the worst one at the root, where a is worse 
+//  than b if its key is smaller, or equal and inserted later
+// -----------------------------------------------------------------------------
+static inline bool worse(			// compare two heap items
+	const Heap_Item &a,					// 1st item
+	const Heap_Item &b)					// 2nd item
+{
+	return a.key_ < b.key_ || (a.key_ == b.key_ && a.seq_ > b.seq_);
+}
+
+// -----------------------------------------------------------------------------
+static void heap_push(				// add an item to a heap
+	Heap_Item *heap,					// heap
+	int   num,							// number of items (before the push)
+	const Heap_Item &item)				// new item
+{
+	int i = num;
+	while (i > 0) {
+		int parent = (i - 1) / 2;
+		if (!worse(item, heap[parent])) break;
+		heap[i] = heap[parent];
+		i = parent;
+	}
+	heap[i] = item;
+}
+
+// -----------------------------------------------------------------------------
+static void heap_replace_top(		// replace the root of a heap
+	Heap_Item *heap,					// heap
+	int   num,							// number of items
+	const Heap_Item &item)				// new item
+{
+	int i = 0;
+	while (true) {
+		int child = 2 * i + 1;
+		if (child >= num) break;
+		if (child + 1 < num && worse(heap[child + 1], heap[child])) ++child;
+		if (!worse(heap[child], item)) break;
+		heap[i] = heap[child];
+		i = child;
+	}
+	heap[i] = item;
+}
+
 // -----------------------------------------------------------------------------
 MinK_List::MinK_List(				// constructor (given max size)
 	int max)							// max size
 {
-	num_  = 0;
-	k_    = max;
-	list_ = new Result[max + 1];
+	num_    = 0;
+	k_      = max;
+	seq_    = 0;
+	sorted_ = true;
+	list_   = NULL;
+	heap_   = NULL;
+	if (max > HEAP_K) heap_ = new Heap_Item[max];
+	else list_ = new Result[max + 1];
 }
 
 // -----------------------------------------------------------------------------
@@ -20,6 +73,16 @@ MinK_List::~MinK_List() 			// destructor
 	if (list_ != NULL) {
 		delete[] list_; list_ = NULL;
 	}
+	if (heap_ != NULL) {
+		delete[] heap_; heap_ = NULL;
+	}
+}
+
+// -----------------------------------------------------------------------------
+void MinK_List::sort_heap()			// sort heap_ (worst first)
+{
+	std::sort(heap_, heap_ + num_, worse);
+	sorted_ = true;
 }
 
 // -----------------------------------------------------------------------------
@@ -27,6 +90,16 @@ float MinK_List::insert(			// insert item (inline for speed)
 	float key,							// key of item
 	int id)								// id of item
 {
+	if (heap_ != NULL) {			// keys are negated in the heap
+		Heap_Item item = { -key, id, seq_++ };
+		if (num_ < k_) heap_push(heap_, num_++, item);
+		else if (-key > heap_[0].key_) heap_replace_top(heap_, num_, item);
+		else return -heap_[0].key_;
+
+		sorted_ = false;
+		return max_key();
+	}
+
 	int i = 0;
 	for (i = num_; i > 0; --i) {
 		if (key < list_[i-1].key_) list_[i] = list_[i - 1];
@@ -44,9 +117,14 @@ float MinK_List::insert(			// insert item (inline for speed)
 MaxK_List::MaxK_List(				// constructor (given max size)
 	int max)							// max size
 {
-	num_  = 0;
-	k_    = max;
-	list_ = new Result[max + 1];
+	num_    = 0;
+	k_      = max;
+	seq_    = 0;
+	sorted_ = true;
+	list_   = NULL;
+	heap_   = NULL;
+	if (max > HEAP_K) heap_ = new Heap_Item[max];
+	else list_ = new Result[max + 1];
 }
 
 // -----------------------------------------------------------------------------
@@ -55,6 +133,16 @@ MaxK_List::~MaxK_List() 			// destructor
 	if (list_ != NULL) {
 		delete[] list_; list_ = NULL;
 	}
+	if (heap_ != NULL) {
+		delete[] heap_; heap_ = NULL;
+	}
+}
+
+// -----------------------------------------------------------------------------
+void MaxK_List::sort_heap()			// sort heap_ (worst first)
+{
+	std::sort(heap_, heap_ + num_, worse);
+	sorted_ = true;
 }
 
 // -----------------------------------------------------------------------------
@@ -62,6 +150,16 @@ float MaxK_List::insert(			// insert item
 	float key,							// key of item
 	int id)								// id of item
 {
+	if (heap_ != NULL) {
+		Heap_Item item = { key, id, seq_++ };
+		if (num_ < k_) heap_push(heap_, num_++, item);
+		else if (key > heap_[0].key_) heap_replace_top(heap_, num_, item);
+		else return heap_[0].key_;
+
+		sorted_ = false;
+		return min_key();
+	}
+
 	int i = 0;
 	for (i = num_; i > 0; i--) {
 		if (list_[i-1].key_ < key) list_[i] = list_[i - 1];
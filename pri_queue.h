@@ -1,13 +1,31 @@
 #ifndef __PRI_QUEUE_H
 #define __PRI_QUEUE_H
 
+#include <atomic>
+
 struct Result;
 
+// -----------------------------------------------------------------------------
+//  Heap_Item: an entry of a top-k heap. seq_ is the insertion count, which 
+//  breaks ties of keys in favor of the earlier item, as the sorted lists do.
+// -----------------------------------------------------------------------------
+struct Heap_Item {
+	float key_;							// key (negated for MinK_List)
+	int   id_;							// object id
+	int   seq_;							// insertion count
+};
+
 // -----------------------------------------------------------------------------
 //  MinK_List: a structure which maintains the smallest k values (of type float)
 //  and associated object id (of type int).
 //
 //  This structure is used for ANN search
+//
+//  for k <= HEAP_K, the list is kept sorted by insertion (O(k) per insert, but 
+//  fast for small k); for larger k, it is a binary heap with the k-th value at 
+//  the root (O(log k) per insert), which is sorted on the first access by 
+//  rank. Both give the same items in the same order, and min_key() / max_key()
+//  are always exact, so callers can prune by them as before.
 // -----------------------------------------------------------------------------
 class MinK_List {
 public:
@@ -15,19 +33,35 @@ public:
 	~MinK_List();					// destructor
 
 	// -------------------------------------------------------------------------
-	inline void reset() { num_ = 0; }
+	inline void reset() { num_ = 0; seq_ = 0; sorted_ = true; }
 
 	// -------------------------------------------------------------------------
-	inline float min_key() { return (num_ > 0 ? list_[0].key_ : MAXREAL); }
+	inline float min_key() {
+		if (heap_ == NULL) return (num_ > 0 ? list_[0].key_ : MAXREAL);
+		return (num_ > 0 ? ith_key(0) : MAXREAL);
+	}
 
 	// -------------------------------------------------------------------------
-	inline float max_key() { return (num_>=k_ ? list_[k_-1].key_ : MAXREAL); }
+	inline float max_key() {
+		if (heap_ == NULL) return (num_>=k_ ? list_[k_-1].key_ : MAXREAL);
+		return (num_ >= k_ ? -heap_[0].key_ : MAXREAL);
+	}
 
 	// -------------------------------------------------------------------------
-	inline float ith_key(int i) { return (i < num_ ? list_[i].key_ : MAXREAL); }
+	inline float ith_key(int i) {
+		if (i >= num_) return MAXREAL;
+		if (heap_ == NULL) return list_[i].key_;
+		if (!sorted_) sort_heap();
+		return -heap_[num_ - 1 - i].key_;
+	}
 
 	// -------------------------------------------------------------------------
-	inline int ith_id(int i) { return (i < num_ ? list_[i].id_ : MININT); }
+	inline int ith_id(int i) {
+		if (i >= num_) return MININT;
+		if (heap_ == NULL) return list_[i].id_;
+		if (!sorted_) sort_heap();
+		return heap_[num_ - 1 - i].id_;
+	}
 
 	// -------------------------------------------------------------------------
 	inline int size() { return num_; }
@@ -43,14 +77,21 @@ public:
 protected:
 	int    k_;						// max numner of keys
 	int    num_;					// number of key current active
-	Result *list_;					// the list itself
+	Result *list_;					// the list itself (k <= HEAP_K)
+	Heap_Item *heap_;				// the heap itself (k > HEAP_K, or NULL)
+	int    seq_;					// number of inserts since reset
+	bool   sorted_;					// true if heap_ is sorted by rank
+
+	// -------------------------------------------------------------------------
+	void sort_heap();				// sort heap_ (worst first)
 };
 
 // -----------------------------------------------------------------------------
 //  MaxK_List: An MaxK_List structure is one which maintains the largest k 
 //  values (of type float) and associated object id (of type int).
 //
-//  This structure is used for MIP search
+//  This structure is used for MIP search; it switches to a heap for k > HEAP_K
+//  like MinK_List.
 // -----------------------------------------------------------------------------
 class MaxK_List {
 public:
@@ -58,19 +99,35 @@ public:
 	~MaxK_List();					// destructor
 
 	// -------------------------------------------------------------------------
-	inline void reset() { num_ = 0; }
+	inline void reset() { num_ = 0; seq_ = 0; sorted_ = true; }
 
 	// -------------------------------------------------------------------------
-	inline float max_key() { return num_ > 0 ? list_[0].key_ : MINREAL; }
+	inline float max_key() {
+		if (heap_ == NULL) return num_ > 0 ? list_[0].key_ : MINREAL;
+		return num_ > 0 ? ith_key(0) : MINREAL;
+	}
 
 	// -------------------------------------------------------------------------
-	inline float min_key() { return num_ == k_ ? list_[k_-1].key_ : MINREAL; }
+	inline float min_key() {
+		if (heap_ == NULL) return num_ == k_ ? list_[k_-1].key_ : MINREAL;
+		return num_ == k_ ? heap_[0].key_ : MINREAL;
+	}
 
 	// -------------------------------------------------------------------------
-	inline float ith_key(int i) { return i < num_ ? list_[i].key_ : MINREAL; }
+	inline float ith_key(int i) {
+		if (i >= num_) return MINREAL;
+		if (heap_ == NULL) return list_[i].key_;
+		if (!sorted_) sort_heap();
+		return heap_[num_ - 1 - i].key_;
+	}
 
 	// -------------------------------------------------------------------------
-	inline int ith_id(int i) { return i < num_ ? list_[i].id_ : MININT; }
+	inline int ith_id(int i) {
+		if (i >= num_) return MININT;
+		if (heap_ == NULL) return list_[i].id_;
+		if (!sorted_) sort_heap();
+		return heap_[num_ - 1 - i].id_;
+	}
 
 	// -------------------------------------------------------------------------
 	inline int size() { return num_; }
@@ -86,7 +143,28 @@ public:
 private:
 	int k_;							// max numner of keys
 	int num_;						// number of key current active
-	Result *list_;					// the list itself
+	Result *list_;					// the list itself (k <= HEAP_K)
+	Heap_Item *heap_;				// the heap itself (k > HEAP_K, or NULL)
+	int seq_;						// number of inserts since reset
+	bool sorted_;					// true if heap_ is sorted by rank
+
+	// -------------------------------------------------------------------------
+	void sort_heap();				// sort heap_ (worst first)
 };
 
+// -----------------------------------------------------------------------------
+//  share_kip: raise the shared k-th MIP value to kip (if larger) and return 
+//  the larger of both, which is a valid pruning bound for every thread
+// -----------------------------------------------------------------------------
+inline float share_kip(				// publish and read the shared bound
+	float kip,							// k-th MIP value of this thread
+	std::atomic<float> *bound)			// shared k-th MIP value
+{
+	float old = bound->load(std::memory_order_relaxed);
+	while (kip > old && !bound->compare_exchange_weak(old, kip, 
+		std::memory_order_relaxed)) {}
+
+	return kip > old ? kip : old;
+}
+
 #endif // __PRI_QUEUE_H
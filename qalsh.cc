@@ -1,26 +1,176 @@
 #include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
 #include <cstring>
+#include <vector>
 
 #include "def.h"
 #include "random.h"
 #include "util.h"
+#include "simd.h"
 #include "pri_queue.h"
+#include "parallel.h"
+#include "stats.h"
+#include "fht.h"
 #include "qalsh.h"
 
+int g_key_bits = 32;
+
+// -----------------------------------------------------------------------------
+float Cand_Check::verify(			// verify a candidate, return R
+	int   j)							// position in the index
+{
+	int id = index_[j];
+	if (norm_d_[id][0] * norm_q_[0] > kip_) {
+		float ip = calc_inner_product(kern_, dim_, kip_, data_[id], 
+			norm_d_[id], query_, norm_q_);
+		if (ip > kip_) {
+			kip_ = list_->insert(ip, id + 1);
+			if (bound_ != NULL) kip_ = share_kip(kip_, bound_);
+		}
+	}
+	return sqrt(MAX(2.0f * (M_ * M_ - lambda_ * kip_), 0.0f));
+}
+
+// -----------------------------------------------------------------------------
+QALSH_Scratch::QALSH_Scratch()		// constructor
+{
+	max_n_       = 0;
+	max_m_       = 0;
+	epoch_       = 0;
+	visit_       = NULL;
+	lpos_        = NULL;
+	rpos_        = NULL;
+	bucket_flag_ = NULL;
+	range_flag_  = NULL;
+	q_val_       = NULL;
+	max_q_       = 0;
+	query_       = NULL;
+	max_f_       = 0;
+	fht_         = NULL;
+	max_s_       = 0;
+	score_       = NULL;
+	list_k_      = 0;
+	list_        = NULL;
+}
+
+// -----------------------------------------------------------------------------
+QALSH_Scratch::~QALSH_Scratch()		// destructor
+{
+	delete[] visit_;       visit_       = NULL;
+	delete[] lpos_;        lpos_        = NULL;
+	delete[] rpos_;        rpos_        = NULL;
+	delete[] bucket_flag_; bucket_flag_ = NULL;
+	delete[] range_flag_;  range_flag_  = NULL;
+	delete[] q_val_;       q_val_       = NULL;
+	delete[] query_;       query_       = NULL;
+	delete[] fht_;         fht_         = NULL;
+	delete[] score_;       score_       = NULL;
+	delete   list_;        list_        = NULL;
+}
+
+// -----------------------------------------------------------------------------
+float* QALSH_Scratch::query_buf(	// buffer for a transformed query
+	int   size)							// number of floats
+{
+	if (size > max_q_) {
+		delete[] query_;
+		max_q_ = size;
+		query_ = new float[max_q_];
+	}
+	return query_;
+}
+
+// -----------------------------------------------------------------------------
+float* QALSH_Scratch::fht_buf(		// buffer for structured projections
+	int   size)							// number of floats
+{
+	if (size > max_f_) {
+		delete[] fht_;
+		max_f_ = size;
+		fht_   = new float[max_f_];
+	}
+	return fht_;
+}
+
+// -----------------------------------------------------------------------------
+float* QALSH_Scratch::score_buf(	// buffer for SQ8 scores of candidates
+	int   size)							// number of floats
+{
+	if (size > max_s_) {
+		delete[] score_;
+		max_s_ = size;
+		score_ = new float[max_s_];
+	}
+	return score_;
+}
+
+// -----------------------------------------------------------------------------
+MaxK_List* QALSH_Scratch::list(		// top-k list of this thread (not reset)
+	int   k)							// top-k value
+{
+	if (list_ == NULL || list_k_ != k) {
+		delete list_;
+		list_k_ = k;
+		list_   = new MaxK_List(k);
+	}
+	return list_;
+}
+
+// -----------------------------------------------------------------------------
+void QALSH_Scratch::begin(			// start a new query
+	int   n,							// number of data objects of the index
+	int   m)							// number of hash tables of the index
+{
+	if (n > max_n_) {
+		delete[] visit_;
+		max_n_ = n;
+		visit_ = new Visit[max_n_];
+		memset(visit_, 0, max_n_ * sizeof(Visit));
+		epoch_ = 0;
+	}
+	if (m > max_m_) {
+		delete[] lpos_; delete[] rpos_; delete[] q_val_;
+		delete[] bucket_flag_; delete[] range_flag_;
+
+		max_m_       = m;
+		lpos_        = new int[max_m_];
+		rpos_        = new int[max_m_];
+		bucket_flag_ = new bool[max_m_];
+		range_flag_  = new bool[max_m_];
+		q_val_       = new float[max_m_];
+	}
+
+	// -------------------------------------------------------------------------
+	//  a new epoch invalidates all counters; clear them only on wrap-around
+	// -------------------------------------------------------------------------
+	if (++epoch_ == 0) {
+		memset(visit_, 0, max_n_ * sizeof(Visit));
+		epoch_ = 1;
+	}
+}
+
 // -----------------------------------------------------------------------------
 QALSH::QALSH(						// constructor
 	int   n,							// number of data objects
 	int   d,							// dimension of data objects
 	float ratio,						// approximation ratio
-	const float **data)					// data objects
+	const float **data,					// data objects
+	bool  build,						// build tables now (on g_num_threads)
+	const float **a,					// shared hash functions (or NULL)
+	const float *last)					// last coordinates (or NULL: in data)
 {
 	// -------------------------------------------------------------------------
 	//  init parameters
 	// -------------------------------------------------------------------------
 	n_pts_      = n;
 	dim_        = d;
+	kern_       = dim_kernels(d);
 	appr_ratio_ = ratio;
 	data_       = data;
+	last_       = last;
 	beta_       = (float) CANDIDATES / n;
 	delta_      = 1.0f / E;
 
@@ -40,55 +190,363 @@ QALSH::QALSH(						// constructor
 	// -------------------------------------------------------------------------
 	//  generate hash functions
 	// -------------------------------------------------------------------------
+	owned_     = true;
+	own_a_     = a == NULL;
+	dead_      = NULL;
+	srht_      = NULL;
+	data_proj_ = NULL;
 	a_ = new float*[m_];
-	for (int i = 0; i < m_; ++i) { // chosen from N(0.0, 1.0)
-		a_[i] = new float[dim_];
-		for (int j = 0; j < dim_; ++j) {
-			a_[i][j] = gaussian(0.0F, 1.0F);
+	if (own_a_ && g_struct_proj == 1) {
+		srht_ = new SRHT(dim_, m_);
+		float *buf = new float[srht_->buf_size()];
+		for (int i = 0; i < m_; ++i) {
+			a_[i] = new float[dim_];
+			srht_->row(i, a_[i], buf);
+		}
+		delete[] buf; buf = NULL;
+	}
+	else {
+		Random rng;
+		for (int i = 0; i < m_; ++i) { // chosen from N(0.0, 1.0)
+			if (!own_a_) { a_[i] = (float *) a[i]; continue; }
+
+			a_[i] = new float[dim_];
+			rng.gaussian(dim_, a_[i]);
 		}
 	}
 	
 	// -------------------------------------------------------------------------
 	//  bulkloading
 	// -------------------------------------------------------------------------
-	freq_        = new int[n_pts_];
-	lpos_        = new int[m_];
-	rpos_        = new int[m_];
-	checked_     = new bool[n_pts_];
-	bucket_flag_ = new bool[m_];
-	range_flag_  = new bool[m_];
-	q_val_       = new float[m_];
-
-	tables_ = new Result*[m_];
+	key_bits_ = g_key_bits == 16 ? 16 : 32;
+	base_     = new float[m_];
+	step_     = new float[m_];
+	alloc_tables();
 	for (int i = 0; i < m_; ++i) {
-		tables_[i] = new Result[n_pts_];
+		if (keys_  != NULL) keys_[i]  = new float[n_pts_];
+		if (qkeys_ != NULL) qkeys_[i] = new int16_t[n_pts_];
+		if (ids_   != NULL) ids_[i]   = new int[n_pts_];
+		if (sids_  != NULL) sids_[i]  = new uint16_t[n_pts_];
+	}
+	if (build) {
+		project_data(g_num_threads);
+		parallel_for(m_, g_num_threads, [&](int /*tid*/, int i) {
+			build_table(i);
+		});
+		free_data_proj();
+	}
+}
+
+// -----------------------------------------------------------------------------
+int QALSH::calc_m(					// number of hash tables of an index
+	int   n,							// number of data objects
+	float ratio)						// approximation ratio
+{
+	// -------------------------------------------------------------------------
+	//  the number of hash tables, as in the constructor
+	// -------------------------------------------------------------------------
+	float beta  = (float) CANDIDATES / n;
+	float delta = 1.0f / E;
+	float w     = sqrt((8.0f * ratio * ratio * log(ratio)) / 
+		(ratio * ratio - 1.0f));
+	float p1    = calc_p(w / 2.0f);
+	float p2    = calc_p(w / (2.0f * ratio));
+	float para1 = sqrt(log(2.0f / beta));
+	float para2 = sqrt(log(1.0f / delta));
+	float para3 = 2.0f * (p1 - p2) * (p1 - p2);
+
+	return (int) ceil((para1 + para2) * (para1 + para2) / para3);
+}
 
+// -----------------------------------------------------------------------------
+float QALSH::query_cost(			// expected cost of one query
+	int   n,							// number of data objects
+	int   d,							// dimensionality
+	float ratio)						// approximation ratio
+{
+	int m = calc_m(n, ratio);
+	return m * (d + log2((float) n)) + COUNT_COST * SCAN_FRAC * m * n + 
+		(CANDIDATES + MAXK - 1) * d;
+}
+
+// -----------------------------------------------------------------------------
+size_t QALSH::build_size(			// memory of building an index
+	int   n,							// number of data objects
+	int   d,							// dimensionality
+	float ratio,						// approximation ratio
+	bool  shared,						// true if hash functions are shared
+	int   num_threads)					// number of threads
+{
+	size_t m = (size_t) calc_m(n, ratio);
+	size_t key_size = g_key_bits == 16 ? sizeof(int16_t) : SIZEFLOAT;
+	size_t id_size  = g_key_bits == 16 && n <= 65536 ? sizeof(uint16_t) : 
+		SIZEINT;
+
+	size_t size = m * n * (key_size + id_size);
+	if (!shared) size += m * d * SIZEFLOAT;
+	if (!shared && g_struct_proj == 1) size += m * n * SIZEFLOAT;
+	size += (size_t) MAX(num_threads, 1) * n * sizeof(Result);
+	return size;
+}
+
+// -----------------------------------------------------------------------------
+void QALSH::project_data(			// project all data objects (SRHT only)
+	int   num_threads)					// number of threads
+{
+	if (srht_ == NULL || data_proj_ != NULL) return;
+
+	// -------------------------------------------------------------------------
+	//  with last_, every thread assembles the full object in vec first
+	// -------------------------------------------------------------------------
+	int size = srht_->buf_size();
+	int threads = MAX(num_threads, 1);
+	float *buf = new float[(size_t) threads * size];
+	float *vec = last_ != NULL ? new float[(size_t) threads * dim_] : NULL;
+	data_proj_ = new float[(size_t) n_pts_ * m_];
+	parallel_for(n_pts_, num_threads, [&](int tid, int j) {
+		const float *obj = data_[j];
+		if (last_ != NULL) {
+			float *v = vec + (size_t) tid * dim_;
+			memcpy(v, data_[j], (dim_ - 1) * SIZEFLOAT);
+			v[dim_ - 1] = last_[j];
+			obj = v;
+		}
+		srht_->project(dim_, obj, data_proj_ + (size_t) j * m_, 
+			buf + (size_t) tid * size);
+	});
+	delete[] buf; buf = NULL;
+	delete[] vec; vec = NULL;
+}
+
+// -----------------------------------------------------------------------------
+void QALSH::free_data_proj()		// release keys of project_data
+{
+	delete[] data_proj_; data_proj_ = NULL;
+	data_ = NULL; last_ = NULL;
+}
+
+// -----------------------------------------------------------------------------
+void QALSH::build_table(			// project and sort one hash table
+	int   i)							// table id
+{
+	Result *table = new Result[n_pts_];
+	if (data_proj_ != NULL) {
+		for (int j = 0; j < n_pts_; ++j) {
+			table[j].id_  = j;
+			table[j].key_ = data_proj_[(size_t) j * m_ + i];
+		}
+	}
+	else if (last_ != NULL) {
+		const float *a = a_[i];
+		const Dim_Kernels *kern = dim_kernels(dim_ - 1);
+		for (int j = 0; j < n_pts_; ++j) {
+			table[j].id_  = j;
+			table[j].key_ = calc_inner_product(kern, dim_ - 1, a, data_[j]) + 
+				a[dim_ - 1] * last_[j];
+		}
+	}
+	else {
 		const float *a = a_[i];
 		for (int j = 0; j < n_pts_; ++j) {
-			tables_[i][j].id_  = j;
-			tables_[i][j].key_ = calc_inner_product(dim_, a, data_[j]);
+			table[j].id_  = j;
+			table[j].key_ = calc_inner_product(kern_, dim_, a, data_[j]);
+		}
+	}
+	sort_results(n_pts_, false, table);
+
+	// -------------------------------------------------------------------------
+	//  quantize keys to [-32768, 32767] over the range of this table
+	// -------------------------------------------------------------------------
+	if (qkeys_ != NULL) {
+		float lo   = table[0].key_;
+		float hi   = table[n_pts_ - 1].key_;
+		float step = hi > lo ? (hi - lo) / 65535.0f : 1.0f;
+		base_[i] = lo + 32768.0f * step;
+		step_[i] = step;
+
+		int16_t *qkeys = qkeys_[i];
+		for (int j = 0; j < n_pts_; ++j) {
+			int q = (int) lroundf((table[j].key_ - lo) / step) - 32768;
+			qkeys[j] = (int16_t) MIN(MAX(q, -32768), 32767);
 		}
-		qsort(tables_[i], n_pts_, sizeof(Result), ResultComp);
 	}
+	else {
+		base_[i] = 0.0f;
+		step_[i] = 1.0f;
+
+		float *keys = keys_[i];
+		for (int j = 0; j < n_pts_; ++j) keys[j] = table[j].key_;
+	}
+
+	if (sids_ != NULL) {
+		uint16_t *sids = sids_[i];
+		for (int j = 0; j < n_pts_; ++j) sids[j] = (uint16_t) table[j].id_;
+	}
+	else {
+		int *ids = ids_[i];
+		for (int j = 0; j < n_pts_; ++j) ids[j] = table[j].id_;
+	}
+	delete[] table; table = NULL;
+}
+
+// -----------------------------------------------------------------------------
+void QALSH::alloc_tables()			// allocate tables for key_bits_
+{
+	keys_ = NULL; qkeys_ = NULL;
+	ids_  = NULL; sids_  = NULL;
+
+	if (key_bits_ == 16) qkeys_ = new int16_t*[m_];
+	else keys_ = new float*[m_];
+
+	if (key_bits_ == 16 && n_pts_ <= 65536) sids_ = new uint16_t*[m_];
+	else ids_ = new int*[m_];
+}
+
+// -----------------------------------------------------------------------------
+size_t QALSH::index_size()			// memory of hash functions and tables
+{
+	size_t key_size = key_bits_ / 8;
+	size_t id_size  = sids_ != NULL ? sizeof(uint16_t) : sizeof(int);
+
+	size_t a_size = own_a_ ? (size_t) m_ * dim_ : 0;
+	return (a_size + (size_t) m_ * 2) * SIZEFLOAT + 
+		(size_t) m_ * n_pts_ * (key_size + id_size);
 }
 
 // -----------------------------------------------------------------------------
 QALSH::~QALSH()						// destructor
 {
-	delete[] freq_;        freq_        = NULL;
-	delete[] lpos_;        lpos_        = NULL;
-	delete[] rpos_;        rpos_        = NULL;
-	delete[] checked_;     checked_     = NULL;
-	delete[] bucket_flag_; bucket_flag_ = NULL;
-	delete[] range_flag_;  range_flag_  = NULL;
-	delete[] q_val_;       q_val_       = NULL;
-	
+	if (owned_) {
+		for (int i = 0; i < m_; ++i) {
+			if (own_a_) delete[] a_[i];
+			if (keys_  != NULL) delete[] keys_[i];
+			if (qkeys_ != NULL) delete[] qkeys_[i];
+			if (ids_   != NULL) delete[] ids_[i];
+			if (sids_  != NULL) delete[] sids_[i];
+		}
+		delete[] base_; delete[] step_;
+	}
+	base_ = NULL; step_ = NULL;
+
+	delete   srht_;  srht_  = NULL;
+	delete[] data_proj_; data_proj_ = NULL;
+	delete[] a_;     a_     = NULL;
+	delete[] keys_;  keys_  = NULL;
+	delete[] qkeys_; qkeys_ = NULL;
+	delete[] ids_;   ids_   = NULL;
+	delete[] sids_;  sids_  = NULL;
+}
+
+// -----------------------------------------------------------------------------
+int QALSH::save(					// write index to an index file
+	FILE  *fp)							// output file
+{
+	// -------------------------------------------------------------------------
+	//  parameters, hash functions (m x d, unless shared), quantization (m, m), 
+	//  keys (m x n), ids (m x n)
+	// -------------------------------------------------------------------------
+	int   para_i[5] = { n_pts_, dim_, m_, l_, key_bits_ };
+	float para_f[7] = { appr_ratio_, w_, p1_, p2_, alpha_, beta_, delta_ };
+
+	if (write_aligned(fp, para_i, sizeof(para_i))) return 1;
+	if (write_aligned(fp, para_f, sizeof(para_f))) return 1;
+
+	if (own_a_) {
+		for (int i = 0; i < m_; ++i) {
+			fwrite(a_[i], SIZEFLOAT, dim_, fp);
+		}
+		if (write_aligned(fp, NULL, 0)) return 1;
+	}
+
+	if (write_aligned(fp, base_, m_ * SIZEFLOAT)) return 1;
+	if (write_aligned(fp, step_, m_ * SIZEFLOAT)) return 1;
+
 	for (int i = 0; i < m_; ++i) {
-		delete[] a_[i];      a_[i]      = NULL;
-		delete[] tables_[i]; tables_[i] = NULL;
+		if (qkeys_ != NULL) fwrite(qkeys_[i], sizeof(int16_t), n_pts_, fp);
+		else fwrite(keys_[i], SIZEFLOAT, n_pts_, fp);
 	}
-	delete[] a_;      a_      = NULL;
-	delete[] tables_; tables_ = NULL;
+	if (write_aligned(fp, NULL, 0)) return 1;
+
+	for (int i = 0; i < m_; ++i) {
+		if (sids_ != NULL) fwrite(sids_[i], sizeof(uint16_t), n_pts_, fp);
+		else fwrite(ids_[i], SIZEINT, n_pts_, fp);
+	}
+	if (write_aligned(fp, NULL, 0)) return 1;
+
+	return ferror(fp) ? 1 : 0;
+}
+
+// -----------------------------------------------------------------------------
+QALSH* QALSH::load(					// index in place from an mmap-ed file
+	Mmap_Cursor *in,					// input mapping
+	int   n,							// expected number of data objects
+	int   d,							// expected dimensionality
+	const float **data,					// data objects
+	const float **a_in)					// shared hash functions (or NULL)
+{
+	const int   *para_i = (const int *) read_aligned(in, 5 * sizeof(int));
+	const float *para_f = (const float *) read_aligned(in, 7 * SIZEFLOAT);
+	if (para_i == NULL || para_f == NULL || para_i[0] != n || para_i[1] != d ||
+		(para_i[4] != 32 && para_i[4] != 16)) {
+		printf("Corrupted QALSH index\n");
+		return NULL;
+	}
+	int m = para_i[2];
+	int key_size = para_i[4] / 8;
+	int id_size  = para_i[4] == 16 && n <= 65536 ? 2 : 4;
+
+	const char *a = NULL;			// own hash functions (m x d)
+	if (a_in == NULL) {
+		a = (const char *) read_aligned(in, (size_t) m * d * SIZEFLOAT);
+	}
+	const char *b = (const char *) read_aligned(in, (size_t) m * SIZEFLOAT);
+	const char *s = (const char *) read_aligned(in, (size_t) m * SIZEFLOAT);
+	const char *k = (const char *) read_aligned(in, (size_t) m*n*key_size);
+	const char *t = (const char *) read_aligned(in, (size_t) m*n*id_size);
+	if ((a == NULL && a_in == NULL) || b == NULL || s == NULL || k == NULL ||
+		t == NULL) {
+		printf("Corrupted QALSH index\n");
+		return NULL;
+	}
+
+	QALSH *lsh = new QALSH();
+	lsh->n_pts_      = n;
+	lsh->dim_        = d;
+	lsh->kern_       = dim_kernels(d);
+	lsh->m_          = m;
+	lsh->l_          = para_i[3];
+	lsh->key_bits_   = para_i[4];
+	lsh->appr_ratio_ = para_f[0];
+	lsh->w_          = para_f[1];
+	lsh->p1_         = para_f[2];
+	lsh->p2_         = para_f[3];
+	lsh->alpha_      = para_f[4];
+	lsh->beta_       = para_f[5];
+	lsh->delta_      = para_f[6];
+	lsh->data_       = data;
+	lsh->last_       = NULL;
+	lsh->owned_      = false;
+	lsh->own_a_      = a_in == NULL;
+	lsh->dead_       = NULL;
+	lsh->srht_       = NULL;
+	lsh->data_proj_  = NULL;
+
+	lsh->base_ = (float *) b;
+	lsh->step_ = (float *) s;
+	lsh->a_    = new float*[m];
+	lsh->alloc_tables();
+	for (int i = 0; i < m; ++i) {
+		const char *ki = k + (size_t) i * n * key_size;
+		const char *ti = t + (size_t) i * n * id_size;
+
+		if (a_in != NULL) lsh->a_[i] = (float *) a_in[i];
+		else lsh->a_[i] = (float *) a + (size_t) i * d;
+		if (lsh->keys_  != NULL) lsh->keys_[i]  = (float *) ki;
+		if (lsh->qkeys_ != NULL) lsh->qkeys_[i] = (int16_t *) ki;
+		if (lsh->ids_   != NULL) lsh->ids_[i]   = (int *) ti;
+		if (lsh->sids_  != NULL) lsh->sids_[i]  = (uint16_t *) ti;
+	}
+	return lsh;
 }
 
 // -----------------------------------------------------------------------------
@@ -112,7 +570,25 @@ void QALSH::display()				// display parameters
 	printf("    beta  = %f\n",   beta_);
 	printf("    delta = %f\n",   delta_);
 	printf("    m     = %d\n",   m_);
-	printf("    l     = %d\n\n", l_);
+	printf("    l     = %d\n",   l_);
+	printf("    proj  = %s\n",   srht_ != NULL ? "srht" : "dense");
+	printf("    bits  = %d\n\n", key_bits_);
+}
+
+// -----------------------------------------------------------------------------
+void QALSH::project_query(			// projections of one query
+	const float *query,					// input query
+	QALSH_Scratch *scratch,				// search context of this thread
+	float *proj)						// projections (m values) (return)
+{
+	if (srht_ != NULL) {
+		float *buf = scratch->fht_buf(srht_->buf_size());
+		srht_->project(dim_, query, proj, buf);
+		return;
+	}
+	for (int i = 0; i < m_; ++i) {
+		proj[i] = calc_inner_product(kern_, dim_, (const float *) a_[i], query);
+	}
 }
 
 // -----------------------------------------------------------------------------
@@ -120,32 +596,125 @@ int QALSH::knn(						// c-k-ANN search
 	int   top_k,						// top-k
 	float R,							// limited search range
 	const float *query,					// input query
+	QALSH_Scratch *scratch,				// search context of this thread
 	std::vector<int> &cand)				// NN candidates (return)
+{
+	scratch->begin(n_pts_, m_);
+	float *proj = scratch->q_val_;	// converted in place by knn_scan
+	project_query(query, scratch, proj);
+	return search(top_k, R, proj, scratch, cand, NULL);
+}
+
+// -----------------------------------------------------------------------------
+int QALSH::knn(						// c-k-ANN search with verification
+	int   top_k,						// top-k
+	float R,							// limited search range
+	const float *query,					// input query
+	QALSH_Scratch *scratch,				// search context of this thread
+	Cand_Check *check)					// verifies candidates, returns R
+{
+	scratch->begin(n_pts_, m_);
+	float *proj = scratch->q_val_;	// converted in place by knn_scan
+	project_query(query, scratch, proj);
+	std::vector<int> cand;			// stays empty
+	return search(top_k, R, proj, scratch, cand, check);
+}
+
+// -----------------------------------------------------------------------------
+void QALSH::project(				// project a block of queries
+	int   qn,							// number of queries
+	const float **query,				// queries
+	int   dim,							// number of leading coordinates
+	float *proj)						// projections (qn x m) (return)
+{
+	calc_ip_block(dim, qn, query, m_, (const float **) a_, proj);
+}
+
+// -----------------------------------------------------------------------------
+int QALSH::knn_proj(				// c-k-ANN search from projections
+	int   top_k,						// top-k
+	float R,							// limited search range
+	const float *proj,					// projections of query (m values)
+	QALSH_Scratch *scratch,				// search context of this thread
+	std::vector<int> &cand)				// NN candidates (return)
+{
+	scratch->begin(n_pts_, m_);
+	return search(top_k, R, proj, scratch, cand, NULL);
+}
+
+// -----------------------------------------------------------------------------
+int QALSH::knn_proj(				// c-k-ANN search with verification
+	int   top_k,						// top-k
+	float R,							// limited search range
+	const float *proj,					// projections of query (m values)
+	QALSH_Scratch *scratch,				// search context of this thread
+	Cand_Check *check)					// verifies candidates, returns R
+{
+	scratch->begin(n_pts_, m_);
+	std::vector<int> cand;			// stays empty
+	return search(top_k, R, proj, scratch, cand, check);
+}
+
+// -----------------------------------------------------------------------------
+int QALSH::search(					// dispatch knn_scan by table types
+	int   top_k,						// top-k
+	float R,							// limited search range
+	const float *proj,					// projections of query (m values)
+	QALSH_Scratch *scratch,				// search context of this thread
+	std::vector<int> &cand,				// NN candidates (return)
+	Cand_Check *check)					// verification (or NULL)
+{
+	if (qkeys_ != NULL && sids_ != NULL) {
+		return knn_scan(top_k, R, proj, qkeys_, sids_, scratch, cand, check);
+	}
+	else if (qkeys_ != NULL) {
+		return knn_scan(top_k, R, proj, qkeys_, ids_, scratch, cand, check);
+	}
+	return knn_scan(top_k, R, proj, keys_, ids_, scratch, cand, check);
+}
+
+// -----------------------------------------------------------------------------
+//  keys are compared in the units of the table (q_vals and step_), so that for 
+//  float keys (base_ = 0, step_ = 1) the search is exactly the unquantized one
+// -----------------------------------------------------------------------------
+template<class Key, class Id>
+int QALSH::knn_scan(				// c-k-ANN search on typed tables
+	int   top_k,						// top-k
+	float R,							// limited search range
+	const float *proj,					// projections of query (m values)
+	Key   **keys_in,					// sorted keys of hash tables
+	Id    **ids_in,						// object ids of hash tables
+	QALSH_Scratch *scratch,				// search context of this thread
+	std::vector<int> &cand,				// NN candidates (return)
+	Cand_Check *check)					// verification (or NULL)
 {
 	int candidates = CANDIDATES + top_k - 1; // candidate size
 	// float kdist = MAXREAL;			// k-th ANN distance
 	
 	// -------------------------------------------------------------------------
-	//  initialize parameters
+	//  initialize parameters (scratch->begin() is called by the caller)
 	// -------------------------------------------------------------------------
-	memset(freq_, 0, n_pts_ * SIZEFLOAT);
-	memset(checked_, false, n_pts_ * SIZEBOOL);
-	memset(bucket_flag_, true, m_ * SIZEBOOL);
-	memset(range_flag_, true, m_ * SIZEBOOL);
+	int   *lpos        = scratch->lpos_;
+	int   *rpos        = scratch->rpos_;
+	bool  *bucket_flag = scratch->bucket_flag_;
+	bool  *range_flag  = scratch->range_flag_;
+	float *q_vals      = scratch->q_val_;
+
+	memset(bucket_flag, true, m_ * SIZEBOOL);
+	memset(range_flag, true, m_ * SIZEBOOL);
 	
-	Result tmp;
-	Result *table = NULL;
+	const Key *keys = NULL;
+	const Id  *ids  = NULL;
 	for (int i = 0; i < m_; ++i) {
-		tmp.key_= calc_inner_product(dim_, (const float *) a_[i], query);
-		q_val_[i] = tmp.key_;
+		q_vals[i] = (proj[i] - base_[i]) / step_[i];
 
-		table = tables_[i];
-		int pos = std::lower_bound(table, table+n_pts_, tmp, cmp) - table;
+		keys = keys_in[i];
+		int pos = std::lower_bound(keys, keys+n_pts_, q_vals[i]) - keys;
 		if (pos <= 0) {
-			lpos_[i] = -1; rpos_[i] = pos;
+			lpos[i] = -1; rpos[i] = pos;
 		}
 		else {
-			lpos_[i] = pos - 1; rpos_[i] = pos;
+			lpos[i] = pos - 1; rpos[i] = pos;
 		}
 	}
 
@@ -166,89 +735,97 @@ int QALSH::knn(						// c-k-ANN search
 		//  step 1: initialize the stop condition for current round
 		// ---------------------------------------------------------------------
 		int num_bucket = 0;
-		memset(bucket_flag_, true, m_ * SIZEBOOL);
+		memset(bucket_flag, true, m_ * SIZEBOOL);
+		STATS_ADD(rounds_, 1);
 
 		// ---------------------------------------------------------------------
 		//  step 2: (R,c)-NN search
 		// ---------------------------------------------------------------------
-		int cnt = -1, pos = -1, id = -1;
+		int   cnt = -1, pos = -1, id = -1;
+		float r   = -1.0f;			// search range from check
 		while (num_bucket < m_ && num_range < m_) {
 			float ldist = -1.0f;	// left  proj dist to query
 			float rdist = -1.0f;	// right proj dist to query
 			float q_val = -1.0f;	// hash value of 
-			float dist  = -1.0f;	// l2-sqr dist
+			float step  = -1.0f;	// key step of table
 
 			for (int j = 0; j < m_; ++j) {
-				if (!bucket_flag_[j]) continue;
+				if (!bucket_flag[j]) continue;
 
-				table = tables_[j];
-				q_val = q_val_[j];
+				keys  = keys_in[j];
+				ids   = ids_in[j];
+				q_val = q_vals[j];
+				step  = step_[j];
 				// -------------------------------------------------------------
 				//  step 2.1: scan the left part of hash table
 				// -------------------------------------------------------------
 				cnt = 0;
-				pos = lpos_[j];
+				pos = lpos[j];
 				while (cnt < SCAN_SIZE) {
 					ldist = MAXREAL;
 					if (pos >= 0) {
-						ldist = fabs(q_val - table[pos].key_);
+						ldist = fabs(q_val - keys[pos]) * step;
 					}
 					if (ldist > bucket || ldist > range) break;
 
-					id = table[pos].id_;
-					if (++freq_[id] >= l_ && !checked_[id]) {
-						checked_[id] = true;
-						cand.push_back(id);
-						// dist = calc_l2_sqr(dim_, kdist, data_[id], query);
-						// kdist = list->insert(dist, id);
+					STATS_ADD(entries_, 1);
+					id = ids[pos];
+					if (scratch->collide(id) == l_ && 
+						(dead_ == NULL || !dead_[id])) {
+						if (check == NULL) cand.push_back(id);
+						else if ((r = check->verify(id)) < R) {
+							R = r; range = R * w_ / 2.0f;
+						}
 
 						if (++dist_cnt >= candidates) break;
 					}
 					--pos; ++cnt;
 				}
 				if (dist_cnt >= candidates) break;
-				lpos_[j] = pos;
+				lpos[j] = pos;
 
 				// -------------------------------------------------------------
 				//  step 2.2: scan right part of hash table
 				// -------------------------------------------------------------
 				cnt = 0;
-				pos = rpos_[j];
+				pos = rpos[j];
 				while (cnt < SCAN_SIZE) {
 					rdist = MAXREAL;
 					if (pos < n_pts_) {
-						rdist = fabs(q_val - table[pos].key_);
+						rdist = fabs(q_val - keys[pos]) * step;
 					}
 					if (rdist > bucket || rdist > range) break;
 
-					id = table[pos].id_;
-					if (++freq_[id] >= l_ && !checked_[id]) {
-						checked_[id] = true;
-						cand.push_back(id);
-						// dist = calc_l2_sqr(dim_, kdist, data_[id], query);
-						// kdist = list->insert(dist, id);
+					STATS_ADD(entries_, 1);
+					id = ids[pos];
+					if (scratch->collide(id) == l_ && 
+						(dead_ == NULL || !dead_[id])) {
+						if (check == NULL) cand.push_back(id);
+						else if ((r = check->verify(id)) < R) {
+							R = r; range = R * w_ / 2.0f;
+						}
 
 						if (++dist_cnt >= candidates) break;
 					}
 					++pos; ++cnt;
 				}
 				if (dist_cnt >= candidates) break;
-				rpos_[j] = pos;
+				rpos[j] = pos;
 
 				// -------------------------------------------------------------
 				//  step 2.3: check whether this bucket is finished scanned
 				// -------------------------------------------------------------
 				if (ldist > bucket && rdist > bucket) {
-					bucket_flag_[j] = false;
+					bucket_flag[j] = false;
 					if (++num_bucket > m_) break;
 				}
 				if (ldist > range && rdist > range) {
-					if (bucket_flag_[j]) {
-						bucket_flag_[j] = false;
+					if (bucket_flag[j]) {
+						bucket_flag[j] = false;
 						if (++num_bucket > m_) break;
 					}
-					if (range_flag_[j]) {
-						range_flag_[j] = false;
+					if (range_flag[j]) {
+						range_flag[j] = false;
 						if (++num_range > m_) break;
 					}
 				}
@@ -256,9 +833,10 @@ int QALSH::knn(						// c-k-ANN search
 			if (dist_cnt >= candidates) break;
 		}
 		// ---------------------------------------------------------------------
-		//  step 3: stop condition T1 and T2
+		//  step 3: stop condition T1 and T2 (T1 of -et 1 bounds the ratio of 
+		//  the k-th MIP found so far only, so it gives up some recall)
 		// ---------------------------------------------------------------------
-		// if (sqrt(kdist) < appr_ratio_ * radius) break;
+		if (check != NULL && R < appr_ratio_ * radius) break;
 		if (num_range >= m_ || dist_cnt >= candidates) break;
 
 		// ---------------------------------------------------------------------
@@ -267,5 +845,6 @@ int QALSH::knn(						// c-k-ANN search
 		radius = appr_ratio_ * radius;
 		bucket = radius * w_ / 2.0f;
 	}
+	STATS_ADD(cands_, dist_cnt);
 	return 0;
 }
@@ -1,8 +1,149 @@
 #ifndef __QALSH_H
 #define __QALSH_H
 
+#include <atomic>
+
 struct Result;
+struct Mmap_Cursor;
+struct Dim_Kernels;
 class  MinK_List;
+class  MaxK_List;
+class  QALSH;
+class  SRHT;
+
+extern int g_key_bits;				// global parameter: bits per hash key
+
+// -----------------------------------------------------------------------------
+//  Cand_Check: the streaming knn() verifies every candidate j (a position of 
+//  the index) as soon as it reaches l_ collisions, for the k-MIP search of 
+//  H2_ALSH in one block: object index_[j] is checked against the query (with 
+//  the partial-norm bound of kip_) and goes to list_ if it beats kip_. verify() 
+//  returns the search range R = sqrt(2 (M^2 - lambda * kip)) that the k-th 
+//  MIP value so far allows in the transformed space. It is a plain struct 
+//  kept in QALSH_Scratch, so that knn_scan calls it directly and a streaming 
+//  search allocates nothing.
+// -----------------------------------------------------------------------------
+struct Cand_Check {
+	const Dim_Kernels *kern_;		// kernels for dim_ (simd.h)
+	int   dim_;						// dimensionality of data
+	const int   *index_;			// object ids of the positions of the index
+	const float **data_;			// data objects
+	const float **norm_d_;			// l2-norms of data objects
+	const float *query_;			// input query
+	const float *norm_q_;			// l2-norms of query
+	float M_;						// max norm of the block
+	float lambda_;					// scale of the query (M / normq)
+	float kip_;						// k-th MIP value so far (updated)
+	MaxK_List *list_;				// top-k MIP results (updated)
+	std::atomic<float> *bound_;		// shared k-th MIP value (or NULL)
+
+	// -------------------------------------------------------------------------
+	float verify(					// verify a candidate, return R
+		int   j);						// position in the index
+};
+
+// -----------------------------------------------------------------------------
+//  QALSH_Scratch: the per-query search context of QALSH. The index is only 
+//  read by knn(), so many threads can search one index at the same time, as 
+//  long as every thread uses its own scratch. A scratch can be reused across 
+//  queries and across indexes (e.g., all blocks of H2_ALSH); it grows lazily 
+//  to the largest index it has searched.
+//
+//  The collision counters are epoch-stamped: the counter of an object is only 
+//  valid if its stamp equals the epoch of the current query. Starting a query 
+//  thus costs O(m) instead of an O(n) memset, and a query touches only the 
+//  counters of the objects it actually collides with.
+//
+//  the indexes built on QALSH (H2_ALSH, XBox, L2_ALSH, ...) keep their query 
+//  buffers in the scratch as well (the transformed query, the candidates, a 
+//  top-k list, and the buffers of kmip_batch), so that a thread allocates 
+//  nothing once its scratch has grown to the largest query (or batch).
+// -----------------------------------------------------------------------------
+struct Batch_Buf {					// buffers of the batched searches
+	std::vector<float> kip_;			// k-th MIP value of queries
+	std::vector<int>   active_;			// queries that are not pruned yet
+	std::vector<int>   scan_;			// queries that still scan a block
+	std::vector<const float*> act_q_;	// queries of active_ or scan_
+	std::vector<float> proj_;			// projections of all queries
+	std::vector<float> buf_;			// inner products or projections
+	std::vector<const float*> rows_;	// points to verify
+	std::vector<float> ips_;			// inner products of candidates
+	std::vector<float> zero_;			// row of removed points
+};
+
+// -----------------------------------------------------------------------------
+struct Visit {						// epoch-stamped collision counter
+	uint32_t epoch_;					// epoch of last update
+	int      freq_;						// collision frequency
+};
+
+class QALSH_Scratch {
+public:
+	QALSH_Scratch();				// constructor
+	~QALSH_Scratch();				// destructor
+
+	// -------------------------------------------------------------------------
+	void begin(						// start a new query
+		int   n,						// number of data objects of the index
+		int   m);						// number of hash tables of the index
+
+	// -------------------------------------------------------------------------
+	float *query_buf(				// buffer for a transformed query
+		int   size);					// number of floats
+
+	// -------------------------------------------------------------------------
+	float *fht_buf(					// buffer for structured projections
+		int   size);					// number of floats
+
+	// -------------------------------------------------------------------------
+	float *score_buf(				// buffer for SQ8 scores of candidates
+		int   size);					// number of floats
+
+	// -------------------------------------------------------------------------
+	inline std::vector<int> &cand() { return cand_; }
+
+	// -------------------------------------------------------------------------
+	inline Cand_Check &check() { return check_; }
+
+	// -------------------------------------------------------------------------
+	inline Batch_Buf &batch() { return batch_; }
+
+	// -------------------------------------------------------------------------
+	MaxK_List *list(				// top-k list of this thread (not reset)
+		int   k);						// top-k value
+
+	// -------------------------------------------------------------------------
+	inline int collide(int id) {	// count a collision, return frequency
+		Visit &v = visit_[id];
+		if (v.epoch_ != epoch_) { v.epoch_ = epoch_; v.freq_ = 0; }
+		return ++v.freq_;
+	}
+
+protected:
+	int      max_n_;				// capacity of visit_
+	int      max_m_;				// capacity of the per-table arrays
+	uint32_t epoch_;				// epoch of the current query
+	Visit    *visit_;				// collision counters
+	int      *lpos_;				// left  position of hash table
+	int      *rpos_;				// right position of hash table
+	bool     *bucket_flag_;			// bucket flag
+	bool     *range_flag_;			// range flag
+	float    *q_val_;				// hash value of query
+
+	int      max_q_;				// capacity of query_
+	float    *query_;				// transformed query of the caller
+	int      max_f_;				// capacity of fht_
+	float    *fht_;					// buffer of SRHT::project
+	int      max_s_;				// capacity of score_
+	float    *score_;				// buffer of SQ8::filter
+	std::vector<int> cand_;			// candidates of the caller
+	Cand_Check check_;				// candidate verification of the caller
+	Batch_Buf  batch_;				// buffers of the batched searches
+	int      list_k_;				// top-k value of list_
+	MaxK_List *list_;				// top-k list of the caller (or NULL)
+
+	friend class QALSH;
+};
 
 // -----------------------------------------------------------------------------
 //  Query-Aware Locality-Sensitive Hashing (QALSH) is used to solve the problem 
@@ -12,6 +153,33 @@ class  MinK_List;
 //  Fang, and Wilfred Ng in their paper "Query-aware locality-sensitive hashing 
 //  for approximate nearest neighbor search", in Proceedings of the VLDB 
 //  Endowment (PVLDB), 9(1), pages 1–12, 2015.
+//
+//  every hash table is stored as two arrays (struct of arrays): the sorted 
+//  projections keys_[i] and the object ids ids_[i]. The binary search and the 
+//  bucket scans of knn() only read keys, and an id is only read once its key 
+//  falls into the current bucket.
+//
+//  with g_key_bits = 16, keys are quantized to int16 over the range of each 
+//  table, i.e., key ~ base_[i] + step_[i] * qkey, and ids are stored as uint16 
+//  if n <= 65536 (e.g., the blocks of H2_ALSH). The query is projected into 
+//  the same units, so collision counting runs on the quantized keys directly. 
+//  A table then takes 4 (or 6) instead of 8 bytes per object, at the cost of 
+//  a rounding error of step_[i] / 2 on each key.
+//
+//  the hash functions can also be shared by many indexes in the same space 
+//  (e.g., the blocks of H2_ALSH): the caller passes a set of at least m rows, 
+//  and the index uses its first m. Shared hash functions are neither freed 
+//  nor saved by the index; load() then gets them from the caller, too.
+//
+//  the data of the build can leave out their last coordinate: with last, row 
+//  j holds the first d - 1 coordinates of object j and last[j] the d-th one, 
+//  e.g., the coordinate sqrt(M^2 - |o|^2) of H2_ALSH, which then needs no 
+//  copy of the data. The index only reads the data while it builds tables.
+//
+//  with g_struct_proj = 1, own hash functions are the rows of an SRHT (see 
+//  fht.h): knn() and the build project by fast Hadamard transforms, while the 
+//  rows are kept as dense a_ for project() and save(). A loaded index uses 
+//  the dense rows (the same projections up to rounding).
 // -----------------------------------------------------------------------------
 class QALSH {
 public:
@@ -19,11 +187,91 @@ public:
 		int   n,						// number of data objects
 		int   d,						// dimensionality
 		float ratio,					// approximation ratio
-		const float **data);			// data objects
+		const float **data,				// data objects
+		bool  build = true,				// build tables now (on g_num_threads)
+		const float **a = NULL,			// shared hash functions (or NULL)
+		const float *last = NULL);		// last coordinates (or NULL: in data)
 
 	// -------------------------------------------------------------------------
 	~QALSH();						// destructor
 
+	// -------------------------------------------------------------------------
+	//  the tables are independent of each other, so they can be built by many 
+	//  threads (e.g., all tables of all blocks of H2_ALSH at once). The hash 
+	//  functions are drawn in the constructor, so the index does not depend on
+	//  the number of threads.
+	//
+	//  with structured projections, project_data() first computes the keys of 
+	//  all tables point by point (n x m floats), build_table() takes its keys 
+	//  from there, and free_data_proj() releases them once all tables are 
+	//  built. Both are no-ops for dense hash functions. free_data_proj() also 
+	//  drops the data, which the caller may release afterwards.
+	// -------------------------------------------------------------------------
+	void project_data(				// project all data objects (SRHT only)
+		int   num_threads);				// number of threads
+
+	// -------------------------------------------------------------------------
+	void build_table(				// project and sort one hash table
+		int   i);						// table id
+
+	// -------------------------------------------------------------------------
+	void free_data_proj();			// release keys of project_data
+
+	// -------------------------------------------------------------------------
+	inline int num_tables() { return m_; }
+
+	// -------------------------------------------------------------------------
+	inline const float **hash_funcs() { return (const float **) a_; }
+
+	// -------------------------------------------------------------------------
+	static int calc_m(				// number of hash tables of an index
+		int   n,						// number of data objects
+		float ratio);					// approximation ratio
+
+	// -------------------------------------------------------------------------
+	//  tombstones: objects i with dead[i] != 0 are never returned as 
+	//  candidates (the array is owned by the caller, NULL: none)
+	// -------------------------------------------------------------------------
+	inline void set_tombstones(const uint8_t *dead) { dead_ = dead; }
+
+	// -------------------------------------------------------------------------
+	//  query_cost: the expected cost of one knn() on n objects, in units of 
+	//  one multiply-add of an inner product: m projections and binary 
+	//  searches, collision counting over SCAN_FRAC of every table (at 
+	//  COUNT_COST each), and the inner products of the candidates
+	// -------------------------------------------------------------------------
+	static float query_cost(		// expected cost of one query
+		int   n,						// number of data objects
+		int   d,						// dimensionality
+		float ratio);					// approximation ratio
+
+	// -------------------------------------------------------------------------
+	//  build_size: the memory of an index on n objects while its tables are 
+	//  built on num_threads threads (hash functions, tables, projections of 
+	//  the data with structured hash functions, and one sort buffer per thread)
+	// -------------------------------------------------------------------------
+	static size_t build_size(		// memory of building an index
+		int   n,						// number of data objects
+		int   d,						// dimensionality
+		float ratio,					// approximation ratio
+		bool  shared,					// true if hash functions are shared
+		int   num_threads);				// number of threads
+
+	// -------------------------------------------------------------------------
+	size_t index_size();			// memory of hash functions and tables
+
+	// -------------------------------------------------------------------------
+	int save(						// write index to an index file
+		FILE  *fp);						// output file
+
+	// -------------------------------------------------------------------------
+	static QALSH* load(				// index in place from an mmap-ed file
+		Mmap_Cursor *in,				// input mapping
+		int   n,						// expected number of data objects
+		int   d,						// expected dimensionality
+		const float **data,				// data objects
+		const float **a = NULL);		// shared hash functions (or NULL)
+
 	// -------------------------------------------------------------------------
 	void display();					// display parameters
 
@@ -32,13 +280,61 @@ public:
 		int   top_k,					// top-k
 		float R,						// limited search range
 		const float *query,				// input query
+		QALSH_Scratch *scratch,			// search context of this thread
 		std::vector<int> &cand);		// NN candidates (return)
 
+	// -------------------------------------------------------------------------
+	//  streaming c-k-ANN search: every candidate goes to check right away, so 
+	//  that it is verified and tightens R. The range of the bucket 
+	//  scans shrinks with R, and the search stops at the end of a round once 
+	//  R < c * radius (stop condition T1 of QALSH), or as knn() above.
+	// -------------------------------------------------------------------------
+	int knn(						// c-k-ANN search with verification
+		int   top_k,					// top-k
+		float R,						// limited search range
+		const float *query,				// input query
+		QALSH_Scratch *scratch,			// search context of this thread
+		Cand_Check *check);				// verifies candidates, returns R
+
+	// -------------------------------------------------------------------------
+	//  batched queries: project() computes the projections of a block of 
+	//  queries on all hash functions by one blocked GEMM (calc_ip_block), 
+	//  using the first dim coordinates only (e.g., without the zero padding 
+	//  of transformed queries); knn_proj() then searches from the (rescaled) 
+	//  projections of one query
+	// -------------------------------------------------------------------------
+	void project(					// project a block of queries
+		int   qn,						// number of queries
+		const float **query,			// queries
+		int   dim,						// number of leading coordinates
+		float *proj);					// projections (qn x m) (return)
+
+	// -------------------------------------------------------------------------
+	int knn_proj(					// c-k-ANN search from projections
+		int   top_k,					// top-k
+		float R,						// limited search range
+		const float *proj,				// projections of query (m values)
+		QALSH_Scratch *scratch,			// search context of this thread
+		std::vector<int> &cand);		// NN candidates (return)
+
+	// -------------------------------------------------------------------------
+	int knn_proj(					// c-k-ANN search with verification
+		int   top_k,					// top-k
+		float R,						// limited search range
+		const float *proj,				// projections of query (m values)
+		QALSH_Scratch *scratch,			// search context of this thread
+		Cand_Check *check);				// verifies candidates, returns R
+
 protected:
+	QALSH() {}						// constructor (used by load)
+
+	// -------------------------------------------------------------------------
 	int    n_pts_;					// number of data objects
 	int    dim_;					// dimensionality
+	const Dim_Kernels *kern_;		// kernels for dim_ (simd.h)
 	float  appr_ratio_;				// approximation ratio
-	const  float **data_;			// data objects
+	const  float **data_;			// data objects (only while building)
+	const  float *last_;			// last coordinates of data_ (or NULL)
 
 	float  w_;						// bucket width
 	float  p1_;						// positive probability
@@ -49,19 +345,52 @@ protected:
 	int    m_;						// number of hash tables
 	int    l_;						// collision threshold
 	float  **a_;					// lsh functions
-	Result **tables_;				// hash tables
-
-	int    *freq_;					// frequency		
-	int    *lpos_;					// left  position of hash table
-	int    *rpos_;					// right position of hash table
-	bool   *checked_;				// whether checked
-	bool   *bucket_flag_;			// bucket flag
-	bool   *range_flag_;			// range flag
-	float  *q_val_;					// hash value of query
+	SRHT   *srht_;					// structured lsh functions (or NULL)
+	float  *data_proj_;				// keys of project_data (n x m, or NULL)
+	float  **keys_;					// hash tables: sorted projections
+	int    **ids_;					// hash tables: object ids of keys_
+	int    key_bits_;				// bits per key (32 or 16)
+	float  *base_;					// quantization: key of qkey 0 per table
+	float  *step_;					// quantization: key step per table
+	int16_t  **qkeys_;				// hash tables: quantized keys_
+	uint16_t **sids_;				// hash tables: compact ids_
+	bool   owned_;					// false if a_ and tables are mmap-ed
+	bool   own_a_;					// false if a_ is shared (caller's)
+	const  uint8_t *dead_;			// tombstones of objects (or NULL)
 
 	// -------------------------------------------------------------------------
-	float calc_p(					// calc probability
+	static float calc_p(			// calc probability
 		float x);						// x = w / (2.0 * r)
+
+	// -------------------------------------------------------------------------
+	void alloc_tables();			// allocate tables for key_bits_
+
+	// -------------------------------------------------------------------------
+	void project_query(				// projections of one query
+		const float *query,				// input query
+		QALSH_Scratch *scratch,			// search context of this thread
+		float *proj);					// projections (m values) (return)
+
+	// -------------------------------------------------------------------------
+	int search(						// dispatch knn_scan by table types
+		int   top_k,					// top-k
+		float R,						// limited search range
+		const float *proj,				// projections of query (m values)
+		QALSH_Scratch *scratch,			// search context of this thread
+		std::vector<int> &cand,			// NN candidates (return)
+		Cand_Check *check);				// verification (or NULL)
+
+	// -------------------------------------------------------------------------
+	template<class Key, class Id>
+	int knn_scan(					// c-k-ANN search on typed tables
+		int   top_k,					// top-k
+		float R,						// limited search range
+		const float *proj,				// projections of query (m values)
+		Key   **keys,					// sorted keys of hash tables
+		Id    **ids,					// object ids of hash tables
+		QALSH_Scratch *scratch,			// search context of this thread
+		std::vector<int> &cand,			// NN candidates (return)
+		Cand_Check *check);				// verification (or NULL)
 };
 
 #endif // __QALSH_H
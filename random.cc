@@ -1,9 +1,89 @@
 #include <algorithm>
+#include <atomic>
 #include <cmath>
+#include <cstdint>
+#include <cstdlib>
 
 #include "def.h"
 #include "random.h"
 
+int g_seed = 0;
+
+static std::atomic<uint64_t> g_stream(0); // next stream of Random
+
+// -----------------------------------------------------------------------------
+static uint64_t splitmix64(			// next value of splitmix64
+	uint64_t &x)						// state (updated)
+{
+	uint64_t z = (x += 0x9E3779B97F4A7C15ULL);
+	z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+	z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+	return z ^ (z >> 31);
+}
+
+// -----------------------------------------------------------------------------
+void reset_streams()				// restart the streams of Random (as srand)
+{
+	g_stream.store(0);
+}
+
+// -----------------------------------------------------------------------------
+Random::Random()					// constructor (next stream)
+{
+	legacy_ = g_seed == 0;
+
+	uint64_t x = ((uint64_t) (uint32_t) g_seed << 32) ^ 
+		(g_stream.fetch_add(1) * 0xD1B54A32D192ED03ULL);
+	s_[0] = splitmix64(x);
+	s_[1] = splitmix64(x);
+	if (s_[0] == 0 && s_[1] == 0) s_[1] = 1;
+}
+
+// -----------------------------------------------------------------------------
+void Random::gaussian(				// r.v.s from Gaussian(0, 1)
+	int   n,							// number of values
+	float *x)							// values (return)
+{
+	if (legacy_) {
+		for (int i = 0; i < n; ++i) x[i] = ::gaussian(0.0f, 1.0f);
+		return;
+	}
+
+	// -------------------------------------------------------------------------
+	//  Box-Muller on chunks: first the uniforms (u1 in (0, 1], u2 in [0, 1)), 
+	//  then the transform, so that both loops have no branches
+	// -------------------------------------------------------------------------
+	const int   CHUNK = 64;
+	const float UNIT  = 1.0f / 16777216.0f; // 2^-24
+	float u1[CHUNK], u2[CHUNK];
+
+	for (int i = 0; i < n; i += 2 * CHUNK) {
+		int num = MIN(CHUNK, (n - i + 1) / 2);
+		for (int j = 0; j < num; ++j) {
+			uint64_t bits = next();
+			u1[j] = ((uint32_t) (bits >> 40) + 1) * UNIT;
+			u2[j] = (uint32_t) ((bits >> 16) & 0xFFFFFF) * UNIT;
+		}
+		for (int j = 0; j < num; ++j) {
+			float r = sqrt(-2.0f * log(u1[j]));
+			float t = 2.0f * PI * u2[j];
+			u1[j] = r * cos(t);
+			u2[j] = r * sin(t);
+		}
+
+		float *y = x + i;
+		int   left = MIN(2 * CHUNK, n - i);
+		for (int j = 0; j < left; ++j) y[j] = (j & 1) ? u2[j >> 1] : u1[j >> 1];
+	}
+}
+
+// -----------------------------------------------------------------------------
+float Random::sign()				// r.v. from {-1, +1}
+{
+	if (legacy_) return uniform(0.0f, 1.0f) < 0.5f ? -1.0f : 1.0f;
+	return (next() >> 63) ? 1.0f : -1.0f;
+}
+
 // -----------------------------------------------------------------------------
 //	Given a mean and a standard deviation, gaussian generates a normally 
 //		distributed random number.
@@ -1,6 +1,8 @@
 #ifndef __RANDOM_H
 #define __RANDOM_H
 
+extern int g_seed;					// global parameter: random seed (0: rand())
+
 // -----------------------------------------------------------------------------
 inline float uniform(				// r.v. from Uniform(min, max)
 	float min,							// min value
@@ -23,6 +25,46 @@ float gaussian(				// r.v. from Gaussian(mean, sigma)
 	float mean,							// mean value
 	float sigma);						// std value
 
+// -----------------------------------------------------------------------------
+//  Random: the source of the random hash functions of the indexes. With 
+//  g_seed = 0, it draws from rand() (gaussian() and uniform() above) in the 
+//  same order as before, so that indexes do not change. Otherwise, every 
+//  Random object owns a xorshift128+ stream, seeded from g_seed and a stream 
+//  counter (streams go out in construction order), and draws Gaussians by 
+//  the Box-Muller transform in batches, without rejection loop, shared state 
+//  or locks. Indexes built from the same seed are then the same on any number 
+//  of threads, and generators of different threads never contend.
+// -----------------------------------------------------------------------------
+class Random {
+public:
+	Random();						// constructor (next stream)
+
+	// -------------------------------------------------------------------------
+	void gaussian(					// r.v.s from Gaussian(0, 1)
+		int   n,						// number of values
+		float *x);						// values (return)
+
+	// -------------------------------------------------------------------------
+	float sign();					// r.v. from {-1, +1}
+
+protected:
+	bool     legacy_;				// true if drawn from rand()
+	uint64_t s_[2];					// state of xorshift128+
+
+	// -------------------------------------------------------------------------
+	inline uint64_t next() {		// next 64 random bits
+		uint64_t s1 = s_[0];
+		const uint64_t s0 = s_[1];
+		s_[0] = s0;
+		s1 ^= s1 << 23;
+		s_[1] = s1 ^ s0 ^ (s1 >> 17) ^ (s0 >> 26);
+		return s_[1] + s0;
+	}
+};
+
+// -----------------------------------------------------------------------------
+void reset_streams();				// restart the streams of Random (as srand)
+
 // -----------------------------------------------------------------------------
 inline float normal_pdf(			// pdf of Guassian(mean, std)
 	float x,							// variable
@@ -0,0 +1,405 @@
+#include <algorithm>
+#include <cerrno>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <signal.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <unistd.h>
+
+#include "def.h"
+#include "util.h"
+#include "matrix.h"
+#include "pri_queue.h"
+#include "parallel.h"
+#include "qalsh.h"
+#include "h2_alsh.h"
+#include "pca.h"
+#include "server.h"
+
+int g_server_port = 0;
+int g_batch_wait  = 200;
+
+// -----------------------------------------------------------------------------
+static inline float elapsed_us(		// microseconds from start to end
+	const timeval &start,				// start time
+	const timeval &end)					// end time
+{
+	return (end.tv_sec - start.tv_sec) * 1000000.0f + 
+		(end.tv_usec - start.tv_usec);
+}
+
+// -----------------------------------------------------------------------------
+H2_Server::H2_Server(				// constructor
+	H2_ALSH *lsh,						// index
+	int   d,							// dimensionality
+	int   batch,						// max requests per micro-batch
+	int   wait,							// batch window (in microseconds)
+	const PCA *pca)						// rotation of data (or NULL)
+{
+	lsh_         = lsh;
+	dim_         = d;
+	batch_       = MAX(1, batch);
+	wait_        = MAX(0, wait);
+	pca_         = pca;
+	num_threads_ = MAX(1, g_num_threads);
+	stop_        = false;
+	scratch_     = new QALSH_Scratch[num_threads_];
+
+	query_       = new Matrix(batch_, d);
+	norm_q_      = new Matrix(batch_, NORM_K, false);
+	queries_     = 0;
+	batches_     = 0;
+	gettimeofday(&last_report_, NULL);
+}
+
+// -----------------------------------------------------------------------------
+H2_Server::~H2_Server()				// destructor
+{
+	delete[] scratch_; scratch_ = NULL;
+	delete query_;  query_  = NULL;
+	delete norm_q_; norm_q_ = NULL;
+}
+
+// -----------------------------------------------------------------------------
+int H2_Server::run(					// serve requests until shut down
+	int   port,							// TCP port (0: stdin)
+	int   out_fd)						// fd of responses for stdin
+{
+	signal(SIGPIPE, SIG_IGN);		// a closed client must not kill the server
+
+	int listen_fd = -1;
+	if (port == 0) {
+		Server_Client client;
+		client.in_ = STDIN_FILENO; client.out_ = out_fd; client.alive_ = true;
+		clients_.push_back(client);
+		printf("Serving k-MIP requests on stdin ");
+	}
+	else {
+		listen_fd = socket(AF_INET, SOCK_STREAM, 0);
+		int on = 1;
+		setsockopt(listen_fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+
+		sockaddr_in addr;
+		memset(&addr, 0, sizeof(addr));
+		addr.sin_family      = AF_INET;
+		addr.sin_addr.s_addr = htonl(INADDR_ANY);
+		addr.sin_port        = htons((uint16_t) port);
+		if (listen_fd < 0 || bind(listen_fd, (sockaddr*) &addr, 
+			sizeof(addr)) != 0 || listen(listen_fd, SOMAXCONN) != 0) {
+			printf("Could not listen on port %d\n", port);
+			if (listen_fd >= 0) close(listen_fd);
+			return 1;
+		}
+		printf("Serving k-MIP requests on port %d ", port);
+	}
+	printf("(batch = %d, wait = %d us, threads = %d)\n\n", batch_, wait_, 
+		num_threads_);
+	fflush(stdout);
+
+	// -------------------------------------------------------------------------
+	//  event loop: wait for requests (or the end of the batch window), read 
+	//  all clients that have data, and search the pending requests once the 
+	//  window of the first one is over
+	// -------------------------------------------------------------------------
+	std::vector<pollfd> fds;
+	std::vector<int> ids;			// client of fds[i] (-1: listener)
+	while (!stop_) {
+		timeval now;
+		gettimeofday(&now, NULL);
+		float timeout = SERVER_REPORT * 1000000.0f - 
+			elapsed_us(last_report_, now);
+		if (!pending_.empty()) {
+			timeout = MIN(timeout, wait_ - elapsed_us(pending_[0].arrive_, now));
+		}
+		timeout = MAX(timeout, 0.0f);
+
+		fds.clear(); ids.clear();
+		if (listen_fd >= 0) {
+			pollfd p = { listen_fd, POLLIN, 0 };
+			fds.push_back(p); ids.push_back(-1);
+		}
+		for (int c = 0; c < (int) clients_.size(); ++c) {
+			if (!clients_[c].alive_) continue;
+			pollfd p = { clients_[c].in_, POLLIN, 0 };
+			fds.push_back(p); ids.push_back(c);
+		}
+		if (fds.empty()) break;		// stdin is closed
+
+		timespec ts;
+		ts.tv_sec  = (time_t) (timeout / 1000000.0f);
+		ts.tv_nsec = (long) (timeout - ts.tv_sec * 1000000.0f) * 1000L;
+		if (ppoll(&fds[0], fds.size(), &ts, NULL) < 0 && errno != EINTR) {
+			printf("Could not poll requests (errno = %d)\n", errno);
+			break;
+		}
+
+		for (size_t i = 0; i < fds.size() && !stop_; ++i) {
+			if (fds[i].revents == 0) continue;
+			if (ids[i] >= 0) { read_client(ids[i]); continue; }
+
+			int fd = accept(listen_fd, NULL, NULL);
+			if (fd < 0) continue;
+			Server_Client client;
+			client.in_ = fd; client.out_ = fd; client.alive_ = true;
+			clients_.push_back(client);
+		}
+
+		gettimeofday(&now, NULL);
+		if (!pending_.empty() && elapsed_us(pending_[0].arrive_, now) >= wait_) {
+			flush();
+		}
+		report(false);
+
+		// ---------------------------------------------------------------------
+		//  drop closed clients (pending requests refer to clients by id)
+		// ---------------------------------------------------------------------
+		if (pending_.empty() && listen_fd >= 0) {
+			int num = 0;
+			for (size_t c = 0; c < clients_.size(); ++c) {
+				if (clients_[c].alive_) clients_[num++] = clients_[c];
+			}
+			clients_.resize(num);
+		}
+	}
+	if (!pending_.empty()) flush();
+	report(true);
+
+	// -------------------------------------------------------------------------
+	//  close all clients
+	// -------------------------------------------------------------------------
+	for (size_t c = 0; c < clients_.size(); ++c) {
+		if (clients_[c].alive_ && listen_fd >= 0) close(clients_[c].in_);
+	}
+	clients_.clear();
+	if (listen_fd >= 0) close(listen_fd);
+
+	return 0;
+}
+
+// -----------------------------------------------------------------------------
+void H2_Server::read_client(		// read and handle requests of a client
+	int   c)							// client id
+{
+	char tmp[65536];
+	ssize_t num = read(clients_[c].in_, tmp, sizeof(tmp));
+	if (num <= 0) {
+		if (num < 0 && errno == EINTR) return;
+		if (clients_[c].in_ != STDIN_FILENO) close(clients_[c].in_);
+		clients_[c].alive_ = false;
+		return;
+	}
+
+	// -------------------------------------------------------------------------
+	//  handle all complete requests, and keep the rest for the next read
+	// -------------------------------------------------------------------------
+	std::vector<char> &buf = clients_[c].buf_;
+	buf.insert(buf.end(), tmp, tmp + num);
+
+	size_t size = (size_t) (dim_ + 1) * 4;
+	size_t pos  = 0;
+	while (buf.size() - pos >= size && !stop_) {
+		request(c, &buf[pos]);
+		pos += size;
+	}
+	buf.erase(buf.begin(), buf.begin() + pos);
+}
+
+// -----------------------------------------------------------------------------
+void H2_Server::request(			// handle one request
+	int   c,							// client id
+	const char *req)					// request (4 + 4d bytes)
+{
+	int32_t k = 0;
+	memcpy(&k, req, 4);
+	if (k < 0) { stop_ = true; return; }
+
+	if (k == 0) {
+		flush();					// keep the order of responses
+		float cnt[5];
+		counters(cnt);
+
+		int32_t num = 5;
+		std::vector<char> out(4 + sizeof(cnt));
+		memcpy(&out[0], &num, 4);
+		memcpy(&out[4], cnt, sizeof(cnt));
+		send(c, out);
+		return;
+	}
+
+	// -------------------------------------------------------------------------
+	//  add a k-MIP request to the micro-batch
+	// -------------------------------------------------------------------------
+	int i = (int) pending_.size();
+	float *query = query_->row(i);
+	if (pca_ != NULL) {
+		raw_.resize(dim_);
+		memcpy(raw_.data(), req + 4, dim_ * SIZEFLOAT);
+		const float *raw = raw_.data();
+		pca_->rotate(1, &raw, &query);
+	}
+	else {
+		memcpy(query, req + 4, dim_ * SIZEFLOAT);
+	}
+	calc_norm(dim_, query, norm_q_->row(i));
+
+	Server_Request r;
+	r.client_ = c;
+	r.k_      = MIN((int) k, MAXK);
+	gettimeofday(&r.arrive_, NULL);
+	pending_.push_back(r);
+
+	if ((int) pending_.size() >= batch_) flush();
+}
+
+// -----------------------------------------------------------------------------
+void H2_Server::flush()				// search all pending requests
+{
+	int num = (int) pending_.size();
+	if (num == 0) return;
+
+	// -------------------------------------------------------------------------
+	//  group the requests by k (in arrival order within a group)
+	// -------------------------------------------------------------------------
+	std::vector<int> order(num);
+	for (int i = 0; i < num; ++i) order[i] = i;
+	std::stable_sort(order.begin(), order.end(), [&](int a, int b) {
+		return pending_[a].k_ < pending_[b].k_; });
+
+	std::vector<const float*> query(num), norm_q(num);
+	std::vector<MaxK_List*> list(num);
+	for (int i = 0; i < num; ++i) {
+		query[i]  = query_->row(order[i]);
+		norm_q[i] = norm_q_->row(order[i]);
+		list[i]   = new MaxK_List(pending_[order[i]].k_);
+	}
+
+	for (int g = 0; g < num; ) {
+		int top_k = pending_[order[g]].k_;
+		int cnt   = 1;
+		while (g + cnt < num && pending_[order[g + cnt]].k_ == top_k) ++cnt;
+
+		if (cnt == 1) {
+			lsh_->kmip(top_k, query[g], norm_q[g], &scratch_[0], list[g]);
+		}
+		else {
+			int chunks = MIN(num_threads_, cnt);
+			int per    = (cnt + chunks - 1) / chunks;
+			parallel_for(chunks, num_threads_, [&](int tid, int j) {
+				int first = g + j * per;
+				int size  = MIN(per, g + cnt - first);
+				if (size <= 0) return;
+				lsh_->kmip_batch(top_k, size, &query[first], &norm_q[first], 
+					&scratch_[tid], &list[first]);
+			});
+		}
+		g += cnt;
+	}
+
+	// -------------------------------------------------------------------------
+	//  respond in arrival order
+	// -------------------------------------------------------------------------
+	std::vector<int> slot(num);		// position of request i in list
+	for (int i = 0; i < num; ++i) slot[order[i]] = i;
+
+	std::vector<char> out;
+	timeval now;
+	for (int i = 0; i < num; ++i) {
+		MaxK_List *l = list[slot[i]];
+		int32_t size = l->size();
+		out.resize(4 + (size_t) size * 8);
+		memcpy(&out[0], &size, 4);
+		for (int j = 0; j < size; ++j) {
+			int32_t id = l->ith_id(j) - 1;
+			float   ip = l->ith_key(j);
+			memcpy(&out[4 + j * 8], &id, 4);
+			memcpy(&out[8 + j * 8], &ip, 4);
+		}
+		send(pending_[i].client_, out);
+
+		gettimeofday(&now, NULL);
+		latency_.push_back(elapsed_us(pending_[i].arrive_, now) / 1000.0f);
+	}
+	queries_ += num;
+	++batches_;
+
+	for (int i = 0; i < num; ++i) {
+		delete list[i]; list[i] = NULL;
+	}
+	pending_.clear();
+}
+
+// -----------------------------------------------------------------------------
+void H2_Server::counters(			// counters since the last report
+	float *cnt)							// 5 counters (return)
+{
+	timeval now;
+	gettimeofday(&now, NULL);
+	float secs = elapsed_us(last_report_, now) / 1000000.0f;
+	int   num  = (int) latency_.size();
+
+	float mean = 0.0f, p99 = 0.0f;
+	if (num > 0) {
+		for (int i = 0; i < num; ++i) mean += latency_[i];
+		mean /= num;
+
+		std::vector<float> sorted(latency_);
+		int pos = MAX(0, (int) ceil(0.99f * num) - 1);
+		std::nth_element(sorted.begin(), sorted.begin() + pos, sorted.end());
+		p99 = sorted[pos];
+	}
+	cnt[0] = (float) queries_;
+	cnt[1] = (float) batches_;
+	cnt[2] = secs > 0.0f ? num / secs : 0.0f;
+	cnt[3] = mean;
+	cnt[4] = p99;
+}
+
+// -----------------------------------------------------------------------------
+void H2_Server::report(				// report QPS and latencies
+	bool  force)						// report before SERVER_REPORT
+{
+	timeval now;
+	gettimeofday(&now, NULL);
+	float secs = elapsed_us(last_report_, now) / 1000000.0f;
+	if (!force && secs < SERVER_REPORT) return;
+
+	if (!latency_.empty()) {
+		float cnt[5];
+		counters(cnt);
+		printf("Served %lld queries in %lld batches: %.1f QPS, mean %.3f ms, "
+			"p99 %.3f ms (last %.1f s)\n", queries_, batches_, cnt[2], cnt[3], 
+			cnt[4], secs);
+		fflush(stdout);
+	}
+	latency_.clear();
+	last_report_ = now;
+}
+
+// -----------------------------------------------------------------------------
+void H2_Server::send(				// send a response to a client
+	int   c,							// client id
+	const std::vector<char> &buf)		// response
+{
+	Server_Client &client = clients_[c];
+	if (!client.alive_ && client.in_ != STDIN_FILENO) return;
+
+	size_t pos = 0;
+	while (pos < buf.size()) {
+		ssize_t num = write(client.out_, &buf[pos], buf.size() - pos);
+		if (num < 0 && errno == EINTR) continue;
+		if (num <= 0) {
+			if (client.alive_ && client.in_ != STDIN_FILENO) close(client.in_);
+			client.alive_ = false;
+			return;
+		}
+		pos += num;
+	}
+}
@@ -0,0 +1,116 @@
+#ifndef __SERVER_H
+#define __SERVER_H
+
+#include <vector>
+#include <sys/time.h>
+
+class H2_ALSH;
+class QALSH_Scratch;
+class Matrix;
+class PCA;
+
+extern int g_server_port;			// global parameter: TCP port (0: stdin)
+extern int g_batch_wait;			// global parameter: batch window (us)
+
+// -----------------------------------------------------------------------------
+//  H2_Server: a long-running k-MIP server over one H2_ALSH index, which reads 
+//  requests from stdin (port 0; the responses go to out_fd) or from the TCP 
+//  clients of port. All integers and floats are 32-bit, little-endian.
+//
+//  request:  int32 k, then the query (d floats); every request has 4 + 4d 
+//            bytes. k > 0 asks for the top-k MIP results of the query (k is 
+//            at most MAXK), k = 0 for the counters of the server, and k < 0 
+//            shuts the server down (the query is ignored in both cases).
+//  response: int32 num, then num pairs (int32 id, float ip) in descending 
+//            order of ip, where id is the 0-based id of the data object; for 
+//            k = 0, num = 5 and five floats follow instead: queries and 
+//            batches served so far, and the QPS, mean and p99 latency (ms) 
+//            since the last report.
+//
+//  requests that arrive within wait microseconds of the first pending one 
+//  (and at most batch of them) are searched as one micro-batch: the queries 
+//  with the same k go to H2_ALSH::kmip_batch, split over -nt threads, and a 
+//  single query goes to H2_ALSH::kmip. Every client gets its responses in 
+//  the order of its requests (a counter request ends the batch). The QPS and 
+//  latencies (from the arrival of a request to its response) are reported 
+//  every SERVER_REPORT seconds. With pca, the index is built on rotated data, 
+//  so every query is rotated the same way before it is searched.
+// -----------------------------------------------------------------------------
+struct Server_Client {				// connection of a client
+	int   in_;							// fd of requests
+	int   out_;							// fd of responses
+	bool  alive_;						// false once closed
+	std::vector<char> buf_;				// bytes of incomplete requests
+};
+
+struct Server_Request {				// pending k-MIP request
+	int   client_;						// client id
+	int   k_;							// top-k value
+	timeval arrive_;					// arrival time
+};
+
+class H2_Server {
+public:
+	H2_Server(						// constructor
+		H2_ALSH *lsh,					// index
+		int   d,						// dimensionality
+		int   batch,					// max requests per micro-batch
+		int   wait,						// batch window (in microseconds)
+		const PCA *pca);				// rotation of data (or NULL)
+
+	// -------------------------------------------------------------------------
+	~H2_Server();					// destructor
+
+	// -------------------------------------------------------------------------
+	int run(						// serve requests until shut down
+		int   port,						// TCP port (0: stdin)
+		int   out_fd);					// fd of responses for stdin
+
+protected:
+	H2_ALSH *lsh_;					// index
+	int   dim_;						// dimensionality
+	int   batch_;					// max requests per micro-batch
+	int   wait_;					// batch window (in microseconds)
+	const PCA *pca_;				// rotation of data (or NULL)
+	int   num_threads_;				// threads of a micro-batch
+	bool  stop_;					// true once shut down
+	QALSH_Scratch *scratch_;		// search contexts (one per thread)
+
+	Matrix *query_;					// queries of pending requests
+	Matrix *norm_q_;				// l2-norms of pending queries
+	std::vector<float> raw_;		// query of a request before rotation
+	std::vector<Server_Request> pending_; // pending requests
+	std::vector<Server_Client>  clients_; // clients
+
+	long long queries_;				// queries served
+	long long batches_;				// micro-batches served
+	timeval   last_report_;			// time of the last report
+	std::vector<float> latency_;	// latencies since the last report (ms)
+
+	// -------------------------------------------------------------------------
+	void read_client(				// read and handle requests of a client
+		int   c);						// client id
+
+	// -------------------------------------------------------------------------
+	void request(					// handle one request
+		int   c,						// client id
+		const char *req);				// request (4 + 4d bytes)
+
+	// -------------------------------------------------------------------------
+	void flush();					// search all pending requests
+
+	// -------------------------------------------------------------------------
+	void counters(					// counters since the last report
+		float *cnt);					// 5 counters (return)
+
+	// -------------------------------------------------------------------------
+	void report(					// report QPS and latencies
+		bool  force);					// report before SERVER_REPORT
+
+	// -------------------------------------------------------------------------
+	void send(						// send a response to a client
+		int   c,						// client id
+		const std::vector<char> &buf);	// response
+};
+
+#endif // __SERVER_H
@@ -1,9 +1,17 @@
 #include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
 
 #include "def.h"
 #include "util.h"
+#include "simd.h"
+#include "matrix.h"
 #include "pri_queue.h"
 #include "srp_lsh.h"
+#include "sq8.h"
 #include "sign_alsh.h"
 
 // -----------------------------------------------------------------------------
@@ -21,12 +29,14 @@ Sign_ALSH::Sign_ALSH(				// constructor
 	// -------------------------------------------------------------------------
 	n_pts_         = n;
 	dim_           = d;
+	kern_          = dim_kernels(d);
 	K_             = K;
 	m_             = m;
 	U_             = U;
 	data_          = data;
 	norm_d_        = norm_d;
 	sign_alsh_dim_ = d + m;
+	index_file_    = NULL;
 
 	// -------------------------------------------------------------------------
 	//  build index
@@ -38,10 +48,13 @@ Sign_ALSH::Sign_ALSH(				// constructor
 Sign_ALSH::~Sign_ALSH()				// destructor
 {
 	delete lsh_; lsh_ = NULL;
-	for (int i = 0; i < n_pts_; ++i) {
-		delete[] sign_alsh_data_[i]; sign_alsh_data_[i] = NULL;
+	delete sq8_; sq8_ = NULL;
+	delete sign_alsh_data_; sign_alsh_data_ = NULL;
+
+	if (index_file_ != NULL) {
+		munmap_file(index_file_);
+		delete index_file_; index_file_ = NULL;
 	}
-	delete[] sign_alsh_data_; sign_alsh_data_ = NULL;
 }
 
 // -----------------------------------------------------------------------------
@@ -63,18 +76,18 @@ void Sign_ALSH::bulkload()			// bulkloading
 	float scale = U_ / M_;
 	int   exponent = -1;
 
-	sign_alsh_data_ = new float*[n_pts_];
+	sign_alsh_data_ = new Matrix(n_pts_, sign_alsh_dim_);
 	for (int i = 0; i < n_pts_; ++i) {
-		sign_alsh_data_[i] = new float[sign_alsh_dim_];
+		float *sign_alsh_data = sign_alsh_data_->row(i);
 
 		norm[i] *= scale;
 		for (int j = 0; j < sign_alsh_dim_; ++j) {
 			if (j < dim_) {
-				sign_alsh_data_[i][j] = data_[i][j] * scale;
+				sign_alsh_data[j] = data_[i][j] * scale;
 			}
 			else {
 				exponent = (int) pow(2.0f, j - dim_ + 1);
-				sign_alsh_data_[i][j] = 0.5f - pow(norm[i], exponent);
+				sign_alsh_data[j] = 0.5f - pow(norm[i], exponent);
 			}
 		}
 	}
@@ -82,7 +95,79 @@ void Sign_ALSH::bulkload()			// bulkloading
 	// -------------------------------------------------------------------------
 	//  indexing the new format of data using srp-lsh
 	// -------------------------------------------------------------------------
-	lsh_ = new SRP_LSH(n_pts_, sign_alsh_dim_, K_, (const float **) sign_alsh_data_);
+	lsh_ = new SRP_LSH(n_pts_, sign_alsh_dim_, K_, 
+		(const float **) sign_alsh_data_->rows());
+	sq8_ = g_sq_frac > 0.0f ? new SQ8(n_pts_, dim_, data_) : NULL;
+}
+
+// -----------------------------------------------------------------------------
+int Sign_ALSH::save(				// write index to disk
+	const char *fname)					// address of index file
+{
+	FILE *fp = fopen(fname, "wb");
+	if (!fp) {
+		printf("Could not create %s\n", fname);
+		return 1;
+	}
+
+	float para[2] = { U_, M_ };
+	int ret = write_index_header(fp, IDX_SIGN_ALSH, n_pts_, dim_);
+	ret |= write_aligned(fp, &m_, sizeof(int));
+	ret |= write_aligned(fp, para, sizeof(para));
+	if (ret == 0) ret = lsh_->save(fp);
+	fclose(fp);
+
+	if (ret != 0) {
+		printf("Could not write %s\n", fname);
+		return 1;
+	}
+	return 0;
+}
+
+// -----------------------------------------------------------------------------
+Sign_ALSH* Sign_ALSH::load(			// load index from disk (mmap-ed)
+	int   n,							// number of data objects
+	int   d,							// dimension of data objects
+	const char *fname,					// address of index file
+	const float **data, 				// input data
+	const float **norm_d)				// l2-norm of data objects
+{
+	Mmap_File  *mf = new Mmap_File();
+	Mmap_Cursor in;
+	if (open_index(fname, IDX_SIGN_ALSH, n, d, mf, &in) == 1) {
+		delete mf;
+		return NULL;
+	}
+
+	Sign_ALSH *lsh = new Sign_ALSH();
+	lsh->n_pts_  = n;
+	lsh->dim_    = d;
+	lsh->kern_   = dim_kernels(d);
+	lsh->data_   = data;
+	lsh->norm_d_ = norm_d;
+	lsh->sign_alsh_data_ = NULL;	// only needed to build the SRP_LSH
+	lsh->index_file_     = mf;
+	lsh->sq8_ = NULL;
+
+	const int   *m    = (const int *) read_aligned(&in, sizeof(int));
+	const float *para = (const float *) read_aligned(&in, 2 * SIZEFLOAT);
+	lsh->lsh_ = NULL;
+	if (m != NULL && para != NULL && *m > 0) {
+		lsh->lsh_ = SRP_LSH::load(&in, n, d + *m, NULL);
+	}
+	if (lsh->lsh_ == NULL) {
+		printf("Corrupted Sign_ALSH index %s\n", fname);
+		delete lsh;
+		return NULL;
+	}
+	lsh->m_             = *m;
+	lsh->U_             = para[0];
+	lsh->M_             = para[1];
+	lsh->sign_alsh_dim_ = d + *m;
+	lsh->K_             = lsh->lsh_->num_hash();
+	if (g_sq_frac > 0.0f) lsh->sq8_ = new SQ8(n, d, data);
+
+	return lsh;
 }
 
 // -----------------------------------------------------------------------------
@@ -97,11 +182,23 @@ void Sign_ALSH::display()			// display parameters
 	printf("    M = %f\n\n", M_);
 }
 
+// -----------------------------------------------------------------------------
+size_t Sign_ALSH::index_size()		// memory of index (without data)
+{
+	size_t size = lsh_->index_size();
+	if (sq8_ != NULL) size += sq8_->index_size();
+
+	Matrix *trans = sign_alsh_data_;	// transformed data (NULL if loaded)
+	if (trans != NULL) size += (size_t) trans->n() * trans->stride() * SIZEFLOAT;
+	return size;
+}
+
 // -----------------------------------------------------------------------------
 int Sign_ALSH::kmip(				// c-k-AMIP search
 	int   top_k,						// top-k value
 	const float *query,					// input query
 	const float *norm_q,				// l2-norm of query
+	SRP_Scratch *scratch,				// search context of this thread
 	MaxK_List *list)					// top-k mip results
 {
 	float kip   = MINREAL;
@@ -110,7 +207,7 @@ int Sign_ALSH::kmip(				// c-k-AMIP search
 	// -------------------------------------------------------------------------
 	//  construct Sign_ALSH query
 	// -------------------------------------------------------------------------
-	float *sign_alsh_query = new float[sign_alsh_dim_]; // dim + m
+	float *sign_alsh_query = scratch->query_buf(sign_alsh_dim_); // dim + m
 	for (int i = 0; i < sign_alsh_dim_; ++i) {
 		if (i < dim_) sign_alsh_query[i] = query[i] / normq;
 		else sign_alsh_query[i] = 0.0f;
@@ -119,22 +216,32 @@ int Sign_ALSH::kmip(				// c-k-AMIP search
 	// -------------------------------------------------------------------------
 	//  conduct c-k-AMC search by SRP-LSH
 	// -------------------------------------------------------------------------
-	std::vector<int> cand;
-	lsh_->kmc(top_k, (const float *) sign_alsh_query, cand);
+	std::vector<int> &cand = scratch->cand();
+	cand.clear();
+	lsh_->kmc(top_k, (const float *) sign_alsh_query, scratch, cand);
 
 	// -------------------------------------------------------------------------
-	//  calc inner product for candidates returned by SRP-LSH
+	//  calc inner product for candidates returned by SRP-LSH (or for the best 
+	//  of them by their int8 codes)
 	// -------------------------------------------------------------------------
+	if (sq8_ != NULL) {
+		sq8_->filter(top_k, query, NULL, cand, 
+			scratch->score_buf(sq8_->buf_size((int) cand.size())));
+	}
 	int size = (int) cand.size();
+	sort_cand(size, norm_d_, cand.data());
 	for (int i = 0; i < size; ++i) {
+		if (i + PREFETCH_DIST < size) {
+			int next = cand[i + PREFETCH_DIST];
+			prefetch_point(dim_, data_[next], norm_d_[next]);
+		}
 		int id = cand[i];
 		if (norm_d_[id][0] * normq <= kip) break;
-				
-		float ip = calc_inner_product(dim_, kip, data_[id], norm_d_[id], 
-			query, norm_q);
+
+		float ip = calc_inner_product(kern_, dim_, kip, data_[id], 
+			norm_d_[id], query, norm_q);
 		kip = list->insert(ip, id + 1);
 	}
-	delete[] sign_alsh_query; sign_alsh_query = NULL;
 
 	return 0;
 }
\ No newline at end of file
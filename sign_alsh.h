@@ -2,7 +2,12 @@
 #define __SIGN_ALSH_H
 
 class SRP_LSH;
+class SRP_Scratch;
+class SQ8;
+class Matrix;
 class MaxK_List;
+struct Mmap_File;
+struct Dim_Kernels;
 
 // -----------------------------------------------------------------------------
 //  Sign-LSH is used to solve the problem of c-Approximate Maximum Inner 
@@ -30,16 +35,36 @@ public:
 	// -------------------------------------------------------------------------
 	void display();					// display parameters
 
+	// -------------------------------------------------------------------------
+	size_t index_size();			// memory of index (without data)
+
 	// -------------------------------------------------------------------------
 	int kmip(						// c-k-AMIP search
 		int   top_k,					// top-k value
 		const float *query,				// input query
 		const float *norm_q,			// l2-norm of query
+		SRP_Scratch *scratch,			// search context of this thread
 		MaxK_List *list);				// top-k mip results
 
+	// -------------------------------------------------------------------------
+	int save(						// write index to disk
+		const char *fname);				// address of index file
+
+	// -------------------------------------------------------------------------
+	static Sign_ALSH* load(			// load index from disk (mmap-ed)
+		int   n,						// number of data objects
+		int   d,						// dimension of data objects
+		const char *fname,				// address of index file
+		const float **data, 			// input data
+		const float **norm_d);			// l2-norm of data objects
+
 protected:
+	Sign_ALSH() {}					// constructor (used by load)
+
+	// -------------------------------------------------------------------------
 	int   n_pts_;					// number of data points
 	int   dim_;						// dimensionality
+	const Dim_Kernels *kern_;		// kernels for dim_ (simd.h)
 	int   K_;						// number of hash tables
 	int   m_;						// additional dimension of data
 	float U_;						// scale factor
@@ -48,8 +73,10 @@ protected:
 
 	float M_;						// max norm of data objects
 	int   sign_alsh_dim_;			// dimension of sign_alsh data
-	float **sign_alsh_data_;		// sign_alsh data
+	Matrix *sign_alsh_data_;		// sign_alsh data
+	Mmap_File *index_file_;			// mapping of loaded index (or NULL)
 	SRP_LSH *lsh_;					// SRP_LSH
+	SQ8   *sq8_;					// int8 codes of data (or NULL)
 
 	// -------------------------------------------------------------------------
 	void bulkload();				// bulkloading
@@ -0,0 +1,843 @@
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define SIMD_X86
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+#include <arm_neon.h>
+#define SIMD_NEON
+#endif
+
+#include "def.h"
+#include "simd.h"
+#include "stats.h"
+
+// -----------------------------------------------------------------------------
+//  scalar kernels
+// -----------------------------------------------------------------------------
+static float ip_scalar(				// plain inner product
+	int   dim,							// dimension
+	const float *p1,					// 1st point
+	const float *p2)					// 2nd point
+{
+	float ret = 0.0f;
+	for (int i = 0; i < dim; ++i) {
+		ret += p1[i] * p2[i];
+	}
+	return ret;
+}
+
+// -----------------------------------------------------------------------------
+static float ip_thres_scalar(		// inner product with early termination
+	int   dim,							// dimension
+	float threshold,					// threshold
+	const float *p1,					// 1st point
+	const float *norm1,					// l2-norm of 1st point
+	const float *p2,					// 2nd point
+	const float *norm2)					// l2-norm of 2nd point
+{
+	float ip = 0.0f;
+	int base = 0;
+	for (int t = 1; t < NORM_K && NORM_DIMS[t-1] <= dim; ++t) {
+		for (; base < NORM_DIMS[t-1]; ++base) {
+			ip += p1[base] * p2[base];
+		}
+		if (ip + norm1[t]*norm2[t] <= threshold) {
+			STATS_ADD(early_, 1); return ip;
+		}
+	}
+	for (int i = base; i < dim; ++i) {
+		ip += p1[i] * p2[i];
+	}
+	return ip;
+}
+
+// -----------------------------------------------------------------------------
+static float l2_sqr_scalar(			// l2 square distance with threshold
+	int   dim,							// dimension
+	float threshold,					// threshold
+	const float *p1,					// 1st point
+	const float *p2)					// 2nd point
+{
+	unsigned d = dim & ~unsigned(7);
+	const float *aa = p1, *end_a = aa + d;
+	const float *bb = p2, *end_b = bb + d;
+
+	__builtin_prefetch(aa, 0, 3);
+	__builtin_prefetch(bb, 0, 0);
+
+	float r = 0.0f;
+	float r0, r1, r2, r3, r4, r5, r6, r7;
+
+	const float *a = end_a, *b = end_b;
+
+	r0 = r1 = r2 = r3 = r4 = r5 = r6 = r7 = 0.0f;
+	switch (dim & 7) {
+		case 7: r6 = SQR(a[6] - b[6]);
+		case 6: r5 = SQR(a[5] - b[5]);
+		case 5: r4 = SQR(a[4] - b[4]);
+		case 4: r3 = SQR(a[3] - b[3]);
+		case 3: r2 = SQR(a[2] - b[2]);
+		case 2: r1 = SQR(a[1] - b[1]);
+		case 1: r0 = SQR(a[0] - b[0]);
+	}
+
+	a = aa; b = bb;
+	for (; a < end_a; a += 8, b += 8) {
+		__builtin_prefetch(a+32, 0, 3);
+		__builtin_prefetch(b+32, 0, 0);
+
+		r += (r0 + r1 + r2 + r3 + r4 + r5 + r6 + r7);
+		if (r > threshold) return r;
+
+		r0 = SQR(a[0] - b[0]);
+		r1 = SQR(a[1] - b[1]);
+		r2 = SQR(a[2] - b[2]);
+		r3 = SQR(a[3] - b[3]);
+		r4 = SQR(a[4] - b[4]);
+		r5 = SQR(a[5] - b[5]);
+		r6 = SQR(a[6] - b[6]);
+		r7 = SQR(a[7] - b[7]);
+	}
+	r += (r0 + r1 + r2 + r3 + r4 + r5 + r6 + r7);
+
+	return r;
+}
+
+// -----------------------------------------------------------------------------
+static void ip4_scalar(				// inner products of a query and 4 points
+	int   dim,							// dimension
+	const float *q,						// query
+	const float **p,					// 4 points
+	float *ip)							// 4 inner products (return)
+{
+	float r0 = 0.0f, r1 = 0.0f, r2 = 0.0f, r3 = 0.0f;
+	for (int i = 0; i < dim; ++i) {
+		r0 += q[i] * p[0][i];
+		r1 += q[i] * p[1][i];
+		r2 += q[i] * p[2][i];
+		r3 += q[i] * p[3][i];
+	}
+	ip[0] = r0; ip[1] = r1; ip[2] = r2; ip[3] = r3;
+}
+
+// -----------------------------------------------------------------------------
+static void hamming_scalar(			// Hamming distances to a query code
+	int   n,							// number of codes
+	int   m,							// number of uint64_t words per code
+	const uint64_t *codes,				// codes (n x m, contiguous)
+	const uint64_t *q,					// query code (m words)
+	uint16_t *dist)						// Hamming distances (return)
+{
+	for (int i = 0; i < n; ++i, codes += m) {
+		int r = 0;
+		for (int j = 0; j < m; ++j) r += __builtin_popcountll(codes[j] ^ q[j]);
+		dist[i] = (uint16_t) r;
+	}
+}
+
+// -----------------------------------------------------------------------------
+static float ip_u8_scalar(			// inner product with a uint8 code
+	int   dim,							// dimension
+	const float *q,						// query (floats)
+	const uint8_t *code)				// code (dim bytes)
+{
+	float ret = 0.0f;
+	for (int i = 0; i < dim; ++i) {
+		ret += q[i] * (float) code[i];
+	}
+	return ret;
+}
+
+#ifdef SIMD_X86
+#define TARGET_AVX2     __attribute__((target("avx2,fma")))
+#define TARGET_AVX512   __attribute__((target("avx512f,avx2,fma")))
+#define TARGET_POPCNT   __attribute__((target("popcnt")))
+#define TARGET_AVX512BW __attribute__((target("avx512f,avx512bw")))
+#define TARGET_VPOPCNT  __attribute__((target("avx512f,avx512vpopcntdq")))
+
+// -----------------------------------------------------------------------------
+//  AVX2 kernels (8 floats per register)
+//
+//  ip, ip_thres, and l2_sqr are templates on a fixed dimension D: with D > 0, 
+//  dim is the constant D, so all loops have constant trip counts, which the 
+//  compiler unrolls, and the tails are resolved at compile time. The kernels 
+//  of g_simd are the ones with D = 0 (see dim_kernels).
+// -----------------------------------------------------------------------------
+constexpr int checked_dim(			// dims before the last checkpoint
+	int   D,							// fixed dimension
+	int   t = 0)						// next checkpoint
+{
+	return t < NORM_K - 1 && NORM_DIMS[t] <= D ? checked_dim(D, t + 1) : 
+		(t > 0 ? NORM_DIMS[t-1] : 0);
+}
+
+// -----------------------------------------------------------------------------
+constexpr int rest_dim(				// dim after the partial-norm checkpoints
+	int   D)							// fixed dimension (0: none)
+{
+	return D > 0 ? D - checked_dim(D) : 0;
+}
+
+// -----------------------------------------------------------------------------
+TARGET_AVX2 static inline float hsum_avx2(// horizontal sum of 8 floats
+	__m256 v)							// input register
+{
+	__m128 x = _mm_add_ps(_mm256_castps256_ps128(v), _mm256_extractf128_ps(v,1));
+	x = _mm_add_ps(x, _mm_movehl_ps(x, x));
+	x = _mm_add_ss(x, _mm_movehdup_ps(x));
+	return _mm_cvtss_f32(x);
+}
+
+// -----------------------------------------------------------------------------
+template<int D>						// fixed dimension (0: dim)
+TARGET_AVX2 static float ip_avx2_t(	// plain inner product
+	int   dim,							// dimension
+	const float *p1,					// 1st point
+	const float *p2)					// 2nd point
+{
+	if (D > 0) dim = D;
+	__m256 s0 = _mm256_setzero_ps(), s1 = _mm256_setzero_ps();
+	__m256 s2 = _mm256_setzero_ps(), s3 = _mm256_setzero_ps();
+
+	int i = 0;
+	for (; i + 32 <= dim; i += 32) {
+		s0 = _mm256_fmadd_ps(_mm256_loadu_ps(p1+i),    _mm256_loadu_ps(p2+i),    s0);
+		s1 = _mm256_fmadd_ps(_mm256_loadu_ps(p1+i+8),  _mm256_loadu_ps(p2+i+8),  s1);
+		s2 = _mm256_fmadd_ps(_mm256_loadu_ps(p1+i+16), _mm256_loadu_ps(p2+i+16), s2);
+		s3 = _mm256_fmadd_ps(_mm256_loadu_ps(p1+i+24), _mm256_loadu_ps(p2+i+24), s3);
+	}
+	for (; i + 8 <= dim; i += 8) {
+		s0 = _mm256_fmadd_ps(_mm256_loadu_ps(p1+i), _mm256_loadu_ps(p2+i), s0);
+	}
+	float ret = hsum_avx2(_mm256_add_ps(_mm256_add_ps(s0, s1),
+		_mm256_add_ps(s2, s3)));
+	for (; i < dim; ++i) {
+		ret += p1[i] * p2[i];
+	}
+	return ret;
+}
+
+// -----------------------------------------------------------------------------
+template<int D>						// fixed dimension (0: dim)
+TARGET_AVX2 static float ip_thres_avx2_t(// inner product with early termination
+	int   dim,							// dimension
+	float threshold,					// threshold
+	const float *p1,					// 1st point
+	const float *norm1,					// l2-norm of 1st point
+	const float *p2,					// 2nd point
+	const float *norm2)					// l2-norm of 2nd point
+{
+	if (D > 0) dim = D;
+	__m256 acc = _mm256_setzero_ps();
+	float  ip  = 0.0f;
+	int    base = 0;
+	for (int t = 1; t < NORM_K && NORM_DIMS[t-1] <= dim; ++t) {
+		for (; base < NORM_DIMS[t-1]; base += 8) {
+			acc = _mm256_fmadd_ps(_mm256_loadu_ps(p1+base),
+				_mm256_loadu_ps(p2+base), acc);
+		}
+		ip = hsum_avx2(acc);
+		if (ip + norm1[t]*norm2[t] <= threshold) {
+			STATS_ADD(early_, 1); return ip;
+		}
+	}
+	return ip + ip_avx2_t<rest_dim(D)>(dim - base, p1 + base, p2 + base);
+}
+
+// -----------------------------------------------------------------------------
+template<int D>						// fixed dimension (0: dim)
+TARGET_AVX2 static float l2_sqr_avx2_t(// l2 square distance with threshold
+	int   dim,							// dimension
+	float threshold,					// threshold
+	const float *p1,					// 1st point
+	const float *p2)					// 2nd point
+{
+	if (D > 0) dim = D;
+	__m256 s0 = _mm256_setzero_ps(), s1 = _mm256_setzero_ps();
+	__m256 s2 = _mm256_setzero_ps(), s3 = _mm256_setzero_ps();
+
+	int i = 0;
+	for (; i + 32 <= dim; i += 32) {
+		__m256 d0 = _mm256_sub_ps(_mm256_loadu_ps(p1+i),    _mm256_loadu_ps(p2+i));
+		__m256 d1 = _mm256_sub_ps(_mm256_loadu_ps(p1+i+8),  _mm256_loadu_ps(p2+i+8));
+		__m256 d2 = _mm256_sub_ps(_mm256_loadu_ps(p1+i+16), _mm256_loadu_ps(p2+i+16));
+		__m256 d3 = _mm256_sub_ps(_mm256_loadu_ps(p1+i+24), _mm256_loadu_ps(p2+i+24));
+		s0 = _mm256_fmadd_ps(d0, d0, s0);
+		s1 = _mm256_fmadd_ps(d1, d1, s1);
+		s2 = _mm256_fmadd_ps(d2, d2, s2);
+		s3 = _mm256_fmadd_ps(d3, d3, s3);
+
+		if (i + 32 < dim) {			// check threshold once per 32 dims
+			float r = hsum_avx2(_mm256_add_ps(_mm256_add_ps(s0, s1),
+				_mm256_add_ps(s2, s3)));
+			if (r > threshold) return r;
+		}
+	}
+	for (; i + 8 <= dim; i += 8) {
+		__m256 d0 = _mm256_sub_ps(_mm256_loadu_ps(p1+i), _mm256_loadu_ps(p2+i));
+		s0 = _mm256_fmadd_ps(d0, d0, s0);
+	}
+	float r = hsum_avx2(_mm256_add_ps(_mm256_add_ps(s0, s1),
+		_mm256_add_ps(s2, s3)));
+	for (; i < dim; ++i) {
+		r += SQR(p1[i] - p2[i]);
+	}
+	return r;
+}
+
+// -----------------------------------------------------------------------------
+//  AVX-512 kernels (16 floats per register, masked tail)
+// -----------------------------------------------------------------------------
+template<int D>						// fixed dimension (0: dim)
+TARGET_AVX512 static float ip_avx512_t(// plain inner product
+	int   dim,							// dimension
+	const float *p1,					// 1st point
+	const float *p2)					// 2nd point
+{
+	if (D > 0) dim = D;
+	__m512 s0 = _mm512_setzero_ps(), s1 = _mm512_setzero_ps();
+	__m512 s2 = _mm512_setzero_ps(), s3 = _mm512_setzero_ps();
+
+	int i = 0;
+	for (; i + 64 <= dim; i += 64) {
+		s0 = _mm512_fmadd_ps(_mm512_loadu_ps(p1+i),    _mm512_loadu_ps(p2+i),    s0);
+		s1 = _mm512_fmadd_ps(_mm512_loadu_ps(p1+i+16), _mm512_loadu_ps(p2+i+16), s1);
+		s2 = _mm512_fmadd_ps(_mm512_loadu_ps(p1+i+32), _mm512_loadu_ps(p2+i+32), s2);
+		s3 = _mm512_fmadd_ps(_mm512_loadu_ps(p1+i+48), _mm512_loadu_ps(p2+i+48), s3);
+	}
+	for (; i + 16 <= dim; i += 16) {
+		s0 = _mm512_fmadd_ps(_mm512_loadu_ps(p1+i), _mm512_loadu_ps(p2+i), s0);
+	}
+	if (i < dim) {
+		__mmask16 mask = (__mmask16) ((1u << (dim - i)) - 1);
+		s1 = _mm512_fmadd_ps(_mm512_maskz_loadu_ps(mask, p1+i),
+			_mm512_maskz_loadu_ps(mask, p2+i), s1);
+	}
+	return _mm512_reduce_add_ps(_mm512_add_ps(_mm512_add_ps(s0, s1),
+		_mm512_add_ps(s2, s3)));
+}
+
+// -----------------------------------------------------------------------------
+template<int D>						// fixed dimension (0: dim)
+TARGET_AVX512 static float ip_thres_avx512_t(// ip with early termination
+	int   dim,							// dimension
+	float threshold,					// threshold
+	const float *p1,					// 1st point
+	const float *norm1,					// l2-norm of 1st point
+	const float *p2,					// 2nd point
+	const float *norm2)					// l2-norm of 2nd point
+{
+	if (D > 0) dim = D;
+	// -------------------------------------------------------------------------
+	//  the checkpoints are multiples of 8 floats, so they use 256-bit registers
+	// -------------------------------------------------------------------------
+	__m256 acc = _mm256_setzero_ps();
+	float  ip  = 0.0f;
+	int    base = 0;
+	for (int t = 1; t < NORM_K && NORM_DIMS[t-1] <= dim; ++t) {
+		for (; base < NORM_DIMS[t-1]; base += 8) {
+			acc = _mm256_fmadd_ps(_mm256_loadu_ps(p1+base),
+				_mm256_loadu_ps(p2+base), acc);
+		}
+		ip = hsum_avx2(acc);
+		if (ip + norm1[t]*norm2[t] <= threshold) {
+			STATS_ADD(early_, 1); return ip;
+		}
+	}
+	return ip + ip_avx512_t<rest_dim(D)>(dim - base, p1 + base, 
+		p2 + base);
+}
+
+// -----------------------------------------------------------------------------
+template<int D>						// fixed dimension (0: dim)
+TARGET_AVX512 static float l2_sqr_avx512_t(// l2 square distance with threshold
+	int   dim,							// dimension
+	float threshold,					// threshold
+	const float *p1,					// 1st point
+	const float *p2)					// 2nd point
+{
+	if (D > 0) dim = D;
+	__m512 s0 = _mm512_setzero_ps(), s1 = _mm512_setzero_ps();
+
+	int i = 0;
+	for (; i + 32 <= dim; i += 32) {
+		__m512 d0 = _mm512_sub_ps(_mm512_loadu_ps(p1+i),    _mm512_loadu_ps(p2+i));
+		__m512 d1 = _mm512_sub_ps(_mm512_loadu_ps(p1+i+16), _mm512_loadu_ps(p2+i+16));
+		s0 = _mm512_fmadd_ps(d0, d0, s0);
+		s1 = _mm512_fmadd_ps(d1, d1, s1);
+
+		if (i + 32 < dim) {			// check threshold once per 32 dims
+			float r = _mm512_reduce_add_ps(_mm512_add_ps(s0, s1));
+			if (r > threshold) return r;
+		}
+	}
+	for (; i + 16 <= dim; i += 16) {
+		__m512 d0 = _mm512_sub_ps(_mm512_loadu_ps(p1+i), _mm512_loadu_ps(p2+i));
+		s0 = _mm512_fmadd_ps(d0, d0, s0);
+	}
+	if (i < dim) {
+		__mmask16 mask = (__mmask16) ((1u << (dim - i)) - 1);
+		__m512 d0 = _mm512_sub_ps(_mm512_maskz_loadu_ps(mask, p1+i),
+			_mm512_maskz_loadu_ps(mask, p2+i));
+		s1 = _mm512_fmadd_ps(d0, d0, s1);
+	}
+	return _mm512_reduce_add_ps(_mm512_add_ps(s0, s1));
+}
+
+// -----------------------------------------------------------------------------
+TARGET_AVX2 static void ip4_avx2(	// inner products of a query and 4 points
+	int   dim,							// dimension
+	const float *q,						// query
+	const float **p,					// 4 points
+	float *ip)							// 4 inner products (return)
+{
+	const float *p0 = p[0], *p1 = p[1], *p2 = p[2], *p3 = p[3];
+	__m256 s0 = _mm256_setzero_ps(), s1 = _mm256_setzero_ps();
+	__m256 s2 = _mm256_setzero_ps(), s3 = _mm256_setzero_ps();
+
+	int i = 0;
+	for (; i + 8 <= dim; i += 8) {
+		__m256 x = _mm256_loadu_ps(q+i);
+		s0 = _mm256_fmadd_ps(x, _mm256_loadu_ps(p0+i), s0);
+		s1 = _mm256_fmadd_ps(x, _mm256_loadu_ps(p1+i), s1);
+		s2 = _mm256_fmadd_ps(x, _mm256_loadu_ps(p2+i), s2);
+		s3 = _mm256_fmadd_ps(x, _mm256_loadu_ps(p3+i), s3);
+	}
+	float r0 = hsum_avx2(s0), r1 = hsum_avx2(s1);
+	float r2 = hsum_avx2(s2), r3 = hsum_avx2(s3);
+	for (; i < dim; ++i) {
+		r0 += q[i] * p0[i]; r1 += q[i] * p1[i];
+		r2 += q[i] * p2[i]; r3 += q[i] * p3[i];
+	}
+	ip[0] = r0; ip[1] = r1; ip[2] = r2; ip[3] = r3;
+}
+
+// -----------------------------------------------------------------------------
+TARGET_AVX512 static void ip4_avx512(// inner products of a query and 4 points
+	int   dim,							// dimension
+	const float *q,						// query
+	const float **p,					// 4 points
+	float *ip)							// 4 inner products (return)
+{
+	const float *p0 = p[0], *p1 = p[1], *p2 = p[2], *p3 = p[3];
+	__m512 s0 = _mm512_setzero_ps(), s1 = _mm512_setzero_ps();
+	__m512 s2 = _mm512_setzero_ps(), s3 = _mm512_setzero_ps();
+
+	int i = 0;
+	for (; i + 16 <= dim; i += 16) {
+		__m512 x = _mm512_loadu_ps(q+i);
+		s0 = _mm512_fmadd_ps(x, _mm512_loadu_ps(p0+i), s0);
+		s1 = _mm512_fmadd_ps(x, _mm512_loadu_ps(p1+i), s1);
+		s2 = _mm512_fmadd_ps(x, _mm512_loadu_ps(p2+i), s2);
+		s3 = _mm512_fmadd_ps(x, _mm512_loadu_ps(p3+i), s3);
+	}
+	if (i < dim) {
+		__mmask16 mask = (__mmask16) ((1u << (dim - i)) - 1);
+		__m512 x = _mm512_maskz_loadu_ps(mask, q+i);
+		s0 = _mm512_fmadd_ps(x, _mm512_maskz_loadu_ps(mask, p0+i), s0);
+		s1 = _mm512_fmadd_ps(x, _mm512_maskz_loadu_ps(mask, p1+i), s1);
+		s2 = _mm512_fmadd_ps(x, _mm512_maskz_loadu_ps(mask, p2+i), s2);
+		s3 = _mm512_fmadd_ps(x, _mm512_maskz_loadu_ps(mask, p3+i), s3);
+	}
+	ip[0] = _mm512_reduce_add_ps(s0); ip[1] = _mm512_reduce_add_ps(s1);
+	ip[2] = _mm512_reduce_add_ps(s2); ip[3] = _mm512_reduce_add_ps(s3);
+}
+
+// -----------------------------------------------------------------------------
+//  Hamming kernels: POPCNT per word (AVX2 set), 8 words per register with 
+//  either a nibble lookup (AVX-512BW) or VPOPCNTQ; the tail of a code is read 
+//  by a masked load, so codes of any length are handled
+// -----------------------------------------------------------------------------
+TARGET_AVX2 static float ip_u8_avx2(// inner product with a uint8 code
+	int   dim,							// dimension
+	const float *q,						// query (floats)
+	const uint8_t *code)				// code (dim bytes)
+{
+	__m256 s0 = _mm256_setzero_ps(), s1 = _mm256_setzero_ps();
+
+	int i = 0;
+	for (; i + 16 <= dim; i += 16) {
+		__m128i c = _mm_loadu_si128((const __m128i *) (code + i));
+		__m256  x0 = _mm256_cvtepi32_ps(_mm256_cvtepu8_epi32(c));
+		__m256  x1 = _mm256_cvtepi32_ps(_mm256_cvtepu8_epi32(
+			_mm_srli_si128(c, 8)));
+		s0 = _mm256_fmadd_ps(_mm256_loadu_ps(q+i),   x0, s0);
+		s1 = _mm256_fmadd_ps(_mm256_loadu_ps(q+i+8), x1, s1);
+	}
+	for (; i + 8 <= dim; i += 8) {
+		__m128i c = _mm_loadl_epi64((const __m128i *) (code + i));
+		__m256  x = _mm256_cvtepi32_ps(_mm256_cvtepu8_epi32(c));
+		s0 = _mm256_fmadd_ps(_mm256_loadu_ps(q+i), x, s0);
+	}
+	float ret = hsum_avx2(_mm256_add_ps(s0, s1));
+	for (; i < dim; ++i) {
+		ret += q[i] * (float) code[i];
+	}
+	return ret;
+}
+
+// -----------------------------------------------------------------------------
+TARGET_AVX512 static float ip_u8_avx512(// inner product with a uint8 code
+	int   dim,							// dimension
+	const float *q,						// query (floats)
+	const uint8_t *code)				// code (dim bytes)
+{
+	__m512 s0 = _mm512_setzero_ps(), s1 = _mm512_setzero_ps();
+
+	int i = 0;
+	for (; i + 32 <= dim; i += 32) {
+		__m512 x0 = _mm512_cvtepi32_ps(_mm512_cvtepu8_epi32(
+			_mm_loadu_si128((const __m128i *) (code + i))));
+		__m512 x1 = _mm512_cvtepi32_ps(_mm512_cvtepu8_epi32(
+			_mm_loadu_si128((const __m128i *) (code + i + 16))));
+		s0 = _mm512_fmadd_ps(_mm512_loadu_ps(q+i),    x0, s0);
+		s1 = _mm512_fmadd_ps(_mm512_loadu_ps(q+i+16), x1, s1);
+	}
+	for (; i + 16 <= dim; i += 16) {
+		__m512 x = _mm512_cvtepi32_ps(_mm512_cvtepu8_epi32(
+			_mm_loadu_si128((const __m128i *) (code + i))));
+		s0 = _mm512_fmadd_ps(_mm512_loadu_ps(q+i), x, s0);
+	}
+	float ret = _mm512_reduce_add_ps(_mm512_add_ps(s0, s1));
+	for (; i < dim; ++i) {
+		ret += q[i] * (float) code[i];
+	}
+	return ret;
+}
+
+// -----------------------------------------------------------------------------
+TARGET_POPCNT static void hamming_popcnt(// Hamming distances to a query code
+	int   n,							// number of codes
+	int   m,							// number of uint64_t words per code
+	const uint64_t *codes,				// codes (n x m, contiguous)
+	const uint64_t *q,					// query code (m words)
+	uint16_t *dist)						// Hamming distances (return)
+{
+	for (int i = 0; i < n; ++i, codes += m) {
+		long long r = 0;
+		for (int j = 0; j < m; ++j) r += _mm_popcnt_u64(codes[j] ^ q[j]);
+		dist[i] = (uint16_t) r;
+	}
+}
+
+// -----------------------------------------------------------------------------
+TARGET_AVX512BW static inline __m512i popcnt_avx512bw(// popcount of 8 words
+	__m512i v)							// input register
+{
+	const __m512i lut = _mm512_set4_epi32(0x04030302, 0x03020201,
+		0x03020201, 0x02010100);		// popcount of nibbles 0, ..., 15
+	const __m512i low = _mm512_set1_epi8(0x0f);
+
+	__m512i lo = _mm512_and_si512(v, low);
+	__m512i hi = _mm512_and_si512(_mm512_srli_epi16(v, 4), low);
+	__m512i c  = _mm512_add_epi8(_mm512_shuffle_epi8(lut, lo), 
+		_mm512_shuffle_epi8(lut, hi));
+	return _mm512_sad_epu8(c, _mm512_setzero_si512());
+}
+
+// -----------------------------------------------------------------------------
+TARGET_AVX512BW static void hamming_avx512bw(// Hamming distances to a query
+	int   n,							// number of codes
+	int   m,							// number of uint64_t words per code
+	const uint64_t *codes,				// codes (n x m, contiguous)
+	const uint64_t *q,					// query code (m words)
+	uint16_t *dist)						// Hamming distances (return)
+{
+	__mmask8 tail = (__mmask8) ((1u << (m & 7)) - 1);
+	for (int i = 0; i < n; ++i, codes += m) {
+		__m512i acc = _mm512_setzero_si512();
+		int j = 0;
+		for (; j + 8 <= m; j += 8) {
+			acc = _mm512_add_epi64(acc, popcnt_avx512bw(_mm512_xor_si512(
+				_mm512_loadu_si512(codes+j), _mm512_loadu_si512(q+j))));
+		}
+		if (j < m) {
+			acc = _mm512_add_epi64(acc, popcnt_avx512bw(_mm512_xor_si512(
+				_mm512_maskz_loadu_epi64(tail, codes+j),
+				_mm512_maskz_loadu_epi64(tail, q+j))));
+		}
+		dist[i] = (uint16_t) _mm512_reduce_add_epi64(acc);
+	}
+}
+
+// -----------------------------------------------------------------------------
+TARGET_VPOPCNT static void hamming_vpopcnt(// Hamming distances to a query
+	int   n,							// number of codes
+	int   m,							// number of uint64_t words per code
+	const uint64_t *codes,				// codes (n x m, contiguous)
+	const uint64_t *q,					// query code (m words)
+	uint16_t *dist)						// Hamming distances (return)
+{
+	__mmask8 tail = (__mmask8) ((1u << (m & 7)) - 1);
+	for (int i = 0; i < n; ++i, codes += m) {
+		__m512i acc = _mm512_setzero_si512();
+		int j = 0;
+		for (; j + 8 <= m; j += 8) {
+			acc = _mm512_add_epi64(acc, _mm512_popcnt_epi64(_mm512_xor_si512(
+				_mm512_loadu_si512(codes+j), _mm512_loadu_si512(q+j))));
+		}
+		if (j < m) {
+			acc = _mm512_add_epi64(acc, _mm512_popcnt_epi64(_mm512_xor_si512(
+				_mm512_maskz_loadu_epi64(tail, codes+j),
+				_mm512_maskz_loadu_epi64(tail, q+j))));
+		}
+		dist[i] = (uint16_t) _mm512_reduce_add_epi64(acc);
+	}
+}
+#endif // SIMD_X86
+
+#ifdef SIMD_NEON
+// -----------------------------------------------------------------------------
+//  NEON kernels (4 floats per register)
+// -----------------------------------------------------------------------------
+static float ip_neon(				// plain inner product
+	int   dim,							// dimension
+	const float *p1,					// 1st point
+	const float *p2)					// 2nd point
+{
+	float32x4_t s0 = vdupq_n_f32(0.0f), s1 = vdupq_n_f32(0.0f);
+	float32x4_t s2 = vdupq_n_f32(0.0f), s3 = vdupq_n_f32(0.0f);
+
+	int i = 0;
+	for (; i + 16 <= dim; i += 16) {
+		s0 = vfmaq_f32(s0, vld1q_f32(p1+i),    vld1q_f32(p2+i));
+		s1 = vfmaq_f32(s1, vld1q_f32(p1+i+4),  vld1q_f32(p2+i+4));
+		s2 = vfmaq_f32(s2, vld1q_f32(p1+i+8),  vld1q_f32(p2+i+8));
+		s3 = vfmaq_f32(s3, vld1q_f32(p1+i+12), vld1q_f32(p2+i+12));
+	}
+	for (; i + 4 <= dim; i += 4) {
+		s0 = vfmaq_f32(s0, vld1q_f32(p1+i), vld1q_f32(p2+i));
+	}
+	float ret = vaddvq_f32(vaddq_f32(vaddq_f32(s0, s1), vaddq_f32(s2, s3)));
+	for (; i < dim; ++i) {
+		ret += p1[i] * p2[i];
+	}
+	return ret;
+}
+
+// -----------------------------------------------------------------------------
+static float ip_thres_neon(			// inner product with early termination
+	int   dim,							// dimension
+	float threshold,					// threshold
+	const float *p1,					// 1st point
+	const float *norm1,					// l2-norm of 1st point
+	const float *p2,					// 2nd point
+	const float *norm2)					// l2-norm of 2nd point
+{
+	float32x4_t s0 = vdupq_n_f32(0.0f), s1 = vdupq_n_f32(0.0f);
+	float ip = 0.0f;
+	int   base = 0;
+	for (int t = 1; t < NORM_K && NORM_DIMS[t-1] <= dim; ++t) {
+		for (; base < NORM_DIMS[t-1]; base += 8) {
+			s0 = vfmaq_f32(s0, vld1q_f32(p1+base),   vld1q_f32(p2+base));
+			s1 = vfmaq_f32(s1, vld1q_f32(p1+base+4), vld1q_f32(p2+base+4));
+		}
+		ip = vaddvq_f32(vaddq_f32(s0, s1));
+		if (ip + norm1[t]*norm2[t] <= threshold) {
+			STATS_ADD(early_, 1); return ip;
+		}
+	}
+	return ip + ip_neon(dim - base, p1 + base, p2 + base);
+}
+
+// -----------------------------------------------------------------------------
+static float l2_sqr_neon(			// l2 square distance with threshold
+	int   dim,							// dimension
+	float threshold,					// threshold
+	const float *p1,					// 1st point
+	const float *p2)					// 2nd point
+{
+	float32x4_t s0 = vdupq_n_f32(0.0f), s1 = vdupq_n_f32(0.0f);
+	float32x4_t s2 = vdupq_n_f32(0.0f), s3 = vdupq_n_f32(0.0f);
+
+	int i = 0;
+	for (; i + 16 <= dim; i += 16) {
+		float32x4_t d0 = vsubq_f32(vld1q_f32(p1+i),    vld1q_f32(p2+i));
+		float32x4_t d1 = vsubq_f32(vld1q_f32(p1+i+4),  vld1q_f32(p2+i+4));
+		float32x4_t d2 = vsubq_f32(vld1q_f32(p1+i+8),  vld1q_f32(p2+i+8));
+		float32x4_t d3 = vsubq_f32(vld1q_f32(p1+i+12), vld1q_f32(p2+i+12));
+		s0 = vfmaq_f32(s0, d0, d0);
+		s1 = vfmaq_f32(s1, d1, d1);
+		s2 = vfmaq_f32(s2, d2, d2);
+		s3 = vfmaq_f32(s3, d3, d3);
+
+		if ((i & 31) == 16 && i + 16 < dim) {// check once per 32 dims
+			float r = vaddvq_f32(vaddq_f32(vaddq_f32(s0,s1), vaddq_f32(s2,s3)));
+			if (r > threshold) return r;
+		}
+	}
+	float r = vaddvq_f32(vaddq_f32(vaddq_f32(s0, s1), vaddq_f32(s2, s3)));
+	for (; i < dim; ++i) {
+		r += SQR(p1[i] - p2[i]);
+	}
+	return r;
+}
+
+// -----------------------------------------------------------------------------
+static void ip4_neon(				// inner products of a query and 4 points
+	int   dim,							// dimension
+	const float *q,						// query
+	const float **p,					// 4 points
+	float *ip)							// 4 inner products (return)
+{
+	const float *p0 = p[0], *p1 = p[1], *p2 = p[2], *p3 = p[3];
+	float32x4_t s0 = vdupq_n_f32(0.0f), s1 = vdupq_n_f32(0.0f);
+	float32x4_t s2 = vdupq_n_f32(0.0f), s3 = vdupq_n_f32(0.0f);
+
+	int i = 0;
+	for (; i + 4 <= dim; i += 4) {
+		float32x4_t x = vld1q_f32(q+i);
+		s0 = vfmaq_f32(s0, x, vld1q_f32(p0+i));
+		s1 = vfmaq_f32(s1, x, vld1q_f32(p1+i));
+		s2 = vfmaq_f32(s2, x, vld1q_f32(p2+i));
+		s3 = vfmaq_f32(s3, x, vld1q_f32(p3+i));
+	}
+	float r0 = vaddvq_f32(s0), r1 = vaddvq_f32(s1);
+	float r2 = vaddvq_f32(s2), r3 = vaddvq_f32(s3);
+	for (; i < dim; ++i) {
+		r0 += q[i] * p0[i]; r1 += q[i] * p1[i];
+		r2 += q[i] * p2[i]; r3 += q[i] * p3[i];
+	}
+	ip[0] = r0; ip[1] = r1; ip[2] = r2; ip[3] = r3;
+}
+
+// -----------------------------------------------------------------------------
+static void hamming_neon(			// Hamming distances to a query code
+	int   n,							// number of codes
+	int   m,							// number of uint64_t words per code
+	const uint64_t *codes,				// codes (n x m, contiguous)
+	const uint64_t *q,					// query code (m words)
+	uint16_t *dist)						// Hamming distances (return)
+{
+	for (int i = 0; i < n; ++i, codes += m) {
+		uint16x8_t acc = vdupq_n_u16(0);
+		int j = 0;
+		for (; j + 2 <= m; j += 2) {
+			uint8x16_t x = vreinterpretq_u8_u64(veorq_u64(vld1q_u64(codes+j), 
+				vld1q_u64(q+j)));
+			acc = vpadalq_u8(acc, vcntq_u8(x));
+		}
+		int r = vaddvq_u16(acc);
+		if (j < m) r += __builtin_popcountll(codes[j] ^ q[j]);
+		dist[i] = (uint16_t) r;
+	}
+}
+
+// -----------------------------------------------------------------------------
+static float ip_u8_neon(			// inner product with a uint8 code
+	int   dim,							// dimension
+	const float *q,						// query (floats)
+	const uint8_t *code)				// code (dim bytes)
+{
+	float32x4_t s0 = vdupq_n_f32(0.0f), s1 = vdupq_n_f32(0.0f);
+
+	int i = 0;
+	for (; i + 8 <= dim; i += 8) {
+		uint16x8_t c = vmovl_u8(vld1_u8(code + i));
+		float32x4_t x0 = vcvtq_f32_u32(vmovl_u16(vget_low_u16(c)));
+		float32x4_t x1 = vcvtq_f32_u32(vmovl_u16(vget_high_u16(c)));
+		s0 = vfmaq_f32(s0, vld1q_f32(q+i),   x0);
+		s1 = vfmaq_f32(s1, vld1q_f32(q+i+4), x1);
+	}
+	float ret = vaddvq_f32(vaddq_f32(s0, s1));
+	for (; i < dim; ++i) {
+		ret += q[i] * (float) code[i];
+	}
+	return ret;
+}
+#endif // SIMD_NEON
+
+// -----------------------------------------------------------------------------
+static SIMD_Kernels select_kernels() // select kernel set by CPU features
+{
+	SIMD_Kernels scalar = { "scalar", ip_scalar, ip_thres_scalar, l2_sqr_scalar,
+		ip4_scalar, hamming_scalar, ip_u8_scalar };
+	SIMD_Kernels best   = scalar;
+	const char *force   = getenv("H2_ALSH_SIMD");
+	if (force != NULL && strcmp(force, "scalar") == 0) return scalar;
+
+#ifdef SIMD_X86
+	__builtin_cpu_init();			// required before static constructors
+	bool avx2   = __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma");
+	bool avx512 = avx2 && __builtin_cpu_supports("avx512f");
+	bool popcnt = __builtin_cpu_supports("popcnt");
+	bool avx512bw   = avx512 && __builtin_cpu_supports("avx512bw");
+	bool avx512vpop = avx512 && __builtin_cpu_supports("avx512vpopcntdq");
+
+	SIMD_Kernels k_avx2   = { "avx2", ip_avx2_t<0>, ip_thres_avx2_t<0>, 
+		l2_sqr_avx2_t<0>, ip4_avx2, popcnt ? hamming_popcnt : hamming_scalar, 
+		ip_u8_avx2 };
+	SIMD_Kernels k_avx512 = { "avx512", ip_avx512_t<0>, ip_thres_avx512_t<0>,
+		l2_sqr_avx512_t<0>, ip4_avx512, k_avx2.hamming_, ip_u8_avx512 };
+	if (avx512vpop) k_avx512.hamming_ = hamming_vpopcnt;
+	else if (avx512bw) k_avx512.hamming_ = hamming_avx512bw;
+
+	if (avx512) best = k_avx512;
+	else if (avx2) best = k_avx2;
+
+	if (force != NULL && strcmp(force, "avx2") == 0 && avx2) best = k_avx2;
+#endif
+
+#ifdef SIMD_NEON
+	SIMD_Kernels k_neon = { "neon", ip_neon, ip_thres_neon, l2_sqr_neon,
+		ip4_neon, hamming_neon, ip_u8_neon };
+	best = k_neon;					// NEON is mandatory on AArch64
+#endif
+	return best;
+}
+
+// -----------------------------------------------------------------------------
+//  g_simd is constant-initialized to the scalar kernels, so it is usable from 
+//  any static constructor; the best kernel set is installed right after
+// -----------------------------------------------------------------------------
+SIMD_Kernels g_simd = { "scalar", ip_scalar, ip_thres_scalar, l2_sqr_scalar,
+	ip4_scalar, hamming_scalar, ip_u8_scalar };
+
+// -----------------------------------------------------------------------------
+//  kernels for the fixed dimensions of SIMD_DIMS: the dimensions of the data 
+//  sets (Mnist, Sift, Netflix and Yahoo, Gist), and with one more coordinate 
+//  for the transformed data of H2_ALSH, XBox, and Simple_LSH
+// -----------------------------------------------------------------------------
+#define SIMD_DIMS(X) X(50) X(51) X(128) X(129) X(300) X(301) X(960) X(961)
+
+static const int   MAX_DIMS = 16;	// capacity of g_dim_kernels
+static Dim_Kernels g_dim_kernels[MAX_DIMS]; // fixed dimensions of g_simd
+static int         g_num_dims = 0;	// number of fixed dimensions
+static Dim_Kernels g_any_dim = { 0, ip_scalar, ip_thres_scalar, l2_sqr_scalar };
+
+// -----------------------------------------------------------------------------
+static void select_dim_kernels()	// fixed-dimension kernels of g_simd
+{
+	g_any_dim.ip_       = g_simd.ip_;
+	g_any_dim.ip_thres_ = g_simd.ip_thres_;
+	g_any_dim.l2_sqr_   = g_simd.l2_sqr_;
+	g_num_dims = 0;
+
+#ifdef SIMD_X86
+#define SIMD_DIM_AVX2(D) g_dim_kernels[g_num_dims++] = Dim_Kernels { D, \
+	ip_avx2_t<D>, ip_thres_avx2_t<D>, l2_sqr_avx2_t<D> };
+#define SIMD_DIM_AVX512(D) g_dim_kernels[g_num_dims++] = Dim_Kernels { D, \
+	ip_avx512_t<D>, ip_thres_avx512_t<D>, l2_sqr_avx512_t<D> };
+
+	if (strcmp(g_simd.name_, "avx2") == 0) { SIMD_DIMS(SIMD_DIM_AVX2) }
+	else if (strcmp(g_simd.name_, "avx512") == 0) { SIMD_DIMS(SIMD_DIM_AVX512) }
+#endif
+}
+
+// -----------------------------------------------------------------------------
+const Dim_Kernels* dim_kernels(		// kernels for one dimension
+	int   dim)							// dimension
+{
+	for (int i = 0; i < g_num_dims; ++i) {
+		if (g_dim_kernels[i].dim_ == dim) return &g_dim_kernels[i];
+	}
+	return &g_any_dim;
+}
+
+// -----------------------------------------------------------------------------
+static struct SIMD_Init {
+	SIMD_Init() { g_simd = select_kernels(); select_dim_kernels(); }
+} simd_init;
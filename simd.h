@@ -0,0 +1,95 @@
+#ifndef __SIMD_H
+#define __SIMD_H
+
+#include <cstdint>
+
+// -----------------------------------------------------------------------------
+//  SIMD kernels of inner product and l2 distance
+//
+//  one kernel set (scalar, AVX2, AVX-512 or NEON) is selected once at startup
+//  by CPU feature detection, and calc_inner_product() and calc_l2_sqr() in
+//  util.cc call through it. The environment variable H2_ALSH_SIMD (scalar,
+//  avx2, avx512) forces a kernel set that the CPU supports.
+//
+//  the early-termination inner product keeps the partial-norm checkpoints of
+//  the scalar version: after the first NORM_DIMS[t-1] coordinates (def.h), 
+//  it returns once ip + norm1[t] * norm2[t] <= threshold.
+//
+//  the 1 x 4 inner product kernel is the register tile of the blocked 
+//  query-by-point inner products calc_ip_block() in util.cc.
+//
+//  the Hamming kernel (for SRP_LSH) uses VPOPCNTQ, an AVX-512BW nibble lookup, 
+//  POPCNT (with AVX2), or NEON VCNT, respectively.
+//
+//  the uint8 inner product kernel scores candidates against the int8 codes of 
+//  SQ8 (sq8.h); the codes are widened to floats in registers.
+// -----------------------------------------------------------------------------
+typedef float (*IP_Func)(			// plain inner product
+	int   dim,							// dimension
+	const float *p1,					// 1st point
+	const float *p2);					// 2nd point
+
+typedef float (*IP_Thres_Func)(		// inner product with early termination
+	int   dim,							// dimension
+	float threshold,					// threshold
+	const float *p1,					// 1st point
+	const float *norm1,					// l2-norm of 1st point
+	const float *p2,					// 2nd point
+	const float *norm2);				// l2-norm of 2nd point
+
+typedef float (*L2_Func)(			// l2 square distance with threshold
+	int   dim,							// dimension
+	float threshold,					// threshold
+	const float *p1,					// 1st point
+	const float *p2);					// 2nd point
+
+typedef void (*IP4_Func)(			// inner products of a query and 4 points
+	int   dim,							// dimension
+	const float *q,						// query
+	const float **p,					// 4 points
+	float *ip);							// 4 inner products (return)
+
+typedef void (*Hamming_Func)(		// Hamming distances to a query code
+	int   n,							// number of codes
+	int   m,							// number of uint64_t words per code
+	const uint64_t *codes,				// codes (n x m, contiguous)
+	const uint64_t *q,					// query code (m words)
+	uint16_t *dist);					// Hamming distances (return)
+
+typedef float (*IP_U8_Func)(		// inner product with a uint8 code
+	int   dim,							// dimension
+	const float *q,						// query (floats)
+	const uint8_t *code);				// code (dim bytes)
+
+struct SIMD_Kernels {
+	const char    *name_;			// name of kernel set
+	IP_Func       ip_;				// plain inner product
+	IP_Thres_Func ip_thres_;		// inner product with early termination
+	L2_Func       l2_sqr_;			// l2 square distance with threshold
+	IP4_Func      ip4_;				// micro-kernel of calc_ip_block()
+	Hamming_Func  hamming_;			// Hamming distances of codes
+	IP_U8_Func    ip_u8_;			// inner product with a uint8 code
+};
+
+extern SIMD_Kernels g_simd;			// kernel set selected at startup
+
+// -----------------------------------------------------------------------------
+//  Dim_Kernels: the kernels ip_, ip_thres_, and l2_sqr_ of g_simd compiled for 
+//  one fixed dimension, i.e., with constant trip counts (fully unrolled, and 
+//  no runtime tail handling); dim is ignored. Every index gets the kernels of 
+//  its dimension by dim_kernels() when it is built or loaded, and calls them 
+//  by the overloads of calc_inner_product() in util.h. Dimensions without 
+//  fixed kernels (and the scalar and NEON sets) get the kernels of g_simd.
+// -----------------------------------------------------------------------------
+struct Dim_Kernels {
+	int           dim_;				// fixed dimension (0: any dimension)
+	IP_Func       ip_;				// plain inner product
+	IP_Thres_Func ip_thres_;		// inner product with early termination
+	L2_Func       l2_sqr_;			// l2 square distance with threshold
+};
+
+// -----------------------------------------------------------------------------
+const Dim_Kernels* dim_kernels(		// kernels for one dimension
+	int   dim);							// dimension
+
+#endif // __SIMD_H
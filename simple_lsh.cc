@@ -1,9 +1,17 @@
 #include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
 
 #include "def.h"
 #include "util.h"
+#include "simd.h"
+#include "matrix.h"
 #include "pri_queue.h"
 #include "srp_lsh.h"
+#include "sq8.h"
 #include "simple_lsh.h"
 
 
@@ -20,9 +28,11 @@ Simple_LSH::Simple_LSH(				// constructor
 	// -------------------------------------------------------------------------
 	n_pts_  = n;
 	dim_    = d;
+	kern_   = dim_kernels(d);
 	K_      = K;
 	data_   = data;
 	norm_d_ = norm_d;
+	index_file_ = NULL;
 
 	// -------------------------------------------------------------------------
 	//  build index
@@ -34,10 +44,13 @@ Simple_LSH::Simple_LSH(				// constructor
 Simple_LSH::~Simple_LSH()			// destructor
 {
 	delete lsh_; lsh_ = NULL;
-	for (int i = 0; i < n_pts_; ++i) {
-		delete[] simple_lsh_data_[i]; simple_lsh_data_[i] = NULL;
+	delete sq8_; sq8_ = NULL;
+	delete simple_lsh_data_; simple_lsh_data_ = NULL;
+
+	if (index_file_ != NULL) {
+		munmap_file(index_file_);
+		delete index_file_; index_file_ = NULL;
 	}
-	delete[] simple_lsh_data_; simple_lsh_data_ = NULL;
 }
 
 // -----------------------------------------------------------------------------
@@ -57,19 +70,82 @@ void Simple_LSH::bulkload()			// bulkloading
 	// -------------------------------------------------------------------------
 	//  construct new format of data
 	// -------------------------------------------------------------------------
-	simple_lsh_data_ = new float*[n_pts_];
+	simple_lsh_data_ = new Matrix(n_pts_, dim_ + 1);
 	for (int i = 0; i < n_pts_; ++i) {
-		simple_lsh_data_[i] = new float[dim_ + 1];
+		float *simple_lsh_data = simple_lsh_data_->row(i);
 		for (int j = 0; j < dim_; ++j) {
-			simple_lsh_data_[i][j] = data_[i][j] / M_;
+			simple_lsh_data[j] = data_[i][j] / M_;
 		}
-		simple_lsh_data_[i][dim_] = sqrt(1.0f - norm_sqr[i] / max_norm_sqr);
+		simple_lsh_data[dim_] = sqrt(1.0f - norm_sqr[i] / max_norm_sqr);
 	}
 
 	// -------------------------------------------------------------------------
 	//  indexing the new data using SRP-LSH
 	// -------------------------------------------------------------------------
-	lsh_ = new SRP_LSH(n_pts_, dim_+1, K_, (const float **) simple_lsh_data_);
+	lsh_ = new SRP_LSH(n_pts_, dim_ + 1, K_, 
+		(const float **) simple_lsh_data_->rows());
+	sq8_ = g_sq_frac > 0.0f ? new SQ8(n_pts_, dim_, data_) : NULL;
+}
+
+// -----------------------------------------------------------------------------
+int Simple_LSH::save(				// write index to disk
+	const char *fname)					// address of index file
+{
+	FILE *fp = fopen(fname, "wb");
+	if (!fp) {
+		printf("Could not create %s\n", fname);
+		return 1;
+	}
+
+	int ret = write_index_header(fp, IDX_SIMPLE_LSH, n_pts_, dim_);
+	ret |= write_aligned(fp, &M_, SIZEFLOAT);
+	if (ret == 0) ret = lsh_->save(fp);
+	fclose(fp);
+
+	if (ret != 0) {
+		printf("Could not write %s\n", fname);
+		return 1;
+	}
+	return 0;
+}
+
+// -----------------------------------------------------------------------------
+Simple_LSH* Simple_LSH::load(		// load index from disk (mmap-ed)
+	int   n,							// number of data objects
+	int   d,							// dimension of data objects
+	const char *fname,					// address of index file
+	const float **data, 				// input data
+	const float **norm_d)				// l2-norm of data objects
+{
+	Mmap_File  *mf = new Mmap_File();
+	Mmap_Cursor in;
+	if (open_index(fname, IDX_SIMPLE_LSH, n, d, mf, &in) == 1) {
+		delete mf;
+		return NULL;
+	}
+
+	Simple_LSH *lsh = new Simple_LSH();
+	lsh->n_pts_  = n;
+	lsh->dim_    = d;
+	lsh->kern_   = dim_kernels(d);
+	lsh->data_   = data;
+	lsh->norm_d_ = norm_d;
+	lsh->simple_lsh_data_ = NULL;	// only needed to build the SRP_LSH
+	lsh->index_file_      = mf;
+	lsh->sq8_ = NULL;
+
+	const float *M = (const float *) read_aligned(&in, SIZEFLOAT);
+	lsh->lsh_ = M != NULL ? SRP_LSH::load(&in, n, d + 1, NULL) : NULL;
+	if (lsh->lsh_ == NULL) {
+		printf("Corrupted Simple_LSH index %s\n", fname);
+		delete lsh;
+		return NULL;
+	}
+	lsh->M_ = *M;
+	lsh->K_ = lsh->lsh_->num_hash();
+	if (g_sq_frac > 0.0f) lsh->sq8_ = new SQ8(n, d, data);
+
+	return lsh;
 }
 
 // -----------------------------------------------------------------------------
@@ -82,11 +158,23 @@ void Simple_LSH::display() 			// display parameters
 	printf("    M = %f\n\n", M_);
 }
 
+// -----------------------------------------------------------------------------
+size_t Simple_LSH::index_size()		// memory of index (without data)
+{
+	size_t size = lsh_->index_size();
+	if (sq8_ != NULL) size += sq8_->index_size();
+
+	Matrix *trans = simple_lsh_data_;	// transformed data (NULL if loaded)
+	if (trans != NULL) size += (size_t) trans->n() * trans->stride() * SIZEFLOAT;
+	return size;
+}
+
 // -----------------------------------------------------------------------------
 int Simple_LSH::kmip(				// c-k-AMIP search
 	int   top_k,						// top-k value
 	const float *query,					// input query
 	const float *norm_q,				// l2-norm of query
+	SRP_Scratch *scratch,				// search context of this thread
 	MaxK_List *list)					// top-k MIP results (return) 
 {
 	float kip   = MINREAL;
@@ -95,7 +183,7 @@ int Simple_LSH::kmip(				// c-k-AMIP search
 	// -------------------------------------------------------------------------
 	//  construct Simple_LSH query
 	// -------------------------------------------------------------------------
-	float *simple_lsh_query = new float[dim_ + 1];
+	float *simple_lsh_query = scratch->query_buf(dim_ + 1);
 	for (int i = 0; i < dim_; ++i) {
 		simple_lsh_query[i] = query[i] / normq;
 	}
@@ -104,22 +192,32 @@ int Simple_LSH::kmip(				// c-k-AMIP search
 	// -------------------------------------------------------------------------
 	//  conduct c-k-AMC search by SRP-LSH
 	// -------------------------------------------------------------------------
-	std::vector<int> cand;
-	lsh_->kmc(top_k, (const float *) simple_lsh_query, cand);
+	std::vector<int> &cand = scratch->cand();
+	cand.clear();
+	lsh_->kmc(top_k, (const float *) simple_lsh_query, scratch, cand);
 
 	// -------------------------------------------------------------------------
-	//  calc inner product for candidates returned by SRP-LSH
+	//  calc inner product for candidates returned by SRP-LSH (or for the best 
+	//  of them by their int8 codes)
 	// -------------------------------------------------------------------------
+	if (sq8_ != NULL) {
+		sq8_->filter(top_k, query, NULL, cand, 
+			scratch->score_buf(sq8_->buf_size((int) cand.size())));
+	}
 	int size = (int) cand.size();
+	sort_cand(size, norm_d_, cand.data());
 	for (int i = 0; i < size; ++i) {
+		if (i + PREFETCH_DIST < size) {
+			int next = cand[i + PREFETCH_DIST];
+			prefetch_point(dim_, data_[next], norm_d_[next]);
+		}
 		int id = cand[i];
 		if (norm_d_[id][0] * normq <= kip) break;
-				
-		float ip = calc_inner_product(dim_, kip, data_[id], norm_d_[id], 
-			query, norm_q);
+
+		float ip = calc_inner_product(kern_, dim_, kip, data_[id], 
+			norm_d_[id], query, norm_q);
 		kip = list->insert(ip, id + 1);
 	}
-	delete[] simple_lsh_query; simple_lsh_query = NULL;
 
 	return 0;
 }
\ No newline at end of file
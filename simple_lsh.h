@@ -2,7 +2,12 @@
 #define __SIMPLE_LSH_H
 
 class SRP_LSH;
+class SRP_Scratch;
+class SQ8;
+class Matrix;
 class MaxK_List;
+struct Mmap_File;
+struct Dim_Kernels;
 
 // -----------------------------------------------------------------------------
 //  Simple-LSH is used to solve the problem of c-Approximate Maximum Inner 
@@ -28,23 +33,45 @@ public:
 	// -------------------------------------------------------------------------
 	void display();					// display parameters
 
+	// -------------------------------------------------------------------------
+	size_t index_size();			// memory of index (without data)
+
 	// -------------------------------------------------------------------------
 	int kmip(						// c-k-AMIP search
 		int   top_k,					// top-k value
 		const float *query,				// input query
 		const float *norm_q,			// l2-norm of query
+		SRP_Scratch *scratch,			// search context of this thread
 		MaxK_List *list);				// top-k mip results
 
+	// -------------------------------------------------------------------------
+	int save(						// write index to disk
+		const char *fname);				// address of index file
+
+	// -------------------------------------------------------------------------
+	static Simple_LSH* load(			// load index from disk (mmap-ed)
+		int   n,						// number of data objects
+		int   d,						// dimension of data objects
+		const char *fname,				// address of index file
+		const float **data, 			// input data
+		const float **norm_d);			// l2-norm of data objects
+
 protected:
+	Simple_LSH() {}					// constructor (used by load)
+
+	// -------------------------------------------------------------------------
 	int   n_pts_;					// number of data objects
 	int   dim_;						// dimensionality
+	const Dim_Kernels *kern_;		// kernels for dim_ (simd.h)
 	int   K_;						// number of hash tables
 	const float **data_;			// original data objects
 	const float **norm_d_;			// l2-norm of data objects
 	
 	float M_;						// max l2-norm of data objects
-	float **simple_lsh_data_;		// simple_lsh data
+	Matrix *simple_lsh_data_;		// simple_lsh data
+	Mmap_File *index_file_;			// mapping of loaded index (or NULL)
 	SRP_LSH *lsh_;					// SRP_LSH
+	SQ8   *sq8_;					// int8 codes of data (or NULL)
 
 	// -------------------------------------------------------------------------
 	void bulkload();				// bulkloading
@@ -0,0 +1,119 @@
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <vector>
+
+#include "def.h"
+#include "simd.h"
+#include "sq8.h"
+
+float g_sq_frac = 0.0f;
+
+// -----------------------------------------------------------------------------
+SQ8::SQ8(							// constructor
+	int   n,							// number of data objects
+	int   d,							// dimensionality
+	const float **data)					// data objects
+{
+	n_     = n;
+	d_     = d;
+	lo_    = new float[d_];
+	step_  = new float[d_];
+	codes_ = new uint8_t[(size_t) n_ * d_];
+
+	// -------------------------------------------------------------------------
+	//  the range of every coordinate, split into 255 steps
+	// -------------------------------------------------------------------------
+	float *hi = new float[d_];
+	for (int j = 0; j < d_; ++j) { lo_[j] = MAXREAL; hi[j] = MINREAL; }
+	for (int i = 0; i < n_; ++i) {
+		for (int j = 0; j < d_; ++j) {
+			lo_[j] = MIN(lo_[j], data[i][j]);
+			hi[j]  = MAX(hi[j],  data[i][j]);
+		}
+	}
+	for (int j = 0; j < d_; ++j) {
+		step_[j] = hi[j] > lo_[j] ? (hi[j] - lo_[j]) / 255.0f : 1.0f;
+	}
+	delete[] hi; hi = NULL;
+
+	for (int i = 0; i < n_; ++i) encode(i, data[i]);
+}
+
+// -----------------------------------------------------------------------------
+SQ8::~SQ8()							// destructor
+{
+	delete[] lo_;    lo_    = NULL;
+	delete[] step_;  step_  = NULL;
+	delete[] codes_; codes_ = NULL;
+}
+
+// -----------------------------------------------------------------------------
+void SQ8::encode(					// (re-)encode one object
+	int   id,							// object id (0 <= id < n)
+	const float *vec)					// data object
+{
+	uint8_t *code = codes_ + (size_t) id * d_;
+	for (int j = 0; j < d_; ++j) {
+		int c = (int) lroundf((vec[j] - lo_[j]) / step_[j]);
+		code[j] = (uint8_t) MIN(MAX(c, 0), 255);
+	}
+}
+
+// -----------------------------------------------------------------------------
+size_t SQ8::index_size()			// memory of codes and ranges
+{
+	return (size_t) n_ * d_ + (size_t) d_ * 2 * SIZEFLOAT;
+}
+
+// -----------------------------------------------------------------------------
+int SQ8::filter(					// keep the best candidates by score
+	int   top_k,						// top-k value
+	const float *query,					// input query
+	const int *index,					// object id of cand[j] (or NULL)
+	std::vector<int> &cand,				// candidates (filtered in place)
+	float *buf)							// buffer (buf_size(size) floats)
+{
+	int size = (int) cand.size();
+	int keep = MAX(top_k, (int) ceil(g_sq_frac * size));
+	if (keep >= size) return size;
+
+	// -------------------------------------------------------------------------
+	//  approximate scores (<q, lo> is the same for all, so it is left out)
+	// -------------------------------------------------------------------------
+	float *q     = buf;
+	float *score = buf + d_;
+	float *tmp   = score + size;
+	for (int j = 0; j < d_; ++j) q[j] = query[j] * step_[j];
+
+	for (int j = 0; j < size; ++j) {
+		int id = index != NULL ? index[cand[j]] : cand[j];
+		if (id < n_) {
+			score[j] = g_simd.ip_u8_(d_, q, codes_ + (size_t) id * d_);
+		}
+		else score[j] = MAXREAL;
+	}
+
+	// -------------------------------------------------------------------------
+	//  the keep-th best score, then all candidates above it and the first ties
+	// -------------------------------------------------------------------------
+	memcpy(tmp, score, size * SIZEFLOAT);
+	std::nth_element(tmp, tmp + keep - 1, tmp + size, std::greater<float>());
+	float thres = tmp[keep - 1];
+
+	int above = 0;
+	for (int j = 0; j < size; ++j) if (score[j] > thres) ++above;
+
+	int num = 0, ties = keep - above;
+	for (int j = 0; j < size; ++j) {
+		if (score[j] > thres || (score[j] == thres && ties-- > 0)) {
+			cand[num++] = cand[j];
+		}
+	}
+	cand.resize(num);
+	return num;
+}
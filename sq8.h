@@ -0,0 +1,62 @@
+#ifndef __SQ8_H
+#define __SQ8_H
+
+extern float g_sq_frac;				// global parameter: re-rank fraction (0: off)
+
+// -----------------------------------------------------------------------------
+//  SQ8: int8 scalar quantization of a data set, i.e., the compressed copy of 
+//  the data (d bytes per object instead of 4d) that scores candidates before 
+//  they are verified. Every coordinate j is quantized over its range in the 
+//  data, x[j] ~ lo[j] + step[j] * code[j], so that 
+//
+//      <q, x> ~ <q, lo> + sum_j (q[j] * step[j]) * code[j],
+//
+//  and a query pays d multiply-adds once for q * step and <q, lo>, then one 
+//  uint8 inner product (g_simd.ip_u8_) per candidate.
+//
+//  filter() keeps the MAX(top_k, g_sq_frac * size) candidates with the best 
+//  approximate scores (in their input order), and the callers verify only 
+//  those against the original floats, with the same partial-norm bounds as 
+//  before. Objects that have no code (id >= n) are always kept.
+// -----------------------------------------------------------------------------
+class SQ8 {
+public:
+	SQ8(							// constructor
+		int   n,						// number of data objects
+		int   d,						// dimensionality
+		const float **data);			// data objects
+
+	// -------------------------------------------------------------------------
+	~SQ8();							// destructor
+
+	// -------------------------------------------------------------------------
+	inline int n() { return n_; }
+
+	// -------------------------------------------------------------------------
+	void encode(					// (re-)encode one object
+		int   id,						// object id (0 <= id < n)
+		const float *vec);				// data object
+
+	// -------------------------------------------------------------------------
+	size_t index_size();			// memory of codes and ranges
+
+	// -------------------------------------------------------------------------
+	inline int buf_size(int size) { return d_ + 2 * size; }
+
+	// -------------------------------------------------------------------------
+	int filter(						// keep the best candidates by score
+		int   top_k,					// top-k value
+		const float *query,				// input query
+		const int *index,				// object id of cand[j] (or NULL)
+		std::vector<int> &cand,			// candidates (filtered in place)
+		float *buf);					// buffer (buf_size(size) floats)
+
+protected:
+	int     n_;						// number of data objects
+	int     d_;						// dimensionality
+	float   *lo_;					// min value of every coordinate
+	float   *step_;					// quantization step of every coordinate
+	uint8_t *codes_;				// codes of data objects (n x d)
+};
+
+#endif // __SQ8_H
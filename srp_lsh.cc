@@ -1,12 +1,109 @@
 #include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
 #include <vector>
 
 #include "def.h"
 #include "util.h"
 #include "random.h"
-#include "pri_queue.h"
+#include "simd.h"
+#include "stats.h"
+#include "fht.h"
 #include "srp_lsh.h"
 
+// -----------------------------------------------------------------------------
+SRP_Scratch::SRP_Scratch()			// constructor
+{
+	code_   = NULL;
+	key_    = NULL;
+	dist_   = NULL;
+	cnt_    = NULL;
+	max_n_  = 0;
+	max_K_  = 0;
+	max_m_  = 0;
+	max_q_  = 0;
+	query_  = NULL;
+	max_f_  = 0;
+	fht_    = NULL;
+	max_s_  = 0;
+	score_  = NULL;
+}
+
+// -----------------------------------------------------------------------------
+SRP_Scratch::~SRP_Scratch()			// destructor
+{
+	delete[] code_;  code_  = NULL;
+	delete[] key_;   key_   = NULL;
+	delete[] dist_;  dist_  = NULL;
+	delete[] cnt_;   cnt_   = NULL;
+	delete[] query_; query_ = NULL;
+	delete[] fht_;   fht_   = NULL;
+	delete[] score_; score_ = NULL;
+}
+
+// -----------------------------------------------------------------------------
+void SRP_Scratch::begin(			// start a new query
+	int   n,							// number of data objects of the index
+	int   K,							// number of hash functions of the index
+	int   m)							// number of uint64_t hash code
+{
+	if (n > max_n_) {
+		delete[] dist_;
+		max_n_ = n;
+		dist_  = new uint16_t[max_n_];
+	}
+	if (K > max_K_) {
+		delete[] code_; delete[] cnt_;
+		max_K_ = K;
+		code_  = new bool[max_K_];
+		cnt_   = new int[max_K_ + 1];
+	}
+	if (m > max_m_) {
+		delete[] key_;
+		max_m_ = m;
+		key_   = new uint64_t[max_m_];
+	}
+}
+
+// -----------------------------------------------------------------------------
+float* SRP_Scratch::query_buf(		// buffer for a transformed query
+	int   size)							// number of floats
+{
+	if (size > max_q_) {
+		delete[] query_;
+		max_q_ = size;
+		query_ = new float[max_q_];
+	}
+	return query_;
+}
+
+// -----------------------------------------------------------------------------
+float* SRP_Scratch::fht_buf(		// buffer for structured projections
+	int   size)							// number of floats
+{
+	if (size > max_f_) {
+		delete[] fht_;
+		max_f_ = size;
+		fht_   = new float[max_f_];
+	}
+	return fht_;
+}
+
+// -----------------------------------------------------------------------------
+float* SRP_Scratch::score_buf(		// buffer for SQ8 scores of candidates
+	int   size)							// number of floats
+{
+	if (size > max_s_) {
+		delete[] score_;
+		max_s_ = size;
+		score_ = new float[max_s_];
+	}
+	return score_;
+}
+
 // -----------------------------------------------------------------------------
 SRP_LSH::SRP_LSH(					// constructor
 	int   n,							// cardinality of dataset
@@ -19,6 +116,7 @@ SRP_LSH::SRP_LSH(					// constructor
 	// -------------------------------------------------------------------------
 	n_pts_ = n;
 	dim_   = d;
+	kern_  = dim_kernels(d);
 	K_     = K;
 	m_     = (int) ceil(K / 64.0f);
 	data_  = data;
@@ -26,74 +124,135 @@ SRP_LSH::SRP_LSH(					// constructor
 	// -------------------------------------------------------------------------
 	//  generate random projection vectors
 	// -------------------------------------------------------------------------
-	proj_ = new float*[K_];
+	owned_ = true;
+	srht_  = g_struct_proj == 1 ? new SRHT(dim_, K_) : NULL;
+	proj_  = new float*[K_];
+
+	Random rng;
+	float *buf = new float[K_ + (srht_ != NULL ? srht_->buf_size() : 0)];
 	for (int i = 0; i < K_; ++i) {
 		proj_[i] = new float[dim_];
-		for (int j = 0; j < dim_; ++j) {
-			proj_[i][j] = gaussian(0.0f, 1.0f);
-		}
-	}
-
-	// -------------------------------------------------------------------------
-	//  initialize lookup table for all uint16_t values
-	// -------------------------------------------------------------------------
-	int size = 1 << 16;
-	table16_ = new uint32_t[size];
-	for (int i = 0; i < size; ++i) {
-		table16_[i] = bit_count(i);
+		if (srht_ != NULL) srht_->row(i, proj_[i], buf);
+		else rng.gaussian(dim_, proj_[i]);
 	}
 
 	// -------------------------------------------------------------------------
 	//  calculate and compress hash code after random projection
 	// -------------------------------------------------------------------------
 	bool *hash_code = new bool[K_];
-	hash_key_ = new uint64_t*[n_pts_];
+	hash_key_ = new uint64_t[(size_t) n_pts_ * m_];
 	for (int i = 0; i < n_pts_; ++i) {
-		for (int j = 0; j < K_; ++j) {
-			hash_code[j] = calc_hash_code(j, data_[i]);
-		}
-		hash_key_[i] = compress_hash_code((const bool*) hash_code);
+		calc_hash_codes(data_[i], buf, hash_code);
+		compress_hash_code((const bool*) hash_code, 
+			hash_key_ + (size_t) i * m_);
 	}
 	delete[] hash_code; hash_code = NULL;
+	delete[] buf; buf = NULL;
 }
 
 // -----------------------------------------------------------------------------
 SRP_LSH::~SRP_LSH()					// destructor
 {
-	for (int i = 0; i < K_; ++i) {
-		delete[] proj_[i];	proj_[i] = NULL;
+	if (owned_) {
+		for (int i = 0; i < K_; ++i) {
+			delete[] proj_[i]; proj_[i] = NULL;
+		}
+		delete[] hash_key_;
 	}
-	delete[] proj_;	proj_ = NULL;
+	hash_key_ = NULL;
+	delete[] proj_; proj_ = NULL;
+	delete   srht_; srht_ = NULL;
+}
 
-	delete[] table16_; table16_ = NULL;
-	for (int i = 0; i < n_pts_; ++i) {
-		delete[] hash_key_[i]; hash_key_[i] = NULL;
+// -----------------------------------------------------------------------------
+int SRP_LSH::save(					// write index to an index file
+	FILE  *fp)							// output file
+{
+	// -------------------------------------------------------------------------
+	//  parameters, projection vectors (K x d), hash keys (n x m)
+	// -------------------------------------------------------------------------
+	int para[4] = { n_pts_, dim_, K_, m_ };
+	if (write_aligned(fp, para, sizeof(para))) return 1;
+
+	for (int i = 0; i < K_; ++i) {
+		fwrite(proj_[i], SIZEFLOAT, dim_, fp);
 	}
-	delete[] hash_key_; hash_key_ = NULL;
+	if (write_aligned(fp, NULL, 0)) return 1;
+
+	size_t size = (size_t) n_pts_ * m_ * sizeof(uint64_t);
+	if (write_aligned(fp, hash_key_, size)) return 1;
+
+	return ferror(fp) ? 1 : 0;
 }
 
 // -----------------------------------------------------------------------------
-inline uint32_t SRP_LSH::bit_count(	// count the number of 1 bits of x
-	uint32_t x) 						// input uint32_t value
+SRP_LSH* SRP_LSH::load(				// index in place from an mmap-ed file
+	Mmap_Cursor *in,					// input mapping
+	int   n,							// expected number of data objects
+	int   d,							// expected dimensionality
+	const float **data)					// data objects
 {
-    uint32_t num = x - ((x >> 1) & 033333333333) - ((x >> 2) & 011111111111);
-    return ((num + (num >> 3)) & 030707070707) % 63;
-}
+	const int *para = (const int *) read_aligned(in, 4 * sizeof(int));
+	if (para == NULL || para[0] != n || para[1] != d) {
+		printf("Corrupted SRP_LSH index\n");
+		return NULL;
+	}
+	int K = para[2], m = para[3];
+	const float *proj = (const float *) read_aligned(in, 
+		(size_t) K * d * SIZEFLOAT);
+	const uint64_t *key = (const uint64_t *) read_aligned(in, 
+		(size_t) n * m * sizeof(uint64_t));
+	if (proj == NULL || key == NULL) {
+		printf("Corrupted SRP_LSH index\n");
+		return NULL;
+	}
+
+	SRP_LSH *lsh = new SRP_LSH();
+	lsh->n_pts_  = n;
+	lsh->dim_    = d;
+	lsh->kern_   = dim_kernels(d);
+	lsh->K_      = K;
+	lsh->m_      = m;
+	lsh->data_   = data;
+	lsh->owned_  = false;
+	lsh->srht_   = NULL;
+
+	lsh->proj_     = new float*[K];
+	lsh->hash_key_ = (uint64_t *) key;
+	for (int i = 0; i < K; ++i) {
+		lsh->proj_[i] = (float *) proj + (size_t) i * d;
+	}
 
+	return lsh;
+}
 
 // -----------------------------------------------------------------------------
 inline bool SRP_LSH::calc_hash_code( // calc hash code after random projection
 	int   id,							// projection vector id
 	const float *data)					// input data
 {
-	return calc_inner_product(dim_, proj_[id], data) >= 0 ? true : false;
+	return calc_inner_product(kern_, dim_, proj_[id], data) >= 0 ? true : false;
+}
+
+// -----------------------------------------------------------------------------
+void SRP_LSH::calc_hash_codes(		// calc all K hash codes of an object
+	const float *data,					// input data
+	float *buf,							// buffer (K + buf_size() floats)
+	bool  *hash_code)					// hash code (return)
+{
+	if (srht_ == NULL) {
+		for (int i = 0; i < K_; ++i) hash_code[i] = calc_hash_code(i, data);
+		return;
+	}
+	srht_->project(dim_, data, buf, buf + K_);
+	for (int i = 0; i < K_; ++i) hash_code[i] = buf[i] >= 0;
 }
 
 // -----------------------------------------------------------------------------
-uint64_t* SRP_LSH::compress_hash_code( // compress hash code with 64 bits
-	const bool *hash_code)				// input hash code
+void SRP_LSH::compress_hash_code(	// compress hash code with 64 bits
+	const bool *hash_code,				// input hash code
+	uint64_t *hash_key)					// compressed hash code (return)
 {
-	uint64_t *hash_key = new uint64_t[m_];
 	int shift = 0;
 	for (int i = 0; i < m_; ++i) {
 		int size = (i == m_-1 && K_%64 != 0) ? (K_ % 64) : 64;
@@ -105,7 +264,6 @@ uint64_t* SRP_LSH::compress_hash_code( // compress hash code with 64 bits
 		hash_key[i] = val;
 		shift += size;
 	}
-	return hash_key;
 }
 
 // -----------------------------------------------------------------------------
@@ -115,53 +273,68 @@ void SRP_LSH::display()				// display parameters
 	printf("    n = %d\n",   n_pts_);
 	printf("    d = %d\n",   dim_);
 	printf("    K = %d\n",   K_);
-	printf("    m = %d\n\n", m_);
+	printf("    m = %d\n",   m_);
+	printf("    proj = %s\n\n", srht_ != NULL ? "srht" : "dense");
+}
+
+// -----------------------------------------------------------------------------
+size_t SRP_LSH::index_size()		// memory of projections and hash codes
+{
+	return (size_t) K_ * dim_ * SIZEFLOAT + 
+		(size_t) n_pts_ * m_ * sizeof(uint64_t);
 }
 
 // -----------------------------------------------------------------------------
 int SRP_LSH::kmc(					// c-k-AMC search
 	int   top_k,						// top-k value
 	const float *query,					// input query
+	SRP_Scratch *scratch,				// search context of this thread
 	std::vector<int> &cand) 			// MCS candidates  (return)
 {
+	scratch->begin(n_pts_, K_, m_);
+
 	// -------------------------------------------------------------------------
 	//  calculate the hash key (compressed hash code) of query
 	// -------------------------------------------------------------------------
-	bool *hash_code_q = new bool[K_];
-	for (int i = 0; i < K_; ++i) {
-		hash_code_q[i] = calc_hash_code(i, query);
-	}
-	uint64_t *hash_key_q = compress_hash_code((const bool*) hash_code_q);
+	bool *hash_code_q = scratch->code_;
+	float *buf = NULL;
+	if (srht_ != NULL) buf = scratch->fht_buf(K_ + srht_->buf_size());
+	calc_hash_codes(query, buf, hash_code_q);
+	uint64_t *hash_key_q = scratch->key_;
+	compress_hash_code((const bool*) hash_code_q, hash_key_q);
 
 	// -------------------------------------------------------------------------
-	//  find the candidates with largest matched values
+	//  calculate the Hamming distances of all data objects
 	// -------------------------------------------------------------------------
-	MaxK_List *list = new MaxK_List(CANDIDATES + top_k - 1);
-	int total_bits = 64 * m_;
-	for (int i = 0; i < n_pts_; ++i) {
-		uint32_t match = 0;
-		for (int j = 0; j < m_; ++j) {
-			match += table_lookup(hash_key_[i][j] ^ hash_key_q[j]);
-		}
-		list->insert((float) (total_bits - match), i);
-	}
+	uint16_t *dist = scratch->dist_;
+	g_simd.hamming_(n_pts_, m_, hash_key_, hash_key_q, dist);
+	STATS_ADD(entries_, n_pts_);
 
-	int size = list->size();
-	for (int i = 0; i < size; ++i) {
-		cand.push_back(list->ith_id(i));
+	// -------------------------------------------------------------------------
+	//  find the candidates with smallest distances: the size candidates are 
+	//  all objects with distance < thres and the first ones with distance = 
+	//  thres; they are placed by counting sort (by distance, then by id)
+	// -------------------------------------------------------------------------
+	int size = MIN(CANDIDATES + top_k - 1, n_pts_);
+	int *cnt = scratch->cnt_;
+	memset(cnt, 0, (K_ + 1) * SIZEINT);
+	for (int i = 0; i < n_pts_; ++i) ++cnt[dist[i]];
+
+	int thres = 0, sum = 0;
+	while (sum + cnt[thres] < size) {
+		int tmp = cnt[thres]; cnt[thres] = sum; sum += tmp; ++thres;
 	}
+	cnt[thres] = sum;				// offsets of all distances <= thres
 
-	delete[] hash_code_q; hash_code_q = NULL;
-	delete[] hash_key_q;  hash_key_q  = NULL;
-	delete list; list = NULL;
+	int base = (int) cand.size(), num = 0;
+	cand.resize(base + size);
+	for (int i = 0; i < n_pts_ && num < size; ++i) {
+		int d = dist[i];
+		if (d < thres || (d == thres && cnt[d] < size)) {
+			cand[base + cnt[d]++] = i; ++num;
+		}
+	}
+	STATS_ADD(cands_, size);
 
 	return 0;
 }
-
-// -----------------------------------------------------------------------------
-inline uint32_t SRP_LSH::table_lookup( // table lookup the match value
-	uint64_t x)							// input uint64_t value
-{
-	return table16_[x & 0xffff] + table16_[(x>>16) & 0xffff] + 
-		table16_[(x>>32) & 0xffff] + table16_[(x>>48) & 0xffff];
-}
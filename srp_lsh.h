@@ -2,6 +2,60 @@
 #define __SRP_LSH_H
 
 class MaxK_List;
+class SRHT;
+struct Mmap_Cursor;
+struct Dim_Kernels;
+
+// -----------------------------------------------------------------------------
+//  SRP_Scratch: the per-query search context of SRP_LSH (and of Sign_ALSH and 
+//  Simple_LSH built on it), so that many threads can search one index at the 
+//  same time without allocating: every thread uses its own scratch, which 
+//  grows lazily to the largest index it has searched.
+// -----------------------------------------------------------------------------
+class SRP_Scratch {
+public:
+	SRP_Scratch();					// constructor
+	~SRP_Scratch();					// destructor
+
+	// -------------------------------------------------------------------------
+	void begin(						// start a new query
+		int   n,						// number of data objects of the index
+		int   K,						// number of hash functions of the index
+		int   m);						// number of uint64_t hash code
+
+	// -------------------------------------------------------------------------
+	float *query_buf(				// buffer for a transformed query
+		int   size);					// number of floats
+
+	// -------------------------------------------------------------------------
+	float *fht_buf(					// buffer for structured projections
+		int   size);					// number of floats
+
+	// -------------------------------------------------------------------------
+	float *score_buf(				// buffer for SQ8 scores of candidates
+		int   size);					// number of floats
+
+	// -------------------------------------------------------------------------
+	inline std::vector<int> &cand() { return cand_; }
+
+	// -------------------------------------------------------------------------
+	bool     *code_;				// hash code of query (K)
+	uint64_t *key_;					// compressed hash code of query (m)
+	uint16_t *dist_;				// Hamming distances of data objects (n)
+	int      *cnt_;					// counters of counting sort (K + 1)
+
+protected:
+	int      max_n_;				// capacity of dist_
+	int      max_K_;				// capacity of code_ and cnt_
+	int      max_m_;				// capacity of key_
+	int      max_q_;				// capacity of query_
+	float    *query_;				// transformed query of the caller
+	int      max_f_;				// capacity of fht_
+	float    *fht_;					// projections and buffer of SRHT
+	int      max_s_;				// capacity of score_
+	float    *score_;				// buffer of SQ8::filter
+	std::vector<int> cand_;			// candidates of the caller
+};
 
 // -----------------------------------------------------------------------------
 //  Sign-Random Projection LSH (SRP_LSH) is used to solve the problem of 
@@ -11,6 +65,16 @@ class MaxK_List;
 //  estimation techniques from rounding algorithms", In Proceedings of the 
 //  thiry-fourth annual ACM symposium on Theory of computing (STOC), pages 
 //  380–388, 2002.
+//
+//  the hash codes of all objects are stored in one contiguous array (n x m 
+//  words). kmc() computes the Hamming distances of all codes to the query code 
+//  by the SIMD kernel g_simd.hamming_, and then selects the candidates by a 
+//  counting sort on the integer distances (ties are broken by smaller id),
+//  which requires K < 65536.
+//
+//  with g_struct_proj = 1, the projection vectors are the rows of an SRHT 
+//  (see fht.h), so that the K signs of a data object or query come from fast 
+//  Hadamard transforms; proj_ keeps the dense rows for save().
 // -----------------------------------------------------------------------------
 class SRP_LSH {
 public:
@@ -26,26 +90,45 @@ public:
 	// -------------------------------------------------------------------------
 	void display();					// display parameters
 
+	// -------------------------------------------------------------------------
+	size_t index_size();			// memory of projections and hash codes
+
 	// -------------------------------------------------------------------------
 	int kmc(						// c-k-AMC search
 		int   top_k,					// top-k value
 		const float *query,				// input query
+		SRP_Scratch *scratch,			// search context of this thread
 		std::vector<int> &cand); 		// MCS candidates  (return)
 
+	// -------------------------------------------------------------------------
+	inline int num_hash() { return K_; }
+
+	// -------------------------------------------------------------------------
+	int save(						// write index to an index file
+		FILE  *fp);						// output file
+
+	// -------------------------------------------------------------------------
+	static SRP_LSH* load(			// index in place from an mmap-ed file
+		Mmap_Cursor *in,				// input mapping
+		int   n,						// expected number of data objects
+		int   d,						// expected dimensionality
+		const float **data);			// data objects
+
 protected:
+	SRP_LSH() {}					// constructor (used by load)
+
+	// -------------------------------------------------------------------------
 	int   n_pts_;					// number of data objects
 	int   dim_;						// dimensionality
+	const Dim_Kernels *kern_;		// kernels for dim_ (simd.h)
 	int   K_;						// number of hash functions
 	const float **data_;			// data objects
 
 	int      m_;					// number of compressed uint64_t hash code
 	float    **proj_;				// random projection vectors
-	uint64_t **hash_key_;			// hash code of data objects
-	uint32_t *table16_;				// table to record the number of "1" bits
-
-	// -------------------------------------------------------------------------
-	uint32_t bit_count(				// count the number of 1 bits of x
-		uint32_t x); 					// input uint32_t value
+	SRHT     *srht_;				// structured proj_ (or NULL)
+	uint64_t *hash_key_;			// hash codes of data objects (n x m)
+	bool     owned_;				// false if proj_ and hash_key_ are mmap-ed
 
 	// -------------------------------------------------------------------------
 	bool calc_hash_code(			// calc hash code after random projection
@@ -53,12 +136,15 @@ protected:
 		const float *data);				// input data
 
 	// -------------------------------------------------------------------------
-	uint64_t* compress_hash_code(	// compress hash code with 64 bits
-		const bool *hash_code);			// input hash code
-	
+	void calc_hash_codes(			// calc all K hash codes of an object
+		const float *data,				// input data
+		float *buf,						// buffer (K + buf_size() floats)
+		bool  *hash_code);				// hash code (return)
+
 	// -------------------------------------------------------------------------
-	uint32_t table_lookup(			// table lookup the match value
-		uint64_t x);					// input uint64_t value
+	void compress_hash_code(		// compress hash code with 64 bits
+		const bool *hash_code,			// input hash code
+		uint64_t *hash_key);			// compressed hash code (return)
 };
 
 #endif // __SRP_LSH_H
@@ -0,0 +1,24 @@
+#include <cstdint>
+#include <cstdio>
+
+#include "stats.h"
+
+#ifdef H2_STATS
+thread_local Query_Stats g_stats;
+#endif
+
+// -----------------------------------------------------------------------------
+uint64_t stats_value(				// get the i-th counter of Query_Stats
+	const Query_Stats &s,				// counters
+	int   i)							// counter id (0 ... STATS_NUM - 1)
+{
+	switch (i) {
+	case 0:  return s.blocks_;
+	case 1:  return s.pruned_;
+	case 2:  return s.rounds_;
+	case 3:  return s.entries_;
+	case 4:  return s.cands_;
+	case 5:  return s.ips_;
+	default: return s.early_;
+	}
+}
@@ -0,0 +1,83 @@
+#ifndef __STATS_H
+#define __STATS_H
+
+#include <cstdint>
+
+// -----------------------------------------------------------------------------
+//  Query_Stats: per-query counters of the search, to see why a query is slow. 
+//  They are only compiled in with -DH2_STATS (make STATS=1); otherwise 
+//  STATS_ADD and STATS_SCOPE expand to nothing and cost nothing.
+//
+//  every thread counts into its own thread-local g_stats, which the driver 
+//  (kmip_queries in amips.cc) resets before and reads after each query. Work 
+//  done for a query on other threads (e.g., the blocks of kmip_parallel) is 
+//  counted in a Stats_Scope and merged into the stats of the calling thread.
+// -----------------------------------------------------------------------------
+struct Query_Stats {
+	uint64_t blocks_;					// blocks visited (H2_ALSH)
+	uint64_t pruned_;					// blocks pruned by M * normq <= kip
+	uint64_t rounds_;					// rounds (radius expansions) of QALSH
+	uint64_t entries_;					// hash table entries scanned
+	uint64_t cands_;					// candidates produced by LSH
+	uint64_t ips_;						// inner products computed
+	uint64_t early_;					// early terminations of inner products
+
+	Query_Stats() { reset(); }
+
+	// -------------------------------------------------------------------------
+	void reset() {					// clear all counters
+		blocks_ = 0; pruned_ = 0; rounds_ = 0; entries_ = 0; 
+		cands_  = 0; ips_    = 0; early_  = 0;
+	}
+
+	// -------------------------------------------------------------------------
+	void add(						// add the counters of another query
+		const Query_Stats &s) {			// counters
+		blocks_ += s.blocks_; pruned_ += s.pruned_; rounds_ += s.rounds_; 
+		entries_ += s.entries_; cands_ += s.cands_; ips_ += s.ips_; 
+		early_  += s.early_;
+	}
+
+	// -------------------------------------------------------------------------
+	void div(						// share of one of num queries of a batch
+		int   num) {					// number of queries
+		blocks_ /= num; pruned_ /= num; rounds_ /= num; entries_ /= num; 
+		cands_  /= num; ips_    /= num; early_  /= num;
+	}
+};
+
+const int   STATS_NUM = 7;			// number of counters of Query_Stats
+const char  STATS_NAME[STATS_NUM][10] = { "blocks", "pruned", "rounds", 
+	"entries", "cands", "ips", "early" };
+
+#ifdef H2_STATS
+extern thread_local Query_Stats g_stats; // counters of this thread
+
+// -----------------------------------------------------------------------------
+//  Stats_Scope: counts into a fresh g_stats until it goes out of scope, then 
+//  adds the counts to *target and restores the counts before
+// -----------------------------------------------------------------------------
+class Stats_Scope {
+public:
+	Stats_Scope(Query_Stats *target) { target_ = target; saved_ = g_stats; 
+		g_stats.reset(); }
+	~Stats_Scope() { target_->add(g_stats); g_stats = saved_; }
+
+protected:
+	Query_Stats *target_;			// where the counts go
+	Query_Stats saved_;				// counts before the scope
+};
+
+#define STATS_ADD(field, v)		(g_stats.field += (v))
+#define STATS_SCOPE(target)		Stats_Scope stats_scope_(target)
+#else
+#define STATS_ADD(field, v)		((void) 0)
+#define STATS_SCOPE(target)		((void) 0)
+#endif
+
+// -----------------------------------------------------------------------------
+uint64_t stats_value(				// get the i-th counter of Query_Stats
+	const Query_Stats &s,				// counters
+	int   i);							// counter id (0 ... STATS_NUM - 1)
+
+#endif // __STATS_H
@@ -0,0 +1,366 @@
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <unistd.h>
+
+#include "def.h"
+#include "util.h"
+#include "parallel.h"
+#include "random.h"
+#include "fht.h"
+#include "sq8.h"
+#include "qalsh.h"
+#include "h2_alsh.h"
+#include "h2_shards.h"
+#include "pca.h"
+#include "amips.h"
+#include "sweep.h"
+
+// -----------------------------------------------------------------------------
+//  Sweep_Index: an index set built by the sweep, and its build parameters
+// -----------------------------------------------------------------------------
+struct Sweep_Index {
+	std::string key_;					// build parameters
+	char  index_set_[220];				// address of index set
+	float index_time_;					// indexing time of the first build
+	float index_mb_;					// index size (MB), -1 if unknown
+};
+
+// -----------------------------------------------------------------------------
+static float resident_mb()			// resident memory of this process (MB)
+{
+	FILE *fp = fopen("/proc/self/statm", "r");
+	if (!fp) return -1.0f;
+
+	long size = 0, resident = 0;
+	int  ret  = fscanf(fp, "%ld %ld", &size, &resident);
+	fclose(fp);
+	if (ret != 2) return -1.0f;
+
+	return resident * (float) sysconf(_SC_PAGESIZE) / 1048576.0f;
+}
+
+// -----------------------------------------------------------------------------
+static bool parse_set(				// parse one parameter set
+	char  *line,						// options of the set (modified)
+	int   *alg,							// algorithm (return)
+	int   *K,							// -K (return)
+	int   *m,							// -m (return)
+	float *U,							// -U (return)
+	float *nn_ratio,					// -c0 (return)
+	float *mip_ratio)					// -c (return)
+{
+	std::vector<char*> args;
+	for (char *t = strtok(line, " \t\r\n"); t; t = strtok(NULL, " \t\r\n")) {
+		args.push_back(t);
+	}
+
+	int num = (int) args.size();
+	for (int i = 0; i + 1 < num; i += 2) {
+		const char *opt = args[i];
+		const char *val = args[i + 1];
+
+		if (strcmp(opt, "-alg") == 0) {
+			*alg = atoi(val);
+			if (*alg < 1 || *alg > 7) return false;
+		}
+		else if (strcmp(opt, "-K") == 0) {
+			*K = atoi(val);
+			if (*K <= 0) return false;
+		}
+		else if (strcmp(opt, "-m") == 0) {
+			*m = atoi(val);
+			if (*m <= 0) return false;
+		}
+		else if (strcmp(opt, "-U") == 0) {
+			*U = (float) atof(val);
+			if (*U <= 0.0f || *U > 1.0f) return false;
+		}
+		else if (strcmp(opt, "-c0") == 0) {
+			*nn_ratio = (float) atof(val);
+			if (*nn_ratio <= 1.0f) return false;
+		}
+		else if (strcmp(opt, "-c") == 0) {
+			*mip_ratio = (float) atof(val);
+			if (*mip_ratio <= 0.0f || *mip_ratio >= 1.0f) return false;
+		}
+		else if (strcmp(opt, "-nt") == 0) {
+			g_num_threads = atoi(val);
+			if (g_num_threads <= 0) return false;
+		}
+		else if (strcmp(opt, "-kb") == 0) {
+			g_key_bits = atoi(val);
+			if (g_key_bits != 32 && g_key_bits != 16) return false;
+		}
+		else if (strcmp(opt, "-bq") == 0) {
+			g_query_batch = atoi(val);
+			if (g_query_batch < 0) return false;
+		}
+		else if (strcmp(opt, "-iq") == 0) {
+			g_query_threads = atoi(val);
+			if (g_query_threads <= 0) return false;
+		}
+		else if (strcmp(opt, "-bp") == 0) {
+			g_block_mode = atoi(val);
+			if (g_block_mode != 0 && g_block_mode != 1) return false;
+		}
+		else if (strcmp(opt, "-et") == 0) {
+			g_early_stop = atoi(val);
+			if (g_early_stop != 0 && g_early_stop != 1) return false;
+		}
+		else if (strcmp(opt, "-sp") == 0) {
+			g_shared_proj = atoi(val);
+			if (g_shared_proj != 0 && g_shared_proj != 1) return false;
+		}
+		else if (strcmp(opt, "-rp") == 0) {
+			g_struct_proj = atoi(val);
+			if (g_struct_proj != 0 && g_struct_proj != 1) return false;
+		}
+		else if (strcmp(opt, "-sd") == 0) {
+			g_seed = atoi(val);
+			if (g_seed < 0) return false;
+		}
+		else if (strcmp(opt, "-sq") == 0) {
+			g_sq_frac = (float) atof(val);
+			if (g_sq_frac < 0.0f || g_sq_frac > 1.0f) return false;
+		}
+		else if (strcmp(opt, "-sh") == 0) {
+			g_num_shards = atoi(val);
+			if (g_num_shards <= 0) return false;
+		}
+		else if (strcmp(opt, "-mb") == 0) {
+			g_build_mb = atoi(val);
+			if (g_build_mb < 0) return false;
+		}
+		else return false;
+	}
+	return num % 2 == 0 && *alg >= 1;
+}
+
+// -----------------------------------------------------------------------------
+int sweep(							// in-process parameter sweep
+	int   n,							// number of data objects
+	int   qn,							// number of query objects
+	int   d,							// dimensionality
+	int   K,							// -K of the command line
+	int   m,							// -m of the command line
+	float U,							// -U of the command line
+	float nn_ratio,						// -c0 of the command line
+	float mip_ratio,					// -c of the command line
+	const float **data,					// data objects
+	const float **norm_d,				// l2-norm of data objects
+	const float **query,				// query objects
+	const float **norm_q,				// l2-norm of query objects
+	const Result **R,					// MIP ground truth results
+	const char *sweep_set,				// address of parameter sets
+	const char *out_path)				// output path
+{
+	FILE *in = fopen(sweep_set, "r");
+	if (!in) {
+		printf("Could not open %s\n", sweep_set);
+		return 1;
+	}
+
+	char output_set[220];
+	sprintf(output_set, "%ssweep.csv", out_path);
+	bool exists = access(output_set, F_OK) == 0;
+	FILE *fp = fopen(output_set, "a+");
+	if (!fp) {
+		printf("Could not create %s\n", output_set);
+		fclose(in);
+		return 1;
+	}
+	if (!exists) {
+		fprintf(fp, "set,alg,params,reused,index_time,index_mb,memory_mb,"
+			"run,top_k,ratio,time_ms,recall,qps,p50_ms,p95_ms,p99_ms\n");
+	}
+
+	// -------------------------------------------------------------------------
+	//  the globals of the command line, restored before every set
+	// -------------------------------------------------------------------------
+	int num_threads   = g_num_threads;
+	int key_bits      = g_key_bits;
+	int query_batch   = g_query_batch;
+	int query_threads = g_query_threads;
+	int block_mode    = g_block_mode;
+	int early_stop    = g_early_stop;
+	int shared_proj   = g_shared_proj;
+	int struct_proj   = g_struct_proj;
+	int seed          = g_seed;
+	float sq_frac     = g_sq_frac;
+	int num_shards    = g_num_shards;
+	int build_mb      = g_build_mb;
+
+	std::vector<Sweep_Index> indexes;
+	std::vector<Eval_Row> rows;
+	g_eval_rows = &rows;
+
+	char line[1024], params[1024], key[256];
+	int  num_sets = 0;
+	while (fgets(line, sizeof(line), in)) {
+		char *hash = strchr(line, '#');
+		if (hash != NULL) *hash = '\0';
+		line[strcspn(line, "\r\n")] = '\0';
+
+		int len = (int) strlen(line);
+		while (len > 0 && (line[len-1] == ' ' || line[len-1] == '\t')) {
+			line[--len] = '\0';
+		}
+		char *start = line + strspn(line, " \t");
+		if (*start == '\0') continue;
+		strncpy(params, start, sizeof(params));
+
+		// ---------------------------------------------------------------------
+		//  parameters of this set
+		// ---------------------------------------------------------------------
+		g_num_threads   = num_threads;
+		g_key_bits      = key_bits;
+		g_query_batch   = query_batch;
+		g_query_threads = query_threads;
+		g_block_mode    = block_mode;
+		g_early_stop    = early_stop;
+		g_shared_proj   = shared_proj;
+		g_struct_proj   = struct_proj;
+		g_seed          = seed;
+		g_sq_frac       = sq_frac;
+		g_num_shards    = num_shards;
+		g_build_mb      = build_mb;
+
+		int   alg = -1, sK = K, sm = m;
+		float sU = U, c0 = nn_ratio, c = mip_ratio;
+		if (!parse_set(start, &alg, &sK, &sm, &sU, &c0, &c)) {
+			printf("Invalid parameter set: %s\n", params);
+			continue;
+		}
+		printf("Parameter set %d: %s\n\n", ++num_sets, params);
+
+		// ---------------------------------------------------------------------
+		//  find a saved index with the same build parameters (shards of -alg 1 
+		//  are always built)
+		// ---------------------------------------------------------------------
+		key[0] = '\0';
+		if (alg == 1 && g_num_shards <= 1) {
+			sprintf(key, "1 %f %f %d %d %d %d %d", c0, c, g_key_bits, 
+				g_block_mode, g_shared_proj, g_struct_proj, g_seed);
+		}
+		else if (alg == 5) {
+			sprintf(key, "5 %d %d %f %d %d", sK, sm, sU, g_struct_proj, g_seed);
+		}
+		else if (alg == 6) sprintf(key, "6 %d %d %d", sK, g_struct_proj, g_seed);
+
+		Sweep_Index *index = NULL;
+		bool reused = false;
+		if (key[0] != '\0') {
+			for (size_t i = 0; i < indexes.size(); ++i) {
+				if (indexes[i].key_ == key) { index = &indexes[i]; break; }
+			}
+			if (index != NULL) reused = true;
+			else {
+				Sweep_Index idx;
+				idx.key_ = key;
+				sprintf(idx.index_set_, "%ssweep_%d.idx", out_path, 
+					(int) indexes.size());
+				idx.index_time_ = 0.0f;
+				idx.index_mb_   = -1.0f;
+				remove(idx.index_set_);
+				indexes.push_back(idx);
+				index = &indexes.back();
+			}
+		}
+		const char *index_set = index != NULL ? index->index_set_ : NULL;
+
+		// ---------------------------------------------------------------------
+		//  run, with the random state of a fresh process
+		// ---------------------------------------------------------------------
+		rows.clear();
+		g_index_time = 0.0f;
+		g_index_mb   = -1.0f;
+		srand(6);
+		reset_streams();
+
+		switch (alg) {
+		case 1:
+			h2_alsh(n, qn, d, c0, c, data, norm_d, query, norm_q, R, 
+				index_set, out_path);
+			break;
+		case 2:
+			l2_alsh(n, qn, d, sm, sU, c0, data, norm_d, query, norm_q, R, 
+				out_path);
+			break;
+		case 3:
+			l2_alsh2(n, qn, d, sm, sU, c0, data, norm_d, query, norm_q, R, 
+				out_path);
+			break;
+		case 4:
+			xbox(n, qn, d, c0, data, norm_d, query, norm_q, R, out_path);
+			break;
+		case 5:
+			sign_alsh(n, qn, d, sK, sm, sU, data, norm_d, query, norm_q, R, 
+				index_set, out_path);
+			break;
+		case 6:
+			simple_lsh(n, qn, d, sK, data, norm_d, query, norm_q, R, 
+				index_set, out_path);
+			break;
+		case 7:
+			linear_scan(n, qn, d, data, norm_d, query, norm_q, R, out_path);
+			break;
+		}
+		if (index != NULL && !reused) {
+			index->index_time_ = g_index_time;
+			index->index_mb_   = g_index_mb;
+		}
+		float index_time = index != NULL ? index->index_time_ : g_index_time;
+		float index_mb   = index != NULL ? index->index_mb_   : g_index_mb;
+		float memory_mb  = resident_mb();
+
+		// ---------------------------------------------------------------------
+		//  one row per top-k value; run counts the searches of a set with the 
+		//  same top-k (e.g., XBox and H2_ALSH- of -alg 4)
+		// ---------------------------------------------------------------------
+		for (size_t i = 0; i < rows.size(); ++i) {
+			const Eval_Row &r = rows[i];
+			int run = 0;
+			for (size_t j = 0; j < i; ++j) {
+				if (rows[j].top_k_ == r.top_k_) ++run;
+			}
+			fprintf(fp, "%d,%d,\"%s\",%d,%f,%f,%f,"
+				"%d,%d,%f,%f,%f,%f,%f,%f,%f\n", 
+				num_sets, alg, params, reused ? 1 : 0, index_time, index_mb, 
+				memory_mb, run, r.top_k_, r.ratio_, r.time_, r.recall_, r.qps_,
+				r.p50_, r.p95_, r.p99_);
+		}
+		fflush(fp);
+	}
+	printf("Results of %d parameter sets in %s\n\n", num_sets, output_set);
+
+	// -------------------------------------------------------------------------
+	//  release space
+	// -------------------------------------------------------------------------
+	for (size_t i = 0; i < indexes.size(); ++i) {
+		remove(indexes[i].index_set_);
+	}
+	g_num_threads   = num_threads;
+	g_key_bits      = key_bits;
+	g_query_batch   = query_batch;
+	g_query_threads = query_threads;
+	g_block_mode    = block_mode;
+	g_early_stop    = early_stop;
+	g_shared_proj   = shared_proj;
+	g_struct_proj   = struct_proj;
+	g_seed          = seed;
+	g_sq_frac       = sq_frac;
+	g_num_shards    = num_shards;
+	g_build_mb      = build_mb;
+	g_eval_rows     = NULL;
+
+	fclose(fp);
+	fclose(in);
+
+	return 0;
+}
@@ -0,0 +1,42 @@
+#ifndef __SWEEP_H
+#define __SWEEP_H
+
+// -----------------------------------------------------------------------------
+//  sweep: run many parameter sets of -alg 1 - 7 in one process (-alg 13), on 
+//  the data, queries and ground truth loaded once by main.cc.
+//
+//  every non-empty line of sweep_set (# starts a comment) is one parameter 
+//  set, written as command line options, e.g.,
+//
+//      -alg 1 -c0 2.0 -c 0.5 -nt 4 -bq 64
+//      -alg 5 -K 64 -m 2 -U 0.75
+//
+//  the options of a line are -alg, -c0, -c, -K, -m, -U, -nt, -kb, -bq, -iq, 
+//  -bp, -et, and -sp; the ones not given keep their values from the command 
+//  line. The indexes of -alg 1, 5 and 6 are saved to a temporary index set 
+//  in out_path and loaded again by every later line with the same build 
+//  parameters, so that sweeping query parameters (-nt, -bq, -iq, -et) does 
+//  not rebuild them. The indexes of -alg 2 - 4 are rebuilt every time.
+//
+//  every top-k row of every set goes to one table, out_path/sweep.csv, with 
+//  the build time (of the first build), index size, memory, and the accuracy 
+//  and speed of the queries.
+// -----------------------------------------------------------------------------
+int sweep(							// in-process parameter sweep
+	int   n,							// number of data objects
+	int   qn,							// number of query objects
+	int   d,							// dimensionality
+	int   K,							// -K of the command line
+	int   m,							// -m of the command line
+	float U,							// -U of the command line
+	float nn_ratio,						// -c0 of the command line
+	float mip_ratio,					// -c of the command line
+	const float **data,					// data objects
+	const float **norm_d,				// l2-norm of data objects
+	const float **query,				// query objects
+	const float **norm_q,				// l2-norm of query objects
+	const Result **R,					// MIP ground truth results
+	const char *sweep_set,				// address of parameter sets
+	const char *out_path);				// output path
+
+#endif // __SWEEP_H
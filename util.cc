@@ -1,6 +1,9 @@
 #include <algorithm>
 #include <cassert>
 #include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
 #include <cstring>
 #include <vector>
 
@@ -9,10 +12,16 @@
 #include <stdarg.h>
 #include <sys/stat.h>
 #include <sys/types.h>
+#include <sys/mman.h>
+#include <fcntl.h>
 
 #include "def.h"
 #include "util.h"
+#include "matrix.h"
+#include "simd.h"
 #include "pri_queue.h"
+#include "parallel.h"
+#include "stats.h"
 
 timeval g_start_time;
 timeval g_end_time;
@@ -20,6 +29,8 @@ timeval g_end_time;
 float g_runtime = -1.0f;
 float g_ratio   = -1.0f;
 float g_recall  = -1.0f;
+float g_recall_tol = 0.0f;
+uint64_t g_rotation = 0;
 
 // -----------------------------------------------------------------------------
 int ResultComp(						// cmp func for qsort (ascending)
@@ -87,6 +98,26 @@ void create_dir(					// create dir if the path exists
 	}
 }
 
+// -----------------------------------------------------------------------------
+void calc_norm(						// calc l2-norms of one data object
+	int   d,							// dimensionality
+	const float *data,					// data object
+	float *norm_d)						// l2-norms (NORM_K values) (return)
+{
+	memset(norm_d, 0.0f, NORM_K * SIZEFLOAT);
+	for (int j = 0; j < d; ++j) {
+		float tmp = data[j];
+		norm_d[0] += tmp*tmp;
+		for (int t = 1; t < NORM_K; ++t) {
+			if (j < NORM_DIMS[t-1]) norm_d[t] += tmp*tmp;
+		}
+	}
+	for (int t = 1; t < NORM_K; ++t) {
+		norm_d[t] = sqrt(norm_d[0] - norm_d[t]);
+	}
+	norm_d[0] = sqrt(norm_d[0]);
+}
+
 // -----------------------------------------------------------------------------
 int read_data(						// read data from disk
 	int   n,							// number of data objects
@@ -106,24 +137,14 @@ int read_data(						// read data from disk
 	int j = 0;
 	while (!feof(fp) && i < n) {
 		float tmp = 0.0f;
-		memset(norm_d[i], 0.0f, NORM_K * SIZEFLOAT);
-
 		fscanf(fp, "%d", &j);
 		for (j = 0; j < d; ++j) {
 			fscanf(fp, " %f", &tmp);
 			data[i][j] = tmp;
-
-			norm_d[i][0] += tmp*tmp;
-			for (int t = 1; t < NORM_K; ++t) {
-				if (j < 8*t)  norm_d[i][t] += tmp*tmp;
-			}
 		}
 		fscanf(fp, "\n");
 
-		for (int t = 1; t < NORM_K; ++t) {
-			norm_d[i][t] = sqrt(norm_d[i][0] - norm_d[i][t]);
-		}
-		norm_d[i][0] = sqrt(norm_d[i][0]);
+		calc_norm(d, data[i], norm_d[i]);
 		++i;
 	}
 	assert(feof(fp) && i == n);
@@ -137,6 +158,325 @@ int read_data(						// read data from disk
 	return 0;
 }
 
+// -----------------------------------------------------------------------------
+int mmap_file(						// map a whole file read-only into memory
+	const char *fname,					// address of file
+	Mmap_File *mf)						// mapped file (return)
+{
+	int fd = open(fname, O_RDONLY);
+	if (fd < 0) {
+		printf("Could not open %s\n", fname);
+		return 1;
+	}
+
+	struct stat st;
+	if (fstat(fd, &st) != 0 || st.st_size <= 0) {
+		printf("Could not stat %s\n", fname);
+		close(fd);
+		return 1;
+	}
+
+	void *addr = mmap(NULL, (size_t) st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);						// the mapping keeps its own reference
+	if (addr == MAP_FAILED) {
+		printf("Could not mmap %s\n", fname);
+		return 1;
+	}
+	madvise(addr, (size_t) st.st_size, MADV_WILLNEED);
+
+	mf->addr_ = (char*) addr;
+	mf->size_ = (size_t) st.st_size;
+
+	return 0;
+}
+
+// -----------------------------------------------------------------------------
+void munmap_file(					// unmap a file mapped by mmap_file
+	Mmap_File *mf)						// mapped file
+{
+	if (mf->addr_ != NULL) {
+		munmap(mf->addr_, mf->size_);
+		mf->addr_ = NULL; mf->size_ = 0;
+	}
+}
+
+// -----------------------------------------------------------------------------
+bool is_bin_data(					// check whether a file is binary data file
+	const char *fname)					// address of data set
+{
+	FILE *fp = fopen(fname, "rb");
+	if (!fp) return false;
+
+	char magic[sizeof(BIN_MAGIC)];
+	bool ret = fread(magic, 1, sizeof(magic), fp) == sizeof(magic) &&
+		memcmp(magic, BIN_MAGIC, sizeof(magic)) == 0;
+	fclose(fp);
+
+	return ret;
+}
+
+// -----------------------------------------------------------------------------
+int write_bin_data(					// write data to disk in binary format
+	int   n,							// number of data objects
+	int   d,							// dimensionality
+	const char *fname,					// address of binary data set
+	const float **data,					// data objects
+	const float **norm_d)				// l2-norm of data objects
+{
+	gettimeofday(&g_start_time, NULL);
+	FILE *fp = fopen(fname, "wb");
+	if (!fp) {
+		printf("Could not create %s\n", fname);
+		return 1;
+	}
+
+	// -------------------------------------------------------------------------
+	//  write header: magic, version, n, d, NORM_K, stride, NORM_DIMS (padded 
+	//  to BIN_HEADER)
+	// -------------------------------------------------------------------------
+	static_assert(sizeof(BIN_MAGIC) + 5 * SIZEINT + sizeof(NORM_DIMS) <= 
+		BIN_HEADER, "NORM_DIMS do not fit into the header");
+
+	int  stride  = Matrix::padded_stride(d);
+	char header[BIN_HEADER];
+	int  para[5] = { BIN_VERSION, n, d, NORM_K, stride };
+
+	memset(header, 0, BIN_HEADER);
+	memcpy(header, BIN_MAGIC, sizeof(BIN_MAGIC));
+	memcpy(header + sizeof(BIN_MAGIC), para, sizeof(para));
+	memcpy(header + sizeof(BIN_MAGIC) + sizeof(para), NORM_DIMS, 
+		sizeof(NORM_DIMS));
+	fwrite(header, 1, BIN_HEADER, fp);
+
+	// -------------------------------------------------------------------------
+	//  write data objects and their l2-norms
+	// -------------------------------------------------------------------------
+	std::vector<float> pad(stride - d, 0.0f);
+	for (int i = 0; i < n; ++i) {
+		fwrite(data[i], SIZEFLOAT, d, fp);
+		fwrite(pad.data(), SIZEFLOAT, stride - d, fp);
+	}
+	for (int i = 0; i < n; ++i) {
+		fwrite(norm_d[i], SIZEFLOAT, NORM_K, fp);
+	}
+	if (ferror(fp)) {
+		printf("Could not write %s\n", fname);
+		fclose(fp);
+		return 1;
+	}
+	fclose(fp);
+
+	gettimeofday(&g_end_time, NULL);
+	float running_time = g_end_time.tv_sec - g_start_time.tv_sec + 
+		(g_end_time.tv_usec - g_start_time.tv_usec) / 1000000.0f;
+	printf("Write Binary Data: %f Seconds\n\n", running_time);
+
+	return 0;
+}
+
+// -----------------------------------------------------------------------------
+int read_bin_data(					// mmap data from binary data file
+	int   n,							// number of data objects
+	int   d,							// dimensionality
+	const char *fname,					// address of binary data set
+	Matrix **data,						// view of data objects (return)
+	Matrix **norm_d,					// view of l2-norm (return)
+	Mmap_File *mf)						// mapped file (return)
+{
+	gettimeofday(&g_start_time, NULL);
+	if (mmap_file(fname, mf) == 1) return 1;
+
+	// -------------------------------------------------------------------------
+	//  check header against the expected n and d; the file has norm_k l2-norms 
+	//  per object, by the checkpoints dims (only known from version 3 on)
+	// -------------------------------------------------------------------------
+	int para[5] = { -1, -1, -1, -1, -1 };
+	int dims[NORM_K - 1];
+	if (mf->size_ >= (size_t) BIN_HEADER) {
+		memcpy(para, mf->addr_ + sizeof(BIN_MAGIC), sizeof(para));
+		memcpy(dims, mf->addr_ + sizeof(BIN_MAGIC) + sizeof(para), 
+			sizeof(dims));
+	}
+	int norm_k = para[3];
+	int stride = para[0] == 1 ? d : para[4];
+	size_t size = (size_t) BIN_HEADER + (size_t) n * ((size_t) stride + 
+		MAX(norm_k, 0)) * SIZEFLOAT;
+
+	if (mf->size_ != size || memcmp(mf->addr_, BIN_MAGIC, 
+		sizeof(BIN_MAGIC)) != 0 || para[0] < 1 || para[0] > BIN_VERSION || 
+		para[1] != n || para[2] != d || norm_k < 1 || stride < d) {
+		printf("Binary data %s does not match n = %d, d = %d\n", fname, n, d);
+		munmap_file(mf);
+		return 1;
+	}
+
+	bool same_dims = para[0] >= 3 && norm_k == NORM_K;
+	for (int t = 0; t < NORM_K - 1 && same_dims; ++t) {
+		if (dims[t] != NORM_DIMS[t]) same_dims = false;
+	}
+
+	// -------------------------------------------------------------------------
+	//  hand out views of the mapping (zero copy); l2-norms by other 
+	//  checkpoints are recomputed from the rows instead
+	// -------------------------------------------------------------------------
+	const float *rows  = (const float*) (mf->addr_ + BIN_HEADER);
+	const float *norms = rows + (size_t) n * stride;
+	*data = new Matrix(n, d, stride, rows);
+	if (same_dims) {
+		*norm_d = new Matrix(n, NORM_K, NORM_K, norms);
+	}
+	else {
+		printf("Binary data %s has other norm checkpoints than NORM_DIMS; "
+			"recomputing l2-norms (regenerate it by -alg 12)\n", fname);
+		*norm_d = new Matrix(n, NORM_K, false);
+		for (int i = 0; i < n; ++i) {
+			calc_norm(d, (*data)->row(i), (*norm_d)->row(i));
+		}
+	}
+
+	gettimeofday(&g_end_time, NULL);
+	float running_time = g_end_time.tv_sec - g_start_time.tv_sec + 
+		(g_end_time.tv_usec - g_start_time.tv_usec) / 1000000.0f;
+	printf("Read Binary Data: %f Seconds\n\n", running_time);
+
+	return 0;
+}
+
+// -----------------------------------------------------------------------------
+int load_data(						// load text or binary data from disk
+	int   n,							// number of data objects
+	int   d,							// dimensionality
+	const char *fname,					// address of data set
+	Matrix **data,						// data objects (return)
+	Matrix **norm_d,					// l2-norm of data objects (return)
+	Mmap_File *mf)						// mapped file (return)
+{
+	if (is_bin_data(fname)) {
+		return read_bin_data(n, d, fname, data, norm_d, mf);
+	}
+
+	*data   = new Matrix(n, d);
+	*norm_d = new Matrix(n, NORM_K, false);
+	return read_data(n, d, fname, (*data)->rows(), (*norm_d)->rows());
+}
+
+// -----------------------------------------------------------------------------
+void free_data(						// release data from load_data
+	Matrix *data,						// data objects
+	Matrix *norm_d,						// l2-norm of data objects
+	Mmap_File *mf)						// mapped file
+{
+	delete data;   data   = NULL;	// views do not release the mapping
+	delete norm_d; norm_d = NULL;
+	munmap_file(mf);
+}
+
+// -----------------------------------------------------------------------------
+int write_aligned(					// write a section padded to IDX_ALIGN
+	FILE  *fp,							// output file
+	const void *buf,					// section
+	size_t size)						// size of section (in bytes)
+{
+	static const char zeros[IDX_ALIGN] = { 0 };
+
+	if (size > 0 && fwrite(buf, 1, size, fp) != size) return 1;
+	long pos = ftell(fp);
+	if (pos < 0) return 1;
+
+	size_t pad = (IDX_ALIGN - pos % IDX_ALIGN) % IDX_ALIGN;
+	if (pad > 0 && fwrite(zeros, 1, pad, fp) != pad) return 1;
+
+	return 0;
+}
+
+// -----------------------------------------------------------------------------
+const void* read_aligned(			// get a section written by write_aligned
+	Mmap_Cursor *in,					// input mapping
+	size_t size)						// size of section (in bytes)
+{
+	if (in->pos_ > in->size_ || size > in->size_ - in->pos_) return NULL;
+
+	const void *ret = in->addr_ + in->pos_;
+	size_t end = in->pos_ + size;
+	in->pos_ = (end + IDX_ALIGN - 1) / IDX_ALIGN * IDX_ALIGN;
+
+	return ret;
+}
+
+// -----------------------------------------------------------------------------
+int write_index_header(				// write the header of an index file
+	FILE  *fp,							// output file
+	int   type,							// index type
+	int   n,							// number of data objects
+	int   d)							// dimensionality
+{
+	char header[IDX_ALIGN];
+	int  para[4] = { IDX_VERSION, type, n, d };
+	uint64_t rotation = type == IDX_PCA ? 0 : g_rotation;
+
+	memset(header, 0, IDX_ALIGN);
+	memcpy(header, IDX_MAGIC, sizeof(IDX_MAGIC));
+	memcpy(header + sizeof(IDX_MAGIC), para, sizeof(para));
+	memcpy(header + sizeof(IDX_MAGIC) + sizeof(para), &rotation, 
+		sizeof(rotation));
+
+	return write_aligned(fp, header, IDX_ALIGN);
+}
+
+// -----------------------------------------------------------------------------
+int open_index(						// mmap an index file and check its header
+	const char *fname,					// address of index file
+	int   type,							// expected index type
+	int   n,							// expected number of data objects
+	int   d,							// expected dimensionality
+	Mmap_File *mf,						// mapped file (return)
+	Mmap_Cursor *in)					// cursor after the header (return)
+{
+	if (mmap_file(fname, mf) == 1) return 1;
+
+	in->addr_ = mf->addr_;
+	in->size_ = mf->size_;
+	in->pos_  = 0;
+
+	const char *header = (const char *) read_aligned(in, IDX_ALIGN);
+	int para[4];
+	if (header == NULL || memcmp(header, IDX_MAGIC, sizeof(IDX_MAGIC)) != 0) {
+		printf("%s is not an index file\n", fname);
+		munmap_file(mf);
+		return 1;
+	}
+	memcpy(para, header + sizeof(IDX_MAGIC), sizeof(para));
+
+	if (para[0] != IDX_VERSION) {
+		printf("Unsupported version %d of index file %s\n", para[0], fname);
+		munmap_file(mf);
+		return 1;
+	}
+	if (para[1] != type || para[2] != n || para[3] != d) {
+		printf("Index file %s does not match (type %d, n %d, d %d)\n", fname,
+			para[1], para[2], para[3]);
+		munmap_file(mf);
+		return 1;
+	}
+
+	// -------------------------------------------------------------------------
+	//  the index must be built on data in the same coordinates (files written 
+	//  before the digest have zeros there, i.e., unrotated data)
+	// -------------------------------------------------------------------------
+	uint64_t rotation = 0;
+	memcpy(&rotation, header + sizeof(IDX_MAGIC) + sizeof(para), 
+		sizeof(rotation));
+	if (type != IDX_PCA && rotation != g_rotation) {
+		printf("Index file %s was built on %s data, but the data are %s\n", 
+			fname, rotation == 0 ? "unrotated" : "PCA-rotated", 
+			g_rotation == 0 ? "unrotated (without -pc 1)" : 
+			(rotation == 0 ? "PCA-rotated (-pc 1)" : "rotated by other axes"));
+		munmap_file(mf);
+		return 1;
+	}
+	return 0;
+}
+
 // -----------------------------------------------------------------------------
 int read_ground_truth(				// read ground truth results from disk
 	int qn,								// number of query objects
@@ -177,11 +517,8 @@ float calc_inner_product(			// calc inner product
 	const float *p1,					// 1st point
 	const float *p2)					// 2nd point
 {
-	float ret = 0.0f;
-	for (int i = 0; i < dim; ++i) {
-		ret += p1[i] * p2[i];
-	}
-	return ret;
+	STATS_ADD(ips_, 1);
+	return g_simd.ip_(dim, p1, p2);
 }
 
 // -----------------------------------------------------------------------------
@@ -193,116 +530,84 @@ float calc_inner_product(			// calc inner product
 	const float *p2,					// 2nd point
 	const float *norm2) 				// l2-norm of 2nd point
 {
-	float ip = 0.0f;
-	int base = 0;
-	for (int t = 1; t < NORM_K; ++t) {
-		int end = base + 8;
-		for (int i = base; i < end; ++i) {
-			ip += p1[i] * p2[i];
-		}
-		if (ip + norm1[t]*norm2[t] <= threshold) return ip; 
-		base += 8;
-	}
-	for (int i = base; i < dim; ++i) {
-		ip += p1[i] * p2[i];
-	}
-	return ip;
-
-	// unsigned d = dim & ~unsigned(7);
-	// const float *aa = p1, *end_a = aa + d;
-	// const float *bb = p2, *end_b = bb + d;
-
-	// float r = 0.0f;
-	// float r0, r1, r2, r3, r4, r5, r6, r7;
-
-	// const float *a = aa, *b = bb;
-	// int t = 1;
-	// for (; a < end_a; a += 8, b += 8) {
-	// 	__builtin_prefetch(a+32, 0, 3);
-	// 	__builtin_prefetch(b+32, 0, 0);
-
-	// 	r0 = a[0] * b[0];
-	// 	r1 = a[1] * b[1];
-	// 	r2 = a[2] * b[2];
-	// 	r3 = a[3] * b[3];
-	// 	r4 = a[4] * b[4];
-	// 	r5 = a[5] * b[5];
-	// 	r6 = a[6] * b[6];
-	// 	r7 = a[7] * b[7];
-
-	// 	r += r0 + r1 + r2 + r3 + r4 + r5 + r6 + r7;
-
-	// 	if (t < NORM_K && r+norm1[t]*norm2[t] <= threshold) return r;
-	// 	++t;
-	// }
-	// __builtin_prefetch(a, 0, 3);
-	// __builtin_prefetch(b, 0, 0);
-
-	// r0 = r1 = r2 = r3 = r4 = r5 = r6 = r7 = 0.0f;
-	// switch (dim & 7) {
-	// 	case 7: r6 = a[6] * b[6];
-	// 	case 6: r5 = a[5] * b[5];
-	// 	case 5: r4 = a[4] * b[4];
-	// 	case 4: r3 = a[3] * b[3];
-	// 	case 3: r2 = a[2] * b[2];
-	// 	case 2: r1 = a[1] * b[1];
-	// 	case 1: r0 = a[0] * b[0];
-	// }
-	// r += r0 + r1 + r2 + r3 + r4 + r5 + r6 + r7;
-	
-	// return r;
+	STATS_ADD(ips_, 1);
+	return g_simd.ip_thres_(dim, threshold, p1, norm1, p2, norm2);
 }
 
 // -----------------------------------------------------------------------------
-float calc_l2_sqr(					// calc L2 square distance
+float calc_inner_product(			// calc inner product
+	const Dim_Kernels *kern,			// kernels for dim
 	int   dim,							// dimension
-	float threshold,					// threshold
 	const float *p1,					// 1st point
 	const float *p2)					// 2nd point
 {
-	unsigned d = dim & ~unsigned(7);
-	const float *aa = p1, *end_a = aa + d;
-	const float *bb = p2, *end_b = bb + d;
-
-	__builtin_prefetch(aa, 0, 3);
-	__builtin_prefetch(bb, 0, 0);
-
-	float r = 0.0f;
-	float r0, r1, r2, r3, r4, r5, r6, r7;
+	STATS_ADD(ips_, 1);
+	return kern->ip_(dim, p1, p2);
+}
 
-	const float *a = end_a, *b = end_b;
+// -----------------------------------------------------------------------------
+float calc_inner_product(			// calc inner product
+	const Dim_Kernels *kern,			// kernels for dim
+	int   dim,							// dimension
+	float threshold,					// threshold
+	const float *p1,					// 1st point
+	const float *norm1,					// l2-norm of 1st point
+	const float *p2,					// 2nd point
+	const float *norm2) 				// l2-norm of 2nd point
+{
+	STATS_ADD(ips_, 1);
+	return kern->ip_thres_(dim, threshold, p1, norm1, p2, norm2);
+}
 
-	r0 = r1 = r2 = r3 = r4 = r5 = r6 = r7 = 0.0f;
-	switch (dim & 7) {
-		case 7: r6 = SQR(a[6] - b[6]);
-		case 6: r5 = SQR(a[5] - b[5]);
-		case 5: r4 = SQR(a[4] - b[4]);
-		case 4: r3 = SQR(a[3] - b[3]);
-		case 3: r2 = SQR(a[2] - b[2]);
-		case 2: r1 = SQR(a[1] - b[1]);
-		case 1: r0 = SQR(a[0] - b[0]);
+// -----------------------------------------------------------------------------
+void calc_ip_block(					// calc inner products of blocks
+	int   dim,							// dimension
+	int   qn,							// number of queries
+	const float **q,					// queries
+	int   n,							// number of points
+	const float **p,					// points
+	float *ip)							// inner products (qn x n) (return)
+{
+	STATS_ADD(ips_, (uint64_t) qn * n);
+
+	int tile = MAX(4, (IP_BLOCK / (dim * SIZEFLOAT)) & ~3);
+	for (int j0 = 0; j0 < n; j0 += tile) {
+		int j1 = MIN(j0 + tile, n);
+		for (int i = 0; i < qn; ++i) {
+			float *out = ip + (size_t) i * n;
+
+			int j = j0;
+			for (; j + 4 <= j1; j += 4) g_simd.ip4_(dim, q[i], p + j, out + j);
+			if (j < j1) {			// pad the last register tile
+				const float *pt[4];
+				float tmp[4];
+				for (int k = 0; k < 4; ++k) pt[k] = p[MIN(j + k, j1 - 1)];
+				g_simd.ip4_(dim, q[i], pt, tmp);
+				for (int k = 0; j + k < j1; ++k) out[j + k] = tmp[k];
+			}
+		}
 	}
+}
 
-	a = aa; b = bb;
-	for (; a < end_a; a += 8, b += 8) {
-		__builtin_prefetch(a+32, 0, 3);
-		__builtin_prefetch(b+32, 0, 0);
-
-		r += (r0 + r1 + r2 + r3 + r4 + r5 + r6 + r7);
-		if (r > threshold) return r;
+// -----------------------------------------------------------------------------
+float calc_l2_sqr(					// calc L2 square distance
+	int   dim,							// dimension
+	float threshold,					// threshold
+	const float *p1,					// 1st point
+	const float *p2)					// 2nd point
+{
+	return g_simd.l2_sqr_(dim, threshold, p1, p2);
+}
 
-		r0 = SQR(a[0] - b[0]);
-		r1 = SQR(a[1] - b[1]);
-		r2 = SQR(a[2] - b[2]);
-		r3 = SQR(a[3] - b[3]);
-		r4 = SQR(a[4] - b[4]);
-		r5 = SQR(a[5] - b[5]);
-		r6 = SQR(a[6] - b[6]);
-		r7 = SQR(a[7] - b[7]);
-	}
-	r += (r0 + r1 + r2 + r3 + r4 + r5 + r6 + r7);
-	
-	return r;
+// -----------------------------------------------------------------------------
+float calc_l2_sqr(					// calc L2 square distance
+	const Dim_Kernels *kern,			// kernels for dim
+	int   dim,							// dimension
+	float threshold,					// threshold
+	const float *p1,					// 1st point
+	const float *p2)					// 2nd point
+{
+	return kern->l2_sqr_(dim, threshold, p1, p2);
 }
 
 // -----------------------------------------------------------------------------
@@ -311,9 +616,10 @@ float calc_recall(					// calc recall of mip results
 	const Result *R,					// ground truth results 
 	MaxK_List *list)					// results returned by algorithms
 {
-	int i = k - 1;
-	int last = k - 1;
-	while (i >= 0 && R[last].key_ - list->ith_key(i) > FLOATZERO) {
+	int   i    = k - 1;
+	int   last = k - 1;
+	float tol  = MAX(FLOATZERO, g_recall_tol * fabs(R[last].key_));
+	while (i >= 0 && R[last].key_ - list->ith_key(i) > tol) {
 		--i;
 	}
 	return (i + 1) * 100.0f / k;
@@ -325,9 +631,10 @@ float calc_recall(					// calc recall of mip results
 	const Result *R,					// ground truth results 
 	const Result *result)				// MIP results
 {
-	int i = k - 1;
-	int last = k - 1;
-	while (i >= 0 && R[last].key_ - result[i].key_ > FLOATZERO) {
+	int   i    = k - 1;
+	int   last = k - 1;
+	float tol  = MAX(FLOATZERO, g_recall_tol * fabs(R[last].key_));
+	while (i >= 0 && R[last].key_ - result[i].key_ > tol) {
 		--i;
 	}
 	return (i + 1) * 100.0f / k;
@@ -340,9 +647,10 @@ int get_hits(						// get the number of hits between two ID list
 	const Result *R,					// ground truth results 
 	MaxK_List *list)					// results returned by algorithms
 {
-	int i = k - 1;
-	int last = t - 1;
-	while (i >= 0 && R[last].key_ - list->ith_key(i) > FLOATZERO) {
+	int   i    = k - 1;
+	int   last = t - 1;
+	float tol  = MAX(FLOATZERO, g_recall_tol * fabs(R[last].key_));
+	while (i >= 0 && R[last].key_ - list->ith_key(i) > tol) {
 		--i;
 	}
 	return MIN(t, i + 1);
@@ -408,6 +716,174 @@ int norm_distribution(				// analyse norm distribution of data
 	return 0;
 }
 
+// -----------------------------------------------------------------------------
+static inline uint32_t radix_key(	// map a float key to an ordered uint32
+	float key,							// key
+	bool  desc)							// descending order if true
+{
+	uint32_t u;
+	key += 0.0f;					// -0.0 and 0.0 are ties, as in qsort
+	memcpy(&u, &key, sizeof(u));
+
+	u = (u & 0x80000000u) ? ~u : (u | 0x80000000u);
+	return desc ? ~u : u;
+}
+
+// -----------------------------------------------------------------------------
+void sort_results(					// sort results by key
+	int   n,							// number of results
+	bool  desc,							// descending order if true
+	Result *r)							// results (sorted in place)
+{
+	if (n < RADIX_SIZE) {
+		if (desc) std::sort(r, r + n, [](const Result &a, const Result &b) {
+			return a.key_ > b.key_ || (a.key_ == b.key_ && a.id_ < b.id_); });
+		else std::sort(r, r + n, [](const Result &a, const Result &b) {
+			return a.key_ < b.key_ || (a.key_ == b.key_ && a.id_ < b.id_); });
+		return;
+	}
+
+	// -------------------------------------------------------------------------
+	//  count all three digits in one pass
+	// -------------------------------------------------------------------------
+	const int BITS[3] = { 0, 11, 22 };
+	int cnt[3][2048];
+	memset(cnt, 0, sizeof(cnt));
+
+	uint32_t *key = new uint32_t[2 * (size_t) n];
+	Result   *buf = new Result[n];
+	for (int i = 0; i < n; ++i) {
+		uint32_t u = radix_key(r[i].key_, desc);
+		key[i] = u;
+		++cnt[0][u & 2047]; ++cnt[1][(u >> 11) & 2047]; ++cnt[2][u >> 22];
+	}
+
+	// -------------------------------------------------------------------------
+	//  scatter by each digit from low to high; skip digits shared by all keys
+	// -------------------------------------------------------------------------
+	uint32_t *skey = key, *dkey = key + n;
+	Result   *src  = r,   *dst  = buf;
+	for (int p = 0; p < 3; ++p) {
+		int *c = cnt[p];
+		if (c[(skey[0] >> BITS[p]) & 2047] == n) continue;
+
+		int sum = 0;
+		for (int b = 0; b < 2048; ++b) {
+			int tmp = c[b]; c[b] = sum; sum += tmp;
+		}
+		for (int i = 0; i < n; ++i) {
+			int pos = c[(skey[i] >> BITS[p]) & 2047]++;
+			dkey[pos] = skey[i];
+			dst[pos]  = src[i];
+		}
+		std::swap(skey, dkey);
+		std::swap(src, dst);
+	}
+	if (src != r) memcpy(r, src, n * sizeof(Result));
+
+	delete[] key; key = NULL;
+	delete[] buf; buf = NULL;
+}
+
+// -----------------------------------------------------------------------------
+void sort_by_norm(					// sort data objects by l2-norm (desc)
+	int   n,							// number of data objects
+	const float **norm_d,				// l2-norm of data objects
+	Result *order_d)					// sorted ids and norms (return)
+{
+	for (int i = 0; i < n; ++i) {
+		order_d[i].id_  = i;
+		order_d[i].key_ = norm_d[i][0];
+	}
+	sort_results(n, true, order_d);
+}
+
+// -----------------------------------------------------------------------------
+void sort_cand(						// sort candidates by l2-norm (desc)
+	int   n,							// number of candidates
+	const float **norm_d,				// l2-norm of data objects
+	int   *cand)						// candidate ids (sorted in place)
+{
+	std::sort(cand, cand + n, [&](int a, int b) {
+		float na = norm_d[a][0], nb = norm_d[b][0];
+		return na > nb || (na == nb && a < b);
+	});
+}
+
+// -----------------------------------------------------------------------------
+void linear_kmip(					// k-MIP search of one query by linear scan
+	int   n,							// number of data objects
+	int   d,							// dimensionality
+	const Result *order_d,				// data objects sorted by l2-norm
+	const float **data,					// data objects
+	const float **norm_d,				// l2-norm of data objects
+	const float *query,					// query object
+	const float *norm_q,				// l2-norm of query object
+	MaxK_List *list)					// k-MIP results (return)
+{
+	const Dim_Kernels *kern = dim_kernels(d);
+	float kip = list->min_key();
+	for (int j = 0; j < n; ++j) {
+		int id = order_d[j].id_;
+		if (norm_d[id][0] * norm_q[0] <= kip) break;
+
+		float ip = calc_inner_product(kern, d, kip, data[id], norm_d[id], query, 
+			norm_q);
+		kip = list->insert(ip, id + 1);
+	}
+}
+
+// -----------------------------------------------------------------------------
+void linear_kmip_batch(				// k-MIP search of queries by linear scan
+	int   n,							// number of data objects
+	int   d,							// dimensionality
+	const Result *order_d,				// data objects sorted by l2-norm
+	const float **sorted,				// data objects in the order of order_d
+	int   qn,							// number of query objects
+	const float **query,				// query objects
+	const float **norm_q,				// l2-norm of query objects
+	MaxK_List **list)					// k-MIP results (return)
+{
+	std::vector<int>   active(qn);		// queries that still scan
+	std::vector<float> kip(qn);			// k-th MIP value of queries
+	std::vector<const float*> act_q(qn);
+	std::vector<float> ip((size_t) qn * SCAN_TILE);
+	for (int i = 0; i < qn; ++i) {
+		active[i] = i; kip[i] = list[i]->min_key();
+	}
+
+	int na = qn;
+	for (int j0 = 0; j0 < n && na > 0; j0 += SCAN_TILE) {
+		// ---------------------------------------------------------------------
+		//  drop the queries which no point of this tile (or later) can reach
+		// ---------------------------------------------------------------------
+		float norm = order_d[j0].key_;
+		int   left = 0;
+		for (int k = 0; k < na; ++k) {
+			int i = active[k];
+			if (norm * norm_q[i][0] > kip[i]) active[left++] = i;
+		}
+		if ((na = left) == 0) break;
+
+		// ---------------------------------------------------------------------
+		//  inner products of all remaining queries with the tile
+		// ---------------------------------------------------------------------
+		int nt = MIN(SCAN_TILE, n - j0);
+		for (int k = 0; k < na; ++k) act_q[k] = query[active[k]];
+		calc_ip_block(d, na, act_q.data(), nt, sorted + j0, ip.data());
+
+		for (int k = 0; k < na; ++k) {
+			int   i  = active[k];
+			const float *row = &ip[(size_t) k * nt];
+			for (int j = 0; j < nt; ++j) {
+				if (row[j] > kip[i]) {
+					kip[i] = list[i]->insert(row[j], order_d[j0 + j].id_ + 1);
+				}
+			}
+		}
+	}
+}
+
 // -----------------------------------------------------------------------------
 void k_mip_search(					// k-MIP search
 	int   n, 							// number of data objects
@@ -420,39 +896,43 @@ void k_mip_search(					// k-MIP search
 	const float **norm_q,				// l2-norm of query objects
 	Result **result)					// k-MIP results (return)
 {
-	// -------------------------------------------------------------------------
-	//  calc the norm of data and query
-	// -------------------------------------------------------------------------
 	Result *order_d = new Result[n];
-	for (int i = 0; i < n; ++i) {
-		order_d[i].id_  = i;
-		order_d[i].key_ = norm_d[i][0];
-	}
-	qsort(order_d, n, sizeof(Result), ResultCompDesc);
+	sort_by_norm(n, norm_d, order_d);
 
 	// -------------------------------------------------------------------------
-	//  k-MIP search by linear scan with pruning
+	//  k-MIP search by tiled linear scans with pruning, QUERY_TILE queries at 
+	//  a time (one set of lists per thread)
 	// -------------------------------------------------------------------------
-	MaxK_List *list = new MaxK_List(k);
-	for (int i = 0; i < qn; ++i) {
-		float kip = MINREAL;
-
-		list->reset();
-		for (int j = 0; j < n; ++j) {
- 			int id = order_d[j].id_;
-			if (norm_d[id][0] * norm_q[i][0] <= kip) break;
-
-			float ip = calc_inner_product(d, kip, data[id], norm_d[id], 
-				query[i], norm_q[i]);
-			kip = list->insert(ip, id + 1);
+	const float **sorted = new const float*[n];
+	for (int j = 0; j < n; ++j) sorted[j] = data[order_d[j].id_];
+
+	int num_threads = g_num_threads;
+	int num_tiles   = (qn + QUERY_TILE - 1) / QUERY_TILE;
+	MaxK_List **lists = new MaxK_List*[(size_t) num_threads * QUERY_TILE];
+	for (int t = 0; t < num_threads * QUERY_TILE; ++t) {
+		lists[t] = new MaxK_List(k);
+	}
+	parallel_for(num_tiles, num_threads, [&](int tid, int b) {
+		int first = b * QUERY_TILE;
+		int num   = MIN(QUERY_TILE, qn - first);
+		MaxK_List **list = lists + (size_t) tid * QUERY_TILE;
+		for (int i = 0; i < num; ++i) list[i]->reset();
+		linear_kmip_batch(n, d, order_d, sorted, num, query + first, 
+			norm_q + first, list);
+
+		for (int i = 0; i < num; ++i) {
+			for (int j = 0; j < k; ++j) {
+				result[first + i][j].id_  = list[i]->ith_id(j);
+				result[first + i][j].key_ = list[i]->ith_key(j);
+			}
 		}
+	});
 
-		for (int j = 0; j < k; ++j) {
-			result[i][j].id_  = list->ith_id(j);
-			result[i][j].key_ = list->ith_key(j);
-		}
+	for (int t = 0; t < num_threads * QUERY_TILE; ++t) {
+		delete lists[t]; lists[t] = NULL;
 	}
-	delete list; list = NULL;
+	delete[] lists;   lists   = NULL;
+	delete[] sorted;  sorted  = NULL;
 	delete[] order_d; order_d = NULL;
 }
 
@@ -2,6 +2,8 @@
 #define __UTIL_H
 
 class MaxK_List;
+class Matrix;
+struct Dim_Kernels;
 
 extern timeval g_start_time;		// global parameter: start time
 extern timeval g_end_time;			// global parameter: end time
@@ -9,6 +11,8 @@ extern timeval g_end_time;			// global parameter: end time
 extern float   g_runtime;			// global parameter: running time
 extern float   g_ratio;				// global parameter: overall ratio
 extern float   g_recall;			// global parameter: recall
+extern float   g_recall_tol;		// global parameter: relative key tolerance
+extern uint64_t g_rotation;			// global parameter: digest of data rotation
 
 // -----------------------------------------------------------------------------
 //  struct Result
@@ -36,12 +40,32 @@ int ResultCompDesc(					// compare function for qsort (descending)
 	const void *e1,						// 1st element
 	const void *e2);					// 2nd element
 
+// -----------------------------------------------------------------------------
+//  sort_results: stable LSD radix sort on the float keys (3 passes of 11 bits),
+//  which replaces qsort with ResultComp / ResultCompDesc. Ties keep their input 
+//  order, so if r is filled in id order, the result is the same as qsort's.
+// -----------------------------------------------------------------------------
+void sort_results(					// sort results by key
+	int   n,							// number of results
+	bool  desc,							// descending order if true
+	Result *r);							// results (sorted in place)
+
 // -----------------------------------------------------------------------------
 //  uitlity functions
 // -----------------------------------------------------------------------------
 void create_dir(					// create dir if the path exists
 	char *path);						// input path
 
+// -----------------------------------------------------------------------------
+//  calc_norm: norm_d[0] is the l2-norm of data, and norm_d[t] (0 < t < NORM_K) 
+//  the l2-norm of data without its first NORM_DIMS[t-1] coordinates, which 
+//  bounds the rest of an inner product (see g_simd.ip_thres_)
+// -----------------------------------------------------------------------------
+void calc_norm(						// calc l2-norms of one data object
+	int   d,							// dimensionality
+	const float *data,					// data object
+	float *norm_d);						// l2-norms (NORM_K values) (return)
+
 // -----------------------------------------------------------------------------
 int read_data(						// read data from disk
 	int   n,							// number of data objects
@@ -50,6 +74,128 @@ int read_data(						// read data from disk
 	float **data,						// data objects (return)
 	float **norm_d);					// l2-norm of data objects (return)
 
+// -----------------------------------------------------------------------------
+//  binary data file: a 64-byte header (magic, version, n, d, NORM_K, stride, 
+//  NORM_DIMS), then n contiguous rows of d floats (each padded to stride 
+//  floats, so that mmap-ed rows stay 64-byte aligned), then n contiguous rows 
+//  of NORM_K l2-norms
+//
+//  version 1 files (without stride, i.e., stride = d) and version 2 files 
+//  (without NORM_DIMS) can still be read. The rows of a file with other 
+//  checkpoints than NORM_DIMS (e.g., of version 1 and 2, which have NORM_K = 
+//  3) are mapped as well, but their l2-norms are recomputed by calc_norm
+// -----------------------------------------------------------------------------
+const char BIN_MAGIC[8]   = { 'H', '2', 'A', 'L', 'S', 'H', 'D', 'S' };
+const int  BIN_VERSION    = 3;
+const int  BIN_HEADER     = 64;
+
+struct Mmap_File {					// read-only memory-mapped file
+	char   *addr_;						// start address of mapping
+	size_t size_;						// size of mapping (in bytes)
+
+	Mmap_File() { addr_ = NULL; size_ = 0; }
+};
+
+// -----------------------------------------------------------------------------
+int mmap_file(						// map a whole file read-only into memory
+	const char *fname,					// address of file
+	Mmap_File *mf);						// mapped file (return)
+
+// -----------------------------------------------------------------------------
+void munmap_file(					// unmap a file mapped by mmap_file
+	Mmap_File *mf);						// mapped file
+
+// -----------------------------------------------------------------------------
+bool is_bin_data(					// check whether a file is binary data file
+	const char *fname);					// address of data set
+
+// -----------------------------------------------------------------------------
+int write_bin_data(					// write data to disk in binary format
+	int   n,							// number of data objects
+	int   d,							// dimensionality
+	const char *fname,					// address of binary data set
+	const float **data,					// data objects
+	const float **norm_d);				// l2-norm of data objects
+
+// -----------------------------------------------------------------------------
+int read_bin_data(					// mmap data from binary data file
+	int   n,							// number of data objects
+	int   d,							// dimensionality
+	const char *fname,					// address of binary data set
+	Matrix **data,						// view of data objects (return)
+	Matrix **norm_d,					// view of l2-norm (return)
+	Mmap_File *mf);						// mapped file (return)
+
+// -----------------------------------------------------------------------------
+int load_data(						// load text or binary data from disk
+	int   n,							// number of data objects
+	int   d,							// dimensionality
+	const char *fname,					// address of data set
+	Matrix **data,						// data objects (return)
+	Matrix **norm_d,					// l2-norm of data objects (return)
+	Mmap_File *mf);						// mapped file (return)
+
+// -----------------------------------------------------------------------------
+void free_data(						// release data from load_data
+	Matrix *data,						// data objects
+	Matrix *norm_d,						// l2-norm of data objects
+	Mmap_File *mf);						// mapped file
+
+// -----------------------------------------------------------------------------
+//  index file: a 64-byte header (magic, version, index type, n, d, digest of 
+//  the rotation of the data), then the sections written by the save() methods 
+//  of the indexes. The digest is g_rotation (0: unrotated data, see pca.h) 
+//  when the index is saved, and open_index() refuses an index built on data 
+//  rotated otherwise than the data now (the axes of PCA files themselves are 
+//  always those of unrotated data, so they record 0). Every section starts 
+//  on a 64-byte boundary, so that a loaded index can use its hash tables in 
+//  place from the mmap-ed file, and processes on one machine share a single 
+//  copy through the page cache.
+// -----------------------------------------------------------------------------
+const char IDX_MAGIC[8]   = { 'H', '2', 'A', 'L', 'S', 'H', 'I', 'X' };
+const int  IDX_VERSION    = 3;
+const int  IDX_ALIGN      = 64;
+
+const int  IDX_H2_ALSH    = 1;		// index types
+const int  IDX_SIGN_ALSH  = 2;
+const int  IDX_SIMPLE_LSH = 3;
+const int  IDX_PCA        = 4;		// rotation of the data set (pca.h)
+
+struct Mmap_Cursor {				// sequential reader of a mapped file
+	const char *addr_;					// start address of mapping
+	size_t size_;						// size of mapping (in bytes)
+	size_t pos_;						// current position (in bytes)
+
+	Mmap_Cursor() { addr_ = NULL; size_ = 0; pos_ = 0; }
+};
+
+// -----------------------------------------------------------------------------
+int write_aligned(					// write a section padded to IDX_ALIGN
+	FILE  *fp,							// output file
+	const void *buf,					// section
+	size_t size);						// size of section (in bytes)
+
+// -----------------------------------------------------------------------------
+const void* read_aligned(			// get a section written by write_aligned
+	Mmap_Cursor *in,					// input mapping
+	size_t size);						// size of section (in bytes)
+
+// -----------------------------------------------------------------------------
+int write_index_header(				// write the header of an index file
+	FILE  *fp,							// output file
+	int   type,							// index type
+	int   n,							// number of data objects
+	int   d);							// dimensionality
+
+// -----------------------------------------------------------------------------
+int open_index(						// mmap an index file and check its header
+	const char *fname,					// address of index file
+	int   type,							// expected index type
+	int   n,							// expected number of data objects
+	int   d,							// expected dimensionality
+	Mmap_File *mf,						// mapped file (return)
+	Mmap_Cursor *in);					// cursor after the header (return)
+
 // -----------------------------------------------------------------------------
 int read_ground_truth(				// read ground truth results from disk
 	int    qn,							// number of query objects
@@ -71,6 +217,40 @@ float calc_inner_product(			// calc inner product
 	const float *p2,					// 2nd point
 	const float *norm2);				// l2-norm of 2nd point
 
+// -----------------------------------------------------------------------------
+//  the same inner products by the kernels of an index for its dimension (see 
+//  dim_kernels in simd.h)
+// -----------------------------------------------------------------------------
+float calc_inner_product(			// calc inner product
+	const Dim_Kernels *kern,			// kernels for dim
+	int   dim,							// dimension
+	const float *p1,					// 1st point
+	const float *p2);					// 2nd point
+
+// -----------------------------------------------------------------------------
+float calc_inner_product(			// calc inner product
+	const Dim_Kernels *kern,			// kernels for dim
+	int   dim,							// dimension
+	float threshold,					// threshold
+	const float *p1,					// 1st point
+	const float *norm1,					// l2-norm of 1st point
+	const float *p2,					// 2nd point
+	const float *norm2);				// l2-norm of 2nd point
+
+// -----------------------------------------------------------------------------
+//  calc_ip_block: ip[i * n + j] = <q[i], p[j]> for qn queries and n points, 
+//  i.e., a GEMM of the query block and the transposed points. Points are 
+//  processed in tiles of IP_BLOCK bytes, which stay in the L1 cache while all 
+//  queries are run over them, with a 1 x 4 SIMD register tile (g_simd.ip4_).
+// -----------------------------------------------------------------------------
+void calc_ip_block(					// calc inner products of blocks
+	int   dim,							// dimension
+	int   qn,							// number of queries
+	const float **q,					// queries
+	int   n,							// number of points
+	const float **p,					// points
+	float *ip);							// inner products (qn x n) (return)
+
 // -----------------------------------------------------------------------------
 float calc_l2_sqr(					// calc L2 square distance
 	int   dim,							// dimension
@@ -78,6 +258,18 @@ float calc_l2_sqr(					// calc L2 square distance
 	const float *p1,					// 1st point
 	const float *p2);					// 2nd point
 
+// -----------------------------------------------------------------------------
+float calc_l2_sqr(					// calc L2 square distance
+	const Dim_Kernels *kern,			// kernels for dim
+	int   dim,							// dimension
+	float threshold,					// threshold
+	const float *p1,					// 1st point
+	const float *p2);					// 2nd point
+
+// -----------------------------------------------------------------------------
+//  calc_recall and get_hits count a result as a hit unless its key is more 
+//  than MAX(FLOATZERO, g_recall_tol * |key|) below the key of the last true 
+//  result (g_recall_tol > 0 for the rounding of rotated data, see pca.h)
 // -----------------------------------------------------------------------------
 float calc_recall(					// calc recall (percentage)
 	int   k,							// top-k value
@@ -105,6 +297,67 @@ int norm_distribution(				// analyse norm distribution of data
 	const float **norm_d,				// l2-norm of data objects
 	const char  *out_path);				// output path
 
+// -----------------------------------------------------------------------------
+void sort_by_norm(					// sort data objects by l2-norm (desc)
+	int   n,							// number of data objects
+	const float **norm_d,				// l2-norm of data objects
+	Result *order_d);					// sorted ids and norms (return)
+
+// -----------------------------------------------------------------------------
+//  sort_cand / prefetch_point: the candidates of LSH are verified in 
+//  descending order of norm (ties by id), so that the loop can stop at the 
+//  first candidate with norm_d[id][0] * normq <= kip. Each row is a random 
+//  read, so the loop prefetches the row and l2-norms of the candidate 
+//  PREFETCH_DIST places ahead (its first PREFETCH_LINES cache lines, which 
+//  are also the ones that the partial-norm bound of calc_inner_product 
+//  reads before it can stop).
+// -----------------------------------------------------------------------------
+void sort_cand(						// sort candidates by l2-norm (desc)
+	int   n,							// number of candidates
+	const float **norm_d,				// l2-norm of data objects
+	int   *cand);						// candidate ids (sorted in place)
+
+// -----------------------------------------------------------------------------
+inline void prefetch_point(			// prefetch a data object
+	int   d,							// dimensionality
+	const float *data,					// data object
+	const float *norm_d)				// l2-norm of data object
+{
+	int lines = (d * (int) sizeof(float) + 63) / 64;
+	if (lines > PREFETCH_LINES) lines = PREFETCH_LINES;
+	for (int i = 0; i < lines; ++i) __builtin_prefetch(data + i * 16);
+	__builtin_prefetch(norm_d);
+}
+
+// -----------------------------------------------------------------------------
+void linear_kmip(					// k-MIP search of one query by linear scan
+	int   n,							// number of data objects
+	int   d,							// dimensionality
+	const Result *order_d,				// data objects sorted by l2-norm
+	const float **data,					// data objects
+	const float **norm_d,				// l2-norm of data objects
+	const float *query,					// query object
+	const float *norm_q,				// l2-norm of query object
+	MaxK_List *list);					// k-MIP results (return)
+
+// -----------------------------------------------------------------------------
+//  linear_kmip_batch: the same exact k-MIP search for a tile of queries. The 
+//  data (in norm order) is processed in tiles of SCAN_TILE points, and the 
+//  inner products of all queries of a tile with its points come from one 
+//  blocked GEMM (calc_ip_block). The norm bound is applied per tile: a query 
+//  leaves the tile loop once the largest norm of the next tile times its norm 
+//  cannot beat its k-th MIP value.
+// -----------------------------------------------------------------------------
+void linear_kmip_batch(				// k-MIP search of queries by linear scan
+	int   n,							// number of data objects
+	int   d,							// dimensionality
+	const Result *order_d,				// data objects sorted by l2-norm
+	const float **sorted,				// data objects in the order of order_d
+	int   qn,							// number of query objects
+	const float **query,				// query objects
+	const float **norm_q,				// l2-norm of query objects
+	MaxK_List **list);					// k-MIP results (return)
+
 // -----------------------------------------------------------------------------
 void k_mip_search(					// k-MIP search
 	int   n, 							// number of data objects
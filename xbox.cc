@@ -1,9 +1,17 @@
 #include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
 
 #include "def.h"
 #include "util.h"
+#include "simd.h"
+#include "matrix.h"
 #include "pri_queue.h"
 #include "qalsh.h"
+#include "sq8.h"
 #include "xbox.h"
 
 // -----------------------------------------------------------------------------
@@ -19,6 +27,7 @@ XBox::XBox(							// constructor
 	// -------------------------------------------------------------------------
 	n_pts_      = n;
 	dim_        = d;
+	kern_       = dim_kernels(d);
 	nn_ratio_   = nn_ratio;
 	data_       = data;
 	norm_d_     = norm_d;
@@ -33,10 +42,8 @@ XBox::XBox(							// constructor
 XBox::~XBox()						// destructor
 {
 	delete lsh_; lsh_ = NULL;
-	for (int i = 0; i < n_pts_; ++i) {
-		delete[] xbox_data_[i]; xbox_data_[i] = NULL;
-	}
-	delete[] xbox_data_; xbox_data_ = NULL;
+	delete sq8_; sq8_ = NULL;
+	delete xbox_data_; xbox_data_ = NULL;
 }
 
 // -----------------------------------------------------------------------------
@@ -56,19 +63,21 @@ void XBox::bulkload()				// bulkloading
 	// -------------------------------------------------------------------------
 	//  construct new data and indexing
 	// -------------------------------------------------------------------------
-	xbox_data_ = new float*[n_pts_];
+	xbox_data_ = new Matrix(n_pts_, dim_ + 1);
 	for (int i = 0; i < n_pts_; ++i) {
-		xbox_data_[i] = new float[dim_ + 1];
+		float *xbox_data = xbox_data_->row(i);
 		for (int j = 0; j < dim_; ++j) {
-			xbox_data_[i][j] = data_[i][j];
+			xbox_data[j] = data_[i][j];
 		}
-		xbox_data_[i][dim_] = sqrt(max_norm_sqr - norm_sqr[i]);
+		xbox_data[dim_] = sqrt(max_norm_sqr - norm_sqr[i]);
 	}
 	
 	// -------------------------------------------------------------------------
 	//  indexing the new format of data using qalsh
 	// -------------------------------------------------------------------------
-	lsh_ = new QALSH(n_pts_, dim_+1, nn_ratio_, (const float **) xbox_data_);
+	lsh_ = new QALSH(n_pts_, dim_ + 1, nn_ratio_, 
+		(const float **) xbox_data_->rows());
+	sq8_ = g_sq_frac > 0.0f ? new SQ8(n_pts_, dim_, data_) : NULL;
 }
 
 // -----------------------------------------------------------------------------
@@ -81,12 +90,21 @@ void XBox::display()				// display parameters
 	printf("    M  = %f\n\n", M_);
 }
 
+// -----------------------------------------------------------------------------
+size_t XBox::index_size()			// memory of index (without data)
+{
+	size_t size = lsh_->index_size();
+	if (sq8_ != NULL) size += sq8_->index_size();
+	return size;
+}
+
 // -----------------------------------------------------------------------------
 int XBox::kmip(						// c-k-AMIP search
 	int   top_k,						// top-k value
 	bool  used_new_transform,			// used new transformation
 	const float *query,					// input query
 	const float *norm_q,				// l2-norm of query
+	QALSH_Scratch *scratch,				// search context of this thread
 	MaxK_List *list)					// top-k MIP results (return) 
 {
 	float kip   = MINREAL;
@@ -97,7 +115,7 @@ int XBox::kmip(						// c-k-AMIP search
 	// -------------------------------------------------------------------------
 	float lambda = used_new_transform ? M_ / normq : 1.0f;
 
-	float *xbox_query = new float[dim_ + 1];
+	float *xbox_query = scratch->query_buf(dim_ + 1);
 	for (int i = 0; i < dim_; ++i) {
 		xbox_query[i] = lambda * query[i];
 	}
@@ -106,22 +124,96 @@ int XBox::kmip(						// c-k-AMIP search
 	// -------------------------------------------------------------------------
 	//  conduct c-k-ANN search by qalsh
 	// -------------------------------------------------------------------------
-	std::vector<int> cand;
-	lsh_->knn(top_k, MAXREAL, (const float *) xbox_query, cand);
+	std::vector<int> &cand = scratch->cand();
+	cand.clear();
+	lsh_->knn(top_k, MAXREAL, (const float *) xbox_query, scratch, 
+		cand);
 
 	// -------------------------------------------------------------------------
-	//  calc inner product for candidates returned by qalsh
+	//  calc inner product for candidates returned by qalsh (or for the best 
+	//  of them by their int8 codes)
 	// -------------------------------------------------------------------------
+	if (sq8_ != NULL) {
+		sq8_->filter(top_k, query, NULL, cand, 
+			scratch->score_buf(sq8_->buf_size((int) cand.size())));
+	}
 	int size = (int) cand.size();
+	sort_cand(size, norm_d_, cand.data());
 	for (int i = 0; i < size; ++i) {
+		if (i + PREFETCH_DIST < size) {
+			int next = cand[i + PREFETCH_DIST];
+			prefetch_point(dim_, data_[next], norm_d_[next]);
+		}
 		int id = cand[i];
 		if (norm_d_[id][0] * normq <= kip) break;
-			
-		float ip = calc_inner_product(dim_, kip, data_[id], norm_d_[id], 
-			query, norm_q);
+
+		float ip = calc_inner_product(kern_, dim_, kip, data_[id], 
+			norm_d_[id], query, norm_q);
 		kip = list->insert(ip, id + 1);
 	}
-	delete[] xbox_query; xbox_query = NULL;
+
+	return 0;
+}
+
+// -----------------------------------------------------------------------------
+int XBox::kmip_batch(				// c-k-AMIP search of a batch of queries
+	int   top_k,						// top-k value
+	bool  used_new_transform,			// used new transformation
+	int   qn,							// number of queries
+	const float **query,				// input queries
+	const float **norm_q,				// l2-norm of queries
+	QALSH_Scratch *scratch,				// search context of this thread
+	MaxK_List **list)					// top-k MIP results (return)
+{
+	// -------------------------------------------------------------------------
+	//  project all queries by one GEMM; lambda * <a, q> is the projection of 
+	//  the XBox query (lambda * q, 0)
+	// -------------------------------------------------------------------------
+	Batch_Buf &b = scratch->batch();
+	int m = lsh_->num_tables();
+	b.proj_.resize((size_t) qn * m);
+	float *proj = b.proj_.data();
+	lsh_->project(qn, query, dim_, proj);
+
+	std::vector<int> &cand = scratch->cand();
+	std::vector<const float*> &rows = b.rows_;
+	std::vector<float> &ips = b.ips_;
+	for (int i = 0; i < qn; ++i) {
+		float kip    = MINREAL;
+		float normq  = norm_q[i][0];
+		float lambda = used_new_transform ? M_ / normq : 1.0f;
+
+		float *q_proj = proj + (size_t) i * m;
+		for (int j = 0; j < m; ++j) q_proj[j] *= lambda;
+
+		// ---------------------------------------------------------------------
+		//  conduct c-k-ANN search by qalsh
+		// ---------------------------------------------------------------------
+		cand.clear();
+		lsh_->knn_proj(top_k, MAXREAL, (const float *) q_proj, scratch, cand);
+
+		// ---------------------------------------------------------------------
+		//  calc inner product for candidates by blocked inner products (in 
+		//  descending order of norm, so that the loop below can stop early)
+		// ---------------------------------------------------------------------
+		if (sq8_ != NULL) {
+			sq8_->filter(top_k, query[i], NULL, cand, 
+				scratch->score_buf(sq8_->buf_size((int) cand.size())));
+		}
+		int size = (int) cand.size();
+		sort_cand(size, norm_d_, cand.data());
+		rows.resize(size);
+		ips.resize(size);
+		for (int j = 0; j < size; ++j) rows[j] = data_[cand[j]];
+		calc_ip_block(dim_, 1, &query[i], size, rows.data(), ips.data());
+
+		for (int j = 0; j < size; ++j) {
+			int id = cand[j];
+			if (norm_d_[id][0] * normq <= kip) break;
+
+			kip = list[i]->insert(ips[j], id + 1);
+		}
+	}
 
 	return 0;
 }
@@ -2,7 +2,11 @@
 #define __XBOX_H
 
 class QALSH;
+class QALSH_Scratch;
+class SQ8;
+class Matrix;
 class MaxK_List;
+struct Dim_Kernels;
 
 // -----------------------------------------------------------------------------
 //  XBox is used to solve the problem of c-Approximate Maximum Inner Product 
@@ -33,24 +37,40 @@ public:
 	// -------------------------------------------------------------------------
 	void display();					// display parameters
 
+	// -------------------------------------------------------------------------
+	size_t index_size();			// memory of index (without data)
+
 	// -------------------------------------------------------------------------
 	int kmip(						// c-k-AMIP search
 		int   top_k,					// top-k value
 		bool  used_new_transform,		// used new transformation
 		const float *query,				// input query
 		const float *norm_q,			// l2-norm of query
+		QALSH_Scratch *scratch,			// search context of this thread
 		MaxK_List *list);				// top-k MIP results
 
+	// -------------------------------------------------------------------------
+	int kmip_batch(					// c-k-AMIP search of a batch of queries
+		int   top_k,					// top-k value
+		bool  used_new_transform,		// used new transformation
+		int   qn,						// number of queries
+		const float **query,			// input queries
+		const float **norm_q,			// l2-norm of queries
+		QALSH_Scratch *scratch,			// search context of this thread
+		MaxK_List **list);				// top-k MIP results (return)
+
 protected:
 	int   n_pts_;					// number of data objects
 	int   dim_;						// dimensionality
+	const Dim_Kernels *kern_;		// kernels for dim_ (simd.h)
 	float nn_ratio_;				// approximation ratio for ANN search
 	const float **data_;			// original data objects
 	const float **norm_d_;			// l2-norm of data objects
 
 	float M_;						// max norm of data objects
-	float **xbox_data_;				// xbox data
+	Matrix *xbox_data_;				// xbox data
 	QALSH *lsh_;					// qalsh
+	SQ8   *sq8_;					// int8 codes of data (or NULL)
 
 	// -------------------------------------------------------------------------
 	void bulkload();				// bulkloading